@@ -0,0 +1,42 @@
+//
+//  ChessCRC32.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/5.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessCRC32.h"
+
+#include <pthread.h>
+
+static uint32_t chess_crc32_table[256];
+static pthread_once_t chess_crc32_table_once = PTHREAD_ONCE_INIT;
+
+static void chess_crc32_make_table(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+        }
+        chess_crc32_table[n] = c;
+    }
+}
+
+uint32_t chess_crc32(uint32_t crc, const void *data, size_t length)
+{
+    pthread_once(&chess_crc32_table_once, chess_crc32_make_table);
+
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t c = crc ^ 0xFFFFFFFFU;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        c = chess_crc32_table[(c ^ bytes[i]) & 0xFF] ^ (c >> 8);
+    }
+
+    return c ^ 0xFFFFFFFFU;
+}
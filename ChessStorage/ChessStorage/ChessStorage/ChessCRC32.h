@@ -0,0 +1,33 @@
+//
+//  ChessCRC32.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/5.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#ifndef ChessCRC32_h
+#define ChessCRC32_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The standard CRC-32 (IEEE 802.3, as used by zlib and PNG).
+ *
+ * Pass 0 as crc for the first chunk, and the previous result for the next ones:
+ * chess_crc32(chess_crc32(0, a, n), b, m) == chess_crc32(0, ab, n + m).
+ *
+ * Table driven, thread safe, and does not allocate.
+ **/
+uint32_t chess_crc32(uint32_t crc, const void *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ChessCRC32_h */
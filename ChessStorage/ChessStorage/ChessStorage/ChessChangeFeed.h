@@ -0,0 +1,122 @@
+//
+//  ChessChangeFeed.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/19.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class ChessConfig;
+
+/**
+ * The difference between two ordered snapshots of object IDs, ready to be applied to a table or collection view
+ * in a single batch of updates (beginUpdates / endUpdates, or performBatchUpdates:).
+ *
+ * Like the batch updates of UITableView, deleted and updated indexes refer to previousObjectIDs,
+ * inserted indexes and move destinations refer to objectIDs.
+ * Moves are minimal: the objects kept in their relative order (a longest increasing subsequence) do not move.
+ **/
+
+@interface ChessChangeFeedBatch : NSObject
+
+/**
+ * Computes the batch. The diff is O(n log n) in the number of object IDs.
+ * updatedObjectIDs are the objects changed since the previous snapshot (may be nil).
+ **/
++ (ChessChangeFeedBatch *)batchWithPreviousObjectIDs:(NSArray *)previousObjectIDs
+                                           objectIDs:(NSArray *)objectIDs
+                                    updatedObjectIDs:(NSSet *)updatedObjectIDs;
+
+@property (nonatomic, strong, readonly) NSArray *previousObjectIDs;
+@property (nonatomic, strong, readonly) NSArray *objectIDs;
+
+@property (nonatomic, strong, readonly) NSIndexSet *deletedIndexes;
+@property (nonatomic, strong, readonly) NSIndexSet *insertedIndexes;
+
+/**
+ * Updated objects that did not move. A table view cannot reload and move the same row in one batch,
+ * so updated objects that also moved are listed in movedUpdatedIndexes (indexes in objectIDs) instead:
+ * reload them once the batch has been applied.
+ **/
+@property (nonatomic, strong, readonly) NSIndexSet *updatedIndexes;
+@property (nonatomic, strong, readonly) NSIndexSet *movedUpdatedIndexes;
+
+@property (nonatomic, assign, readonly) NSUInteger numberOfMoves;
+
+- (void)enumerateMovesUsingBlock:(void (^)(NSUInteger fromIndex, NSUInteger toIndex))block;
+
+/**
+ * YES if nothing was inserted, deleted, moved or updated.
+ **/
+@property (nonatomic, assign, readonly, getter=isEmpty) BOOL empty;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * ChessChangeFeed keeps an ordered snapshot of the object IDs matching a query up to date,
+ * and hands the changes to the main thread as coalesced batches (see -[ChessStorage changeFeedWithEntityName:...]).
+ *
+ * Every save on the persistentStoreCoordinator of the configuration (and every store level change merged with
+ * -[ChessConfig mergeChangesWithUpdatedObjectIDs:deletedObjectIDs:]) that touches the entity marks the feed as stale.
+ * A stale feed takes a new snapshot on one of the read-only contexts of the configuration,
+ * diffs it against the previous one on a private queue, and delivers the batch to the main queue.
+ *
+ * At most one batch is in flight: saves happening meanwhile are folded into the next snapshot,
+ * and batches are at least coalescingInterval apart. A burst of 1000 saves results in a handful of batches,
+ * not in 1000 table view animations.
+ **/
+
+@interface ChessChangeFeed : NSObject
+
+/**
+ * snapshotBlock is invoked with a read-only context of the configuration, on its queue,
+ * and returns the current object IDs in display order (nil on error).
+ **/
+- (id)initWithConfig:(ChessConfig *)config
+          entityName:(NSString *)entityName
+       snapshotBlock:(NSArray *(^)(NSManagedObjectContext *moc))snapshotBlock;
+
+@property (nonatomic, copy, readonly) NSString *entityName;
+
+/**
+ * Invoked on the main queue with every non-empty batch. The first batch inserts the initial snapshot.
+ **/
+@property (atomic, copy) void (^changeBlock)(ChessChangeFeedBatch *batch);
+
+/**
+ * The minimum time between two batches.
+ *
+ * Default 1/60 second, one screen frame.
+ **/
+@property (atomic, assign) NSTimeInterval coalescingInterval;
+
+/**
+ * Takes the initial snapshot, and starts observing saves.
+ * stop stops observing; a batch already in flight is dropped.
+ **/
+- (void)start;
+- (void)stop;
+
+/**
+ * Forces a new snapshot, e.g. after changing something the feed cannot observe.
+ **/
+- (void)setNeedsRefresh;
+
+/**
+ * The object IDs of the last delivered batch. Must only be accessed on the main thread.
+ **/
+@property (nonatomic, strong, readonly) NSArray *objectIDs;
+
+/**
+ * Counters since the feed was started, e.g.
+ * @{ @"notifications": @(1000), @"snapshots": @(9), @"batches": @(8), @"changes": @(1000), @"lastDiffTime": @(0.0004) }
+ * lastDiffTime is in seconds.
+ **/
+- (NSDictionary *)statistics;
+
+@end
@@ -0,0 +1,522 @@
+//
+//  ChessChangeFeed.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/19.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessChangeFeed.h"
+#import "ChessConfig.h"
+#import "ChessTime.h"
+
+#import <libkern/OSAtomic.h>
+
+/**
+ * Marks the members of a longest strictly increasing subsequence of values (patience sorting, O(n log n)).
+ **/
+static void ChessChangeFeedLongestIncreasingSubsequence(const NSUInteger *values, NSUInteger count, BOOL *members)
+{
+    memset(members, 0, count * sizeof(BOOL));
+    if (count == 0) return;
+
+    NSUInteger *tails = malloc(count * sizeof(NSUInteger));      // tails[l]: index of the smallest tail of a subsequence of length l + 1
+    NSUInteger *previous = malloc(count * sizeof(NSUInteger));   // previous[i]: index of the element before i in its subsequence
+    NSUInteger length = 0;
+
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        NSUInteger low = 0;
+        NSUInteger high = length;
+        while (low < high)
+        {
+            NSUInteger middle = low + (high - low) / 2;
+            if (values[tails[middle]] < values[i])
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        previous[i] = (low > 0) ? tails[low - 1] : NSNotFound;
+        tails[low] = i;
+
+        if (low == length) length++;
+    }
+
+    for (NSUInteger i = tails[length - 1]; i != NSNotFound; i = previous[i])
+    {
+        members[i] = YES;
+    }
+
+    free(tails);
+    free(previous);
+}
+
+@interface ChessChangeFeedBatch ()
+{
+    NSData *moves;  // pairs of NSUInteger: from index, to index
+}
+
+@property (nonatomic, strong, readwrite) NSArray *previousObjectIDs;
+@property (nonatomic, strong, readwrite) NSArray *objectIDs;
+@property (nonatomic, strong, readwrite) NSIndexSet *deletedIndexes;
+@property (nonatomic, strong, readwrite) NSIndexSet *insertedIndexes;
+@property (nonatomic, strong, readwrite) NSIndexSet *updatedIndexes;
+@property (nonatomic, strong, readwrite) NSIndexSet *movedUpdatedIndexes;
+
+@end
+
+@implementation ChessChangeFeedBatch
+
++ (ChessChangeFeedBatch *)batchWithPreviousObjectIDs:(NSArray *)previousObjectIDs
+                                           objectIDs:(NSArray *)objectIDs
+                                    updatedObjectIDs:(NSSet *)updatedObjectIDs
+{
+    previousObjectIDs = previousObjectIDs ?: @[];
+    objectIDs = objectIDs ?: @[];
+
+    NSUInteger previousCount = [previousObjectIDs count];
+    NSUInteger count = [objectIDs count];
+
+    NSMutableDictionary *previousIndexes = [NSMutableDictionary dictionaryWithCapacity:previousCount];
+    [previousObjectIDs enumerateObjectsUsingBlock:^(id objectID, NSUInteger index, BOOL *stop) {
+        previousIndexes[objectID] = @(index);
+    }];
+
+    NSMutableIndexSet *deletedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableIndexSet *insertedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableIndexSet *updatedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableIndexSet *movedUpdatedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableData *moves = [NSMutableData data];
+
+    // The objects in both snapshots, in their new order, with their old and new indexes.
+
+    NSUInteger *commonPreviousIndexes = malloc(MAX(count, 1) * sizeof(NSUInteger));
+    NSUInteger *commonIndexes = malloc(MAX(count, 1) * sizeof(NSUInteger));
+    NSUInteger commonCount = 0;
+
+    for (NSUInteger index = 0; index < count; index++)
+    {
+        NSNumber *previousIndex = previousIndexes[objectIDs[index]];
+        if (previousIndex)
+        {
+            commonPreviousIndexes[commonCount] = [previousIndex unsignedIntegerValue];
+            commonIndexes[commonCount] = index;
+            commonCount++;
+        }
+        else
+        {
+            [insertedIndexes addIndex:index];
+        }
+    }
+
+    if (commonCount < previousCount)
+    {
+        NSSet *currentObjectIDs = [NSSet setWithArray:objectIDs];
+        for (NSUInteger index = 0; index < previousCount; index++)
+        {
+            if (![currentObjectIDs containsObject:previousObjectIDs[index]])
+                [deletedIndexes addIndex:index];
+        }
+    }
+
+    // The objects whose old indexes form the longest increasing run stay, the others move.
+
+    BOOL *stays = malloc(MAX(commonCount, 1) * sizeof(BOOL));
+    ChessChangeFeedLongestIncreasingSubsequence(commonPreviousIndexes, commonCount, stays);
+
+    for (NSUInteger k = 0; k < commonCount; k++)
+    {
+        BOOL updated = [updatedObjectIDs containsObject:objectIDs[commonIndexes[k]]];
+
+        if (stays[k])
+        {
+            if (updated) [updatedIndexes addIndex:commonPreviousIndexes[k]];
+        }
+        else
+        {
+            NSUInteger move[2] = { commonPreviousIndexes[k], commonIndexes[k] };
+            [moves appendBytes:move length:sizeof(move)];
+
+            if (updated) [movedUpdatedIndexes addIndex:commonIndexes[k]];
+        }
+    }
+
+    free(stays);
+    free(commonPreviousIndexes);
+    free(commonIndexes);
+
+    ChessChangeFeedBatch *batch = [[ChessChangeFeedBatch alloc] init];
+    batch.previousObjectIDs = previousObjectIDs;
+    batch.objectIDs = objectIDs;
+    batch.deletedIndexes = deletedIndexes;
+    batch.insertedIndexes = insertedIndexes;
+    batch.updatedIndexes = updatedIndexes;
+    batch.movedUpdatedIndexes = movedUpdatedIndexes;
+    batch->moves = moves;
+
+    return batch;
+}
+
+- (NSUInteger)numberOfMoves
+{
+    return [moves length] / (2 * sizeof(NSUInteger));
+}
+
+- (void)enumerateMovesUsingBlock:(void (^)(NSUInteger fromIndex, NSUInteger toIndex))block
+{
+    const NSUInteger *pairs = [moves bytes];
+    NSUInteger numberOfMoves = [self numberOfMoves];
+
+    for (NSUInteger i = 0; i < numberOfMoves; i++)
+    {
+        block(pairs[2 * i], pairs[2 * i + 1]);
+    }
+}
+
+- (BOOL)isEmpty
+{
+    return ([self.deletedIndexes count] == 0 &&
+            [self.insertedIndexes count] == 0 &&
+            [self.updatedIndexes count] == 0 &&
+            [self.movedUpdatedIndexes count] == 0 &&
+            [self numberOfMoves] == 0);
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p count=%lu deleted=%lu inserted=%lu moved=%lu updated=%lu>",
+            NSStringFromClass([self class]), self,
+            (unsigned long)[self.objectIDs count],
+            (unsigned long)[self.deletedIndexes count],
+            (unsigned long)[self.insertedIndexes count],
+            (unsigned long)[self numberOfMoves],
+            (unsigned long)([self.updatedIndexes count] + [self.movedUpdatedIndexes count])];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessChangeFeed ()
+{
+    ChessConfig *config;
+    NSArray *(^snapshotBlock)(NSManagedObjectContext *moc);
+
+    dispatch_queue_t feedQueue;
+
+    __weak NSPersistentStoreCoordinator *persistentStoreCoordinator;   // set before the observers are added
+
+    // Only accessed on the feedQueue.
+    NSArray *snapshot;              // nil until the first batch
+    NSMutableSet *pendingUpdatedObjectIDs;
+    BOOL needsRefresh;
+    BOOL refreshScheduled;
+    BOOL batchInFlight;
+    NSTimeInterval lastBatchTime;
+
+    uint64_t numberOfNotifications;
+    uint64_t numberOfSnapshots;
+    uint64_t numberOfBatches;
+    uint64_t numberOfChanges;
+    NSTimeInterval lastDiffTime;
+
+    volatile int32_t running;       // read on any thread
+    volatile int32_t generation;    // incremented by every start and stop, so stale batches are dropped
+}
+
+@property (nonatomic, strong, readwrite) NSArray *objectIDs;
+
+@end
+
+@implementation ChessChangeFeed
+
+@synthesize entityName;
+@synthesize changeBlock;
+@synthesize coalescingInterval;
+@synthesize objectIDs;
+
+- (id)initWithConfig:(ChessConfig *)aConfig
+          entityName:(NSString *)anEntityName
+       snapshotBlock:(NSArray *(^)(NSManagedObjectContext *moc))aSnapshotBlock
+{
+    if ((self = [super init]))
+    {
+        config = aConfig;
+        entityName = [anEntityName copy];
+        snapshotBlock = [aSnapshotBlock copy];
+
+        coalescingInterval = 1.0 / 60.0;
+
+        feedQueue = dispatch_queue_create("ChessChangeFeed", NULL);
+        pendingUpdatedObjectIDs = [[NSMutableSet alloc] init];
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+
+#if !OS_OBJECT_USE_OBJC
+    if (feedQueue)
+        dispatch_release(feedQueue);
+#endif
+}
+
+- (void)start
+{
+    if (!OSAtomicCompareAndSwap32(0, 1, &running))
+    {
+        return;
+    }
+
+    OSAtomicIncrement32(&generation);
+
+    dispatch_async(feedQueue, ^{ @autoreleasepool {
+
+        // May block until the store is set up, but only the feedQueue.
+        persistentStoreCoordinator = [config persistentStoreCoordinator];
+
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(managedObjectContextDidSave:)
+                                                     name:NSManagedObjectContextDidSaveNotification
+                                                   object:nil];
+
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(configDidChangeStore:)
+                                                     name:ChessConfigDidChangeStoreNotification
+                                                   object:config];
+
+        snapshot = nil;
+        needsRefresh = YES;
+        [self scheduleRefresh];
+    }});
+}
+
+- (void)stop
+{
+    if (!OSAtomicCompareAndSwap32(1, 0, &running))
+    {
+        return;
+    }
+
+    OSAtomicIncrement32(&generation);
+
+    dispatch_async(feedQueue, ^{
+        [[NSNotificationCenter defaultCenter] removeObserver:self];
+
+        [pendingUpdatedObjectIDs removeAllObjects];
+        needsRefresh = NO;
+    });
+}
+
+- (void)setNeedsRefresh
+{
+    dispatch_async(feedQueue, ^{
+        needsRefresh = YES;
+        [self scheduleRefresh];
+    });
+}
+
+- (NSDictionary *)statistics
+{
+    __block NSDictionary *result = nil;
+
+    dispatch_sync(feedQueue, ^{
+        result = @{ @"notifications" : @(numberOfNotifications),
+                    @"snapshots"     : @(numberOfSnapshots),
+                    @"batches"       : @(numberOfBatches),
+                    @"changes"       : @(numberOfChanges),
+                    @"lastDiffTime"  : @(lastDiffTime) };
+    });
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Refresh
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)scheduleRefresh
+{
+    // Invoked on the feedQueue.
+
+    if (!needsRefresh || refreshScheduled || batchInFlight || running == 0)
+    {
+        return;
+    }
+
+    refreshScheduled = YES;
+
+    NSTimeInterval delay = MAX(0.0, lastBatchTime + self.coalescingInterval - ChessMonotonicTime());
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), feedQueue, ^{ @autoreleasepool {
+        refreshScheduled = NO;
+        [self refresh];
+    }});
+}
+
+- (void)refresh
+{
+    // Invoked on the feedQueue.
+
+    if (!needsRefresh || batchInFlight || running == 0)
+    {
+        return;
+    }
+
+    needsRefresh = NO;
+    batchInFlight = YES;
+
+    // Saves from now on are covered by the next snapshot.
+    NSSet *updatedObjectIDs = [pendingUpdatedObjectIDs copy];
+    [pendingUpdatedObjectIDs removeAllObjects];
+
+    int32_t batchGeneration = generation;
+    NSArray *(^block)(NSManagedObjectContext *) = snapshotBlock;
+
+    [config performReadOnlyBlock:^(NSManagedObjectContext *moc) {
+
+        NSArray *newSnapshot = moc ? block(moc) : nil;
+
+        dispatch_async(feedQueue, ^{ @autoreleasepool {
+            [self didTakeSnapshot:newSnapshot updatedObjectIDs:updatedObjectIDs generation:batchGeneration];
+        }});
+    }];
+}
+
+- (void)didTakeSnapshot:(NSArray *)newSnapshot updatedObjectIDs:(NSSet *)updatedObjectIDs generation:(int32_t)batchGeneration
+{
+    // Invoked on the feedQueue.
+
+    numberOfSnapshots++;
+
+    if (newSnapshot == nil || batchGeneration != generation)
+    {
+        [self didFinishBatch];
+        return;
+    }
+
+    NSTimeInterval start = ChessMonotonicTime();
+
+    ChessChangeFeedBatch *batch = [ChessChangeFeedBatch batchWithPreviousObjectIDs:snapshot
+                                                                         objectIDs:newSnapshot
+                                                                  updatedObjectIDs:updatedObjectIDs];
+
+    lastDiffTime = ChessMonotonicTime() - start;
+
+    // The first batch is delivered even if empty, it tells the initial results are in.
+    BOOL isFirstBatch = (snapshot == nil);
+    snapshot = newSnapshot;
+
+    if ([batch isEmpty] && !isFirstBatch)
+    {
+        [self didFinishBatch];
+        return;
+    }
+
+    numberOfBatches++;
+    numberOfChanges += [batch.deletedIndexes count] + [batch.insertedIndexes count] + [batch numberOfMoves] +
+                       [batch.updatedIndexes count] + [batch.movedUpdatedIndexes count];
+
+    dispatch_async(dispatch_get_main_queue(), ^{ @autoreleasepool {
+
+        if (batchGeneration == generation)
+        {
+            self.objectIDs = batch.objectIDs;
+
+            void (^block)(ChessChangeFeedBatch *) = self.changeBlock;
+            if (block) block(batch);
+        }
+
+        // The next batch is only computed once this one has been applied,
+        // so the main thread never has more than one batch to apply per run loop turn.
+        dispatch_async(feedQueue, ^{
+            [self didFinishBatch];
+        });
+    }});
+}
+
+- (void)didFinishBatch
+{
+    // Invoked on the feedQueue.
+
+    batchInFlight = NO;
+    lastBatchTime = ChessMonotonicTime();
+
+    [self scheduleRefresh];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Notifications
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)objectsDidChangeWithUpdatedObjectIDs:(NSArray *)updatedObjectIDs
+{
+    dispatch_async(feedQueue, ^{
+        if (running == 0) return;
+
+        numberOfNotifications++;
+
+        [pendingUpdatedObjectIDs addObjectsFromArray:updatedObjectIDs];
+        needsRefresh = YES;
+        [self scheduleRefresh];
+    });
+}
+
+- (BOOL)isObjectOfFeedEntity:(NSManagedObject *)object
+{
+    return [[[object entity] name] isEqualToString:entityName];
+}
+
+- (void)managedObjectContextDidSave:(NSNotification *)notification
+{
+    // This method is invoked on the queue of the saving context.
+
+    NSManagedObjectContext *sender = (NSManagedObjectContext *)[notification object];
+    if (sender.persistentStoreCoordinator == nil || sender.persistentStoreCoordinator != persistentStoreCoordinator)
+    {
+        return;
+    }
+
+    NSDictionary *userInfo = [notification userInfo];
+    BOOL changed = NO;
+
+    NSMutableArray *updatedObjectIDs = [NSMutableArray array];
+    for (NSManagedObject *object in [userInfo objectForKey:NSUpdatedObjectsKey])
+    {
+        if ([self isObjectOfFeedEntity:object])
+            [updatedObjectIDs addObject:[object objectID]];
+    }
+    changed = ([updatedObjectIDs count] > 0);
+
+    for (NSString *key in @[ NSInsertedObjectsKey, NSDeletedObjectsKey ])
+    {
+        if (changed) break;
+
+        for (NSManagedObject *object in [userInfo objectForKey:key])
+        {
+            if ([self isObjectOfFeedEntity:object])
+            {
+                changed = YES;
+                break;
+            }
+        }
+    }
+
+    if (changed)
+    {
+        [self objectsDidChangeWithUpdatedObjectIDs:updatedObjectIDs];
+    }
+}
+
+- (void)configDidChangeStore:(NSNotification *)notification
+{
+    NSDictionary *userInfo = [notification userInfo];
+
+    [self objectsDidChangeWithUpdatedObjectIDs:([userInfo objectForKey:NSUpdatedObjectsKey] ?: @[])];
+}
+
+@end
@@ -0,0 +1,56 @@
+//
+//  ChessColumnarResult.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/3.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+typedef NS_ENUM(NSInteger, ChessColumnType) {
+    ChessColumnTypeObject = 0,      // NSArray, NSNull for nil values (strings, decimals, binary data, ...)
+    ChessColumnTypeInteger,         // int64_t buffer (integer and boolean attributes)
+    ChessColumnTypeDouble,          // double buffer (double and float attributes, dates as seconds since the reference date)
+};
+
+/**
+ * The rows of a projection fetch, stored column by column (see -[ChessStorage fetchColumnsOfEntityName:...]).
+ *
+ * Numeric columns are plain C buffers: a list screen or a statistic can walk them
+ * without a managed object, a dictionary or an NSNumber per row.
+ * Nil values read as 0 in numeric columns, see isNullAtRow:column:.
+ *
+ * Instances are immutable, and may be handed to any thread/queue.
+ **/
+
+@interface ChessColumnarResult : NSObject
+
+/**
+ * Builds the columns from the dictionaries of an NSDictionaryResultType fetch.
+ * The column types follow the attributes of the entity, key paths that are not attributes of the entity are object columns.
+ **/
+- (id)initWithRows:(NSArray *)rows propertyNames:(NSArray *)propertyNames entity:(NSEntityDescription *)entity;
+
+@property (nonatomic, assign, readonly) NSUInteger count;
+@property (nonatomic, copy, readonly) NSArray *propertyNames;
+
+- (ChessColumnType)typeOfColumn:(NSString *)propertyName;
+
+/**
+ * The buffers hold count values, and live as long as the result.
+ * Return NULL (or nil) if the column does not exist, or is of another type.
+ **/
+- (const int64_t *)integerColumn:(NSString *)propertyName;
+- (const double *)doubleColumn:(NSString *)propertyName;
+- (NSArray *)objectColumn:(NSString *)propertyName;
+
+- (BOOL)isNullAtRow:(NSUInteger)row column:(NSString *)propertyName;
+
+/**
+ * Boxed value, nil for nil values. Convenient, but allocates: prefer the buffers in loops.
+ **/
+- (id)valueAtRow:(NSUInteger)row column:(NSString *)propertyName;
+
+@end
@@ -0,0 +1,175 @@
+//
+//  ChessColumnarResult.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/3.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessColumnarResult.h"
+
+static ChessColumnType ChessColumnTypeOfAttribute(NSAttributeDescription *attribute)
+{
+    switch ([attribute attributeType])
+    {
+        case NSInteger16AttributeType:
+        case NSInteger32AttributeType:
+        case NSInteger64AttributeType:
+        case NSBooleanAttributeType:
+            return ChessColumnTypeInteger;
+
+        case NSDoubleAttributeType:
+        case NSFloatAttributeType:
+        case NSDateAttributeType:
+            return ChessColumnTypeDouble;
+
+        default:
+            return ChessColumnTypeObject;
+    }
+}
+
+@interface ChessColumnarResult ()
+{
+    NSUInteger count;
+    NSArray *propertyNames;
+
+    NSDictionary *types;        // property name -> NSNumber (ChessColumnType)
+    NSDictionary *columns;      // property name -> NSData (numeric) or NSArray
+    NSDictionary *nullBitmaps;  // property name -> NSData, only for numeric columns with nil values
+}
+
+@end
+
+@implementation ChessColumnarResult
+
+@synthesize count, propertyNames;
+
+- (id)initWithRows:(NSArray *)rows propertyNames:(NSArray *)aPropertyNames entity:(NSEntityDescription *)entity
+{
+    if ((self = [super init]))
+    {
+        count = [rows count];
+        propertyNames = [aPropertyNames copy];
+
+        NSDictionary *attributesByName = [entity attributesByName];
+
+        NSMutableDictionary *mTypes = [NSMutableDictionary dictionaryWithCapacity:[propertyNames count]];
+        NSMutableDictionary *mColumns = [NSMutableDictionary dictionaryWithCapacity:[propertyNames count]];
+        NSMutableDictionary *mNullBitmaps = [NSMutableDictionary dictionary];
+
+        for (NSString *name in propertyNames)
+        {
+            ChessColumnType type = ChessColumnTypeOfAttribute(attributesByName[name]);
+            BOOL isDate = ([attributesByName[name] attributeType] == NSDateAttributeType);
+
+            NSMutableData *nullBitmap = nil;
+            id column = nil;
+
+            if (type == ChessColumnTypeObject)
+            {
+                NSMutableArray *objects = [NSMutableArray arrayWithCapacity:count];
+                for (NSDictionary *row in rows)
+                {
+                    [objects addObject:row[name] ?: [NSNull null]];
+                }
+                column = objects;
+            }
+            else
+            {
+                size_t valueSize = (type == ChessColumnTypeInteger) ? sizeof(int64_t) : sizeof(double);
+                NSMutableData *buffer = [NSMutableData dataWithLength:(count * valueSize)];
+
+                int64_t *integers = [buffer mutableBytes];
+                double *doubles = [buffer mutableBytes];
+
+                NSUInteger index = 0;
+                for (NSDictionary *row in rows)
+                {
+                    id value = row[name];
+
+                    if (value == nil || value == [NSNull null])
+                    {
+                        if (nullBitmap == nil) nullBitmap = [NSMutableData dataWithLength:((count + 7) / 8)];
+                        ((uint8_t *)[nullBitmap mutableBytes])[index / 8] |= (uint8_t)(1 << (index % 8));
+                    }
+                    else if (type == ChessColumnTypeInteger)
+                    {
+                        integers[index] = [value longLongValue];
+                    }
+                    else
+                    {
+                        doubles[index] = isDate ? [value timeIntervalSinceReferenceDate] : [value doubleValue];
+                    }
+
+                    index++;
+                }
+                column = buffer;
+            }
+
+            mTypes[name] = @(type);
+            mColumns[name] = column;
+            if (nullBitmap) mNullBitmaps[name] = nullBitmap;
+        }
+
+        types = [mTypes copy];
+        columns = [mColumns copy];
+        nullBitmaps = [mNullBitmaps copy];
+    }
+
+    return self;
+}
+
+- (ChessColumnType)typeOfColumn:(NSString *)propertyName
+{
+    return [types[propertyName] integerValue];
+}
+
+- (const int64_t *)integerColumn:(NSString *)propertyName
+{
+    if ([self typeOfColumn:propertyName] != ChessColumnTypeInteger) return NULL;
+
+    return [columns[propertyName] bytes];
+}
+
+- (const double *)doubleColumn:(NSString *)propertyName
+{
+    if ([self typeOfColumn:propertyName] != ChessColumnTypeDouble) return NULL;
+
+    return [columns[propertyName] bytes];
+}
+
+- (NSArray *)objectColumn:(NSString *)propertyName
+{
+    if (types[propertyName] == nil || [self typeOfColumn:propertyName] != ChessColumnTypeObject) return nil;
+
+    return columns[propertyName];
+}
+
+- (BOOL)isNullAtRow:(NSUInteger)row column:(NSString *)propertyName
+{
+    NSParameterAssert(row < count);
+
+    if ([self typeOfColumn:propertyName] == ChessColumnTypeObject)
+    {
+        return [columns[propertyName] objectAtIndex:row] == [NSNull null];
+    }
+
+    NSData *nullBitmap = nullBitmaps[propertyName];
+    if (nullBitmap == nil) return NO;
+
+    return (((const uint8_t *)[nullBitmap bytes])[row / 8] & (1 << (row % 8))) != 0;
+}
+
+- (id)valueAtRow:(NSUInteger)row column:(NSString *)propertyName
+{
+    if (types[propertyName] == nil || [self isNullAtRow:row column:propertyName]) return nil;
+
+    switch ([self typeOfColumn:propertyName])
+    {
+        case ChessColumnTypeInteger : return @([self integerColumn:propertyName][row]);
+        case ChessColumnTypeDouble  : return @([self doubleColumn:propertyName][row]);
+        default                     : return [columns[propertyName] objectAtIndex:row];
+    }
+}
+
+@end
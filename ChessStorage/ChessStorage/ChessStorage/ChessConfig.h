@@ -8,6 +8,69 @@
 
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
+
+typedef NS_ENUM(NSInteger, ChessMainThreadMergeMode) {
+    /**
+     * Every updated object of a save is faulted in on the main thread before merging,
+     * so that any NSFetchedResultsController with a predicate notices the update.
+     * Simple, but a large save stalls the main thread.
+     **/
+    ChessMainThreadMergeModeFaultAllUpdatedObjects = 0,
+    
+    /**
+     * Only updated objects registered in the mainThreadManagedObjectContext,
+     * or of an entity watched by a registered NSFetchedResultsController, are faulted in.
+     * Large change sets are merged in chunks, spread over several run loop turns.
+     **/
+    ChessMainThreadMergeModeTargeted,
+};
+
+typedef NS_ENUM(NSInteger, ChessStorePreparationPhase) {
+    ChessStorePreparationPhaseLoadingModel = 0,
+    ChessStorePreparationPhaseCheckingStore,
+    ChessStorePreparationPhaseMigratingStore,      // Only reported if the store needs a migration.
+    ChessStorePreparationPhaseAddingStore,
+    ChessStorePreparationPhaseCreatingContexts,
+};
+
+typedef NS_ENUM(NSInteger, ChessStoreProfile) {
+    /**
+     * The options of the store are left as they are: Core Data picks the journal mode and the pragmas.
+     **/
+    ChessStoreProfileDefault = 0,
+    
+    /**
+     * Rollback journal, and every commit flushed all the way to the disk (synchronous FULL, fullfsync).
+     * A save survives a power loss once it returns, at the price of the slowest saves.
+     **/
+    ChessStoreProfileDurable,
+    
+    /**
+     * Write-ahead log, synchronous NORMAL: a commit only syncs at checkpoints.
+     * The store is never corrupted, but a power loss may undo the last saves. An 8 MB page cache.
+     * New stores get 4 KB pages and incremental auto vacuum, so the idle maintenance hands deleted space back.
+     **/
+    ChessStoreProfileBalanced,
+    
+    /**
+     * Balanced, plus a 32 MB page cache, 64 MB of memory mapped reads, temporary tables in memory,
+     * and a log checkpointed every 8000 pages rather than 1000, the idle maintenance doing the rest.
+     * New stores get 8 KB pages, fewer and larger reads for bulk work, and incremental auto vacuum.
+     **/
+    ChessStoreProfileThroughput,
+};
+
+@class ChessWriteShard;
+@class ChessQueryAdvisor;
+
+/**
+ * Posted by mergeChangesWithUpdatedObjectIDs:deletedObjectIDs: for store level changes,
+ * which have no NSManagedObjectContextDidSaveNotification.
+ * The object is the ChessConfig. The userInfo holds arrays of NSManagedObjectIDs for NSUpdatedObjectsKey and NSDeletedObjectsKey.
+ * Posted on the thread that invoked the merge.
+ **/
+extern NSString *const ChessConfigDidChangeStoreNotification;
+
 /**
  *
  * ChessConfig  defines Core Data storage on how to configure the basic structures
@@ -27,6 +90,16 @@
     NSManagedObjectContext *managedObjectContext;
     NSManagedObjectContext *mainThreadManagedObjectContext;
     
+    NSMutableArray *readOnlyManagedObjectContexts;
+    NSMutableArray *idleReadOnlyManagedObjectContexts;
+    NSMutableArray *pendingReadOnlyBlocks;
+    NSUInteger numberOfBusyReadOnlyManagedObjectContexts;
+    dispatch_queue_t readOnlyManagedObjectContextsQueue;
+    NSUInteger numberOfReadOnlyManagedObjectContexts;
+    
+    NSArray *writeShards;
+    NSMutableArray *fetchIndexes;
+    
     BOOL autoRemovePreviousDatabaseFile;
     BOOL autoRecreateDatabaseFile;
     BOOL autoAllowExternalBinaryDataStorage;
@@ -56,7 +129,7 @@
  * Provides access to the the thread-safe components of the CoreData stack.
  *
  * Please note:
- * The managedObjectContext is private to the storageQueue.
+ * The managedObjectContext is private to the storageQueue (or to the current write shard, see numberOfWriteShards).
  * If you're on the main thread you can use the mainThreadManagedObjectContext.
  * Otherwise you must create and use your own managedObjectContext.
  *
@@ -85,6 +158,305 @@
 @property (nonatomic, strong, readonly) NSManagedObjectContext *mainThreadManagedObjectContext;
 @property (nonatomic, strong, readonly) NSManagedObjectContext *managedObjectContext;
 
+/**
+ * The maximum number of read-only contexts in the pool used by performReadOnlyBlock:.
+ * Must be set before the first invocation of performReadOnlyBlock:.
+ *
+ * Default 2
+ **/
+@property (readwrite) NSUInteger numberOfReadOnlyManagedObjectContexts;
+
+/**
+ * Asynchronously invokes the given block with an idle read-only managedObjectContext from a small pool.
+ *
+ * The pooled contexts are NSPrivateQueueConcurrencyType contexts on the shared persistentStoreCoordinator,
+ * each with its own queue. So long reads run in parallel with the storageQueue and the main thread,
+ * without blocking either of them.
+ *
+ * The block is invoked on the queue of the context (via performBlock:).
+ * The context is reset once the block returns, so managed objects must not escape the block.
+ * Hand NSManagedObjectIDs or dictionaries to other queues instead.
+ *
+ * If every pooled context is busy, the block is queued, and blocks are dispatched in order as contexts are returned.
+ * No thread waits meanwhile.
+ * Never save the pooled contexts.
+ **/
+- (void)performReadOnlyBlock:(void (^)(NSManagedObjectContext *moc))block;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Preparation
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The CoreData stack is created lazily, by the first access to the persistentStoreCoordinator,
+ * which loads the model and adds the persistent store (migrating it if needed) with a dispatch_sync onto the storageQueue.
+ * When that first access comes from the main thread, e.g. via the mainThreadManagedObjectContext, the app blocks at launch.
+ *
+ * This method does all of the above asynchronously on the storageQueue instead,
+ * along with the creation of the private managedObjectContext, and then creates the mainThreadManagedObjectContext.
+ *
+ * Requests scheduled on the storageQueue meanwhile (e.g. -[ChessStorage scheduleBlock:]) simply queue up behind the preparation.
+ * On the main thread, wait for the completion before touching the mainThreadManagedObjectContext.
+ *
+ * progressBlock and completionBlock are invoked on the main queue.
+ * The timings are those of the storeSetupHandler, plus @"contextCreationTime" and @"totalTime".
+ * error is the error of the persistent store, if it could not be added.
+ *
+ * This method may be invoked several times, once prepared it simply invokes the completionBlock.
+ **/
+- (void)prepareWithCompletion:(void (^)(NSDictionary *timings, NSError *error))completionBlock;
+- (void)prepareWithProgress:(void (^)(ChessStorePreparationPhase phase))progressBlock
+                 completion:(void (^)(NSDictionary *timings, NSError *error))completionBlock;
+
+/**
+ * YES once a prepareWithCompletion: has completed.
+ **/
+@property (atomic, assign, readonly, getter=isPrepared) BOOL prepared;
+
+/**
+ * The error of the last failed attempt to add the persistent store, if any.
+ **/
+@property (atomic, strong, readonly) NSError *persistentStoreError;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Store Profile
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The SQLite tuning of the store: journal mode, synchronous level, cache and mmap sizes (see ChessStoreProfile).
+ * Setting it merges the pragmas of the profile (see storePragmasForProfile: in ChessConfigProtected.h)
+ * into the NSSQLitePragmasOption of the storeOptions, replacing those of the previous profile.
+ *
+ * Each ChessConfig, hence each database file, has a profile of its own.
+ * Set it before the persistentStoreCoordinator is created. Ignored by in-memory stores.
+ * The page size and auto vacuum mode of a profile only apply to a store created with it:
+ * SQLite cannot change them on an existing database file, short of a full VACUUM.
+ *
+ * Default ChessStoreProfileDefault
+ **/
+@property (readwrite) ChessStoreProfile storeProfile;
+
+/**
+ * With any profile but ChessStoreProfileDefault, a ChessStorage runs performStoreMaintenance on the storageQueue
+ * once it has been idle (no pending request in either lane) for storeMaintenanceIdleDelay seconds,
+ * at most once every storeMaintenanceInterval seconds. A delay of 0 disables the idle maintenance.
+ *
+ * Default 2 seconds, 60 seconds
+ **/
+@property (atomic, assign) NSTimeInterval storeMaintenanceIdleDelay;
+@property (atomic, assign) NSTimeInterval storeMaintenanceInterval;
+
+/**
+ * If the store uses incremental auto vacuum (new stores of the Balanced and Throughput profiles),
+ * hands up to 512 free pages back to the file system,
+ * then checkpoints the write-ahead log into the database file and truncates it.
+ * This runs on a SQLite connection of its own, while the persistentStoreCoordinator is locked.
+ *
+ * Returns what was done, e.g.
+ * @{ @"logFrames": @(3120), @"checkpointedFrames": @(3120), @"freedPages": @(512), @"freePages": @(40),
+ *    @"duration": @(0.018), @"result": @(0) }
+ * logFrames and checkpointedFrames are -1 for a store without a log. result is the SQLite result code.
+ * Returns nil for an in-memory store, or before the persistentStoreCoordinator is created.
+ *
+ * This method may be invoked on any thread/queue.
+ **/
+- (NSDictionary *)performStoreMaintenance;
+
+/**
+ * The maintenance runs so far, e.g.
+ * @{ @"runs": @(4), @"checkpointedFrames": @(9840), @"freedPages": @(512), @"totalTime": @(0.051),
+ *    @"lastTime": @(0.012), @"failures": @(0) }
+ *
+ * This method may be invoked on any thread/queue.
+ **/
+- (NSDictionary *)storeMaintenanceStatistics;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Snapshots
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A snapshot is a directory holding a copy of the files of the SQLite store:
+ * the database file, its write-ahead log, and the external binary data of the store if any.
+ * Along with a binary Manifest.plist, written last, listing every file with its size and CRC-32, e.g.
+ *
+ * @{ @"version": @(1), @"databaseFileName": @"Roster.sqlite", @"creationDate": <NSDate>, @"copyTime": @(0.042),
+ *    @"files": @[ @{ @"path": @"Roster.sqlite", @"size": @(8388608), @"crc32": @(471407779) },
+ *                 @{ @"path": @"Roster.sqlite-wal", @"size": @(1030200), @"crc32": @(2210582117) } ] }
+ *
+ * The files are copied on the storageQueue, while the persistentStoreCoordinator is locked,
+ * so neither the storageQueue nor a write shard is in the middle of a save: the snapshot holds exactly the saved changes.
+ * The shared memory file (-shm) is not copied, SQLite rebuilds it from the log.
+ *
+ * Restoring a snapshot only copies files as well, so seeding a large store costs the time of a file copy,
+ * rather than that of inserting every object.
+ **/
+
+/**
+ * Asynchronously exports a snapshot of the store to snapshotPath, replacing any previous snapshot there.
+ * Changes not saved yet are not part of it, see -[ChessStorage exportSnapshotToPath:completion:] for that.
+ *
+ * completionBlock is invoked on the main queue, with the manifest, or with the error of the copy.
+ * In-memory stores cannot be exported (ENOTSUP in the NSPOSIXErrorDomain).
+ **/
+- (void)exportSnapshotToPath:(NSString *)snapshotPath completion:(void (^)(NSDictionary *manifest, NSError *error))completionBlock;
+
+/**
+ * Swaps the snapshot at snapshotPath in for the store, e.g. to seed a store at first launch from a snapshot in the app bundle.
+ *
+ * Must be invoked before the persistentStoreCoordinator is created (i.e. before prepareWithCompletion:),
+ * otherwise it fails with EBUSY in the NSPOSIXErrorDomain. Do not combine with autoRemovePreviousDatabaseFile.
+ * Without replaceExistingStore, an existing store is kept, and this method returns YES without copying anything.
+ *
+ * The files are copied to a staging directory next to the store, and verified against the manifest
+ * (NSFileReadCorruptFileError otherwise), before any file of the store is touched.
+ * The database, its log and its external data are then moved into a backup directory next to the store,
+ * and the snapshot is renamed into place. If any step fails the backup is moved back, and it is deleted only on success.
+ *
+ * This method may be invoked on any thread/queue.
+ **/
+- (BOOL)restoreSnapshotAtPath:(NSString *)snapshotPath replaceExistingStore:(BOOL)replaceExistingStore error:(NSError **)errorPtr;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Write Shards
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * By default every write goes through the storageQueue and its private managedObjectContext,
+ * so all the writes to the store are serialized on a single queue.
+ *
+ * With write shards, -[ChessStorage scheduleBlock:shardKey:] routes requests by key to one of numberOfWriteShards
+ * additional serial queues, each with its own private managedObjectContext on the shared persistentStoreCoordinator.
+ * The object graph work of the shards (faulting, inserting, validating, change tracking) runs in parallel,
+ * only the store I/O itself is serialized by the persistentStoreCoordinator.
+ *
+ * Saves of the shard contexts are merged into the mainThreadManagedObjectContext, like those of the private one.
+ * They are not merged into the other writing contexts, so shards are meant for independent groups of objects,
+ * e.g. keyed by entity name or by owner. If two writers do change the same object,
+ * the properties changed by the last save win.
+ *
+ * For stores that are entirely independent, use a ChessConfig per database file instead.
+ *
+ * Set numberOfWriteShards once, right after initialization, before a ChessStorage is created with this configuration.
+ *
+ * Default 0
+ **/
+@property (readwrite) NSUInteger numberOfWriteShards;
+
+/**
+ * The ChessWriteShard instances, in index order.
+ **/
+@property (atomic, copy, readonly) NSArray *writeShards;
+
+/**
+ * Returns the write shard of the given key: the one at index [shardKey hash] modulo numberOfWriteShards.
+ * Returns nil without write shards.
+ *
+ * This method may be invoked on any thread/queue.
+ **/
+- (ChessWriteShard *)writeShardForKey:(id<NSObject>)shardKey;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Fetch Indexes
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Declares an index of the entity, applied to the managedObjectModel when it is loaded:
+ * a single key path marks the attribute as indexed, several key paths add a compound index, in the given order.
+ * The name is only used to tell indexes apart, adding the same name twice replaces the previous index.
+ *
+ * This declares in code the indexes recommended by the queryAdvisor, without editing the model file.
+ * Core Data creates the indexes of an entity along with its table, i.e. when the store is created or migrated.
+ * So for an existing store, also add a model version for the change. Indexes are not part of the version hash of an entity:
+ * the new version must also change the versionHashModifier of the entity, or the store is not migrated.
+ * The Roster model declares its indexes that way, in its second version.
+ *
+ * Must be invoked before the first access to the managedObjectModel.
+ **/
+- (void)addFetchIndexWithName:(NSString *)name entityName:(NSString *)entityName keyPaths:(NSArray *)keyPaths;
+
+/**
+ * If set, every fetch of a ChessStorage with this configuration is recorded by the query advisor, with its duration,
+ * as well as the fetch request of every registered fetched results controller.
+ * Recording costs a little on every fetch, so this is meant for debug builds and benchmarks.
+ *
+ * Default nil
+ **/
+@property (atomic, strong) ChessQueryAdvisor *queryAdvisor;
+
+/**
+ * The report of the queryAdvisor against the managedObjectModel, see -[ChessQueryAdvisor reportWithManagedObjectModel:].
+ * Returns nil without a queryAdvisor.
+ *
+ * This method may be invoked on any thread/queue.
+ **/
+- (NSDictionary *)queryAdvisorReport;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Main Thread Merge
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * How saves of the private managedObjectContext are merged into the mainThreadManagedObjectContext.
+ * These properties should only be accessed from the main thread.
+ *
+ * Default ChessMainThreadMergeModeFaultAllUpdatedObjects
+ **/
+@property (nonatomic, assign) ChessMainThreadMergeMode mainThreadMergeMode;
+
+/**
+ * In ChessMainThreadMergeModeTargeted, saves with more changed objects than mainThreadMergeChunkSize are split in chunks.
+ * Chunks are merged until mainThreadMergeTimeSlice seconds have elapsed, then the rest waits for the next run loop turn.
+ *
+ * Default 500, 0.008 seconds
+ **/
+@property (nonatomic, assign) NSUInteger mainThreadMergeChunkSize;
+@property (nonatomic, assign) NSTimeInterval mainThreadMergeTimeSlice;
+
+/**
+ * In ChessMainThreadMergeModeTargeted, updated objects that are not registered in the mainThreadManagedObjectContext
+ * are only faulted in if a registered fetched results controller watches their entity.
+ * Fetched results controllers are held weakly, and must use the mainThreadManagedObjectContext.
+ * Their fetch requests are recorded by the queryAdvisor, if any.
+ **/
+- (void)registerFetchedResultsController:(NSFetchedResultsController *)controller;
+- (void)unregisterFetchedResultsController:(NSFetchedResultsController *)controller;
+
+/**
+ * Saves of the private managedObjectContext are merged into the mainThreadManagedObjectContext.
+ * If you save your own contexts on the persistentStoreCoordinator, register them here to get them merged as well.
+ **/
+- (void)observeSavesOfManagedObjectContext:(NSManagedObjectContext *)moc;
+
+/**
+ * Store level changes (e.g. NSBatchUpdateRequest, NSBatchDeleteRequest) do not go through a managedObjectContext,
+ * so there is no save notification to merge. This method merges them into the mainThreadManagedObjectContext instead:
+ * registered updated objects are refreshed, registered deleted objects are removed from the context.
+ * It also posts ChessConfigDidChangeStoreNotification, for observers of saves such as ChessChangeFeed.
+ *
+ * This method may be invoked on any thread/queue, the merge happens asynchronously on the main thread.
+ **/
+- (void)mergeChangesWithUpdatedObjectIDs:(NSArray *)updatedObjectIDs deletedObjectIDs:(NSArray *)deletedObjectIDs;
+
+/**
+ * Same as above, for any context. Must be invoked on the queue of the context.
+ *
+ * Before iOS 9, deleted objects are only turned into faults.
+ **/
+- (void)mergeChangesWithUpdatedObjectIDs:(NSArray *)updatedObjectIDs
+                        deletedObjectIDs:(NSArray *)deletedObjectIDs
+                intoManagedObjectContext:(NSManagedObjectContext *)moc;
+
+/**
+ * Main thread time spent merging, e.g.
+ * @{ @"merges": @(12), @"totalTime": @(0.031), @"maxTime": @(0.009), @"maxSliceTime": @(0.008),
+ *    @"lastTime": @(0.002), @"faultedObjects": @(2400) }
+ * Times are in seconds. A merge may span several slices.
+ *
+ * This method should only be invoked on the main thread.
+ **/
+- (NSDictionary *)mainThreadMergeStatistics;
+
 /**
  * The Previous Database File is removed before creating a persistant store.
  *
@@ -109,6 +481,16 @@
  **/
 @property (readwrite) BOOL autoAllowExternalBinaryDataStorage;
 
+/**
+ * If set, invoked on the main queue once the persistent store has been set up, with its timings, e.g.
+ * @{ @"modelLoadTime": @(0.004), @"metadataCheckTime": @(0.001), @"migrationRequired": @(NO),
+ *    @"addPersistentStoreTime": @(0.120), @"storePath": @"/.../Roster.sqlite" }
+ * Times are in seconds. storePath is absent for in-memory stores.
+ *
+ * Set it before the first access to the persistentStoreCoordinator.
+ **/
+@property (atomic, copy) void (^storeSetupHandler)(NSDictionary *timings);
+
 /**
  * Initializes a core data storage instance, backed by SQLite, with the given database store filename.
  * It is recommended your database filname use the "sqlite" file extension (e.g. "XMPPRoster.sqlite").
@@ -116,6 +498,12 @@
  **/
 - (id)initWithDatabaseFilename:(NSString *)aDatabaseFileName managedObjectModelName:(NSString *)aManagedObjectModelName;
 
+/**
+ * Initializes a core data storage instance, backed by an in-memory store.
+ * Nothing is written to disk, so this is mostly useful for transient data, tests and benchmarks.
+ **/
+- (id)initWithInMemoryStoreAndManagedObjectModelName:(NSString *)aManagedObjectModelName;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Core Data
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -129,3 +517,20 @@
 - (void)setPersistentStoreDirectory:(NSString *)persistenStoreDirectoryPath;
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A write shard of a ChessConfig: a serial queue, with a private managedObjectContext of its own.
+ *
+ * The queue carries the storageQueueTag of the configuration as a queue specific key, with the shard as value.
+ * So code that asserts to run on the storageQueue runs on a write shard as well,
+ * and -[ChessConfig managedObjectContext] returns the context of the current shard.
+ **/
+
+@interface ChessWriteShard : NSObject
+
+@property (nonatomic, assign, readonly) NSUInteger index;
+@property (nonatomic, strong, readonly) dispatch_queue_t queue;
+
+@end
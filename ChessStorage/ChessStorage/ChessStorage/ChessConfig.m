@@ -7,12 +7,94 @@
 //
 
 #import "ChessConfig.h"
+#import "ChessTime.h"
+#import "ChessQueryAdvisor.h"
+#import "ChessCRC32.h"
 #import <objc/runtime.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sqlite3.h>
+
+NSString *const ChessConfigDidChangeStoreNotification = @"ChessConfigDidChangeStoreNotification";
+
+/**
+ * A part of a save notification, waiting to be merged into the mainThreadManagedObjectContext.
+ **/
+@interface ChessMergeChunk : NSObject
+
+@property (nonatomic, strong) NSNotification *notification;
+@property (nonatomic, assign) BOOL lastChunkOfSave;
+
+@end
+
+@implementation ChessMergeChunk
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessWriteShard ()
+
+@property (nonatomic, assign, readwrite) NSUInteger index;
+@property (nonatomic, strong, readwrite) dispatch_queue_t queue;
+
+// Only accessed on the queue of the shard.
+@property (nonatomic, strong) NSManagedObjectContext *managedObjectContext;
+
+@end
+
+@implementation ChessWriteShard
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessConfig ()
+{
+    // These are only accessed on the main thread.
+    NSMutableArray *pendingMergeChunks;
+    BOOL isDrainingMergeChunks;
+    NSHashTable *fetchedResultsControllers;
+    NSTimeInterval currentMergeTime;
+    
+    NSUInteger mergeCount;
+    NSUInteger faultedObjectCount;
+    NSTimeInterval totalMergeTime;
+    NSTimeInterval maxMergeTime;
+    NSTimeInterval maxMergeSliceTime;
+    NSTimeInterval lastMergeTime;
+    
+    // Only accessed on the storageQueue.
+    NSTimeInterval modelLoadTime;
+    NSDictionary *storeSetupTimings;
+    void (^preparationProgressBlock)(ChessStorePreparationPhase phase);
+    
+    // Only accessed on the storageQueue, see storeProfile.
+    ChessStoreProfile storeProfile;
+    NSUInteger maintenanceRuns;
+    NSUInteger maintenanceFailures;
+    uint64_t maintenanceCheckpointedFrames;
+    uint64_t maintenanceFreedPages;
+    NSTimeInterval maintenanceTotalTime;
+    NSTimeInterval maintenanceLastTime;
+}
+
+@property (atomic, assign, readwrite, getter=isPrepared) BOOL prepared;
+@property (atomic, strong, readwrite) NSError *persistentStoreError;
+@property (atomic, copy, readwrite) NSArray *writeShards;
+
+@end
 
 @implementation ChessConfig
 
 @synthesize storeOptions, databaseFileName, managedObjectModelName, persistentStoreDirectory = _persistentStoreDirectory;
 @synthesize storageQueueTag, storageQueue;
+@synthesize mainThreadMergeMode, mainThreadMergeChunkSize, mainThreadMergeTimeSlice;
+@synthesize storeSetupHandler;
+@synthesize prepared, persistentStoreError;
+@synthesize writeShards;
+@synthesize queryAdvisor;
+@synthesize storeMaintenanceIdleDelay, storeMaintenanceInterval;
 
 - (id)initWithDatabaseFilename:(NSString *)aDatabaseFileName managedObjectModelName:(NSString *)aManagedObjectModelName
 {
@@ -30,6 +112,17 @@
     return self;
 }
 
+- (id)initWithInMemoryStoreAndManagedObjectModelName:(NSString *)aManagedObjectModelName
+{
+    if ((self = [super init]))
+    {
+        managedObjectModelName = aManagedObjectModelName;
+        
+        [self commonInit];
+    }
+    return self;
+}
+
 - (void)commonInit
 {
     storeOptions = [self defaultStoreOptions];
@@ -38,6 +131,28 @@
     
     storageQueueTag = &storageQueueTag;
     dispatch_queue_set_specific(storageQueue, storageQueueTag, storageQueueTag, NULL);
+    
+    numberOfReadOnlyManagedObjectContexts = 2;
+    readOnlyManagedObjectContexts = [[NSMutableArray alloc] init];
+    idleReadOnlyManagedObjectContexts = [[NSMutableArray alloc] init];
+    pendingReadOnlyBlocks = [[NSMutableArray alloc] init];
+    readOnlyManagedObjectContextsQueue = dispatch_queue_create("ChessConfig.readOnlyManagedObjectContexts", NULL);
+    
+    mainThreadMergeMode = ChessMainThreadMergeModeFaultAllUpdatedObjects;
+    mainThreadMergeChunkSize = 500;
+    mainThreadMergeTimeSlice = 0.008;
+    pendingMergeChunks = [[NSMutableArray alloc] init];
+    fetchedResultsControllers = [NSHashTable weakObjectsHashTable];
+    
+    fetchIndexes = [[NSMutableArray alloc] init];
+    
+    storeMaintenanceIdleDelay = 2.0;
+    storeMaintenanceInterval = 60.0;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -77,6 +192,43 @@
     return defaultStoreOptions;
 }
 
+- (NSDictionary *)storePragmasForProfile:(ChessStoreProfile)profile
+{
+    // Override me, if needed, to provide customized behavior.
+    //
+    // Negative cache sizes are in KiB, positive ones in pages.
+    // page_size and auto_vacuum only take effect when the database file is created (see createStoreFileAtPath:options:):
+    // an existing store keeps its page size, and is only vacuumed by the maintenance if it was created with them.
+    
+    switch (profile)
+    {
+        case ChessStoreProfileDurable:
+            return @{ @"journal_mode": @"DELETE",
+                      @"synchronous": @"FULL",
+                      @"fullfsync": @"1" };
+            
+        case ChessStoreProfileBalanced:
+            return @{ @"page_size": @"4096",
+                      @"auto_vacuum": @"INCREMENTAL",
+                      @"journal_mode": @"WAL",
+                      @"synchronous": @"NORMAL",
+                      @"cache_size": @"-8192" };
+            
+        case ChessStoreProfileThroughput:
+            return @{ @"page_size": @"8192",
+                      @"auto_vacuum": @"INCREMENTAL",
+                      @"journal_mode": @"WAL",
+                      @"synchronous": @"NORMAL",
+                      @"cache_size": @"-32768",
+                      @"mmap_size": @"67108864",
+                      @"temp_store": @"MEMORY",
+                      @"wal_autocheckpoint": @"8000" };
+            
+        default:
+            return nil;
+    }
+}
+
 - (void)willCreatePersistentStoreWithPath:(NSString *)storePath options:(NSDictionary *)theStoreOptions
 {
     // Override me, if needed, to provide customized behavior.
@@ -210,6 +362,10 @@
             return;
         }
         
+        [self reportPreparationPhase:ChessStorePreparationPhaseLoadingModel];
+        
+        NSTimeInterval start = ChessMonotonicTime();
+        
         NSString *momName = [self managedObjectModelName];
         NSString *momPath = [[self managedObjectModelBundle] pathForResource:momName ofType:@"mom"];
         if (momPath == nil)
@@ -243,10 +399,14 @@
             }
         }
         
+        [self applyFetchIndexesToManagedObjectModel:managedObjectModel];
+        
+        modelLoadTime = ChessMonotonicTime() - start;
+        
         result = managedObjectModel;
     }};
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_sync(storageQueue, block);
@@ -275,6 +435,11 @@
         
         persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:mom];
         
+        NSTimeInterval start = ChessMonotonicTime();
+        NSTimeInterval metadataCheckTime = 0;
+        NSString *storePathForTimings = nil;
+        BOOL migrationRequired = NO;
+        
         if (databaseFileName)
         {
             // SQLite persistent store
@@ -282,6 +447,8 @@
             NSString *storePath = [docsPath stringByAppendingPathComponent:databaseFileName];
             if (storePath)
             {
+                storePathForTimings = storePath;
+                
                 // If storePath is nil, then NSURL will throw an exception
                 if(autoRemovePreviousDatabaseFile)
                 {
@@ -293,17 +460,43 @@
                 
                 [self willCreatePersistentStoreWithPath:storePath options:storeOptions];
                 
+                if (![[NSFileManager defaultManager] fileExistsAtPath:storePath])
+                {
+                    [self createStoreFileAtPath:storePath options:storeOptions];
+                }
+                
+                // Find out up front whether adding the store is going to migrate it,
+                // which is by far the slowest part of the setup.
+                
+                NSTimeInterval metadataCheckStart = ChessMonotonicTime();
+                [self reportPreparationPhase:ChessStorePreparationPhaseCheckingStore];
+                
+                if ([[NSFileManager defaultManager] fileExistsAtPath:storePath])
+                {
+                    NSDictionary *metadata = [NSPersistentStoreCoordinator metadataForPersistentStoreOfType:NSSQLiteStoreType
+                                                                                                        URL:[NSURL fileURLWithPath:storePath]
+                                                                                                      error:NULL];
+                    migrationRequired = metadata && ![mom isConfiguration:nil compatibleWithStoreMetadata:metadata];
+                }
+                
+                metadataCheckTime = ChessMonotonicTime() - metadataCheckStart;
+                
+                [self reportPreparationPhase:(migrationRequired ? ChessStorePreparationPhaseMigratingStore
+                                                                : ChessStorePreparationPhaseAddingStore)];
+                
                 NSError *error = nil;
                 BOOL didAddPersistentStore = [self addPersistentStoreWithPath:storePath options:storeOptions error:&error];
                 if(autoRecreateDatabaseFile && !didAddPersistentStore)
                 {
                     [[NSFileManager defaultManager] removeItemAtPath:storePath error:NULL];
+                    [self createStoreFileAtPath:storePath options:storeOptions];
                     
                     didAddPersistentStore = [self addPersistentStoreWithPath:storePath options:storeOptions error:&error];
                 }
                 
                 if (!didAddPersistentStore)
                 {
+                    self.persistentStoreError = error;
                     [self didNotAddPersistentStoreWithPath:storePath options:storeOptions error:error];
                 }
             }
@@ -312,18 +505,38 @@
         {
             // In-Memory persistent store
             [self willCreatePersistentStoreWithPath:nil options:storeOptions];
+            [self reportPreparationPhase:ChessStorePreparationPhaseAddingStore];
             
             NSError *error = nil;
             if (![self addPersistentStoreWithPath:nil options:storeOptions error:&error])
             {
+                self.persistentStoreError = error;
                 [self didNotAddPersistentStoreWithPath:nil options:storeOptions error:error];
             }
         }
         
+        NSMutableDictionary *timings = [NSMutableDictionary dictionaryWithCapacity:5];
+        timings[@"modelLoadTime"] = @(modelLoadTime);
+        timings[@"metadataCheckTime"] = @(metadataCheckTime);
+        timings[@"migrationRequired"] = @(migrationRequired);
+        timings[@"addPersistentStoreTime"] = @(ChessMonotonicTime() - start - metadataCheckTime);
+        if (storePathForTimings) timings[@"storePath"] = storePathForTimings;
+        
+        storeSetupTimings = [timings copy];
+        
+        void (^handler)(NSDictionary *) = self.storeSetupHandler;
+        if (handler)
+        {
+            NSDictionary *handlerTimings = storeSetupTimings;
+            dispatch_async(dispatch_get_main_queue(), ^{
+                handler(handlerTimings);
+            });
+        }
+        
         result = persistentStoreCoordinator;
     }};
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_sync(storageQueue, block);
@@ -355,6 +568,13 @@
     // Read the comments above!
     //
     
+    // On a write shard, the queue specific value is the shard itself.
+    void *queueSpecific = dispatch_get_specific(storageQueueTag);
+    if (queueSpecific != NULL && queueSpecific != storageQueueTag)
+    {
+        return [self managedObjectContextOfWriteShard:(__bridge ChessWriteShard *)queueSpecific];
+    }
+    
     if (managedObjectContext)
     {
         return managedObjectContext;
@@ -367,12 +587,42 @@
         managedObjectContext.persistentStoreCoordinator = coordinator;
         managedObjectContext.undoManager = nil;
         
+        [self observeSavesOfManagedObjectContext:managedObjectContext];
+        
         [self didCreateManagedObjectContext];
     }
     
     return managedObjectContext;
 }
 
+- (NSManagedObjectContext *)managedObjectContextOfWriteShard:(ChessWriteShard *)shard
+{
+    // This method is invoked on the queue of the shard.
+    
+    if (shard.managedObjectContext)
+    {
+        return shard.managedObjectContext;
+    }
+    
+    NSPersistentStoreCoordinator *coordinator = [self persistentStoreCoordinator];
+    if (coordinator)
+    {
+        NSManagedObjectContext *moc = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+        moc.persistentStoreCoordinator = coordinator;
+        moc.undoManager = nil;
+        
+        // Shards are not merged with each other, so a conflict means another writer saved the same object:
+        // keep its values, except for the properties this shard changed.
+        moc.mergePolicy = NSMergeByPropertyObjectTrumpMergePolicy;
+        
+        shard.managedObjectContext = moc;
+        
+        [self observeSavesOfManagedObjectContext:moc];
+    }
+    
+    return shard.managedObjectContext;
+}
+
 - (NSManagedObjectContext *)mainThreadManagedObjectContext
 {
     // NSManagedObjectContext is NOT thread-safe.
@@ -405,38 +655,1346 @@
         mainThreadManagedObjectContext.persistentStoreCoordinator = coordinator;
         mainThreadManagedObjectContext.undoManager = nil;
         
-        [[NSNotificationCenter defaultCenter] addObserver:self
-                                                 selector:@selector(managedObjectContextDidSave:)
-                                                     name:NSManagedObjectContextDidSaveNotification
-                                                   object:nil];
-        
-        // Todo: If we knew that our private managedObjectContext was going to be the only one writing to the database,
-        // then a small optimization would be to use it as the object when registering above.
+        // Saves are observed per writing context (see observeSavesOfManagedObjectContext:),
+        // rather than for every context in the process.
     }
     
     return mainThreadManagedObjectContext;
 }
 
-- (void)managedObjectContextDidSave:(NSNotification *)notification
+- (NSUInteger)numberOfWriteShards
 {
-    NSManagedObjectContext *sender = (NSManagedObjectContext *)[notification object];
+    return [self.writeShards count];
+}
+
+- (void)setNumberOfWriteShards:(NSUInteger)number
+{
+    dispatch_block_t block = ^{
+        
+        NSAssert([writeShards count] == 0, @"The write shards are already configured");
+        
+        NSMutableArray *shards = [NSMutableArray arrayWithCapacity:number];
+        for (NSUInteger i = 0; i < number; i++)
+        {
+            NSString *label = [NSString stringWithFormat:@"%s.writeShard.%lu", class_getName([self class]), (unsigned long)i];
+            
+            ChessWriteShard *shard = [[ChessWriteShard alloc] init];
+            shard.index = i;
+            shard.queue = dispatch_queue_create([label UTF8String], NULL);
+            
+            // The shard owns its queue, so the unretained value cannot outlive it.
+            dispatch_queue_set_specific(shard.queue, storageQueueTag, (__bridge void *)shard, NULL);
+            
+            [shards addObject:shard];
+        }
+        
+        self.writeShards = shards;
+    };
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+}
+
+- (ChessWriteShard *)writeShardForKey:(id<NSObject>)shardKey
+{
+    NSArray *shards = self.writeShards;
     
-    if ((sender != mainThreadManagedObjectContext) &&
-        (sender.persistentStoreCoordinator == mainThreadManagedObjectContext.persistentStoreCoordinator))
+    NSUInteger count = [shards count];
+    if (count == 0)
     {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        return nil;
+    }
+    
+    return shards[[shardKey hash] % count];
+}
+
+- (NSUInteger)numberOfReadOnlyManagedObjectContexts
+{
+    __block NSUInteger result = 0;
+    
+    dispatch_sync(readOnlyManagedObjectContextsQueue, ^{
+        result = numberOfReadOnlyManagedObjectContexts;
+    });
+    
+    return result;
+}
+
+- (void)setNumberOfReadOnlyManagedObjectContexts:(NSUInteger)number
+{
+    dispatch_sync(readOnlyManagedObjectContextsQueue, ^{
+        NSAssert(numberOfBusyReadOnlyManagedObjectContexts == 0 && [readOnlyManagedObjectContexts count] == 0,
+                 @"The read-only context pool is already in use");
+        numberOfReadOnlyManagedObjectContexts = MAX(number, 1);
+    });
+}
+
+- (void)dispatchPendingReadOnlyBlocks
+{
+    // Invoked on the readOnlyManagedObjectContextsQueue.
+    // Hands the oldest pending blocks to the idle contexts, or to new ones while the pool is not full.
+    
+    while ([pendingReadOnlyBlocks count] > 0 && numberOfBusyReadOnlyManagedObjectContexts < numberOfReadOnlyManagedObjectContexts)
+    {
+        void (^block)(NSManagedObjectContext *) = pendingReadOnlyBlocks[0];
+        [pendingReadOnlyBlocks removeObjectAtIndex:0];
+        
+        numberOfBusyReadOnlyManagedObjectContexts++;
+        
+        NSManagedObjectContext *moc = [idleReadOnlyManagedObjectContexts lastObject];
+        if (moc)
+        {
+            [idleReadOnlyManagedObjectContexts removeLastObject];
+            [self performReadOnlyBlock:block inManagedObjectContext:moc];
+            continue;
+        }
+        
+        // The persistentStoreCoordinator may still be set up on the storageQueue,
+        // so the new context is created off this queue.
+        
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{ @autoreleasepool {
             
-            // http://stackoverflow.com/questions/3923826/nsfetchedresultscontroller-with-predicate-ignores-changes-merged-from-different
-            for (NSManagedObject *object in [[notification userInfo] objectForKey:NSUpdatedObjectsKey]) {
-                [[mainThreadManagedObjectContext objectWithID:[object objectID]] willAccessValueForKey:nil];
+            NSPersistentStoreCoordinator *coordinator = [self persistentStoreCoordinator];
+            if (coordinator == nil)
+            {
+                block(nil);
+                [self enqueueReadOnlyManagedObjectContext:nil];
+                return;
             }
             
-            [mainThreadManagedObjectContext mergeChangesFromContextDidSaveNotification:notification];
-            [self mainThreadManagedObjectContextDidMergeChanges];
-        });
+            NSManagedObjectContext *newContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+            newContext.persistentStoreCoordinator = coordinator;
+            newContext.undoManager = nil;
+            
+            dispatch_async(readOnlyManagedObjectContextsQueue, ^{
+                [readOnlyManagedObjectContexts addObject:newContext];
+            });
+            
+            [self performReadOnlyBlock:block inManagedObjectContext:newContext];
+        }});
+    }
+}
+
+- (void)performReadOnlyBlock:(void (^)(NSManagedObjectContext *moc))block inManagedObjectContext:(NSManagedObjectContext *)moc
+{
+    [moc performBlock:^{ @autoreleasepool {
+        
+        block(moc);
+        [moc reset];
+        
+        [self enqueueReadOnlyManagedObjectContext:moc];
+    }}];
+}
+
+- (void)enqueueReadOnlyManagedObjectContext:(NSManagedObjectContext *)moc
+{
+    dispatch_async(readOnlyManagedObjectContextsQueue, ^{
+        
+        if (moc)
+        {
+            [idleReadOnlyManagedObjectContexts addObject:moc];
+        }
+        numberOfBusyReadOnlyManagedObjectContexts--;
+        
+        [self dispatchPendingReadOnlyBlocks];
+    });
+}
+
+- (void)performReadOnlyBlock:(void (^)(NSManagedObjectContext *moc))block
+{
+    // This is a public method.
+    // It may be invoked on any thread/queue.
+    
+    if (block == nil) return;
+    
+    void (^pendingBlock)(NSManagedObjectContext *) = [block copy];
+    
+    dispatch_async(readOnlyManagedObjectContextsQueue, ^{
+        
+        [pendingReadOnlyBlocks addObject:pendingBlock];
+        [self dispatchPendingReadOnlyBlocks];
+    });
+}
+
+- (void)observeSavesOfManagedObjectContext:(NSManagedObjectContext *)moc
+{
+    if (moc == nil) return;
+    
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(managedObjectContextDidSave:)
+                                                 name:NSManagedObjectContextDidSaveNotification
+                                               object:moc];
+}
+
+- (void)managedObjectContextDidSave:(NSNotification *)notification
+{
+    // This method is invoked on the queue of the saving context.
+    
+    NSManagedObjectContext *sender = (NSManagedObjectContext *)[notification object];
+    
+    dispatch_async(dispatch_get_main_queue(), ^{
+        
+        if ((mainThreadManagedObjectContext == nil) ||
+            (sender == mainThreadManagedObjectContext) ||
+            (sender.persistentStoreCoordinator != mainThreadManagedObjectContext.persistentStoreCoordinator))
+        {
+            return;
+        }
+        
+        if (mainThreadMergeMode == ChessMainThreadMergeModeTargeted)
+        {
+            [self enqueueMergeChunksForNotification:notification];
+            return;
+        }
+        
+        NSTimeInterval start = ChessMonotonicTime();
+        
+        // http://stackoverflow.com/questions/3923826/nsfetchedresultscontroller-with-predicate-ignores-changes-merged-from-different
+        NSSet *updatedObjects = [[notification userInfo] objectForKey:NSUpdatedObjectsKey];
+        for (NSManagedObject *object in updatedObjects) {
+            [[mainThreadManagedObjectContext objectWithID:[object objectID]] willAccessValueForKey:nil];
+        }
+        faultedObjectCount += [updatedObjects count];
+        
+        [mainThreadManagedObjectContext mergeChangesFromContextDidSaveNotification:notification];
+        
+        NSTimeInterval elapsed = ChessMonotonicTime() - start;
+        maxMergeSliceTime = MAX(maxMergeSliceTime, elapsed);
+        [self didFinishMergeWithTime:elapsed];
+        
+        [self mainThreadManagedObjectContextDidMergeChanges];
+    });
+}
+
+- (void)mergeChangesWithUpdatedObjectIDs:(NSArray *)updatedObjectIDs deletedObjectIDs:(NSArray *)deletedObjectIDs
+{
+    if ([updatedObjectIDs count] == 0 && [deletedObjectIDs count] == 0) return;
+    
+    NSArray *updated = [updatedObjectIDs copy] ?: @[];
+    NSArray *deleted = [deletedObjectIDs copy] ?: @[];
+    
+    [[NSNotificationCenter defaultCenter] postNotificationName:ChessConfigDidChangeStoreNotification
+                                                        object:self
+                                                      userInfo:@{ NSUpdatedObjectsKey: updated, NSDeletedObjectsKey: deleted }];
+    
+    dispatch_async(dispatch_get_main_queue(), ^{ @autoreleasepool {
+        
+        if (mainThreadManagedObjectContext == nil)
+        {
+            return;
+        }
+        
+        NSTimeInterval start = ChessMonotonicTime();
+        
+        [self mergeChangesWithUpdatedObjectIDs:updated deletedObjectIDs:deleted intoManagedObjectContext:mainThreadManagedObjectContext];
+        
+        NSTimeInterval elapsed = ChessMonotonicTime() - start;
+        maxMergeSliceTime = MAX(maxMergeSliceTime, elapsed);
+        [self didFinishMergeWithTime:elapsed];
+        
+        [self mainThreadManagedObjectContextDidMergeChanges];
+    }});
+}
+
+- (void)mergeChangesWithUpdatedObjectIDs:(NSArray *)updatedObjectIDs
+                        deletedObjectIDs:(NSArray *)deletedObjectIDs
+                intoManagedObjectContext:(NSManagedObjectContext *)moc
+{
+    // Invoked on the queue of the given context.
+    
+    if ([NSManagedObjectContext respondsToSelector:@selector(mergeChangesFromRemoteContextSave:intoContexts:)])
+    {
+        // iOS 9 and later, which also notifies fetched results controllers of the deletions.
+        [NSManagedObjectContext mergeChangesFromRemoteContextSave:@{ NSUpdatedObjectsKey : updatedObjectIDs,
+                                                                     NSDeletedObjectsKey : deletedObjectIDs }
+                                                     intoContexts:@[moc]];
+        return;
+    }
+    
+    // Only registered objects may hold stale values.
+    // Deleted objects are turned into faults as well, deleting them here would leave unsaved changes behind.
+    
+    for (NSArray *objectIDs in @[updatedObjectIDs, deletedObjectIDs])
+    {
+        for (NSManagedObjectID *objectID in objectIDs)
+        {
+            NSManagedObject *object = [moc objectRegisteredForID:objectID];
+            if (object)
+            {
+                [moc refreshObject:object mergeChanges:NO];
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Fetch Indexes
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)addFetchIndexWithName:(NSString *)name entityName:(NSString *)entityName keyPaths:(NSArray *)keyPaths
+{
+    NSParameterAssert(name && entityName && [keyPaths count] > 0);
+    
+    dispatch_block_t block = ^{
+        
+        NSAssert(managedObjectModel == nil, @"The managedObjectModel is already loaded");
+        
+        NSPredicate *sameIndex = [NSPredicate predicateWithFormat:@"name == %@ AND entityName == %@", name, entityName];
+        [fetchIndexes removeObjectsInArray:[fetchIndexes filteredArrayUsingPredicate:sameIndex]];
+        
+        [fetchIndexes addObject:@{ @"name": [name copy], @"entityName": [entityName copy], @"keyPaths": [keyPaths copy] }];
+    };
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+}
+
+- (void)applyFetchIndexesToManagedObjectModel:(NSManagedObjectModel *)mom
+{
+    // Invoked on the storageQueue, before the model is used by the persistentStoreCoordinator.
+    //
+    // NSFetchIndexDescription only exists as of iOS 11,
+    // so indexes are declared with setIndexed: and compoundIndexes, which SQLite stores have supported since iOS 5.
+    
+    NSDictionary *entitiesByName = [mom entitiesByName];
+    
+    for (NSDictionary *fetchIndex in fetchIndexes)
+    {
+        NSEntityDescription *entity = entitiesByName[fetchIndex[@"entityName"]];
+        NSArray *keyPaths = fetchIndex[@"keyPaths"];
+        
+        if (entity == nil)
+        {
+            NSLog(@"%@: Unknown entity %@ of fetch index %@", [self class], fetchIndex[@"entityName"], fetchIndex[@"name"]);
+            continue;
+        }
+        
+        if ([keyPaths count] == 1)
+        {
+            [[entity attributesByName][[keyPaths firstObject]] setIndexed:YES];
+        }
+        else if (![[entity compoundIndexes] containsObject:keyPaths])
+        {
+            [entity setCompoundIndexes:[([entity compoundIndexes] ?: @[]) arrayByAddingObject:keyPaths]];
+        }
     }
 }
 
+- (NSDictionary *)queryAdvisorReport
+{
+    ChessQueryAdvisor *advisor = self.queryAdvisor;
+    
+    return [advisor reportWithManagedObjectModel:[self managedObjectModel]];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Preparation
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)prepareWithCompletion:(void (^)(NSDictionary *timings, NSError *error))completionBlock
+{
+    [self prepareWithProgress:nil completion:completionBlock];
+}
+
+- (void)prepareWithProgress:(void (^)(ChessStorePreparationPhase phase))progressBlock
+                 completion:(void (^)(NSDictionary *timings, NSError *error))completionBlock
+{
+    // This is a public method.
+    // It may be invoked on any thread/queue.
+    
+    NSTimeInterval start = ChessMonotonicTime();
+    
+    dispatch_async(storageQueue, ^{ @autoreleasepool {
+        
+        // The progress is only reported by the code that actually creates the stack,
+        // so a second preparation does not report anything.
+        preparationProgressBlock = progressBlock;
+        
+        [self persistentStoreCoordinator];
+        
+        NSTimeInterval contextStart = ChessMonotonicTime();
+        if (managedObjectContext == nil)
+        {
+            [self reportPreparationPhase:ChessStorePreparationPhaseCreatingContexts];
+        }
+        [self managedObjectContext];
+        
+        preparationProgressBlock = nil;
+        
+        NSMutableDictionary *timings = [NSMutableDictionary dictionaryWithDictionary:storeSetupTimings];
+        NSTimeInterval contextCreationTime = ChessMonotonicTime() - contextStart;
+        
+        dispatch_async(dispatch_get_main_queue(), ^{ @autoreleasepool {
+            
+            // The persistentStoreCoordinator is ready, so this no longer blocks.
+            NSTimeInterval mainContextStart = ChessMonotonicTime();
+            [self mainThreadManagedObjectContext];
+            
+            timings[@"contextCreationTime"] = @(contextCreationTime + (ChessMonotonicTime() - mainContextStart));
+            timings[@"totalTime"] = @(ChessMonotonicTime() - start);
+            
+            self.prepared = YES;
+            
+            if (completionBlock)
+            {
+                completionBlock(timings, self.persistentStoreError);
+            }
+        }});
+    }});
+}
+
+- (void)reportPreparationPhase:(ChessStorePreparationPhase)phase
+{
+    // Invoked on the storageQueue, while creating the CoreData stack.
+    
+    void (^progressBlock)(ChessStorePreparationPhase) = preparationProgressBlock;
+    if (progressBlock)
+    {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            progressBlock(phase);
+        });
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Snapshots
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define kChessSnapshotManifestFileName  @"Manifest.plist"
+#define kChessSnapshotManifestVersion   1
+#define kChessSnapshotCopyBufferSize    (1024 * 1024)
+
+/**
+ * Copies the file at sourcePath to destinationPath, which is created or truncated, then synced.
+ * The CRC-32 of the bytes is computed along the way, so a copy is verified without reading it twice.
+ * Returns 0, or an errno value.
+ **/
+static int ChessSnapshotCopyFile(const char *sourcePath, const char *destinationPath, uint64_t *sizePtr, uint32_t *crcPtr)
+{
+    int source = open(sourcePath, O_RDONLY);
+    if (source < 0) return errno;
+    
+    int destination = open(destinationPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (destination < 0)
+    {
+        int error = errno;
+        close(source);
+        return error;
+    }
+    
+    char *buffer = malloc(kChessSnapshotCopyBufferSize);
+    uint64_t size = 0;
+    uint32_t crc = 0;
+    int error = (buffer == NULL) ? ENOMEM : 0;
+    
+    while (error == 0)
+    {
+        ssize_t length = read(source, buffer, kChessSnapshotCopyBufferSize);
+        if (length < 0)
+        {
+            if (errno != EINTR) error = errno;
+            continue;
+        }
+        if (length == 0) break;
+        
+        crc = chess_crc32(crc, buffer, (size_t)length);
+        size += (uint64_t)length;
+        
+        ssize_t written = 0;
+        while (written < length && error == 0)
+        {
+            ssize_t result = write(destination, buffer + written, (size_t)(length - written));
+            if (result >= 0)
+                written += result;
+            else if (errno != EINTR)
+                error = errno;
+        }
+    }
+    
+    if (error == 0 && fsync(destination) != 0) error = errno;
+    
+    free(buffer);
+    close(source);
+    if (close(destination) != 0 && error == 0) error = errno;
+    
+    if (sizePtr) *sizePtr = size;
+    if (crcPtr) *crcPtr = crc;
+    
+    return error;
+}
+
+static NSError *ChessSnapshotPOSIXError(int code, NSString *path)
+{
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:@{ NSFilePathErrorKey: path }];
+}
+
+static NSError *ChessSnapshotCorruptError(NSString *path)
+{
+    return [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{ NSFilePathErrorKey: path }];
+}
+
+/**
+ * Invokes the block while no context can save through the coordinator (at once if there is no coordinator yet).
+ **/
+static void ChessPerformWithLockedCoordinator(NSPersistentStoreCoordinator *psc, dispatch_block_t block)
+{
+    if (psc == nil)
+    {
+        block();
+    }
+    else if ([psc respondsToSelector:@selector(performBlockAndWait:)])
+    {
+        [psc performBlockAndWait:block];
+    }
+    else
+    {
+        // Before iOS 8 the coordinator has no queue of its own.
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+        [psc lock];
+        block();
+        [psc unlock];
+#pragma clang diagnostic pop
+    }
+}
+
+/**
+ * Core Data keeps the external binary data of Name.sqlite in .Name_SUPPORT/_EXTERNAL_DATA, next to the store.
+ **/
+static NSString *ChessSnapshotSupportDirectoryName(NSString *aDatabaseFileName)
+{
+    return [NSString stringWithFormat:@".%@_SUPPORT", [aDatabaseFileName stringByDeletingPathExtension]];
+}
+
+/**
+ * The files of the store named aDatabaseFileName in directory, except the -shm one, relative to the directory.
+ **/
+static NSArray *ChessSnapshotFilesOfStore(NSString *directory, NSString *aDatabaseFileName)
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSMutableArray *result = [NSMutableArray array];
+    
+    for (NSString *path in @[ aDatabaseFileName, [aDatabaseFileName stringByAppendingString:@"-wal"] ])
+    {
+        if ([fileManager fileExistsAtPath:[directory stringByAppendingPathComponent:path]])
+        {
+            [result addObject:path];
+        }
+    }
+    
+    NSString *supportDirectoryName = ChessSnapshotSupportDirectoryName(aDatabaseFileName);
+    NSDirectoryEnumerator *enumerator = [fileManager enumeratorAtPath:[directory stringByAppendingPathComponent:supportDirectoryName]];
+    
+    for (NSString *path in enumerator)
+    {
+        if ([[[enumerator fileAttributes] fileType] isEqualToString:NSFileTypeRegular])
+        {
+            [result addObject:[supportDirectoryName stringByAppendingPathComponent:path]];
+        }
+    }
+    
+    return result;
+}
+
+/**
+ * Renames a file of a snapshot taken from the store named snapshotFileName after the file of this store.
+ **/
+static NSString *ChessSnapshotStorePath(NSString *path, NSString *snapshotFileName, NSString *aDatabaseFileName)
+{
+    NSString *snapshotSupportDirectoryName = ChessSnapshotSupportDirectoryName(snapshotFileName);
+    
+    if ([path hasPrefix:snapshotSupportDirectoryName])
+    {
+        return [ChessSnapshotSupportDirectoryName(aDatabaseFileName) stringByAppendingString:[path substringFromIndex:[snapshotSupportDirectoryName length]]];
+    }
+    if ([path hasPrefix:snapshotFileName])
+    {
+        return [aDatabaseFileName stringByAppendingString:[path substringFromIndex:[snapshotFileName length]]];
+    }
+    
+    return nil;
+}
+
+- (void)exportSnapshotToPath:(NSString *)snapshotPath completion:(void (^)(NSDictionary *manifest, NSError *error))completionBlock
+{
+    // This is a public method.
+    // It may be invoked on any thread/queue.
+    
+    NSParameterAssert(snapshotPath != nil);
+    
+    dispatch_block_t block = ^{ @autoreleasepool {
+        
+        NSError *error = nil;
+        NSDictionary *manifest = nil;
+        
+        if (databaseFileName == nil)
+        {
+            error = ChessSnapshotPOSIXError(ENOTSUP, snapshotPath);
+        }
+        else
+        {
+            manifest = [self writeSnapshotToPath:snapshotPath error:&error];
+        }
+        
+        if (completionBlock)
+        {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock(manifest, error);
+            });
+        }
+    }};
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_async(storageQueue, block);
+}
+
+- (NSDictionary *)writeSnapshotToPath:(NSString *)snapshotPath error:(NSError **)errorPtr
+{
+    // Invoked on the storageQueue, so no request of a ChessStorage is in the middle of its changes.
+    
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSString *storeDirectory = [self persistentStoreDirectory];
+    
+    [fileManager removeItemAtPath:snapshotPath error:NULL];
+    if (![fileManager createDirectoryAtPath:snapshotPath withIntermediateDirectories:YES attributes:nil error:errorPtr])
+    {
+        return nil;
+    }
+    
+    NSMutableArray *files = [NSMutableArray array];
+    __block int copyError = 0;
+    __block NSString *failedPath = nil;
+    
+    NSTimeInterval start = ChessMonotonicTime();
+    
+    // Every save goes through the coordinator, the write shards included:
+    // while it is locked the files hold exactly the saved changes, and SQLite does not checkpoint the log.
+    ChessPerformWithLockedCoordinator(persistentStoreCoordinator, ^{
+        
+        NSArray *paths = ChessSnapshotFilesOfStore(storeDirectory, databaseFileName);
+        if (![paths containsObject:databaseFileName])
+        {
+            copyError = ENOENT;
+            failedPath = [storeDirectory stringByAppendingPathComponent:databaseFileName];
+            return;
+        }
+        
+        for (NSString *path in paths)
+        {
+            NSString *sourcePath = [storeDirectory stringByAppendingPathComponent:path];
+            NSString *destinationPath = [snapshotPath stringByAppendingPathComponent:path];
+            
+            [fileManager createDirectoryAtPath:[destinationPath stringByDeletingLastPathComponent]
+                   withIntermediateDirectories:YES
+                                    attributes:nil
+                                         error:NULL];
+            
+            uint64_t size = 0;
+            uint32_t crc = 0;
+            copyError = ChessSnapshotCopyFile([sourcePath fileSystemRepresentation], [destinationPath fileSystemRepresentation], &size, &crc);
+            if (copyError != 0)
+            {
+                failedPath = sourcePath;
+                return;
+            }
+            
+            [files addObject:@{ @"path": path, @"size": @(size), @"crc32": @(crc) }];
+        }
+    });
+    
+    NSTimeInterval copyTime = ChessMonotonicTime() - start;
+    NSData *data = nil;
+    NSDictionary *manifest = nil;
+    
+    if (copyError != 0)
+    {
+        if (errorPtr) *errorPtr = ChessSnapshotPOSIXError(copyError, failedPath);
+    }
+    else
+    {
+        manifest = @{ @"version": @(kChessSnapshotManifestVersion),
+                      @"databaseFileName": databaseFileName,
+                      @"creationDate": [NSDate date],
+                      @"copyTime": @(copyTime),
+                      @"files": files };
+        
+        // The manifest goes last: a snapshot without one is incomplete.
+        data = [NSPropertyListSerialization dataWithPropertyList:manifest format:NSPropertyListBinaryFormat_v1_0 options:0 error:errorPtr];
+    }
+    
+    NSString *manifestPath = [snapshotPath stringByAppendingPathComponent:kChessSnapshotManifestFileName];
+    
+    if (data == nil || ![data writeToFile:manifestPath options:NSDataWritingAtomic error:errorPtr])
+    {
+        [fileManager removeItemAtPath:snapshotPath error:NULL];
+        return nil;
+    }
+    
+    return manifest;
+}
+
+- (BOOL)restoreSnapshotAtPath:(NSString *)snapshotPath replaceExistingStore:(BOOL)replaceExistingStore error:(NSError **)errorPtr
+{
+    // This is a public method.
+    // It may be invoked on any thread/queue.
+    
+    NSParameterAssert(snapshotPath != nil);
+    
+    __block BOOL result = NO;
+    __block NSError *error = nil;
+    
+    dispatch_block_t block = ^{ @autoreleasepool {
+        
+        if (databaseFileName == nil)
+        {
+            error = ChessSnapshotPOSIXError(ENOTSUP, snapshotPath);
+            return;
+        }
+        
+        NSString *storeDirectory = [self persistentStoreDirectory];
+        NSString *storePath = [storeDirectory stringByAppendingPathComponent:databaseFileName];
+        
+        // The coordinator keeps the files open, swapping them now would corrupt the store.
+        if (persistentStoreCoordinator)
+        {
+            error = ChessSnapshotPOSIXError(EBUSY, storePath);
+            return;
+        }
+        
+        if (!replaceExistingStore && [[NSFileManager defaultManager] fileExistsAtPath:storePath])
+        {
+            result = YES;
+            return;
+        }
+        
+        NSError *installError = nil;
+        result = [self installSnapshotAtPath:snapshotPath inDirectory:storeDirectory error:&installError];
+        error = installError;
+    }};
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+    
+    if (!result && errorPtr) *errorPtr = error;
+    
+    return result;
+}
+
+- (BOOL)installSnapshotAtPath:(NSString *)snapshotPath inDirectory:(NSString *)storeDirectory error:(NSError **)errorPtr
+{
+    // Invoked on the storageQueue, before the persistentStoreCoordinator is created.
+    
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSString *manifestPath = [snapshotPath stringByAppendingPathComponent:kChessSnapshotManifestFileName];
+    
+    NSData *data = [NSData dataWithContentsOfFile:manifestPath options:0 error:errorPtr];
+    if (data == nil)
+    {
+        return NO;
+    }
+    
+    NSDictionary *manifest = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:errorPtr];
+    if (manifest == nil)
+    {
+        return NO;
+    }
+    
+    NSArray *files = [manifest isKindOfClass:[NSDictionary class]] ? manifest[@"files"] : nil;
+    NSString *snapshotFileName = [manifest isKindOfClass:[NSDictionary class]] ? manifest[@"databaseFileName"] : nil;
+    
+    if (![files isKindOfClass:[NSArray class]] || ![snapshotFileName isKindOfClass:[NSString class]] ||
+        [manifest[@"version"] integerValue] != kChessSnapshotManifestVersion)
+    {
+        if (errorPtr) *errorPtr = ChessSnapshotCorruptError(manifestPath);
+        return NO;
+    }
+    
+    // Copied and verified aside first, the current store is only touched once the whole snapshot is known to be good.
+    NSString *stagingPath = [storeDirectory stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.restore", databaseFileName]];
+    [fileManager removeItemAtPath:stagingPath error:NULL];
+    
+    NSMutableArray *stagedPaths = [NSMutableArray arrayWithCapacity:[files count]];
+    NSError *error = nil;
+    
+    for (NSDictionary *file in files)
+    {
+        NSString *path = [file isKindOfClass:[NSDictionary class]] ? file[@"path"] : nil;
+        NSString *storeRelativePath = [path isKindOfClass:[NSString class]] ? ChessSnapshotStorePath(path, snapshotFileName, databaseFileName) : nil;
+        
+        if (storeRelativePath == nil || [[path pathComponents] containsObject:@".."])
+        {
+            error = ChessSnapshotCorruptError(manifestPath);
+            break;
+        }
+        
+        NSString *sourcePath = [snapshotPath stringByAppendingPathComponent:path];
+        NSString *stagedPath = [stagingPath stringByAppendingPathComponent:storeRelativePath];
+        
+        [fileManager createDirectoryAtPath:[stagedPath stringByDeletingLastPathComponent]
+               withIntermediateDirectories:YES
+                                attributes:nil
+                                     error:NULL];
+        
+        uint64_t size = 0;
+        uint32_t crc = 0;
+        int copyError = ChessSnapshotCopyFile([sourcePath fileSystemRepresentation], [stagedPath fileSystemRepresentation], &size, &crc);
+        if (copyError != 0)
+        {
+            error = ChessSnapshotPOSIXError(copyError, sourcePath);
+            break;
+        }
+        
+        if (size != [file[@"size"] unsignedLongLongValue] || crc != [file[@"crc32"] unsignedIntValue])
+        {
+            error = ChessSnapshotCorruptError(sourcePath);
+            break;
+        }
+        
+        [stagedPaths addObject:storeRelativePath];
+    }
+    
+    if (error == nil && ![stagedPaths containsObject:databaseFileName])
+    {
+        error = ChessSnapshotCorruptError(manifestPath);
+    }
+    
+    if (error)
+    {
+        [fileManager removeItemAtPath:stagingPath error:NULL];
+        
+        if (errorPtr) *errorPtr = error;
+        return NO;
+    }
+    
+    // The current database, its log and its external data are moved into a backup directory first:
+    // a log or external data left next to the restored database would not match it,
+    // and any failure below puts them back as they were. The backup is only deleted once the snapshot is in place.
+    NSString *backupPath = [storeDirectory stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.backup", databaseFileName]];
+    [fileManager removeItemAtPath:backupPath error:NULL];
+    [fileManager createDirectoryAtPath:backupPath withIntermediateDirectories:YES attributes:nil error:NULL];
+    
+    NSArray *storePaths = @[ databaseFileName,
+                             [databaseFileName stringByAppendingString:@"-wal"],
+                             [databaseFileName stringByAppendingString:@"-shm"],
+                             ChessSnapshotSupportDirectoryName(databaseFileName) ];
+    
+    NSMutableArray *backedUpPaths = [NSMutableArray arrayWithCapacity:[storePaths count]];
+    NSMutableArray *replacedPaths = [NSMutableArray arrayWithCapacity:[storePaths count]];  // backed up, or not there
+    
+    for (NSString *path in storePaths)
+    {
+        NSString *currentPath = [storeDirectory stringByAppendingPathComponent:path];
+        
+        if (rename([currentPath fileSystemRepresentation], [[backupPath stringByAppendingPathComponent:path] fileSystemRepresentation]) == 0)
+        {
+            [backedUpPaths addObject:path];
+        }
+        else if (errno != ENOENT)
+        {
+            error = ChessSnapshotPOSIXError(errno, currentPath);
+            break;
+        }
+        [replacedPaths addObject:path];
+    }
+    
+    // The database file first, then its log and external data.
+    [stagedPaths removeObject:databaseFileName];
+    [stagedPaths insertObject:databaseFileName atIndex:0];
+    
+    for (NSString *path in stagedPaths)
+    {
+        if (error) break;
+        
+        NSString *destinationPath = [storeDirectory stringByAppendingPathComponent:path];
+        
+        [fileManager createDirectoryAtPath:[destinationPath stringByDeletingLastPathComponent]
+               withIntermediateDirectories:YES
+                                attributes:nil
+                                     error:NULL];
+        
+        if (rename([[stagingPath stringByAppendingPathComponent:path] fileSystemRepresentation], [destinationPath fileSystemRepresentation]) != 0)
+        {
+            error = ChessSnapshotPOSIXError(errno, destinationPath);
+        }
+    }
+    
+    [fileManager removeItemAtPath:stagingPath error:NULL];
+    
+    if (error)
+    {
+        // Whatever was installed goes, and the backup comes back.
+        BOOL restored = YES;
+        
+        for (NSString *path in replacedPaths)
+        {
+            [fileManager removeItemAtPath:[storeDirectory stringByAppendingPathComponent:path] error:NULL];
+        }
+        for (NSString *path in backedUpPaths)
+        {
+            NSString *currentPath = [storeDirectory stringByAppendingPathComponent:path];
+            
+            if (rename([[backupPath stringByAppendingPathComponent:path] fileSystemRepresentation], [currentPath fileSystemRepresentation]) != 0)
+            {
+                restored = NO;
+            }
+        }
+        
+        if (!restored)
+        {
+            // Never delete the only copy of the store.
+            NSLog(@"%@: Could not restore the store from its backup, left at %@", [self class], backupPath);
+            
+            if (errorPtr) *errorPtr = error;
+            return NO;
+        }
+    }
+    
+    [fileManager removeItemAtPath:backupPath error:NULL];
+    
+    if (error && errorPtr) *errorPtr = error;
+    
+    return error == nil;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Store Profile
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Free pages handed back to the file system by a single maintenance run, so an idle run stays short.
+#define kChessStoreMaintenanceMaxVacuumPages    512
+
+static int ChessSQLiteInteger(sqlite3 *db, const char *sql)
+{
+    sqlite3_stmt *statement = NULL;
+    int result = 0;
+    
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW)
+    {
+        result = sqlite3_column_int(statement, 0);
+    }
+    
+    sqlite3_finalize(statement);
+    return result;
+}
+
+/**
+ * Creates an empty database file with the page size and auto vacuum mode of the pragmas.
+ * SQLite only honors them before the first table is created and before the switch to write-ahead logging,
+ * and Core Data applies the NSSQLitePragmasOption in no particular order, so on a new store they would be lost
+ * whenever journal_mode comes first. Core Data then creates its tables in the file as in a new store.
+ **/
+static int ChessCreateStoreFile(const char *storePath, NSString *pageSize, NSString *autoVacuum)
+{
+    sqlite3 *db = NULL;
+    int result = sqlite3_open_v2(storePath, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    
+    if (result == SQLITE_OK)
+    {
+        NSMutableString *sql = [NSMutableString string];
+        if (pageSize)
+            [sql appendFormat:@"PRAGMA page_size = %@;", pageSize];
+        if (autoVacuum)
+            [sql appendFormat:@"PRAGMA auto_vacuum = %@;", autoVacuum];
+        
+        // Without any table, only a VACUUM writes the header to the file.
+        [sql appendString:@"VACUUM;"];
+        
+        result = sqlite3_exec(db, [sql UTF8String], NULL, NULL, NULL);
+    }
+    
+    sqlite3_close(db);
+    
+    if (result != SQLITE_OK)
+    {
+        unlink(storePath);
+    }
+    
+    return result;
+}
+
+/**
+ * Runs an incremental vacuum of the store at storePath, then checkpoints and truncates its log,
+ * on a connection of its own. Invoked while the coordinator is locked, so Core Data holds no lock on the database.
+ **/
+static NSDictionary *ChessPerformStoreMaintenance(const char *storePath, int maxVacuumPages)
+{
+    sqlite3 *db = NULL;
+    int result = sqlite3_open_v2(storePath, &db, SQLITE_OPEN_READWRITE, NULL);
+    
+    int logFrames = -1;
+    int checkpointedFrames = -1;
+    int freePages = 0;
+    int freedPages = 0;
+    
+    if (result == SQLITE_OK)
+    {
+        sqlite3_busy_timeout(db, 100);
+        
+        // Reading the free page count also reads the schema, without which the connection does not know about the log.
+        // Only a store with incremental auto vacuum (2) can give free pages back without a full VACUUM.
+        freePages = ChessSQLiteInteger(db, "PRAGMA freelist_count");
+        if (freePages > 0 && ChessSQLiteInteger(db, "PRAGMA auto_vacuum") == 2)
+        {
+            char sql[64];
+            snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%d)", maxVacuumPages);
+            
+            result = sqlite3_exec(db, sql, NULL, NULL, NULL);
+            
+            int remainingPages = ChessSQLiteInteger(db, "PRAGMA freelist_count");
+            freedPages = MAX(freePages - remainingPages, 0);
+            freePages = remainingPages;
+        }
+        
+        // Then the log, vacuum included, goes into the database file.
+        // A passive checkpoint reports the size of the log, the second one truncates it (RESTART before SQLite 3.8.8).
+        // Without a log, both counts are -1.
+        if (result == SQLITE_OK)
+        {
+            result = sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_PASSIVE, &logFrames, &checkpointedFrames);
+        }
+        if (result == SQLITE_OK && logFrames > 0)
+        {
+            result = sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_TRUNCATE, NULL, NULL);
+            if (result == SQLITE_MISUSE)
+            {
+                result = sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_RESTART, NULL, NULL);
+            }
+        }
+    }
+    
+    sqlite3_close(db);
+    
+    return @{ @"logFrames": @(logFrames),
+              @"checkpointedFrames": @(checkpointedFrames),
+              @"freedPages": @(freedPages),
+              @"freePages": @(freePages),
+              @"result": @(result) };
+}
+
+- (ChessStoreProfile)storeProfile
+{
+    __block ChessStoreProfile result = ChessStoreProfileDefault;
+    
+    dispatch_block_t block = ^{
+        result = storeProfile;
+    };
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+    
+    return result;
+}
+
+- (void)setStoreProfile:(ChessStoreProfile)profile
+{
+    dispatch_block_t block = ^{ @autoreleasepool {
+        
+        NSAssert(persistentStoreCoordinator == nil, @"The storeProfile must be set before the persistentStoreCoordinator is created");
+        
+        NSMutableDictionary *pragmas = [NSMutableDictionary dictionaryWithDictionary:storeOptions[NSSQLitePragmasOption]];
+        [pragmas removeObjectsForKeys:[[self storePragmasForProfile:storeProfile] allKeys]];
+        [pragmas addEntriesFromDictionary:[self storePragmasForProfile:profile]];
+        
+        NSMutableDictionary *options = [NSMutableDictionary dictionaryWithDictionary:storeOptions];
+        if ([pragmas count] > 0)
+            options[NSSQLitePragmasOption] = [pragmas copy];
+        else
+            [options removeObjectForKey:NSSQLitePragmasOption];
+        
+        storeOptions = [options copy];
+        storeProfile = profile;
+    }};
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+}
+
+- (void)createStoreFileAtPath:(NSString *)storePath options:(NSDictionary *)theStoreOptions
+{
+    // Invoked on the storageQueue, before the persistent store is added, if there is no database file yet.
+    
+    NSDictionary *pragmas = theStoreOptions[NSSQLitePragmasOption];
+    NSString *pageSize = [pragmas[@"page_size"] description];
+    NSString *autoVacuum = [pragmas[@"auto_vacuum"] description];
+    
+    if (pageSize == nil && autoVacuum == nil)
+    {
+        return;
+    }
+    
+    int result = ChessCreateStoreFile([storePath fileSystemRepresentation], pageSize, autoVacuum);
+    if (result != SQLITE_OK)
+    {
+        NSLog(@"%@: Could not create %@ with page_size %@ and auto_vacuum %@: %s",
+              [self class], storePath, pageSize, autoVacuum, sqlite3_errstr(result));
+    }
+}
+
+- (NSDictionary *)performStoreMaintenance
+{
+    // This is a public method.
+    // It may be invoked on any thread/queue.
+    
+    __block NSDictionary *result = nil;
+    
+    dispatch_block_t block = ^{ @autoreleasepool {
+        
+        if (databaseFileName == nil || persistentStoreCoordinator == nil)
+        {
+            return;
+        }
+        
+        NSString *storePath = [[self persistentStoreDirectory] stringByAppendingPathComponent:databaseFileName];
+        NSTimeInterval start = ChessMonotonicTime();
+        
+        __block NSDictionary *maintenance = nil;
+        ChessPerformWithLockedCoordinator(persistentStoreCoordinator, ^{
+            maintenance = ChessPerformStoreMaintenance([storePath fileSystemRepresentation], kChessStoreMaintenanceMaxVacuumPages);
+        });
+        
+        NSTimeInterval duration = ChessMonotonicTime() - start;
+        
+        maintenanceRuns++;
+        maintenanceTotalTime += duration;
+        maintenanceLastTime = duration;
+        maintenanceCheckpointedFrames += MAX([maintenance[@"checkpointedFrames"] intValue], 0);
+        maintenanceFreedPages += [maintenance[@"freedPages"] unsignedIntegerValue];
+        if ([maintenance[@"result"] intValue] != SQLITE_OK)
+        {
+            maintenanceFailures++;
+        }
+        
+        NSMutableDictionary *mResult = [maintenance mutableCopy];
+        mResult[@"duration"] = @(duration);
+        result = [mResult copy];
+    }};
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+    
+    return result;
+}
+
+- (NSDictionary *)storeMaintenanceStatistics
+{
+    __block NSDictionary *result = nil;
+    
+    dispatch_block_t block = ^{
+        result = @{ @"runs"               : @(maintenanceRuns),
+                    @"checkpointedFrames" : @(maintenanceCheckpointedFrames),
+                    @"freedPages"         : @(maintenanceFreedPages),
+                    @"totalTime"          : @(maintenanceTotalTime),
+                    @"lastTime"           : @(maintenanceLastTime),
+                    @"failures"           : @(maintenanceFailures) };
+    };
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+    
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Targeted Merge
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)registerFetchedResultsController:(NSFetchedResultsController *)controller
+{
+    NSAssert([NSThread isMainThread], @"Invoked on incorrect queue");
+    
+    if (controller) [fetchedResultsControllers addObject:controller];
+    
+    [self.queryAdvisor recordFetchRequest:[controller fetchRequest] duration:0 numberOfResults:0];
+}
+
+- (void)unregisterFetchedResultsController:(NSFetchedResultsController *)controller
+{
+    NSAssert([NSThread isMainThread], @"Invoked on incorrect queue");
+    
+    if (controller) [fetchedResultsControllers removeObject:controller];
+}
+
+- (NSSet *)entityNamesWatchedByFetchedResultsControllers
+{
+    NSMutableSet *entityNames = [NSMutableSet set];
+    
+    for (NSFetchedResultsController *controller in fetchedResultsControllers)
+    {
+        NSEntityDescription *entity = [[controller fetchRequest] entity];
+        if (entity == nil) continue;
+        
+        [entityNames addObject:[entity name]];
+        [entityNames addObjectsFromArray:[[entity subentitiesByName] allKeys]];
+    }
+    
+    return entityNames;
+}
+
+- (void)enqueueMergeChunksForNotification:(NSNotification *)notification
+{
+    NSDictionary *userInfo = [notification userInfo];
+    NSArray *keys = @[ NSInsertedObjectsKey, NSUpdatedObjectsKey, NSDeletedObjectsKey ];
+    
+    NSUInteger total = 0;
+    for (NSString *key in keys)
+    {
+        total += [[userInfo objectForKey:key] count];
+    }
+    
+    NSUInteger chunkSize = MAX(mainThreadMergeChunkSize, 1);
+    
+    if (total <= chunkSize)
+    {
+        ChessMergeChunk *chunk = [[ChessMergeChunk alloc] init];
+        chunk.notification = notification;
+        chunk.lastChunkOfSave = YES;
+        [pendingMergeChunks addObject:chunk];
+    }
+    else
+    {
+        // Split the change set, keeping inserts before updates before deletes.
+        
+        NSMutableDictionary *chunkUserInfo = [NSMutableDictionary dictionary];
+        NSUInteger chunkCount = 0;
+        NSUInteger processed = 0;
+        
+        for (NSString *key in keys)
+        {
+            for (NSManagedObject *object in [userInfo objectForKey:key])
+            {
+                NSMutableSet *objects = chunkUserInfo[key];
+                if (objects == nil)
+                {
+                    objects = [NSMutableSet set];
+                    chunkUserInfo[key] = objects;
+                }
+                [objects addObject:object];
+                
+                chunkCount++;
+                processed++;
+                
+                if (chunkCount == chunkSize || processed == total)
+                {
+                    ChessMergeChunk *chunk = [[ChessMergeChunk alloc] init];
+                    chunk.notification = [NSNotification notificationWithName:[notification name]
+                                                                       object:[notification object]
+                                                                     userInfo:chunkUserInfo];
+                    chunk.lastChunkOfSave = (processed == total);
+                    [pendingMergeChunks addObject:chunk];
+                    
+                    chunkUserInfo = [NSMutableDictionary dictionary];
+                    chunkCount = 0;
+                }
+            }
+        }
+    }
+    
+    if (!isDrainingMergeChunks)
+    {
+        isDrainingMergeChunks = YES;
+        [self drainMergeChunks];
+    }
+}
+
+- (void)drainMergeChunks
+{
+    NSTimeInterval start = ChessMonotonicTime();
+    NSSet *watchedEntityNames = [self entityNamesWatchedByFetchedResultsControllers];
+    
+    while ([pendingMergeChunks count] > 0)
+    { @autoreleasepool {
+        
+        NSTimeInterval chunkStart = ChessMonotonicTime();
+        
+        ChessMergeChunk *chunk = [pendingMergeChunks firstObject];
+        [pendingMergeChunks removeObjectAtIndex:0];
+        
+        // http://stackoverflow.com/questions/3923826/nsfetchedresultscontroller-with-predicate-ignores-changes-merged-from-different
+        // Only fault in what the main thread may actually display.
+        
+        for (NSManagedObject *object in [[chunk.notification userInfo] objectForKey:NSUpdatedObjectsKey])
+        {
+            NSManagedObjectID *objectID = [object objectID];
+            NSManagedObject *registeredObject = [mainThreadManagedObjectContext objectRegisteredForID:objectID];
+            
+            if (registeredObject)
+            {
+                if ([registeredObject isFault])
+                {
+                    [registeredObject willAccessValueForKey:nil];
+                    faultedObjectCount++;
+                }
+            }
+            else if ([watchedEntityNames containsObject:[[objectID entity] name]])
+            {
+                [[mainThreadManagedObjectContext objectWithID:objectID] willAccessValueForKey:nil];
+                faultedObjectCount++;
+            }
+        }
+        
+        [mainThreadManagedObjectContext mergeChangesFromContextDidSaveNotification:chunk.notification];
+        
+        currentMergeTime += ChessMonotonicTime() - chunkStart;
+        
+        if (chunk.lastChunkOfSave)
+        {
+            [self didFinishMergeWithTime:currentMergeTime];
+            currentMergeTime = 0;
+            
+            [self mainThreadManagedObjectContextDidMergeChanges];
+        }
+        
+        if ([pendingMergeChunks count] > 0 && (ChessMonotonicTime() - start) >= mainThreadMergeTimeSlice)
+        {
+            // Give the run loop a chance to handle events and draw, then continue.
+            
+            maxMergeSliceTime = MAX(maxMergeSliceTime, ChessMonotonicTime() - start);
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [self drainMergeChunks];
+            });
+            return;
+        }
+    }}
+    
+    maxMergeSliceTime = MAX(maxMergeSliceTime, ChessMonotonicTime() - start);
+    isDrainingMergeChunks = NO;
+}
+
+- (void)didFinishMergeWithTime:(NSTimeInterval)mergeTime
+{
+    mergeCount++;
+    totalMergeTime += mergeTime;
+    maxMergeTime = MAX(maxMergeTime, mergeTime);
+    lastMergeTime = mergeTime;
+}
+
+- (NSDictionary *)mainThreadMergeStatistics
+{
+    NSAssert([NSThread isMainThread], @"Invoked on incorrect queue");
+    
+    return @{ @"merges"         : @(mergeCount),
+              @"totalTime"      : @(totalMergeTime),
+              @"maxTime"        : @(maxMergeTime),
+              @"maxSliceTime"   : @(maxMergeSliceTime),
+              @"lastTime"       : @(lastMergeTime),
+              @"faultedObjects" : @(faultedObjectCount) };
+}
+
 - (BOOL)autoRemovePreviousDatabaseFile
 {
     __block BOOL result = NO;
@@ -445,7 +2003,7 @@
         result = autoRemovePreviousDatabaseFile;
     }};
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_sync(storageQueue, block);
@@ -459,7 +2017,7 @@
         autoRemovePreviousDatabaseFile = flag;
     };
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_sync(storageQueue, block);
@@ -473,7 +2031,7 @@
         result = autoRecreateDatabaseFile;
     }};
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_sync(storageQueue, block);
@@ -487,7 +2045,7 @@
         autoRecreateDatabaseFile = flag;
     };
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_sync(storageQueue, block);
@@ -501,7 +2059,7 @@
         result = autoAllowExternalBinaryDataStorage;
     }};
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_sync(storageQueue, block);
@@ -515,7 +2073,7 @@
         autoAllowExternalBinaryDataStorage = flag;
     };
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_sync(storageQueue, block);
@@ -43,6 +43,17 @@
  **/
 - (NSDictionary *)defaultStoreOptions;
 
+/**
+ * Override me, if needed, to provide customized behavior.
+ *
+ * Returns the SQLite pragmas applied for the given profile, through NSSQLitePragmasOption (see storeProfile).
+ * Values are strings, e.g. @{ @"journal_mode": @"WAL", @"synchronous": @"NORMAL", @"cache_size": @"-8192" }.
+ * Returns nil for ChessStoreProfileDefault.
+ *
+ * Override to tune a profile further, e.g. with a page_size, which only applies to a new store.
+ **/
+- (NSDictionary *)storePragmasForProfile:(ChessStoreProfile)profile;
+
 /**
  * Override me, if needed, to provide customized behavior.
  *
@@ -0,0 +1,68 @@
+//
+//  ChessDirtyObjectTracker.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/22.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+/**
+ * Immutable snapshot of the unsaved changes of a managedObjectContext.
+ **/
+
+@interface ChessUnsavedChangesStatistics : NSObject
+
+@property (nonatomic, assign, readonly) NSUInteger numberOfInsertedObjects;
+@property (nonatomic, assign, readonly) NSUInteger numberOfUpdatedObjects;
+@property (nonatomic, assign, readonly) NSUInteger numberOfDeletedObjects;
+
+/**
+ * The sum of inserted, updated and deleted objects.
+ **/
+@property (nonatomic, assign, readonly) NSUInteger numberOfUnsavedChanges;
+
+/**
+ * Number of unsaved objects (inserted, updated or deleted) keyed by entity name.
+ **/
+@property (nonatomic, strong, readonly) NSDictionary *numberOfUnsavedChangesByEntityName;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * ChessDirtyObjectTracker keeps incremental counters of the inserted, updated and deleted objects of a context,
+ * fed by NSManagedObjectContextObjectsDidChangeNotification.
+ *
+ * Asking the context for [[moc updatedObjects] count] and friends builds a new set on every call,
+ * whose cost grows with the number of unsaved changes. The counters of this class are O(1) to read,
+ * and cost O(1) per changed object to maintain.
+ *
+ * The tracker is not thread safe.
+ * It must only be used on the queue of the tracked context (the storageQueue).
+ **/
+
+@interface ChessDirtyObjectTracker : NSObject
+
+@property (nonatomic, weak, readonly) NSManagedObjectContext *managedObjectContext;
+
+@property (nonatomic, assign, readonly) NSUInteger numberOfUnsavedChanges;
+
+/**
+ * Starts observing the given context, seeded with its current unsaved changes.
+ * Stops observing the previously tracked context, if any.
+ **/
+- (void)startTrackingManagedObjectContext:(NSManagedObjectContext *)moc;
+
+/**
+ * Forgets all unsaved changes. Invoked after a successful save or a rollback.
+ * Saves of the tracked context are observed automatically.
+ **/
+- (void)reset;
+
+- (ChessUnsavedChangesStatistics *)statistics;
+
+@end
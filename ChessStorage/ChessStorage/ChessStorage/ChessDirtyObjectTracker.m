@@ -0,0 +1,243 @@
+//
+//  ChessDirtyObjectTracker.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/22.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessDirtyObjectTracker.h"
+
+@interface ChessUnsavedChangesStatistics ()
+
+@property (nonatomic, assign, readwrite) NSUInteger numberOfInsertedObjects;
+@property (nonatomic, assign, readwrite) NSUInteger numberOfUpdatedObjects;
+@property (nonatomic, assign, readwrite) NSUInteger numberOfDeletedObjects;
+@property (nonatomic, strong, readwrite) NSDictionary *numberOfUnsavedChangesByEntityName;
+
+@end
+
+@implementation ChessUnsavedChangesStatistics
+
+- (NSUInteger)numberOfUnsavedChanges
+{
+    return self.numberOfInsertedObjects + self.numberOfUpdatedObjects + self.numberOfDeletedObjects;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p inserted=%lu updated=%lu deleted=%lu byEntity=%@>",
+            NSStringFromClass([self class]), self,
+            (unsigned long)self.numberOfInsertedObjects,
+            (unsigned long)self.numberOfUpdatedObjects,
+            (unsigned long)self.numberOfDeletedObjects,
+            self.numberOfUnsavedChangesByEntityName];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessDirtyObjectTracker ()
+{
+    NSMutableSet *insertedObjects;
+    NSMutableSet *updatedObjects;
+    NSMutableSet *deletedObjects;
+
+    NSCountedSet *entityNames;
+}
+
+@property (nonatomic, weak, readwrite) NSManagedObjectContext *managedObjectContext;
+
+@end
+
+@implementation ChessDirtyObjectTracker
+
+@synthesize managedObjectContext;
+
+- (id)init
+{
+    if (self = [super init]) {
+        insertedObjects = [[NSMutableSet alloc] init];
+        updatedObjects = [[NSMutableSet alloc] init];
+        deletedObjects = [[NSMutableSet alloc] init];
+        entityNames = [[NSCountedSet alloc] init];
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+- (void)startTrackingManagedObjectContext:(NSManagedObjectContext *)moc
+{
+    if (managedObjectContext)
+    {
+        [[NSNotificationCenter defaultCenter] removeObserver:self name:nil object:managedObjectContext];
+    }
+
+    self.managedObjectContext = moc;
+    [self reset];
+
+    if (moc == nil)
+    {
+        return;
+    }
+
+    // Seed once with whatever is already pending, this is the only time the sets get materialized.
+
+    for (NSManagedObject *object in [moc insertedObjects])
+        [self objectWasInserted:object];
+    for (NSManagedObject *object in [moc updatedObjects])
+        [self objectWasUpdated:object];
+    for (NSManagedObject *object in [moc deletedObjects])
+        [self objectWasDeleted:object];
+
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(managedObjectContextObjectsDidChange:)
+                                                 name:NSManagedObjectContextObjectsDidChangeNotification
+                                               object:moc];
+
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(managedObjectContextDidSave:)
+                                                 name:NSManagedObjectContextDidSaveNotification
+                                               object:moc];
+}
+
+- (void)reset
+{
+    [insertedObjects removeAllObjects];
+    [updatedObjects removeAllObjects];
+    [deletedObjects removeAllObjects];
+    [entityNames removeAllObjects];
+}
+
+- (NSUInteger)numberOfUnsavedChanges
+{
+    return [insertedObjects count] + [updatedObjects count] + [deletedObjects count];
+}
+
+- (ChessUnsavedChangesStatistics *)statistics
+{
+    NSMutableDictionary *countsByEntityName = [NSMutableDictionary dictionaryWithCapacity:[entityNames count]];
+    for (NSString *entityName in entityNames)
+    {
+        countsByEntityName[entityName] = @([entityNames countForObject:entityName]);
+    }
+
+    ChessUnsavedChangesStatistics *statistics = [[ChessUnsavedChangesStatistics alloc] init];
+    statistics.numberOfInsertedObjects = [insertedObjects count];
+    statistics.numberOfUpdatedObjects = [updatedObjects count];
+    statistics.numberOfDeletedObjects = [deletedObjects count];
+    statistics.numberOfUnsavedChangesByEntityName = countsByEntityName;
+
+    return statistics;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Bookkeeping
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)objectWasInserted:(NSManagedObject *)object
+{
+    if ([deletedObjects containsObject:object])
+    {
+        // Undeleted: the object exists in the store, so it is now merely updated.
+        [deletedObjects removeObject:object];
+        [updatedObjects addObject:object];
+        return;
+    }
+
+    if (![insertedObjects containsObject:object])
+    {
+        [insertedObjects addObject:object];
+        [entityNames addObject:[[object entity] name]];
+    }
+}
+
+- (void)objectWasUpdated:(NSManagedObject *)object
+{
+    if ([insertedObjects containsObject:object] || [deletedObjects containsObject:object])
+    {
+        return;
+    }
+
+    if (![updatedObjects containsObject:object])
+    {
+        [updatedObjects addObject:object];
+        [entityNames addObject:[[object entity] name]];
+    }
+}
+
+- (void)objectWasDeleted:(NSManagedObject *)object
+{
+    if ([insertedObjects containsObject:object])
+    {
+        // Inserted and deleted before any save: the object simply vanishes.
+        [insertedObjects removeObject:object];
+        [entityNames removeObject:[[object entity] name]];
+        return;
+    }
+
+    if ([deletedObjects containsObject:object])
+    {
+        return;
+    }
+
+    if ([updatedObjects containsObject:object])
+        [updatedObjects removeObject:object];
+    else
+        [entityNames addObject:[[object entity] name]];
+
+    [deletedObjects addObject:object];
+}
+
+- (void)objectWasDiscarded:(NSManagedObject *)object
+{
+    if ([object hasChanges])
+    {
+        return;
+    }
+
+    if ([updatedObjects containsObject:object])
+    {
+        [updatedObjects removeObject:object];
+        [entityNames removeObject:[[object entity] name]];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Notifications
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)managedObjectContextObjectsDidChange:(NSNotification *)notification
+{
+    NSDictionary *userInfo = [notification userInfo];
+
+    if ([userInfo objectForKey:NSInvalidatedAllObjectsKey])
+    {
+        [self reset];
+        return;
+    }
+
+    for (NSManagedObject *object in [userInfo objectForKey:NSInsertedObjectsKey])
+        [self objectWasInserted:object];
+    for (NSManagedObject *object in [userInfo objectForKey:NSUpdatedObjectsKey])
+        [self objectWasUpdated:object];
+    for (NSManagedObject *object in [userInfo objectForKey:NSDeletedObjectsKey])
+        [self objectWasDeleted:object];
+    for (NSManagedObject *object in [userInfo objectForKey:NSRefreshedObjectsKey])
+        [self objectWasDiscarded:object];
+    for (NSManagedObject *object in [userInfo objectForKey:NSInvalidatedObjectsKey])
+        [self objectWasDiscarded:object];
+}
+
+- (void)managedObjectContextDidSave:(NSNotification *)notification
+{
+    [self reset];
+}
+
+@end
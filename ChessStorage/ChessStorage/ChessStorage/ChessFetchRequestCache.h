@@ -0,0 +1,69 @@
+//
+//  ChessFetchRequestCache.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/25.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+/**
+ * The parsed, reusable parts of a fetch request shape.
+ * All of them are immutable, and may be shared between fetch requests.
+ **/
+
+@interface ChessFetchTemplate : NSObject
+
+@property (nonatomic, strong, readonly) NSEntityDescription *entity;
+
+/**
+ * The predicate parsed from the criteria string, with its $variables left unbound.
+ * Bind them with predicateWithSubstitutionVariables:.
+ **/
+@property (nonatomic, strong, readonly) NSPredicate *predicateTemplate;
+
+@property (nonatomic, strong, readonly) NSArray *sortDescriptors;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * ChessFetchRequestCache keeps the most recently used fetch templates,
+ * keyed by (entity name, criteria, sort keys, ascending).
+ *
+ * Parsing a criteria string with predicateWithFormat:, splitting the sort keys
+ * and resolving the entity description is much more expensive than binding variables to a parsed predicate.
+ * Apps tend to run the same few query shapes over and over, so those are parsed once.
+ *
+ * Entity descriptions are resolved against the context handed to the first lookup of a shape.
+ * So use one cache per kind of context (private, main thread, ...).
+ *
+ * ChessFetchRequestCache is thread safe.
+ **/
+
+@interface ChessFetchRequestCache : NSObject
+
+- (id)initWithCapacity:(NSUInteger)capacity;
+
+@property (atomic, assign) NSUInteger capacity;
+
+@property (atomic, assign, readonly) NSUInteger count;
+@property (atomic, assign, readonly) uint64_t hits;
+@property (atomic, assign, readonly) uint64_t misses;
+
+/**
+ * Returns the cached template for the given shape, parsing it on a miss.
+ * Returns nil if the entity does not exist in the model of the context.
+ **/
+- (ChessFetchTemplate *)templateForEntityName:(NSString *)entityName
+                                     criteria:(NSString *)criteria
+                                       sortBy:(NSString *)sortKeys
+                                    ascending:(BOOL)isAscending
+                       inManagedObjectContext:(NSManagedObjectContext *)moc;
+
+- (void)removeAllTemplates;
+
+@end
@@ -0,0 +1,131 @@
+//
+//  ChessFetchRequestCache.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/25.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessFetchRequestCache.h"
+#import "ChessLRUCache.h"
+
+@interface ChessFetchTemplate ()
+
+@property (nonatomic, strong, readwrite) NSEntityDescription *entity;
+@property (nonatomic, strong, readwrite) NSPredicate *predicateTemplate;
+@property (nonatomic, strong, readwrite) NSArray *sortDescriptors;
+
+@end
+
+@implementation ChessFetchTemplate
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessFetchRequestCache ()
+{
+    ChessLRUCache *templates;
+}
+
+@end
+
+@implementation ChessFetchRequestCache
+
+- (id)init
+{
+    return [self initWithCapacity:64];
+}
+
+- (id)initWithCapacity:(NSUInteger)capacity
+{
+    if (self = [super init]) {
+        templates = [[ChessLRUCache alloc] initWithCapacity:capacity];
+    }
+
+    return self;
+}
+
+- (NSUInteger)capacity
+{
+    return templates.capacity;
+}
+
+- (void)setCapacity:(NSUInteger)capacity
+{
+    templates.capacity = capacity;
+}
+
+- (NSUInteger)count
+{
+    return templates.count;
+}
+
+- (uint64_t)hits
+{
+    return templates.hits;
+}
+
+- (uint64_t)misses
+{
+    return templates.misses;
+}
+
+- (ChessFetchTemplate *)templateForEntityName:(NSString *)entityName
+                                     criteria:(NSString *)criteria
+                                       sortBy:(NSString *)sortKeys
+                                    ascending:(BOOL)isAscending
+                       inManagedObjectContext:(NSManagedObjectContext *)moc
+{
+    if (entityName == nil)
+    {
+        return nil;
+    }
+
+    // The unit separator cannot appear in entity names, and is very unlikely in criteria or sort keys.
+    NSString *key = [NSString stringWithFormat:@"%@\x1f%@\x1f%@\x1f%d",
+                     entityName, criteria ?: @"", sortKeys ?: @"", isAscending ? 1 : 0];
+
+    ChessFetchTemplate *template = [templates objectForKey:key];
+    if (template)
+    {
+        return template;
+    }
+
+    NSEntityDescription *entity = [NSEntityDescription entityForName:entityName inManagedObjectContext:moc];
+    if (entity == nil)
+    {
+        return nil;
+    }
+
+    template = [[ChessFetchTemplate alloc] init];
+    template.entity = entity;
+
+    if (criteria && [criteria length] > 0)
+    {
+        template.predicateTemplate = [NSPredicate predicateWithFormat:criteria];
+    }
+
+    // sort results by keys which separeted by character ' , '
+    if (sortKeys && [sortKeys length] > 0)
+    {
+        NSArray *keys = [sortKeys componentsSeparatedByString:@","];
+        NSMutableArray *sortDescriptorArray = [NSMutableArray arrayWithCapacity:[keys count]];
+        for (NSString *sortKey in keys)
+        {
+            [sortDescriptorArray addObject:[NSSortDescriptor sortDescriptorWithKey:sortKey ascending:isAscending]];
+        }
+        template.sortDescriptors = [sortDescriptorArray copy];
+    }
+
+    [templates setObject:template forKey:key];
+
+    return template;
+}
+
+- (void)removeAllTemplates
+{
+    [templates removeAllObjects];
+}
+
+@end
@@ -0,0 +1,123 @@
+//
+//  ChessHistogram.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/8/2.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessHistogram.h"
+
+#include <string.h>
+
+#define CHESS_HISTOGRAM_MAX_VALUE ((UINT64_C(1) << CHESS_HISTOGRAM_MAX_BITS) - 1)
+
+static inline unsigned chess_histogram_bucket_index(uint64_t value)
+{
+    if (value < CHESS_HISTOGRAM_SUB_BUCKETS)
+    {
+        return (unsigned)value;
+    }
+    
+    unsigned msb = 63 - (unsigned)__builtin_clzll(value);
+    unsigned shift = msb - CHESS_HISTOGRAM_SUB_BUCKET_BITS;
+    unsigned subBucket = (unsigned)(value >> shift) & (CHESS_HISTOGRAM_SUB_BUCKETS - 1);
+    
+    return (shift + 1) * CHESS_HISTOGRAM_SUB_BUCKETS + subBucket;
+}
+
+static inline uint64_t chess_histogram_bucket_upper_bound(unsigned index)
+{
+    if (index < CHESS_HISTOGRAM_SUB_BUCKETS)
+    {
+        return index;
+    }
+    
+    unsigned shift = index / CHESS_HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t subBucket = index % CHESS_HISTOGRAM_SUB_BUCKETS;
+    uint64_t lower = (CHESS_HISTOGRAM_SUB_BUCKETS + subBucket) << shift;
+    
+    return lower + (UINT64_C(1) << shift) - 1;
+}
+
+void chess_histogram_reset(ChessHistogram *histogram)
+{
+    memset(histogram, 0, sizeof(ChessHistogram));
+}
+
+void chess_histogram_record(ChessHistogram *histogram, uint64_t value)
+{
+    if (value > CHESS_HISTOGRAM_MAX_VALUE)
+    {
+        value = CHESS_HISTOGRAM_MAX_VALUE;
+    }
+    
+    histogram->counts[chess_histogram_bucket_index(value)]++;
+    
+    if (histogram->count == 0 || value < histogram->min)
+        histogram->min = value;
+    if (value > histogram->max)
+        histogram->max = value;
+    
+    histogram->count++;
+    histogram->sum += (double)value;
+}
+
+void chess_histogram_merge(ChessHistogram *destination, const ChessHistogram *source)
+{
+    if (source->count == 0)
+    {
+        return;
+    }
+    
+    for (unsigned i = 0; i < CHESS_HISTOGRAM_BUCKETS; i++)
+    {
+        destination->counts[i] += source->counts[i];
+    }
+    
+    if (destination->count == 0 || source->min < destination->min)
+        destination->min = source->min;
+    if (source->max > destination->max)
+        destination->max = source->max;
+    
+    destination->count += source->count;
+    destination->sum += source->sum;
+}
+
+uint64_t chess_histogram_percentile(const ChessHistogram *histogram, double percentile)
+{
+    if (histogram->count == 0)
+    {
+        return 0;
+    }
+    
+    if (percentile < 0) percentile = 0;
+    if (percentile > 100) percentile = 100;
+    
+    uint64_t rank = (uint64_t)((percentile / 100.0) * (double)histogram->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > histogram->count) rank = histogram->count;
+    
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < CHESS_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t upper = chess_histogram_bucket_upper_bound(i);
+            return (upper < histogram->max) ? upper : histogram->max;
+        }
+    }
+    
+    return histogram->max;
+}
+
+double chess_histogram_mean(const ChessHistogram *histogram)
+{
+    if (histogram->count == 0)
+    {
+        return 0;
+    }
+    
+    return histogram->sum / (double)histogram->count;
+}
@@ -0,0 +1,62 @@
+//
+//  ChessHistogram.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/8/2.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#ifndef ChessHistogram_h
+#define ChessHistogram_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A fixed-size log-linear histogram of unsigned integer values.
+ *
+ * Each power of two is split in 16 linear sub-buckets, so any recorded value
+ * is reported with a relative error below 1/16 (values below 16 are exact).
+ * Values are clamped to 2^40 - 1 (about 12 days when recording microseconds).
+ *
+ * Recording is O(1) and never allocates. The histogram is not thread safe.
+ **/
+
+#define CHESS_HISTOGRAM_SUB_BUCKET_BITS 4
+#define CHESS_HISTOGRAM_SUB_BUCKETS     (1 << CHESS_HISTOGRAM_SUB_BUCKET_BITS)
+#define CHESS_HISTOGRAM_MAX_BITS        40
+#define CHESS_HISTOGRAM_BUCKETS         ((CHESS_HISTOGRAM_MAX_BITS - CHESS_HISTOGRAM_SUB_BUCKET_BITS + 1) * CHESS_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct ChessHistogram {
+    uint64_t counts[CHESS_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+} ChessHistogram;
+
+void chess_histogram_reset(ChessHistogram *histogram);
+
+void chess_histogram_record(ChessHistogram *histogram, uint64_t value);
+
+/**
+ * Adds all values of source to destination.
+ **/
+void chess_histogram_merge(ChessHistogram *destination, const ChessHistogram *source);
+
+/**
+ * Returns the value below which the given percentage (0 - 100) of the recorded values fall,
+ * reported as the upper bound of its bucket. Returns 0 for an empty histogram.
+ **/
+uint64_t chess_histogram_percentile(const ChessHistogram *histogram, double percentile);
+
+double chess_histogram_mean(const ChessHistogram *histogram);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ChessHistogram_h */
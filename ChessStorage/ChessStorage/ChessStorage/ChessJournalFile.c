@@ -0,0 +1,526 @@
+//
+//  ChessJournalFile.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/5.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessJournalFile.h"
+#include "ChessCRC32.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHESS_JOURNAL_FILE_MAGIC            "CHJ1"
+#define CHESS_JOURNAL_FILE_VERSION          1
+#define CHESS_JOURNAL_FILE_HEADER_SIZE      64
+#define CHESS_JOURNAL_FILE_RECORD_HEADER    16
+#define CHESS_JOURNAL_FILE_END_MARKER       16
+
+// The file starts at 1 MiB and doubles as needed.
+// The whole address range is mapped once, so the mapping never moves and syncs need no lock.
+#define CHESS_JOURNAL_FILE_INITIAL_SIZE     (1 << 20)
+#define CHESS_JOURNAL_FILE_MAX_SIZE         (64 << 20)
+
+typedef struct ChessJournalFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t base_lsn;
+    uint64_t checkpoint_lsn;
+    uint32_t crc;           // of the fields above
+    uint8_t reserved[36];
+} ChessJournalFileHeader;
+
+typedef struct ChessJournalFileRecordHeader {
+    uint32_t length;
+    uint32_t crc;           // of lsn and the payload
+    uint64_t lsn;
+} ChessJournalFileRecordHeader;
+
+_Static_assert(sizeof(ChessJournalFileHeader) == CHESS_JOURNAL_FILE_HEADER_SIZE, "journal header layout");
+_Static_assert(sizeof(ChessJournalFileRecordHeader) == CHESS_JOURNAL_FILE_RECORD_HEADER, "journal record layout");
+
+struct ChessJournalFile {
+    pthread_mutex_t lock;       // everything below
+    pthread_mutex_t sync_lock;  // serializes syncs
+
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    size_t capacity;            // size of the file
+    size_t used;                // end of the last record
+    size_t synced;              // end of the range covered by the last sync
+    uint64_t generation;        // incremented whenever the journal starts over
+
+    uint64_t base_lsn;
+    uint64_t last_lsn;
+    uint64_t checkpoint_lsn;
+    uint64_t durable_lsn;
+};
+
+static inline size_t chess_journal_file_record_size(uint32_t length)
+{
+    return (CHESS_JOURNAL_FILE_RECORD_HEADER + (size_t)length + 7) & ~(size_t)7;
+}
+
+static uint32_t chess_journal_file_record_crc(uint64_t lsn, const void *payload, uint32_t length)
+{
+    uint32_t crc = chess_crc32(0, &lsn, sizeof(lsn));
+    return chess_crc32(crc, payload, length);
+}
+
+static void chess_journal_file_write_header(ChessJournalFile *journal)
+{
+    ChessJournalFileHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, CHESS_JOURNAL_FILE_MAGIC, 4);
+    header.version = CHESS_JOURNAL_FILE_VERSION;
+    header.base_lsn = journal->base_lsn;
+    header.checkpoint_lsn = journal->checkpoint_lsn;
+    header.crc = chess_crc32(0, &header, offsetof(ChessJournalFileHeader, crc));
+
+    memcpy(journal->map, &header, sizeof(header));
+}
+
+/**
+ * Returns the size of the valid record at offset, or 0 if there is none.
+ **/
+static size_t chess_journal_file_record_at(ChessJournalFile *journal, size_t offset, uint64_t expected_lsn,
+                                           const void **payload_out, uint32_t *length_out)
+{
+    if (offset + CHESS_JOURNAL_FILE_RECORD_HEADER > journal->capacity)
+    {
+        return 0;
+    }
+
+    ChessJournalFileRecordHeader header;
+    memcpy(&header, journal->map + offset, sizeof(header));
+
+    if (header.lsn != expected_lsn)
+    {
+        return 0;
+    }
+
+    size_t size = chess_journal_file_record_size(header.length);
+    if (size > journal->capacity - offset)
+    {
+        return 0;
+    }
+
+    const void *payload = journal->map + offset + CHESS_JOURNAL_FILE_RECORD_HEADER;
+    if (chess_journal_file_record_crc(header.lsn, payload, header.length) != header.crc)
+    {
+        return 0;
+    }
+
+    if (payload_out) *payload_out = payload;
+    if (length_out) *length_out = header.length;
+
+    return size;
+}
+
+static void chess_journal_file_write_end_marker(ChessJournalFile *journal)
+{
+    size_t length = journal->capacity - journal->used;
+    if (length > CHESS_JOURNAL_FILE_END_MARKER)
+    {
+        length = CHESS_JOURNAL_FILE_END_MARKER;
+    }
+
+    memset(journal->map + journal->used, 0, length);
+}
+
+static void chess_journal_file_free(ChessJournalFile *journal)
+{
+    if (journal->map && journal->map != MAP_FAILED)
+    {
+        munmap(journal->map, journal->map_size);
+    }
+    if (journal->fd >= 0)
+    {
+        close(journal->fd);
+    }
+
+    pthread_mutex_destroy(&journal->lock);
+    pthread_mutex_destroy(&journal->sync_lock);
+    free(journal);
+}
+
+int chess_journal_file_open(const char *path, ChessJournalFile **journal_out)
+{
+    ChessJournalFile *journal = calloc(1, sizeof(ChessJournalFile));
+    if (journal == NULL)
+    {
+        return ENOMEM;
+    }
+
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_mutex_init(&journal->sync_lock, NULL);
+
+    journal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (journal->fd < 0)
+    {
+        int error = errno;
+        chess_journal_file_free(journal);
+        return error;
+    }
+
+    struct stat info;
+    if (fstat(journal->fd, &info) != 0)
+    {
+        int error = errno;
+        chess_journal_file_free(journal);
+        return error;
+    }
+
+    int created = (info.st_size == 0);
+    if (created)
+    {
+        if (ftruncate(journal->fd, CHESS_JOURNAL_FILE_INITIAL_SIZE) != 0)
+        {
+            int error = errno;
+            chess_journal_file_free(journal);
+            return error;
+        }
+        info.st_size = CHESS_JOURNAL_FILE_INITIAL_SIZE;
+    }
+    else if (info.st_size < CHESS_JOURNAL_FILE_HEADER_SIZE)
+    {
+        chess_journal_file_free(journal);
+        return EINVAL;
+    }
+
+    journal->capacity = (size_t)info.st_size;
+    journal->map_size = journal->capacity > CHESS_JOURNAL_FILE_MAX_SIZE ? journal->capacity : CHESS_JOURNAL_FILE_MAX_SIZE;
+    journal->map = mmap(NULL, journal->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+    if (journal->map == MAP_FAILED)
+    {
+        int error = errno;
+        chess_journal_file_free(journal);
+        return error;
+    }
+
+    if (created)
+    {
+        journal->base_lsn = 1;
+        journal->checkpoint_lsn = 0;
+        chess_journal_file_write_header(journal);
+    }
+    else
+    {
+        ChessJournalFileHeader header;
+        memcpy(&header, journal->map, sizeof(header));
+
+        if (memcmp(header.magic, CHESS_JOURNAL_FILE_MAGIC, 4) != 0 ||
+            header.version != CHESS_JOURNAL_FILE_VERSION ||
+            header.crc != chess_crc32(0, &header, offsetof(ChessJournalFileHeader, crc)) ||
+            header.base_lsn == 0)
+        {
+            chess_journal_file_free(journal);
+            return EINVAL;
+        }
+
+        journal->base_lsn = header.base_lsn;
+        journal->checkpoint_lsn = header.checkpoint_lsn;
+    }
+
+    // Find the end of the valid records. Whatever follows is a torn tail, or a leftover of a previous generation.
+    size_t offset = CHESS_JOURNAL_FILE_HEADER_SIZE;
+    uint64_t lsn = journal->base_lsn;
+    size_t size;
+
+    while ((size = chess_journal_file_record_at(journal, offset, lsn, NULL, NULL)) > 0)
+    {
+        offset += size;
+        lsn++;
+    }
+
+    journal->used = offset;
+    journal->synced = offset;
+    journal->last_lsn = lsn - 1;
+    journal->durable_lsn = journal->last_lsn;
+
+    chess_journal_file_write_end_marker(journal);
+
+    *journal_out = journal;
+    return 0;
+}
+
+void chess_journal_file_close(ChessJournalFile *journal)
+{
+    if (journal == NULL) return;
+
+    msync(journal->map, journal->capacity, MS_ASYNC);
+    chess_journal_file_free(journal);
+}
+
+static int chess_journal_file_grow(ChessJournalFile *journal, size_t needed)
+{
+    size_t capacity = journal->capacity;
+    while (capacity < needed)
+    {
+        capacity *= 2;
+    }
+
+    if (capacity > journal->map_size)
+    {
+        return ENOSPC;
+    }
+
+    if (ftruncate(journal->fd, (off_t)capacity) != 0)
+    {
+        return errno;
+    }
+
+    journal->capacity = capacity;
+    return 0;
+}
+
+int chess_journal_file_append(ChessJournalFile *journal, const void *payload, uint32_t length, uint64_t *lsn_out)
+{
+    size_t size = chess_journal_file_record_size(length);
+
+    pthread_mutex_lock(&journal->lock);
+
+    size_t needed = journal->used + size + CHESS_JOURNAL_FILE_END_MARKER;
+    if (needed > journal->capacity)
+    {
+        int error = chess_journal_file_grow(journal, needed);
+        if (error != 0)
+        {
+            pthread_mutex_unlock(&journal->lock);
+            return error;
+        }
+    }
+
+    ChessJournalFileRecordHeader header;
+    header.length = length;
+    header.lsn = journal->last_lsn + 1;
+    header.crc = chess_journal_file_record_crc(header.lsn, payload, length);
+
+    uint8_t *record = journal->map + journal->used;
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + CHESS_JOURNAL_FILE_RECORD_HEADER, payload, length);
+    memset(record + CHESS_JOURNAL_FILE_RECORD_HEADER + length, 0, size - CHESS_JOURNAL_FILE_RECORD_HEADER - length);
+
+    journal->used += size;
+    journal->last_lsn = header.lsn;
+    chess_journal_file_write_end_marker(journal);
+
+    pthread_mutex_unlock(&journal->lock);
+
+    if (lsn_out) *lsn_out = header.lsn;
+    return 0;
+}
+
+int chess_journal_file_sync(ChessJournalFile *journal, uint64_t *durable_lsn_out)
+{
+    pthread_mutex_lock(&journal->sync_lock);
+
+    pthread_mutex_lock(&journal->lock);
+
+    uint64_t lsn = journal->last_lsn;
+    uint64_t generation = journal->generation;
+    size_t page = (size_t)getpagesize();
+    size_t start = (journal->synced / page) * page;
+    size_t end = journal->used + CHESS_JOURNAL_FILE_END_MARKER;
+    if (end > journal->capacity) end = journal->capacity;
+
+    pthread_mutex_unlock(&journal->lock);
+
+    // The header lives in the first page, which is always synced along with the records.
+    int error = 0;
+    if (start > 0 && msync(journal->map, page, MS_SYNC) != 0)
+    {
+        error = errno;
+    }
+    if (error == 0 && end > start && msync(journal->map + start, end - start, MS_SYNC) != 0)
+    {
+        error = errno;
+    }
+    if (error == 0 && fsync(journal->fd) != 0)
+    {
+        error = errno;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+
+    if (error == 0)
+    {
+        if (lsn > journal->durable_lsn)
+        {
+            journal->durable_lsn = lsn;
+        }
+        if (generation == journal->generation)
+        {
+            journal->synced = end;
+        }
+    }
+
+    if (durable_lsn_out) *durable_lsn_out = journal->durable_lsn;
+
+    pthread_mutex_unlock(&journal->lock);
+    pthread_mutex_unlock(&journal->sync_lock);
+
+    return error;
+}
+
+int chess_journal_file_replay(ChessJournalFile *journal, ChessJournalFileReplayFunction function, void *context, uint64_t *count_out)
+{
+    uint64_t count = 0;
+    void *buffer = NULL;
+    size_t buffer_size = 0;
+    int error = 0;
+
+    pthread_mutex_lock(&journal->lock);
+
+    size_t offset = CHESS_JOURNAL_FILE_HEADER_SIZE;
+    uint64_t lsn = journal->base_lsn;
+    uint64_t generation = journal->generation;
+
+    // The function is invoked without the lock, with a copy of the payload,
+    // so it may append or checkpoint (e.g. by saving) along the way.
+    while (lsn <= journal->last_lsn && generation == journal->generation)
+    {
+        const void *payload = NULL;
+        uint32_t length = 0;
+
+        size_t size = chess_journal_file_record_at(journal, offset, lsn, &payload, &length);
+        if (size == 0)
+        {
+            break;
+        }
+
+        if (lsn > journal->checkpoint_lsn)
+        {
+            if (length > buffer_size)
+            {
+                void *larger = realloc(buffer, length);
+                if (larger == NULL)
+                {
+                    error = ENOMEM;
+                    break;
+                }
+                buffer = larger;
+                buffer_size = length;
+            }
+            if (length > 0) memcpy(buffer, payload, length);
+
+            pthread_mutex_unlock(&journal->lock);
+
+            count++;
+            int stop = function(context, lsn, buffer, length);
+
+            pthread_mutex_lock(&journal->lock);
+
+            if (stop != 0)
+            {
+                break;
+            }
+        }
+
+        offset += size;
+        lsn++;
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+
+    free(buffer);
+
+    if (count_out) *count_out = count;
+    return error;
+}
+
+int chess_journal_file_checkpoint(ChessJournalFile *journal, uint64_t lsn)
+{
+    pthread_mutex_lock(&journal->lock);
+
+    if (lsn > journal->last_lsn)
+    {
+        lsn = journal->last_lsn;
+    }
+
+    if (lsn <= journal->checkpoint_lsn)
+    {
+        pthread_mutex_unlock(&journal->lock);
+        return 0;
+    }
+
+    journal->checkpoint_lsn = lsn;
+
+    if (lsn == journal->last_lsn)
+    {
+        // Every record has been applied: start over at the beginning of the file.
+        // The header and the new end marker share the first page, so they reach the disk together.
+        journal->base_lsn = lsn + 1;
+        journal->used = CHESS_JOURNAL_FILE_HEADER_SIZE;
+        journal->synced = 0;
+        journal->generation++;
+        chess_journal_file_write_end_marker(journal);
+    }
+
+    chess_journal_file_write_header(journal);
+
+    int error = 0;
+    if (msync(journal->map, (size_t)getpagesize(), MS_ASYNC) != 0)
+    {
+        error = errno;
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+
+    return error;
+}
+
+uint64_t chess_journal_file_last_lsn(ChessJournalFile *journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    uint64_t lsn = journal->last_lsn;
+    pthread_mutex_unlock(&journal->lock);
+
+    return lsn;
+}
+
+uint64_t chess_journal_file_durable_lsn(ChessJournalFile *journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    uint64_t lsn = journal->durable_lsn;
+    pthread_mutex_unlock(&journal->lock);
+
+    return lsn;
+}
+
+uint64_t chess_journal_file_checkpoint_lsn(ChessJournalFile *journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    uint64_t lsn = journal->checkpoint_lsn;
+    pthread_mutex_unlock(&journal->lock);
+
+    return lsn;
+}
+
+size_t chess_journal_file_used_size(ChessJournalFile *journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    size_t size = journal->used;
+    pthread_mutex_unlock(&journal->lock);
+
+    return size;
+}
+
+size_t chess_journal_file_capacity(ChessJournalFile *journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    size_t size = journal->capacity;
+    pthread_mutex_unlock(&journal->lock);
+
+    return size;
+}
@@ -0,0 +1,108 @@
+//
+//  ChessJournalFile.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/5.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#ifndef ChessJournalFile_h
+#define ChessJournalFile_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An append-only, memory mapped journal of opaque records.
+ * Plain C and POSIX, so it builds and runs anywhere: the format and the replay are tested off device by ChessStorageTests/ChessJournalFileTests.c (make test).
+ *
+ * File layout (little endian, as on every supported CPU):
+ *
+ *   header   64 bytes : magic "CHJ1", version, base LSN, checkpoint LSN, CRC-32 of the preceding fields
+ *   record            : payload length (uint32), CRC-32 of LSN + payload (uint32), LSN (uint64), payload,
+ *                       padded to a multiple of 8 bytes
+ *   end marker        : 16 zero bytes after the last record
+ *
+ * Every record gets the next log sequence number (LSN). The first record of the file has the base LSN.
+ * Reading stops at the first record that is torn (bad CRC, or beyond the end of the file)
+ * or out of sequence (e.g. a leftover of a previous generation), so a crash only ever loses the tail
+ * that was not synced yet.
+ *
+ * Appending copies the record into the mapping, which costs a memcpy. Nothing is durable until
+ * chess_journal_file_sync, which flushes everything appended so far with a single fsync (group commit).
+ *
+ * Once the records have been applied elsewhere (e.g. saved to the store), chess_journal_file_checkpoint
+ * marks them as done. When every record is done, the journal starts over at the beginning of the file,
+ * which is kept at its size to avoid growing it again.
+ *
+ * All functions are thread safe. Functions returning int return 0, or an errno value on failure.
+ **/
+
+typedef struct ChessJournalFile ChessJournalFile;
+
+/**
+ * Invoked for every record to replay. Return non-zero to stop.
+ **/
+typedef int (*ChessJournalFileReplayFunction)(void *context, uint64_t lsn, const void *payload, uint32_t length);
+
+/**
+ * Opens the journal at path, creating it if needed.
+ * An existing file is scanned, so appends continue after its last valid record.
+ * Returns EINVAL if the file is not a journal (or its header is corrupt).
+ **/
+int chess_journal_file_open(const char *path, ChessJournalFile **journal_out);
+
+/**
+ * Unmaps and closes the journal. Records that were not synced are flushed on a best effort basis only.
+ **/
+void chess_journal_file_close(ChessJournalFile *journal);
+
+/**
+ * Appends a record, growing the file if needed, and returns its LSN in lsn_out (may be NULL).
+ **/
+int chess_journal_file_append(ChessJournalFile *journal, const void *payload, uint32_t length, uint64_t *lsn_out);
+
+/**
+ * Makes every record appended so far durable (msync + fsync).
+ * Returns the LSN of the last durable record in durable_lsn_out (may be NULL).
+ * Appends from other threads proceed while the fsync is in progress.
+ **/
+int chess_journal_file_sync(ChessJournalFile *journal, uint64_t *durable_lsn_out);
+
+/**
+ * Invokes function for every valid record after the checkpoint, in LSN order.
+ * The function gets a copy of the payload, and is invoked without any lock held, so it may append or checkpoint.
+ * The replay stops if the journal starts over meanwhile (i.e. once a checkpoint covers every record).
+ * Returns the number of records replayed in count_out (may be NULL).
+ **/
+int chess_journal_file_replay(ChessJournalFile *journal, ChessJournalFileReplayFunction function, void *context, uint64_t *count_out);
+
+/**
+ * Marks every record up to and including lsn as applied.
+ * If that is every record, the journal is truncated: the next record is appended at the beginning again.
+ **/
+int chess_journal_file_checkpoint(ChessJournalFile *journal, uint64_t lsn);
+
+/**
+ * The LSN of the last appended record, of the last durable record, and of the checkpoint.
+ * 0 if there is none.
+ **/
+uint64_t chess_journal_file_last_lsn(ChessJournalFile *journal);
+uint64_t chess_journal_file_durable_lsn(ChessJournalFile *journal);
+uint64_t chess_journal_file_checkpoint_lsn(ChessJournalFile *journal);
+
+/**
+ * The number of bytes in use (header and records), and the size of the file.
+ **/
+size_t chess_journal_file_used_size(ChessJournalFile *journal);
+size_t chess_journal_file_capacity(ChessJournalFile *journal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ChessJournalFile_h */
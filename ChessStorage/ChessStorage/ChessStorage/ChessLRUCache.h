@@ -0,0 +1,46 @@
+//
+//  ChessLRUCache.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/25.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * A bounded key/value cache with least-recently-used eviction.
+ *
+ * Lookups, insertions and evictions are O(1).
+ * ChessLRUCache is thread safe.
+ **/
+
+@interface ChessLRUCache : NSObject
+
+- (id)initWithCapacity:(NSUInteger)capacity;
+
+/**
+ * The maximum number of entries. Lowering it evicts the least recently used entries.
+ **/
+@property (atomic, assign) NSUInteger capacity;
+
+@property (atomic, assign, readonly) NSUInteger count;
+
+/**
+ * The number of objectForKey: calls that found, or did not find, an entry.
+ **/
+@property (atomic, assign, readonly) uint64_t hits;
+@property (atomic, assign, readonly) uint64_t misses;
+
+/**
+ * Returns the cached object, and marks it as the most recently used.
+ **/
+- (id)objectForKey:(id<NSCopying>)key;
+
+- (void)setObject:(id)object forKey:(id<NSCopying>)key;
+
+- (void)removeObjectForKey:(id<NSCopying>)key;
+
+- (void)removeAllObjects;
+
+@end
@@ -0,0 +1,253 @@
+//
+//  ChessLRUCache.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/25.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessLRUCache.h"
+#import <pthread.h>
+
+@interface ChessLRUCacheNode : NSObject
+{
+@public
+    id key;
+    id object;
+
+    ChessLRUCacheNode *next;                    // towards the least recently used
+    __unsafe_unretained ChessLRUCacheNode *prev; // towards the most recently used
+}
+
+@end
+
+@implementation ChessLRUCacheNode
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessLRUCache ()
+{
+    pthread_mutex_t lock;
+
+    NSMutableDictionary *nodesByKey;
+    ChessLRUCacheNode *head;
+    __unsafe_unretained ChessLRUCacheNode *tail;
+
+    NSUInteger capacity;
+    uint64_t hits;
+    uint64_t misses;
+}
+
+@end
+
+@implementation ChessLRUCache
+
+- (id)init
+{
+    return [self initWithCapacity:64];
+}
+
+- (id)initWithCapacity:(NSUInteger)aCapacity
+{
+    if (self = [super init]) {
+        pthread_mutex_init(&lock, NULL);
+        nodesByKey = [[NSMutableDictionary alloc] initWithCapacity:aCapacity];
+        capacity = aCapacity;
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [self removeAllObjects];
+    pthread_mutex_destroy(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark List
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)unlinkNode:(ChessLRUCacheNode *)node
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        head = node->next;
+
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        tail = node->prev;
+
+    node->prev = nil;
+    node->next = nil;
+}
+
+- (void)pushNode:(ChessLRUCacheNode *)node
+{
+    node->prev = nil;
+    node->next = head;
+
+    if (head)
+        head->prev = node;
+    else
+        tail = node;
+
+    head = node;
+}
+
+- (void)evictIfNeeded
+{
+    while ([nodesByKey count] > capacity && tail)
+    {
+        ChessLRUCacheNode *node = tail;
+        [self unlinkNode:node];
+        [nodesByKey removeObjectForKey:node->key];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Public API
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)capacity
+{
+    pthread_mutex_lock(&lock);
+    NSUInteger result = capacity;
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+- (void)setCapacity:(NSUInteger)newCapacity
+{
+    pthread_mutex_lock(&lock);
+    capacity = newCapacity;
+    [self evictIfNeeded];
+    pthread_mutex_unlock(&lock);
+}
+
+- (NSUInteger)count
+{
+    pthread_mutex_lock(&lock);
+    NSUInteger result = [nodesByKey count];
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+- (uint64_t)hits
+{
+    pthread_mutex_lock(&lock);
+    uint64_t result = hits;
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+- (uint64_t)misses
+{
+    pthread_mutex_lock(&lock);
+    uint64_t result = misses;
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+- (id)objectForKey:(id<NSCopying>)key
+{
+    if (key == nil) return nil;
+
+    pthread_mutex_lock(&lock);
+
+    id result = nil;
+    ChessLRUCacheNode *node = nodesByKey[key];
+    if (node)
+    {
+        if (node != head)
+        {
+            [self unlinkNode:node];
+            [self pushNode:node];
+        }
+
+        result = node->object;
+        hits++;
+    }
+    else
+    {
+        misses++;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+- (void)setObject:(id)object forKey:(id<NSCopying>)key
+{
+    if (key == nil) return;
+
+    if (object == nil)
+    {
+        [self removeObjectForKey:key];
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    ChessLRUCacheNode *node = nodesByKey[key];
+    if (node)
+    {
+        [self unlinkNode:node];
+    }
+    else
+    {
+        node = [[ChessLRUCacheNode alloc] init];
+        node->key = [(id)key copy];
+        nodesByKey[node->key] = node;
+    }
+
+    node->object = object;
+    [self pushNode:node];
+    [self evictIfNeeded];
+
+    pthread_mutex_unlock(&lock);
+}
+
+- (void)removeObjectForKey:(id<NSCopying>)key
+{
+    if (key == nil) return;
+
+    pthread_mutex_lock(&lock);
+
+    ChessLRUCacheNode *node = nodesByKey[key];
+    if (node)
+    {
+        [self unlinkNode:node];
+        [nodesByKey removeObjectForKey:key];
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+- (void)removeAllObjects
+{
+    pthread_mutex_lock(&lock);
+
+    // Break the chain iteratively, so that releasing a long list does not recurse.
+    while (head)
+    {
+        ChessLRUCacheNode *node = head;
+        head = node->next;
+        node->next = nil;
+    }
+    tail = nil;
+    [nodesByKey removeAllObjects];
+
+    pthread_mutex_unlock(&lock);
+}
+
+@end
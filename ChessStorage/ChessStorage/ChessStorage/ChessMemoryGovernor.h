@@ -0,0 +1,114 @@
+//
+//  ChessMemoryGovernor.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/9.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSInteger, ChessMemoryTrim) {
+    ChessMemoryTrimNone = 0,        // Within budget, nothing to do.
+    ChessMemoryTrimRefresh,         // Save, then turn the unchanged registered objects back into faults.
+    ChessMemoryTrimReset,           // Save, then reset the context (system memory warning only).
+};
+
+/**
+ * ChessMemoryGovernor bounds the memory held by the contexts of a ChessStorage (see -[ChessStorage memoryGovernor]).
+ *
+ * A context keeps its registered objects, and the row cache snapshots behind them, alive for as long as
+ * something references them: changed objects until the next save, materialized objects through their relationships.
+ * In a long-running session the footprint only ever grows.
+ *
+ * The governor compares the registered objects of each context to a budget, at most every checkInterval seconds.
+ * Over budget, the private managedObjectContext is saved early, and its objects are refreshed into faults,
+ * which releases their values and lets the persistent store coordinator drop the row cache snapshots nobody uses.
+ * The mainThreadManagedObjectContext is never saved or reset, only its unchanged objects are refreshed.
+ * On a system memory warning both contexts are trimmed right away, and the private one is reset.
+ *
+ * Like ChessSavePolicy, the governor does not know anything about Core Data.
+ * The counts are handed to it by ChessStorage, so it may be driven with synthetic values as well.
+ *
+ * Configure the governor before handing it to ChessStorage.
+ * Apart from the configuration, ChessMemoryGovernor is thread safe.
+ **/
+
+@interface ChessMemoryGovernor : NSObject
+
+/**
+ * The maximum number of objects registered in a context, faults included.
+ * 0 disables the limit.
+ *
+ * Default 5000
+ **/
+@property (nonatomic, assign) NSUInteger maxRegisteredObjects;
+
+/**
+ * The maximum estimated number of bytes held by the registered objects of a context.
+ * The estimation is the number of materialized objects multiplied by estimatedBytesPerObject,
+ * plus the number of faults multiplied by estimatedBytesPerFault.
+ * 0 disables the limit.
+ *
+ * Default 4 MB, 1024, 96
+ **/
+@property (nonatomic, assign) NSUInteger maxEstimatedBytes;
+@property (nonatomic, assign) NSUInteger estimatedBytesPerObject;
+@property (nonatomic, assign) NSUInteger estimatedBytesPerFault;
+
+/**
+ * The minimum time between two checks of the same context.
+ * A check walks the registered objects, so it costs as much as the number of registered objects.
+ *
+ * Default 1 second
+ **/
+@property (nonatomic, assign) NSTimeInterval checkInterval;
+
+/**
+ * Applied to the stalenessInterval of the contexts.
+ * Faults fired later than stalenessInterval seconds after their row was cached read the store again,
+ * rather than a snapshot kept alive by another context, so refreshed objects do not come back stale.
+ * A negative value keeps the Core Data default (cached rows never go stale).
+ *
+ * Default 60 seconds
+ **/
+@property (nonatomic, assign) NSTimeInterval stalenessInterval;
+
+/**
+ * Whether the mainThreadManagedObjectContext is checked and trimmed as well.
+ *
+ * Default YES
+ **/
+@property (nonatomic, assign) BOOL governsMainThreadContext;
+
+- (NSUInteger)estimatedBytesWithRegisteredObjects:(NSUInteger)registeredObjects faults:(NSUInteger)faults;
+
+/**
+ * Returns whether a context with the given counts should be trimmed.
+ **/
+- (ChessMemoryTrim)trimWithRegisteredObjects:(NSUInteger)registeredObjects faults:(NSUInteger)faults;
+
+/**
+ * Invoked by ChessStorage. contextName is @"private" or @"mainThread".
+ **/
+- (void)recordCheckOfContextNamed:(NSString *)contextName registeredObjects:(NSUInteger)registeredObjects faults:(NSUInteger)faults;
+- (void)recordTrim:(ChessMemoryTrim)trim ofContextNamed:(NSString *)contextName remainingObjects:(NSUInteger)remainingObjects;
+- (void)recordEarlySave;
+- (void)recordMemoryWarning;
+
+/**
+ * Returns the counts of the last check, the high water marks and the trims of each context, e.g.
+ *
+ * @{ @"private": @{ @"registeredObjects": @(812), @"faults": @(640), @"estimatedBytes": @(237568),
+ *                   @"maxRegisteredObjects": @(5012), @"refreshes": @(14), @"resets": @(1), @"remainingObjects": @(3) },
+ *    @"mainThread": @{ ... },
+ *    @"earlySaves": @(9), @"memoryWarnings": @(1) }
+ *
+ * remainingObjects is the number of objects still registered right after the last trim:
+ * objects referenced outside the context (e.g. by a fetched results controller) survive a refresh.
+ **/
+- (NSDictionary *)statistics;
+
+- (void)resetStatistics;
+
+@end
@@ -0,0 +1,166 @@
+//
+//  ChessMemoryGovernor.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/9.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessMemoryGovernor.h"
+#import <pthread.h>
+
+@interface ChessMemoryGovernor ()
+{
+    pthread_mutex_t lock;
+
+    NSMutableDictionary *contextStatistics;     // context name -> NSMutableDictionary
+    uint64_t earlySaves;
+    uint64_t memoryWarnings;
+}
+
+@end
+
+@implementation ChessMemoryGovernor
+
+@synthesize maxRegisteredObjects, maxEstimatedBytes, estimatedBytesPerObject, estimatedBytesPerFault;
+@synthesize checkInterval, stalenessInterval, governsMainThreadContext;
+
+- (id)init
+{
+    if ((self = [super init]))
+    {
+        pthread_mutex_init(&lock, NULL);
+        contextStatistics = [[NSMutableDictionary alloc] init];
+
+        maxRegisteredObjects = 5000;
+        maxEstimatedBytes = 4 * 1024 * 1024;
+        estimatedBytesPerObject = 1024;
+        estimatedBytesPerFault = 96;
+        checkInterval = 1.0;
+        stalenessInterval = 60.0;
+        governsMainThreadContext = YES;
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&lock);
+}
+
+- (NSUInteger)estimatedBytesWithRegisteredObjects:(NSUInteger)registeredObjects faults:(NSUInteger)faults
+{
+    NSUInteger materialized = (registeredObjects > faults) ? (registeredObjects - faults) : 0;
+
+    return (materialized * estimatedBytesPerObject) + (MIN(faults, registeredObjects) * estimatedBytesPerFault);
+}
+
+- (ChessMemoryTrim)trimWithRegisteredObjects:(NSUInteger)registeredObjects faults:(NSUInteger)faults
+{
+    if (maxRegisteredObjects > 0 && registeredObjects > maxRegisteredObjects)
+    {
+        return ChessMemoryTrimRefresh;
+    }
+
+    if (maxEstimatedBytes > 0 && [self estimatedBytesWithRegisteredObjects:registeredObjects faults:faults] > maxEstimatedBytes)
+    {
+        return ChessMemoryTrimRefresh;
+    }
+
+    return ChessMemoryTrimNone;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Statistics
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSMutableDictionary *)statisticsOfContextNamed:(NSString *)contextName
+{
+    // Invoked with the lock held.
+
+    NSMutableDictionary *result = contextStatistics[contextName];
+    if (result == nil)
+    {
+        result = [@{ @"registeredObjects": @(0), @"faults": @(0), @"estimatedBytes": @(0),
+                     @"maxRegisteredObjects": @(0), @"refreshes": @(0), @"resets": @(0), @"remainingObjects": @(0) } mutableCopy];
+        contextStatistics[contextName] = result;
+    }
+
+    return result;
+}
+
+- (void)recordCheckOfContextNamed:(NSString *)contextName registeredObjects:(NSUInteger)registeredObjects faults:(NSUInteger)faults
+{
+    NSUInteger estimatedBytes = [self estimatedBytesWithRegisteredObjects:registeredObjects faults:faults];
+
+    pthread_mutex_lock(&lock);
+
+    NSMutableDictionary *statistics = [self statisticsOfContextNamed:contextName];
+    statistics[@"registeredObjects"] = @(registeredObjects);
+    statistics[@"faults"] = @(faults);
+    statistics[@"estimatedBytes"] = @(estimatedBytes);
+
+    if (registeredObjects > [statistics[@"maxRegisteredObjects"] unsignedIntegerValue])
+    {
+        statistics[@"maxRegisteredObjects"] = @(registeredObjects);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+- (void)recordTrim:(ChessMemoryTrim)trim ofContextNamed:(NSString *)contextName remainingObjects:(NSUInteger)remainingObjects
+{
+    if (trim == ChessMemoryTrimNone) return;
+
+    NSString *key = (trim == ChessMemoryTrimReset) ? @"resets" : @"refreshes";
+
+    pthread_mutex_lock(&lock);
+
+    NSMutableDictionary *statistics = [self statisticsOfContextNamed:contextName];
+    statistics[key] = @([statistics[key] unsignedLongLongValue] + 1);
+    statistics[@"remainingObjects"] = @(remainingObjects);
+
+    pthread_mutex_unlock(&lock);
+}
+
+- (void)recordEarlySave
+{
+    pthread_mutex_lock(&lock);
+    earlySaves++;
+    pthread_mutex_unlock(&lock);
+}
+
+- (void)recordMemoryWarning
+{
+    pthread_mutex_lock(&lock);
+    memoryWarnings++;
+    pthread_mutex_unlock(&lock);
+}
+
+- (NSDictionary *)statistics
+{
+    pthread_mutex_lock(&lock);
+
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithCapacity:[contextStatistics count] + 2];
+    [contextStatistics enumerateKeysAndObjectsUsingBlock:^(NSString *contextName, NSDictionary *statistics, BOOL *stop) {
+        result[contextName] = [statistics copy];
+    }];
+    result[@"earlySaves"] = @(earlySaves);
+    result[@"memoryWarnings"] = @(memoryWarnings);
+
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+- (void)resetStatistics
+{
+    pthread_mutex_lock(&lock);
+    [contextStatistics removeAllObjects];
+    earlySaves = 0;
+    memoryWarnings = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+@end
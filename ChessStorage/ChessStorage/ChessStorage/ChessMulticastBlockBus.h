@@ -9,30 +9,42 @@
 #import <Foundation/Foundation.h>
 
 /**
- *  ChessMulticastBlockBus is thread safe while you initialize with method 'initWithMulticastBlockQueue: multicastBlockQueueTag: multicastBlockQueueTag:
+ *  ChessMulticastBlockBus is thread safe, and lock-free.
+ *
+ *  Blocks are pushed onto a multi-producer single-consumer list with a single compare-and-swap,
+ *  so addInvokeBlock:invokeQueue: may be invoked from any thread without dispatching anywhere.
+ *
+ *  multicastBlocks detaches the whole list atomically in one step, and then dispatches
+ *  the blocks sharing the same invokeQueue with a single dispatch_async, in the order they were added.
+ *  When nothing was added, multicastBlocks costs a single pointer load.
+ *
+ *  multicastBlocks and removeAllInvokeBlocks may race with addInvokeBlock:invokeQueue:,
+ *  a block added concurrently is simply left for the next multicast.
+ *  They should not be invoked concurrently with each other (the list has a single consumer).
  */
 
 @interface ChessMulticastBlockBus : NSObject
 
-@property (nonatomic, strong, readonly) NSMutableArray *muticastBlockNodesArray;
-
+/**
+ *  The queue and tag are no longer needed, this initializer is kept for compatibility.
+ */
 - (id)initWithMulticastBlockQueue:(dispatch_queue_t)aMulticastBlockQueue multicastBlockQueueTag:(void *)queueTag;
 
+/**
+ *  The block is invoked on invokeQueue, or on the main queue if invokeQueue is nil.
+ */
 - (void)addInvokeBlock:(dispatch_block_t)block invokeQueue:(dispatch_queue_t)invokeQueue;
 
 - (void)removeAllInvokeBlocks;
 
 /**
- *  Invoke all blocks in muticastBlockNodesArray, and reset muticastBlockNodesArray.
+ *  Invoke all added blocks, and reset the list.
  */
 - (void)multicastBlocks;
 
-@end
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-@interface ChessMulticastBlockNode : NSObject
-
-- (id)initWithInvokeBlock:(dispatch_block_t)block   invokeQueue:(dispatch_queue_t)aInvokeQueue;
+/**
+ *  The number of dispatch_async calls issued by multicastBlocks so far.
+ */
+@property (atomic, assign, readonly) int64_t numberOfDispatches;
 
 @end
@@ -7,113 +7,199 @@
 //
 
 #import "ChessMulticastBlockBus.h"
+#import <libkern/OSAtomic.h>
 
-@interface ChessMulticastBlockNode ()
+// Number of distinct invokeQueues grouped on the stack, before falling back to the heap.
+#define kChessMulticastInlineGroups 8
 
-@property (nonatomic, copy) dispatch_block_t invokeBlock;
-@property (nonatomic, strong) dispatch_queue_t invokeQueue;
+typedef struct ChessMulticastBlockNode {
+    struct ChessMulticastBlockNode *next;
+    void *invokeBlock;  // retained dispatch_block_t
+    void *invokeQueue;  // retained dispatch_queue_t
+} ChessMulticastBlockNode;
 
-@end
-
-@implementation ChessMulticastBlockNode
+typedef struct ChessMulticastBlockGroup {
+    void *invokeQueue;
+    ChessMulticastBlockNode *first;
+    ChessMulticastBlockNode *last;
+} ChessMulticastBlockGroup;
 
-@synthesize invokeBlock, invokeQueue;
+static void ChessMulticastBlockNodeFree(ChessMulticastBlockNode *node)
+{
+    CFBridgingRelease(node->invokeBlock);
+    CFBridgingRelease(node->invokeQueue);
+    free(node);
+}
 
-- (id)initWithInvokeBlock:(dispatch_block_t)block   invokeQueue:(dispatch_queue_t)aInvokeQueue
+static void ChessMulticastBlockNodeFreeList(ChessMulticastBlockNode *node)
 {
-    if (self = [super init]) {
-        invokeBlock = [block copy];
-        if (aInvokeQueue)
-            invokeQueue = aInvokeQueue;
-        else
-            invokeQueue = dispatch_get_main_queue();
+    while (node)
+    {
+        ChessMulticastBlockNode *next = node->next;
+        ChessMulticastBlockNodeFree(node);
+        node = next;
     }
-    
-    return self;
 }
 
-@end
-
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 @interface ChessMulticastBlockBus ()
 {
-    NSMutableArray *muticastBlockNodesArray;
-    dispatch_queue_t multicastBlockQueue;
-    void *multicastBlockQueueTag;
+    ChessMulticastBlockNode * volatile head;
+    volatile int64_t numberOfDispatches;
 }
 
 @end
 
 @implementation ChessMulticastBlockBus
 
-@synthesize muticastBlockNodesArray;
-
 - (id)initWithMulticastBlockQueue:(dispatch_queue_t)aMulticastBlockQueue multicastBlockQueueTag:(void *)queueTag;
 {
-    if (self = [super init]) {
-        muticastBlockNodesArray = [[NSMutableArray alloc] init];
-        multicastBlockQueue = aMulticastBlockQueue;
-        multicastBlockQueueTag = queueTag;
+    return [self init];
+}
+
+- (void)dealloc
+{
+    ChessMulticastBlockNodeFreeList([self detachAllNodes]);
+}
+
+- (int64_t)numberOfDispatches
+{
+    return OSAtomicAdd64(0, &numberOfDispatches);
+}
+
+- (ChessMulticastBlockNode *)detachAllNodes
+{
+    // Fast path, nothing to detach.
+    if (head == NULL)
+    {
+        return NULL;
     }
-    
-    return self;
+
+    ChessMulticastBlockNode *list;
+    do {
+        list = head;
+    } while (list && !OSAtomicCompareAndSwapPtrBarrier(list, NULL, (void * volatile *)&head));
+
+    return list;
 }
 
 - (void)addInvokeBlock:(dispatch_block_t)block invokeQueue:(dispatch_queue_t)invokeQueue
 {
-    dispatch_block_t aBlock = ^{@autoreleasepool{
-        if (!block) return;
-        
-        dispatch_queue_t queue = invokeQueue;
-        if (!queue) queue = dispatch_get_main_queue();
-        
-        ChessMulticastBlockNode *node = [[ChessMulticastBlockNode alloc] initWithInvokeBlock:block invokeQueue:queue];
-        [muticastBlockNodesArray addObject:node];
-    }};
-    
-    if (dispatch_get_specific(multicastBlockQueueTag))
-        aBlock();
-    else
-        dispatch_async(multicastBlockQueue, aBlock);
+    if (!block) return;
+
+    dispatch_queue_t queue = invokeQueue;
+    if (!queue) queue = dispatch_get_main_queue();
+
+    ChessMulticastBlockNode *node = malloc(sizeof(ChessMulticastBlockNode));
+    node->invokeBlock = (__bridge_retained void *)[block copy];
+    node->invokeQueue = (__bridge_retained void *)queue;
+
+    ChessMulticastBlockNode *oldHead;
+    do {
+        oldHead = head;
+        node->next = oldHead;
+    } while (!OSAtomicCompareAndSwapPtrBarrier(oldHead, node, (void * volatile *)&head));
 }
 
 - (void)removeAllInvokeBlocks
 {
-    dispatch_block_t aBlock = ^{@autoreleasepool{
-        for (ChessMulticastBlockNode *node in muticastBlockNodesArray) {
-            node.invokeBlock = nil;
-            node.invokeQueue = nil;
-        }
-        
-        [muticastBlockNodesArray removeAllObjects];
-    }};
-    
-    if (dispatch_get_specific(multicastBlockQueueTag))
-        aBlock();
-    else
-        dispatch_async(multicastBlockQueue, aBlock);
+    ChessMulticastBlockNodeFreeList([self detachAllNodes]);
 }
 
 - (void)multicastBlocks
 {
-    dispatch_block_t aBlock = ^{@autoreleasepool{
-        for (ChessMulticastBlockNode *node in muticastBlockNodesArray) {
-            dispatch_queue_t queue = node.invokeQueue;
-            dispatch_block_t block = [node.invokeBlock copy];
-            if (!queue || !block)
-                continue;
-            
-            dispatch_async(queue, block);
+    ChessMulticastBlockNode *list = [self detachAllNodes];
+    if (list == NULL)
+    {
+        return;
+    }
+
+    // The list is LIFO, reverse it so blocks run in the order they were added.
+
+    ChessMulticastBlockNode *reversed = NULL;
+    while (list)
+    {
+        ChessMulticastBlockNode *next = list->next;
+        list->next = reversed;
+        reversed = list;
+        list = next;
+    }
+
+    // Group by invokeQueue, preserving order within each group.
+
+    ChessMulticastBlockGroup inlineGroups[kChessMulticastInlineGroups];
+    ChessMulticastBlockGroup *groups = inlineGroups;
+    NSUInteger groupCapacity = kChessMulticastInlineGroups;
+    NSUInteger groupCount = 0;
+
+    ChessMulticastBlockNode *node = reversed;
+    while (node)
+    {
+        ChessMulticastBlockNode *next = node->next;
+        node->next = NULL;
+
+        NSUInteger i = 0;
+        while (i < groupCount && groups[i].invokeQueue != node->invokeQueue) i++;
+
+        if (i == groupCount)
+        {
+            if (groupCount == groupCapacity)
+            {
+                groupCapacity *= 2;
+                if (groups == inlineGroups)
+                {
+                    groups = malloc(groupCapacity * sizeof(ChessMulticastBlockGroup));
+                    memcpy(groups, inlineGroups, sizeof(inlineGroups));
+                }
+                else
+                {
+                    groups = realloc(groups, groupCapacity * sizeof(ChessMulticastBlockGroup));
+                }
+            }
+
+            groups[i].invokeQueue = node->invokeQueue;
+            groups[i].first = node;
+            groups[i].last = node;
+            groupCount++;
         }
-        
-        [self removeAllInvokeBlocks];
-    }};
-    
-    if (dispatch_get_specific(multicastBlockQueueTag))
-        aBlock();
-    else
-        dispatch_async(multicastBlockQueue, aBlock);
+        else
+        {
+            groups[i].last->next = node;
+            groups[i].last = node;
+        }
+
+        node = next;
+    }
+
+    // One dispatch per invokeQueue.
+
+    for (NSUInteger i = 0; i < groupCount; i++)
+    {
+        ChessMulticastBlockNode *first = groups[i].first;
+
+        dispatch_async((__bridge dispatch_queue_t)groups[i].invokeQueue, ^{
+            ChessMulticastBlockNode *current = first;
+            while (current)
+            {
+                ChessMulticastBlockNode *following = current->next;
+
+                @autoreleasepool {
+                    ((__bridge dispatch_block_t)current->invokeBlock)();
+                }
+                ChessMulticastBlockNodeFree(current);
+
+                current = following;
+            }
+        });
+    }
+
+    OSAtomicAdd64((int64_t)groupCount, &numberOfDispatches);
+
+    if (groups != inlineGroups)
+    {
+        free(groups);
+    }
 }
 
 @end
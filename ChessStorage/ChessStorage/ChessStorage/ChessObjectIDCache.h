@@ -0,0 +1,69 @@
+//
+//  ChessObjectIDCache.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/12.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+/**
+ * ChessObjectIDCache maps uniquing key values to NSManagedObjectIDs, so that "does this object exist?"
+ * is answered by a hash lookup instead of a fetch. See -[ChessStorage setObjectIDCacheCapacity:forEntityName:uniquingKeyPaths:].
+ *
+ * Each cache is registered for an entity and an ordered list of uniquing key paths, e.g. @[ @"name", @"age" ],
+ * and keeps at most capacity entries, evicting the least recently used ones.
+ *
+ * The caches are maintained from NSManagedObjectContextObjectsDidChangeNotification (inserted, updated and deleted objects)
+ * and NSManagedObjectContextDidSaveNotification (the permanent IDs of the inserted objects) of the tracked context.
+ * Entries are not trusted blindly: an object found in the cache is only returned if it still exists,
+ * is not deleted, and still has the requested key values. Stale entries are dropped and count as misses.
+ *
+ * The cache is not thread safe.
+ * It must only be used on the queue of the tracked context (the storageQueue).
+ **/
+
+@interface ChessObjectIDCache : NSObject
+
+@property (nonatomic, weak, readonly) NSManagedObjectContext *managedObjectContext;
+
+/**
+ * Starts observing the given context, and empties all the caches.
+ * Stops observing the previously tracked context, if any.
+ **/
+- (void)startTrackingManagedObjectContext:(NSManagedObjectContext *)moc;
+
+/**
+ * Registers (or resizes) the cache of the given entity and uniquing key paths.
+ * A capacity of 0 removes it.
+ **/
+- (void)setCapacity:(NSUInteger)capacity forEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths;
+
+- (BOOL)hasCacheForEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths;
+
+/**
+ * Returns the object whose key paths have the same values as in values (a dictionary, or any key-value coding container),
+ * if it is cached. Returns nil on a miss, without fetching.
+ **/
+- (NSManagedObject *)objectWithEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths values:(id)values;
+
+/**
+ * Adds the object to every cache registered for its entity, e.g. after fetching it on a miss.
+ **/
+- (void)cacheObject:(NSManagedObject *)object;
+
+- (void)removeAllObjects;
+
+/**
+ * Statistics keyed by entity name, then by the key paths joined with commas, e.g.
+ * @{ @"FriendEntity": @{ @"name,age": @{ @"count": @(812), @"capacity": @(1024), @"hits": @(9000), @"misses": @(1000),
+ *                                         @"staleEntries": @(12), @"hitRate": @(0.9), @"estimatedBytes": @(155904) } } }
+ *
+ * estimatedBytes is an estimate of the memory held by the entries (node, key and object ID),
+ * not a measurement.
+ **/
+- (NSDictionary *)statistics;
+
+@end
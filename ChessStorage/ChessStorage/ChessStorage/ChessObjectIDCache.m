@@ -0,0 +1,345 @@
+//
+//  ChessObjectIDCache.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/12.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessObjectIDCache.h"
+#import "ChessLRUCache.h"
+
+// Rough cost of an entry besides its key: the LRU node, its dictionary slot and the NSManagedObjectID.
+static const NSUInteger kChessObjectIDCacheEntryOverhead = 128;
+
+@interface ChessObjectIDCacheEntry : NSObject
+{
+@public
+    NSArray *keyPaths;
+    ChessLRUCache *objectIDs;   // key -> NSManagedObjectID
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t staleEntries;
+
+    uint64_t numberOfKeysAdded;
+    uint64_t keyBytesAdded;
+}
+
+@end
+
+@implementation ChessObjectIDCacheEntry
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessObjectIDCache ()
+{
+    NSMutableDictionary *entriesByEntityName;   // entity name -> NSArray of ChessObjectIDCacheEntry
+}
+
+@property (nonatomic, weak, readwrite) NSManagedObjectContext *managedObjectContext;
+
+@end
+
+@implementation ChessObjectIDCache
+
+@synthesize managedObjectContext;
+
+- (id)init
+{
+    if (self = [super init]) {
+        entriesByEntityName = [[NSMutableDictionary alloc] init];
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+- (void)startTrackingManagedObjectContext:(NSManagedObjectContext *)moc
+{
+    if (managedObjectContext)
+    {
+        [[NSNotificationCenter defaultCenter] removeObserver:self name:nil object:managedObjectContext];
+    }
+
+    self.managedObjectContext = moc;
+    [self removeAllObjects];
+
+    if (moc == nil)
+    {
+        return;
+    }
+
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(managedObjectContextObjectsDidChange:)
+                                                 name:NSManagedObjectContextObjectsDidChangeNotification
+                                               object:moc];
+
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(managedObjectContextDidSave:)
+                                                 name:NSManagedObjectContextDidSaveNotification
+                                               object:moc];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Configuration
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (ChessObjectIDCacheEntry *)entryForEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths
+{
+    for (ChessObjectIDCacheEntry *entry in entriesByEntityName[entityName])
+    {
+        if ([entry->keyPaths isEqualToArray:keyPaths])
+            return entry;
+    }
+
+    return nil;
+}
+
+- (void)setCapacity:(NSUInteger)capacity forEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths
+{
+    if (entityName == nil || [keyPaths count] == 0)
+    {
+        return;
+    }
+
+    ChessObjectIDCacheEntry *entry = [self entryForEntityName:entityName uniquingKeyPaths:keyPaths];
+
+    if (capacity == 0)
+    {
+        if (entry)
+        {
+            NSMutableArray *entries = [entriesByEntityName[entityName] mutableCopy];
+            [entries removeObjectIdenticalTo:entry];
+
+            if ([entries count] > 0)
+                entriesByEntityName[entityName] = [entries copy];
+            else
+                [entriesByEntityName removeObjectForKey:entityName];
+        }
+        return;
+    }
+
+    if (entry)
+    {
+        entry->objectIDs.capacity = capacity;
+        return;
+    }
+
+    entry = [[ChessObjectIDCacheEntry alloc] init];
+    entry->keyPaths = [keyPaths copy];
+    entry->objectIDs = [[ChessLRUCache alloc] initWithCapacity:capacity];
+
+    NSArray *entries = entriesByEntityName[entityName] ?: @[];
+    entriesByEntityName[entityName] = [entries arrayByAddingObject:entry];
+}
+
+- (BOOL)hasCacheForEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths
+{
+    return ([self entryForEntityName:entityName uniquingKeyPaths:keyPaths] != nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Keys
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The value itself for a single key path, an array of the values otherwise.
+ * Returns nil if any value is missing, such objects are not cached.
+ **/
+- (id)keyWithValues:(id)values keyPaths:(NSArray *)keyPaths
+{
+    if ([keyPaths count] == 1)
+    {
+        id value = [values valueForKeyPath:keyPaths[0]];
+        return (value == [NSNull null]) ? nil : value;
+    }
+
+    NSMutableArray *key = [NSMutableArray arrayWithCapacity:[keyPaths count]];
+    for (NSString *keyPath in keyPaths)
+    {
+        id value = [values valueForKeyPath:keyPath];
+        if (value == nil || value == [NSNull null])
+        {
+            return nil;
+        }
+        [key addObject:value];
+    }
+
+    return key;
+}
+
+static NSUInteger ChessObjectIDCacheKeySize(id key)
+{
+    if ([key isKindOfClass:[NSString class]])
+        return 16 + [(NSString *)key length] * sizeof(unichar);
+
+    if ([key isKindOfClass:[NSArray class]])
+    {
+        NSUInteger size = 16;
+        for (id value in key)
+            size += ChessObjectIDCacheKeySize(value);
+        return size;
+    }
+
+    return 16;
+}
+
+- (void)setObjectID:(NSManagedObjectID *)objectID forKey:(id)key inEntry:(ChessObjectIDCacheEntry *)entry
+{
+    if (key == nil)
+    {
+        return;
+    }
+
+    [entry->objectIDs setObject:objectID forKey:key];
+
+    entry->numberOfKeysAdded++;
+    entry->keyBytesAdded += ChessObjectIDCacheKeySize(key);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Lookup
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSManagedObject *)objectWithEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths values:(id)values
+{
+    ChessObjectIDCacheEntry *entry = [self entryForEntityName:entityName uniquingKeyPaths:keyPaths];
+    if (entry == nil)
+    {
+        return nil;
+    }
+
+    id key = [self keyWithValues:values keyPaths:keyPaths];
+    NSManagedObjectID *objectID = key ? [entry->objectIDs objectForKey:key] : nil;
+    if (objectID == nil)
+    {
+        entry->misses++;
+        return nil;
+    }
+
+    // Registered objects are returned from memory, others are fetched by primary key.
+    NSManagedObject *object = [managedObjectContext existingObjectWithID:objectID error:nil];
+
+    if (object == nil || [object isDeleted] || ![[self keyWithValues:object keyPaths:keyPaths] isEqual:key])
+    {
+        [entry->objectIDs removeObjectForKey:key];
+        entry->staleEntries++;
+        entry->misses++;
+        return nil;
+    }
+
+    entry->hits++;
+    return object;
+}
+
+- (void)cacheObject:(NSManagedObject *)object
+{
+    for (ChessObjectIDCacheEntry *entry in entriesByEntityName[[[object entity] name]])
+    {
+        [self setObjectID:[object objectID] forKey:[self keyWithValues:object keyPaths:entry->keyPaths] inEntry:entry];
+    }
+}
+
+- (void)uncacheObject:(NSManagedObject *)object
+{
+    for (ChessObjectIDCacheEntry *entry in entriesByEntityName[[[object entity] name]])
+    {
+        id key = [self keyWithValues:object keyPaths:entry->keyPaths];
+        if (key) [entry->objectIDs removeObjectForKey:key];
+    }
+}
+
+- (void)removeAllObjects
+{
+    for (NSArray *entries in [entriesByEntityName objectEnumerator])
+    {
+        for (ChessObjectIDCacheEntry *entry in entries)
+            [entry->objectIDs removeAllObjects];
+    }
+}
+
+- (NSDictionary *)statistics
+{
+    NSMutableDictionary *statistics = [NSMutableDictionary dictionaryWithCapacity:[entriesByEntityName count]];
+
+    [entriesByEntityName enumerateKeysAndObjectsUsingBlock:^(NSString *entityName, NSArray *entries, BOOL *stop) {
+
+        NSMutableDictionary *entityStatistics = [NSMutableDictionary dictionaryWithCapacity:[entries count]];
+
+        for (ChessObjectIDCacheEntry *entry in entries)
+        {
+            NSUInteger count = entry->objectIDs.count;
+            uint64_t lookups = entry->hits + entry->misses;
+            uint64_t averageKeySize = entry->numberOfKeysAdded ? (entry->keyBytesAdded / entry->numberOfKeysAdded) : 0;
+
+            entityStatistics[[entry->keyPaths componentsJoinedByString:@","]] =
+                @{ @"count"          : @(count),
+                   @"capacity"       : @(entry->objectIDs.capacity),
+                   @"hits"           : @(entry->hits),
+                   @"misses"         : @(entry->misses),
+                   @"staleEntries"   : @(entry->staleEntries),
+                   @"hitRate"        : @(lookups ? (double)entry->hits / lookups : 0.0),
+                   @"estimatedBytes" : @(count * (kChessObjectIDCacheEntryOverhead + averageKeySize)) };
+        }
+
+        statistics[entityName] = entityStatistics;
+    }];
+
+    return statistics;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Notifications
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)managedObjectContextObjectsDidChange:(NSNotification *)notification
+{
+    NSDictionary *userInfo = [notification userInfo];
+
+    if ([userInfo objectForKey:NSInvalidatedAllObjectsKey])
+    {
+        [self removeAllObjects];
+        return;
+    }
+
+    if ([entriesByEntityName count] == 0)
+    {
+        return;
+    }
+
+    // Inserted objects are cached with their temporary IDs, which stay valid in this context until the save.
+    // Updated objects may have new key values. Their previous keys become stale entries, dropped on lookup.
+
+    for (NSManagedObject *object in [userInfo objectForKey:NSInsertedObjectsKey])
+        [self cacheObject:object];
+    for (NSManagedObject *object in [userInfo objectForKey:NSUpdatedObjectsKey])
+        [self cacheObject:object];
+    for (NSManagedObject *object in [userInfo objectForKey:NSDeletedObjectsKey])
+        [self uncacheObject:object];
+}
+
+- (void)managedObjectContextDidSave:(NSNotification *)notification
+{
+    if ([entriesByEntityName count] == 0)
+    {
+        return;
+    }
+
+    NSDictionary *userInfo = [notification userInfo];
+
+    // The inserted objects now have their permanent IDs.
+
+    for (NSManagedObject *object in [userInfo objectForKey:NSInsertedObjectsKey])
+        [self cacheObject:object];
+    for (NSManagedObject *object in [userInfo objectForKey:NSDeletedObjectsKey])
+        [self uncacheObject:object];
+}
+
+@end
@@ -0,0 +1,75 @@
+//
+//  ChessOperationJournal.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/5.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * A write-ahead journal of storage mutations, in front of the Core Data save path.
+ * See -[ChessStorage journal] for how ChessStorage uses it.
+ *
+ * Records are appended to a memory mapped file (see ChessJournalFile.h for the format).
+ * Appending costs a memcpy, and is not durable by itself.
+ * commitWithCompletion: requests a group commit: all the records appended by the time the commit runs
+ * are made durable by a single fsync, on a private queue, however many commits were requested meanwhile.
+ *
+ * All methods are thread safe.
+ **/
+
+@interface ChessOperationJournal : NSObject
+
+/**
+ * Opens (or creates) the journal file at path.
+ * Returns nil, and an NSPOSIXErrorDomain error, if the file cannot be opened or is not a journal.
+ **/
+- (id)initWithPath:(NSString *)path error:(NSError **)errorPtr;
+
+@property (nonatomic, copy, readonly) NSString *path;
+
+/**
+ * Appends a record, and returns its log sequence number (LSN).
+ * Returns 0 if the record could not be appended, e.g. when the journal is full (64 MiB of records not checkpointed).
+ **/
+- (uint64_t)appendRecord:(NSData *)record;
+
+/**
+ * Requests a group commit of every record appended so far.
+ *
+ * completionBlock (optional) is invoked on a private queue once the records are durable, or the fsync failed.
+ **/
+- (void)commitWithCompletion:(void (^)(BOOL durable))completionBlock;
+
+/**
+ * Invokes the block for every record after the checkpoint, in LSN order, on the calling thread.
+ * No lock is held while the block runs, so it may checkpoint (e.g. by saving).
+ * A checkpoint covering every record ends the replay. Return NO from the block to stop.
+ *
+ * Returns the number of records replayed.
+ **/
+- (NSUInteger)replayRecordsUsingBlock:(BOOL (^)(uint64_t lsn, NSData *record))block;
+
+/**
+ * Marks every record up to and including the given LSN as applied, so it is no longer replayed.
+ * Once every record is applied, the journal starts over at the beginning of its file.
+ **/
+- (void)checkpointThroughLSN:(uint64_t)lsn;
+
+/**
+ * The LSN of the last appended record, of the last durable one, and of the checkpoint. 0 if there is none.
+ **/
+@property (readonly) uint64_t lastLSN;
+@property (readonly) uint64_t durableLSN;
+@property (readonly) uint64_t checkpointLSN;
+
+/**
+ * Counters since the journal was opened, e.g.
+ * @{ @"records": @(10000), @"commits": @(412), @"commitRequests": @(10000), @"failedAppends": @(0),
+ *    @"usedSize": @(1310784), @"capacity": @(2097152) }
+ **/
+- (NSDictionary *)statistics;
+
+@end
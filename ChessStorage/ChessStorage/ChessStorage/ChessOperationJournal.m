@@ -0,0 +1,198 @@
+//
+//  ChessOperationJournal.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/5.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessOperationJournal.h"
+#import "ChessJournalFile.h"
+
+#import <libkern/OSAtomic.h>
+#import <pthread.h>
+
+@interface ChessOperationJournal ()
+{
+    ChessJournalFile *file;
+
+    dispatch_queue_t commitQueue;
+    dispatch_source_t commitSource;
+
+    pthread_mutex_t completionsLock;
+    NSMutableArray *pendingCompletions;     // protected by completionsLock
+
+    volatile int64_t numberOfRecords;
+    volatile int64_t numberOfCommits;
+    volatile int64_t numberOfCommitRequests;
+    volatile int64_t numberOfFailedAppends;
+}
+
+@end
+
+@implementation ChessOperationJournal
+
+@synthesize path;
+
+- (id)initWithPath:(NSString *)aPath error:(NSError **)errorPtr
+{
+    if ((self = [super init]))
+    {
+        int error = chess_journal_file_open([aPath fileSystemRepresentation], &file);
+        if (error != 0)
+        {
+            if (errorPtr)
+            {
+                *errorPtr = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                                code:error
+                                            userInfo:@{ NSFilePathErrorKey: aPath }];
+            }
+            return nil;
+        }
+
+        path = [aPath copy];
+
+        pthread_mutex_init(&completionsLock, NULL);
+        pendingCompletions = [[NSMutableArray alloc] init];
+
+        commitQueue = dispatch_queue_create("ChessOperationJournal.commit", NULL);
+
+        // A data source coalesces every commit request made while a commit is in progress into a single next one.
+        commitSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_ADD, 0, 0, commitQueue);
+
+        __weak ChessOperationJournal *weakSelf = self;
+        dispatch_source_set_event_handler(commitSource, ^{ @autoreleasepool {
+
+            [weakSelf commit];
+        }});
+
+        dispatch_resume(commitSource);
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    if (commitSource)
+    {
+        dispatch_source_cancel(commitSource);
+#if !OS_OBJECT_USE_OBJC
+        dispatch_release(commitSource);
+#endif
+    }
+
+    if (file)
+    {
+        // Honor the commits that were requested, but not run yet.
+        [self commit];
+
+        chess_journal_file_close(file);
+        pthread_mutex_destroy(&completionsLock);
+    }
+
+#if !OS_OBJECT_USE_OBJC
+    if (commitQueue)
+        dispatch_release(commitQueue);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Records
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (uint64_t)appendRecord:(NSData *)record
+{
+    uint64_t lsn = 0;
+
+    int error = chess_journal_file_append(file, [record bytes], (uint32_t)[record length], &lsn);
+    if (error != 0)
+    {
+        OSAtomicIncrement64(&numberOfFailedAppends);
+        return 0;
+    }
+
+    OSAtomicIncrement64(&numberOfRecords);
+    return lsn;
+}
+
+- (void)commitWithCompletion:(void (^)(BOOL durable))completionBlock
+{
+    if (completionBlock)
+    {
+        pthread_mutex_lock(&completionsLock);
+        [pendingCompletions addObject:[completionBlock copy]];
+        pthread_mutex_unlock(&completionsLock);
+    }
+
+    OSAtomicIncrement64(&numberOfCommitRequests);
+    dispatch_source_merge_data(commitSource, 1);
+}
+
+- (void)commit
+{
+    // The completions are taken before the sync,
+    // so every record appended before its commit was requested is covered by this sync.
+
+    pthread_mutex_lock(&completionsLock);
+    NSArray *completions = [pendingCompletions copy];
+    [pendingCompletions removeAllObjects];
+    pthread_mutex_unlock(&completionsLock);
+
+    BOOL durable = (chess_journal_file_sync(file, NULL) == 0);
+    OSAtomicIncrement64(&numberOfCommits);
+
+    for (void (^completionBlock)(BOOL) in completions)
+    {
+        completionBlock(durable);
+    }
+}
+
+static int ChessOperationJournalReplay(void *context, uint64_t lsn, const void *payload, uint32_t length)
+{
+    BOOL (^block)(uint64_t, NSData *) = (__bridge BOOL (^)(uint64_t, NSData *))context;
+
+    @autoreleasepool {
+        return block(lsn, [NSData dataWithBytes:payload length:length]) ? 0 : 1;
+    }
+}
+
+- (NSUInteger)replayRecordsUsingBlock:(BOOL (^)(uint64_t lsn, NSData *record))block
+{
+    uint64_t count = 0;
+    chess_journal_file_replay(file, ChessOperationJournalReplay, (__bridge void *)block, &count);
+
+    return (NSUInteger)count;
+}
+
+- (void)checkpointThroughLSN:(uint64_t)lsn
+{
+    chess_journal_file_checkpoint(file, lsn);
+}
+
+- (uint64_t)lastLSN
+{
+    return chess_journal_file_last_lsn(file);
+}
+
+- (uint64_t)durableLSN
+{
+    return chess_journal_file_durable_lsn(file);
+}
+
+- (uint64_t)checkpointLSN
+{
+    return chess_journal_file_checkpoint_lsn(file);
+}
+
+- (NSDictionary *)statistics
+{
+    return @{ @"records"        : @(OSAtomicAdd64(0, &numberOfRecords)),
+              @"commits"        : @(OSAtomicAdd64(0, &numberOfCommits)),
+              @"commitRequests" : @(OSAtomicAdd64(0, &numberOfCommitRequests)),
+              @"failedAppends"  : @(OSAtomicAdd64(0, &numberOfFailedAppends)),
+              @"usedSize"       : @(chess_journal_file_used_size(file)),
+              @"capacity"       : @(chess_journal_file_capacity(file)) };
+}
+
+@end
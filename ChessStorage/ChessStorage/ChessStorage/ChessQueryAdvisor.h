@@ -0,0 +1,58 @@
+//
+//  ChessQueryAdvisor.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/26.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+/**
+ * ChessQueryAdvisor aggregates the fetch requests of an application by shape
+ * (entity, predicate with its constants left out, sort keys), with their timings,
+ * and recommends the fetch indexes that would serve them (see -[ChessConfig queryAdvisor]).
+ *
+ * Recommended indexes follow the equality, sort, range rule: the key paths compared for equality (==, IN) first,
+ * then the sort keys, then the first key path compared by range (<, >, BETWEEN, BEGINSWITH).
+ * Comparisons no index can serve (!=, CONTAINS, LIKE, case or diacritic insensitive, OR, NOT) are left out.
+ *
+ * ChessQueryAdvisor is thread safe.
+ **/
+
+@interface ChessQueryAdvisor : NSObject
+
+/**
+ * The number of distinct shapes kept. Requests of new shapes beyond it are not recorded.
+ *
+ * Default 256
+ **/
+@property (atomic, assign) NSUInteger maximumNumberOfShapes;
+
+/**
+ * Records one execution of the request. duration is in seconds, 0 if the request was not timed
+ * (e.g. the request of a fetched results controller, recorded when registered).
+ **/
+- (void)recordFetchRequest:(NSFetchRequest *)fetchRequest duration:(NSTimeInterval)duration numberOfResults:(NSUInteger)numberOfResults;
+
+/**
+ * Checks every recorded shape against the indexes of the model (indexed attributes and compound indexes), e.g.
+ *
+ * @{ @"queries": @[ @{ @"entity": @"FriendEntity", @"predicate": @"name == ? AND age == ?", @"sortKeys": @[],
+ *                     @"count": @(1000), @"timedCount": @(1000), @"totalTime": @(0.84), @"averageTime": @(0.00084),
+ *                     @"maxTime": @(0.012), @"averageResults": @(1),
+ *                     @"fullScan": @YES, @"sortWithoutIndex": @NO, @"recommendedIndex": @[ @"name", @"age" ] }, ... ],
+ *    @"recommendedFetchIndexes": @[ @{ @"entity": @"FriendEntity", @"keyPaths": @[ @"name", @"age" ] }, ... ] }
+ *
+ * Queries are sorted by total time, slowest first.
+ * fullScan means no index of the model starts with a key path the predicate can use.
+ * sortWithoutIndex means the results are sorted by SQLite after the fetch, instead of read in index order.
+ * recommendedIndex is only present if no index of the model already serves the query,
+ * and recommendedFetchIndexes leaves out the indexes that are a prefix of another recommended one.
+ **/
+- (NSDictionary *)reportWithManagedObjectModel:(NSManagedObjectModel *)managedObjectModel;
+
+- (void)reset;
+
+@end
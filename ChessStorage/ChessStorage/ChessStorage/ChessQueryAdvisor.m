@@ -0,0 +1,443 @@
+//
+//  ChessQueryAdvisor.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/9/26.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessQueryAdvisor.h"
+#import <pthread.h>
+
+@interface ChessQueryShape : NSObject
+{
+@public
+    NSString *entityName;
+    NSString *predicateShape;
+    NSArray *sortKeys;
+
+    NSArray *equalityKeyPaths;  // in predicate order
+    NSArray *rangeKeyPaths;
+
+    uint64_t count;
+    uint64_t timedCount;
+    uint64_t totalResults;
+    NSTimeInterval totalTime;
+    NSTimeInterval maxTime;
+}
+
+@end
+
+@implementation ChessQueryShape
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessQueryAdvisor ()
+{
+    pthread_mutex_t lock;
+
+    NSMutableDictionary *shapesByKey;
+    NSUInteger maximumNumberOfShapes;
+}
+
+@end
+
+@implementation ChessQueryAdvisor
+
+- (id)init
+{
+    if ((self = [super init]))
+    {
+        pthread_mutex_init(&lock, NULL);
+        shapesByKey = [[NSMutableDictionary alloc] init];
+        maximumNumberOfShapes = 256;
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&lock);
+}
+
+- (NSUInteger)maximumNumberOfShapes
+{
+    pthread_mutex_lock(&lock);
+    NSUInteger result = maximumNumberOfShapes;
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+- (void)setMaximumNumberOfShapes:(NSUInteger)newMaximumNumberOfShapes
+{
+    pthread_mutex_lock(&lock);
+    maximumNumberOfShapes = newMaximumNumberOfShapes;
+    pthread_mutex_unlock(&lock);
+}
+
+- (void)reset
+{
+    pthread_mutex_lock(&lock);
+    [shapesByKey removeAllObjects];
+    pthread_mutex_unlock(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Shapes
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static NSString *ChessQueryAdvisorOperatorName(NSPredicateOperatorType operatorType)
+{
+    switch (operatorType)
+    {
+        case NSLessThanPredicateOperatorType             : return @"<";
+        case NSLessThanOrEqualToPredicateOperatorType    : return @"<=";
+        case NSGreaterThanPredicateOperatorType          : return @">";
+        case NSGreaterThanOrEqualToPredicateOperatorType : return @">=";
+        case NSEqualToPredicateOperatorType              : return @"==";
+        case NSNotEqualToPredicateOperatorType           : return @"!=";
+        case NSMatchesPredicateOperatorType              : return @"MATCHES";
+        case NSLikePredicateOperatorType                 : return @"LIKE";
+        case NSBeginsWithPredicateOperatorType           : return @"BEGINSWITH";
+        case NSEndsWithPredicateOperatorType             : return @"ENDSWITH";
+        case NSInPredicateOperatorType                   : return @"IN";
+        case NSContainsPredicateOperatorType             : return @"CONTAINS";
+        case NSBetweenPredicateOperatorType              : return @"BETWEEN";
+        default                                          : return @"CUSTOM";
+    }
+}
+
+/**
+ * The operator seen from the other side, for "constant < keyPath" comparisons.
+ **/
+static NSPredicateOperatorType ChessQueryAdvisorMirroredOperator(NSPredicateOperatorType operatorType)
+{
+    switch (operatorType)
+    {
+        case NSLessThanPredicateOperatorType             : return NSGreaterThanPredicateOperatorType;
+        case NSLessThanOrEqualToPredicateOperatorType    : return NSGreaterThanOrEqualToPredicateOperatorType;
+        case NSGreaterThanPredicateOperatorType          : return NSLessThanPredicateOperatorType;
+        case NSGreaterThanOrEqualToPredicateOperatorType : return NSLessThanOrEqualToPredicateOperatorType;
+        case NSEqualToPredicateOperatorType              : return NSEqualToPredicateOperatorType;
+        case NSNotEqualToPredicateOperatorType           : return NSNotEqualToPredicateOperatorType;
+        default                                          : return NSCustomSelectorPredicateOperatorType;
+    }
+}
+
+/**
+ * Returns the shape of the predicate, with every constant and variable replaced by "?".
+ * If indexable, the key paths an index can serve are added to equalityKeyPaths and rangeKeyPaths.
+ **/
+- (NSString *)shapeOfPredicate:(NSPredicate *)predicate
+                     indexable:(BOOL)indexable
+              equalityKeyPaths:(NSMutableArray *)equalityKeyPaths
+                 rangeKeyPaths:(NSMutableArray *)rangeKeyPaths
+{
+    if ([predicate isKindOfClass:[NSCompoundPredicate class]])
+    {
+        NSCompoundPredicate *compoundPredicate = (NSCompoundPredicate *)predicate;
+        NSCompoundPredicateType type = [compoundPredicate compoundPredicateType];
+
+        // Only the terms of an AND narrow the search, so only they can use an index.
+        BOOL indexableTerms = indexable && (type == NSAndPredicateType);
+
+        NSMutableArray *terms = [NSMutableArray array];
+        for (NSPredicate *subpredicate in [compoundPredicate subpredicates])
+        {
+            NSString *term = [self shapeOfPredicate:subpredicate
+                                          indexable:indexableTerms
+                                   equalityKeyPaths:equalityKeyPaths
+                                      rangeKeyPaths:rangeKeyPaths];
+
+            if ([subpredicate isKindOfClass:[NSCompoundPredicate class]])
+                term = [NSString stringWithFormat:@"(%@)", term];
+
+            [terms addObject:term];
+        }
+
+        if (type == NSNotPredicateType)
+            return [NSString stringWithFormat:@"NOT %@", [terms firstObject]];
+
+        return [terms componentsJoinedByString:(type == NSAndPredicateType) ? @" AND " : @" OR "];
+    }
+
+    if (![predicate isKindOfClass:[NSComparisonPredicate class]])
+    {
+        return [predicate predicateFormat];
+    }
+
+    NSComparisonPredicate *comparison = (NSComparisonPredicate *)predicate;
+    NSExpression *left = [comparison leftExpression];
+    NSExpression *right = [comparison rightExpression];
+
+    NSString *keyPath = nil;
+    NSPredicateOperatorType operatorType = [comparison predicateOperatorType];
+
+    if ([left expressionType] == NSKeyPathExpressionType && [right expressionType] != NSKeyPathExpressionType)
+    {
+        keyPath = [left keyPath];
+    }
+    else if ([right expressionType] == NSKeyPathExpressionType && [left expressionType] != NSKeyPathExpressionType)
+    {
+        keyPath = [right keyPath];
+        operatorType = ChessQueryAdvisorMirroredOperator(operatorType);
+    }
+
+    if (keyPath == nil || [comparison comparisonPredicateModifier] != NSDirectPredicateModifier)
+    {
+        return [predicate predicateFormat];
+    }
+
+    NSComparisonPredicateOptions options = [comparison options];
+    NSString *optionsName = @"";
+    if (options & (NSCaseInsensitivePredicateOption | NSDiacriticInsensitivePredicateOption))
+    {
+        optionsName = [NSString stringWithFormat:@"[%@%@]",
+                       (options & NSCaseInsensitivePredicateOption) ? @"c" : @"",
+                       (options & NSDiacriticInsensitivePredicateOption) ? @"d" : @""];
+    }
+
+    // SQLite compares the raw values of an index, and cannot follow relationships from it.
+    if (indexable && [optionsName length] == 0 && [keyPath rangeOfString:@"."].location == NSNotFound)
+    {
+        switch (operatorType)
+        {
+            case NSEqualToPredicateOperatorType:
+            case NSInPredicateOperatorType:
+                if (![equalityKeyPaths containsObject:keyPath])
+                    [equalityKeyPaths addObject:keyPath];
+                break;
+
+            case NSLessThanPredicateOperatorType:
+            case NSLessThanOrEqualToPredicateOperatorType:
+            case NSGreaterThanPredicateOperatorType:
+            case NSGreaterThanOrEqualToPredicateOperatorType:
+            case NSBetweenPredicateOperatorType:
+            case NSBeginsWithPredicateOperatorType:
+                if (![rangeKeyPaths containsObject:keyPath])
+                    [rangeKeyPaths addObject:keyPath];
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return [NSString stringWithFormat:@"%@ %@%@ ?", keyPath, ChessQueryAdvisorOperatorName(operatorType), optionsName];
+}
+
+- (void)recordFetchRequest:(NSFetchRequest *)fetchRequest duration:(NSTimeInterval)duration numberOfResults:(NSUInteger)numberOfResults
+{
+    NSString *entityName = [[fetchRequest entity] name] ?: [fetchRequest entityName];
+    if (entityName == nil)
+    {
+        return;
+    }
+
+    NSMutableArray *equalityKeyPaths = [NSMutableArray array];
+    NSMutableArray *rangeKeyPaths = [NSMutableArray array];
+
+    NSPredicate *predicate = [fetchRequest predicate];
+    NSString *predicateShape = predicate ? [self shapeOfPredicate:predicate
+                                                        indexable:YES
+                                                 equalityKeyPaths:equalityKeyPaths
+                                                    rangeKeyPaths:rangeKeyPaths] : @"";
+
+    NSMutableArray *sortKeys = [NSMutableArray arrayWithCapacity:[[fetchRequest sortDescriptors] count]];
+    for (NSSortDescriptor *sortDescriptor in [fetchRequest sortDescriptors])
+    {
+        if ([sortDescriptor key]) [sortKeys addObject:[sortDescriptor key]];
+    }
+
+    NSString *key = [NSString stringWithFormat:@"%@|%@|%@", entityName, predicateShape, [sortKeys componentsJoinedByString:@","]];
+
+    pthread_mutex_lock(&lock);
+
+    ChessQueryShape *shape = shapesByKey[key];
+    if (shape == nil && [shapesByKey count] < maximumNumberOfShapes)
+    {
+        shape = [[ChessQueryShape alloc] init];
+        shape->entityName = entityName;
+        shape->predicateShape = predicateShape;
+        shape->sortKeys = [sortKeys copy];
+        shape->equalityKeyPaths = [equalityKeyPaths copy];
+        shape->rangeKeyPaths = [rangeKeyPaths copy];
+
+        shapesByKey[key] = shape;
+    }
+
+    if (shape)
+    {
+        shape->count++;
+        shape->totalResults += numberOfResults;
+
+        if (duration > 0)
+        {
+            shape->timedCount++;
+            shape->totalTime += duration;
+            shape->maxTime = MAX(shape->maxTime, duration);
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Report
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The key paths of every index of the entity: indexed attributes, compound indexes,
+ * and fetch index descriptions where available (iOS 11).
+ **/
+static NSArray *ChessQueryAdvisorIndexesOfEntity(NSEntityDescription *entity)
+{
+    NSMutableArray *indexes = [NSMutableArray array];
+
+    [[entity attributesByName] enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSAttributeDescription *attribute, BOOL *stop) {
+        if ([attribute isIndexed]) [indexes addObject:@[ name ]];
+    }];
+
+    for (NSArray *compoundIndex in [entity compoundIndexes])
+    {
+        NSMutableArray *keyPaths = [NSMutableArray arrayWithCapacity:[compoundIndex count]];
+        for (id element in compoundIndex)
+        {
+            [keyPaths addObject:[element isKindOfClass:[NSPropertyDescription class]] ? [element name] : element];
+        }
+        [indexes addObject:keyPaths];
+    }
+
+    if ([entity respondsToSelector:@selector(indexes)])
+    {
+        for (id fetchIndex in [entity valueForKey:@"indexes"])
+        {
+            NSArray *keyPaths = [fetchIndex valueForKeyPath:@"elements.propertyName"];
+            if ([keyPaths count]) [indexes addObject:keyPaths];
+        }
+    }
+
+    return indexes;
+}
+
+static BOOL ChessQueryAdvisorIsPrefix(NSArray *prefix, NSArray *keyPaths)
+{
+    return [prefix count] <= [keyPaths count] &&
+           [[keyPaths subarrayWithRange:NSMakeRange(0, [prefix count])] isEqualToArray:prefix];
+}
+
+- (NSDictionary *)reportWithManagedObjectModel:(NSManagedObjectModel *)managedObjectModel
+{
+    pthread_mutex_lock(&lock);
+    NSArray *shapes = [shapesByKey allValues];
+    pthread_mutex_unlock(&lock);
+
+    NSDictionary *entitiesByName = [managedObjectModel entitiesByName];
+    NSMutableArray *queries = [NSMutableArray arrayWithCapacity:[shapes count]];
+    NSMutableArray *recommendations = [NSMutableArray array];
+
+    for (ChessQueryShape *shape in shapes)
+    {
+        NSArray *indexes = ChessQueryAdvisorIndexesOfEntity(entitiesByName[shape->entityName]);
+        NSSet *equalityKeyPaths = [NSSet setWithArray:shape->equalityKeyPaths];
+
+        // Equality, then sort, then range.
+
+        NSMutableArray *recommendedIndex = [shape->equalityKeyPaths mutableCopy];
+        for (NSString *sortKey in shape->sortKeys)
+        {
+            if ([sortKey rangeOfString:@"."].location != NSNotFound) break;
+            if (![recommendedIndex containsObject:sortKey]) [recommendedIndex addObject:sortKey];
+        }
+        NSString *rangeKeyPath = [shape->rangeKeyPaths firstObject];
+        if (rangeKeyPath && ![recommendedIndex containsObject:rangeKeyPath])
+        {
+            [recommendedIndex addObject:rangeKeyPath];
+        }
+
+        BOOL fullScan = YES;
+        BOOL sortWithoutIndex = ([shape->sortKeys count] > 0);
+        BOOL served = ([recommendedIndex count] == 0);
+
+        for (NSArray *index in indexes)
+        {
+            NSString *firstKeyPath = [index firstObject];
+            if ([equalityKeyPaths containsObject:firstKeyPath] || [shape->rangeKeyPaths containsObject:firstKeyPath])
+            {
+                fullScan = NO;
+            }
+
+            if (sortWithoutIndex)
+            {
+                NSUInteger position = 0;
+                while (position < [index count] && [equalityKeyPaths containsObject:index[position]]) position++;
+
+                if (position < [index count] && [index[position] isEqualToString:[shape->sortKeys firstObject]])
+                    sortWithoutIndex = NO;
+            }
+
+            if (ChessQueryAdvisorIsPrefix(recommendedIndex, index))
+            {
+                served = YES;
+            }
+        }
+
+        NSMutableDictionary *query = [NSMutableDictionary dictionary];
+        query[@"entity"] = shape->entityName;
+        query[@"predicate"] = shape->predicateShape;
+        query[@"sortKeys"] = shape->sortKeys;
+        query[@"count"] = @(shape->count);
+        query[@"timedCount"] = @(shape->timedCount);
+        query[@"totalTime"] = @(shape->totalTime);
+        query[@"averageTime"] = @(shape->timedCount ? shape->totalTime / shape->timedCount : 0.0);
+        query[@"maxTime"] = @(shape->maxTime);
+        query[@"averageResults"] = @(shape->count ? (double)shape->totalResults / shape->count : 0.0);
+        query[@"fullScan"] = @(fullScan);
+        query[@"sortWithoutIndex"] = @(sortWithoutIndex);
+
+        if (!served)
+        {
+            query[@"recommendedIndex"] = recommendedIndex;
+            [recommendations addObject:@{ @"entity": shape->entityName, @"keyPaths": [recommendedIndex copy] }];
+        }
+
+        [queries addObject:query];
+    }
+
+    [queries sortUsingComparator:^NSComparisonResult(NSDictionary *query1, NSDictionary *query2) {
+        NSComparisonResult result = [query2[@"totalTime"] compare:query1[@"totalTime"]];
+        return (result != NSOrderedSame) ? result : [query2[@"count"] compare:query1[@"count"]];
+    }];
+
+    // An index also serves the queries of its prefixes.
+
+    NSMutableArray *recommendedFetchIndexes = [NSMutableArray array];
+    for (NSDictionary *recommendation in recommendations)
+    {
+        BOOL redundant = NO;
+        for (NSDictionary *other in recommendations)
+        {
+            if (other == recommendation || ![other[@"entity"] isEqualToString:recommendation[@"entity"]]) continue;
+
+            if ([other[@"keyPaths"] count] > [recommendation[@"keyPaths"] count] &&
+                ChessQueryAdvisorIsPrefix(recommendation[@"keyPaths"], other[@"keyPaths"]))
+            {
+                redundant = YES;
+                break;
+            }
+        }
+
+        if (!redundant && ![recommendedFetchIndexes containsObject:recommendation])
+        {
+            [recommendedFetchIndexes addObject:recommendation];
+        }
+    }
+
+    return @{ @"queries": queries, @"recommendedFetchIndexes": recommendedFetchIndexes };
+}
+
+@end
@@ -0,0 +1,982 @@
+//
+//  ChessRecordParser.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/12.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessRecordParser.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CHESS_RECORD_PARSER_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CHESS_RECORD_PARSER_NEON 1
+#endif
+
+// The 64-bit word tricks below assume the first byte of the input is the low byte of the word.
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CHESS_RECORD_PARSER_SWAR 1
+#endif
+
+// An integer of up to 18 digits always fits an int64_t.
+#define CHESS_RECORD_PARSER_MAX_DIGITS  18
+
+// Longest CSV header name compared with the field names.
+#define CHESS_RECORD_PARSER_MAX_NAME    256
+
+enum {
+    CHESS_RECORD_PARSED = 1,        // a record was parsed
+    CHESS_RECORD_NONE = 0,          // nothing (blank line, or separators between JSON objects)
+    CHESS_RECORD_MALFORMED = -1,
+};
+
+struct ChessRecordParser {
+    ChessRecordFormat format;
+
+    const char *input;
+    size_t length;
+    size_t position;
+
+    int fd;
+    void *map;                  // NULL unless the input is a mapped file
+    size_t released;            // bytes at the start of the mapping handed back to the system
+
+    char **field_names;
+    size_t *field_name_lengths;
+    size_t field_count;
+
+    // CSV: the field index of every column, or -1.
+    long *column_fields;
+    size_t column_count;
+    int header_parsed;
+
+    uint64_t records;
+    uint64_t skipped;
+};
+
+#if CHESS_RECORD_PARSER_SWAR
+static inline uint64_t chess_record_zero_bytes(uint64_t word)
+{
+    // The high bit of the lowest zero byte is set. Higher bytes may be false positives, which never matters:
+    // only the lowest match is used.
+    return (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+}
+#endif
+
+/**
+ * Returns the first occurrence of a, b or c in [p, end), or end.
+ **/
+static const char *chess_record_scan(const char *p, const char *end, char a, char b, char c)
+{
+#if CHESS_RECORD_PARSER_SSE2
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)),
+                                       _mm_cmpeq_epi8(chunk, vc));
+        int mask = _mm_movemask_epi8(matches);
+        if (mask)
+        {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+        p += 16;
+    }
+#elif CHESS_RECORD_PARSER_NEON
+    const uint8x16_t va = vdupq_n_u8((uint8_t)a);
+    const uint8x16_t vb = vdupq_n_u8((uint8_t)b);
+    const uint8x16_t vc = vdupq_n_u8((uint8_t)c);
+
+    while (end - p >= 16)
+    {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)p);
+        uint8x16_t matches = vorrq_u8(vorrq_u8(vceqq_u8(chunk, va), vceqq_u8(chunk, vb)), vceqq_u8(chunk, vc));
+
+        // NEON has no movemask: narrowing keeps 4 bits per byte, in a 64-bit word.
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+        if (mask)
+        {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+        p += 16;
+    }
+#elif CHESS_RECORD_PARSER_SWAR
+    const uint64_t pa = 0x0101010101010101ULL * (uint8_t)a;
+    const uint64_t pb = 0x0101010101010101ULL * (uint8_t)b;
+    const uint64_t pc = 0x0101010101010101ULL * (uint8_t)c;
+
+    while (end - p >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+
+        uint64_t mask = chess_record_zero_bytes(word ^ pa) | chess_record_zero_bytes(word ^ pb) | chess_record_zero_bytes(word ^ pc);
+        if (mask)
+        {
+            return p + (__builtin_ctzll(mask) >> 3);
+        }
+        p += 8;
+    }
+#endif
+
+    for (; p < end; p++)
+    {
+        if (*p == a || *p == b || *p == c)
+        {
+            return p;
+        }
+    }
+
+    return end;
+}
+
+static inline const char *chess_record_skip_whitespace(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Converts 1 to 8 ASCII digits. Returns 0 if one of them is not a digit.
+ **/
+static inline int chess_record_parse_digits(const char *p, size_t count, uint64_t *value_out)
+{
+#if CHESS_RECORD_PARSER_SWAR
+    // Right-align the digits in a word of '0's, then check and convert all 8 bytes at once.
+    uint64_t word = 0x3030303030303030ULL;
+    memcpy((char *)&word + (8 - count), p, count);
+
+    if ((((word & 0xF0F0F0F0F0F0F0F0ULL) | (((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))) != 0x3333333333333333ULL)
+    {
+        return 0;
+    }
+
+    word -= 0x3030303030303030ULL;
+    word = (word * 10) + (word >> 8);
+    word = (((word & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+            (((word >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+
+    *value_out = word;
+    return 1;
+#else
+    uint64_t value = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (p[i] < '0' || p[i] > '9') return 0;
+        value = value * 10 + (uint64_t)(p[i] - '0');
+    }
+
+    *value_out = value;
+    return 1;
+#endif
+}
+
+static int chess_record_parse_integer(const char *p, size_t length, int64_t *integer_out)
+{
+    int negative = 0;
+    if (length > 0 && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+        length--;
+    }
+
+    if (length == 0 || length > CHESS_RECORD_PARSER_MAX_DIGITS)
+    {
+        return 0;
+    }
+
+    // The first chunk takes the odd digits, so that every following chunk is 8 digits.
+    uint64_t value = 0;
+    size_t chunk = (length % 8) ? (length % 8) : 8;
+
+    while (length > 0)
+    {
+        uint64_t digits;
+        if (!chess_record_parse_digits(p, chunk, &digits))
+        {
+            return 0;
+        }
+
+        value = value * 100000000ULL + digits;
+        p += chunk;
+        length -= chunk;
+        chunk = 8;
+    }
+
+    *integer_out = negative ? -(int64_t)value : (int64_t)value;
+    return 1;
+}
+
+static int chess_record_is_number(const char *p, size_t length)
+{
+    int digits = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        char ch = p[i];
+        if (ch >= '0' && ch <= '9')
+            digits++;
+        else if (ch != '-' && ch != '+' && ch != '.' && ch != 'e' && ch != 'E')
+            return 0;
+    }
+    return digits > 0;
+}
+
+static void chess_record_set_field(ChessRecordField *field, const char *value, size_t length, uint32_t flags)
+{
+    field->value = value;
+    field->length = (uint32_t)length;
+    field->flags = flags | CHESS_RECORD_FIELD_PRESENT;
+    field->integer = 0;
+
+    if ((flags & CHESS_RECORD_FIELD_NUMBER) || (!(flags & CHESS_RECORD_FIELD_JSON) && chess_record_is_number(value, length)))
+    {
+        field->flags |= CHESS_RECORD_FIELD_NUMBER;
+
+        if (chess_record_parse_integer(value, length, &field->integer))
+        {
+            field->flags |= CHESS_RECORD_FIELD_INTEGER;
+        }
+    }
+}
+
+/**
+ * Parses the field at the current position.
+ * Returns 1 if it is the last field of its record, 0 if another one follows, CHESS_RECORD_MALFORMED otherwise.
+ **/
+static int chess_record_csv_field(ChessRecordParser *parser, const char **value_out, size_t *length_out, int *escaped_out)
+{
+    const char *p = parser->input + parser->position;
+    const char *end = parser->input + parser->length;
+    const char *value;
+    const char *value_end;
+
+    *escaped_out = 0;
+
+    if (p < end && *p == '"')
+    {
+        value = ++p;
+
+        while (1)
+        {
+            p = chess_record_scan(p, end, '"', '"', '"');
+            if (p == end)
+            {
+                return CHESS_RECORD_MALFORMED;     // unterminated quote
+            }
+            if (p + 1 < end && p[1] == '"')
+            {
+                *escaped_out = 1;
+                p += 2;
+                continue;
+            }
+            break;
+        }
+
+        value_end = p++;
+
+        if (p < end && *p == '\r') p++;
+        if (p < end && *p != ',' && *p != '\n')
+        {
+            return CHESS_RECORD_MALFORMED;         // text after the closing quote
+        }
+    }
+    else
+    {
+        value = p;
+        p = chess_record_scan(p, end, ',', '\n', '"');
+        if (p < end && *p == '"')
+        {
+            return CHESS_RECORD_MALFORMED;         // quote within an unquoted field
+        }
+
+        value_end = p;
+        if (value_end > value && value_end[-1] == '\r') value_end--;
+    }
+
+    *value_out = value;
+    *length_out = (size_t)(value_end - value);
+
+    if (p == end || *p == '\n')
+    {
+        parser->position = (p == end) ? parser->length : (size_t)(p + 1 - parser->input);
+        return 1;
+    }
+
+    parser->position = (size_t)(p + 1 - parser->input);
+    return 0;
+}
+
+static int chess_record_csv_header(ChessRecordParser *parser)
+{
+    size_t capacity = 16;
+    parser->column_fields = malloc(capacity * sizeof(long));
+    if (parser->column_fields == NULL)
+    {
+        return ENOMEM;
+    }
+
+    while (parser->position < parser->length)
+    {
+        const char *value;
+        size_t length;
+        int escaped;
+
+        int last = chess_record_csv_field(parser, &value, &length, &escaped);
+        if (last == CHESS_RECORD_MALFORMED)
+        {
+            return EINVAL;
+        }
+
+        if (parser->column_count == capacity)
+        {
+            capacity *= 2;
+            long *column_fields = realloc(parser->column_fields, capacity * sizeof(long));
+            if (column_fields == NULL)
+            {
+                return ENOMEM;
+            }
+            parser->column_fields = column_fields;
+        }
+
+        char name[CHESS_RECORD_PARSER_MAX_NAME];
+        ChessRecordField field = { value, (uint32_t)length, CHESS_RECORD_FIELD_PRESENT | (escaped ? CHESS_RECORD_FIELD_ESCAPED : 0), 0 };
+        size_t name_length = chess_record_field_copy(&field, name, sizeof(name));
+
+        long field_index = -1;
+        for (size_t i = 0; i < parser->field_count && name_length < sizeof(name); i++)
+        {
+            if (parser->field_name_lengths[i] == name_length && memcmp(parser->field_names[i], name, name_length) == 0)
+            {
+                field_index = (long)i;
+                break;
+            }
+        }
+
+        parser->column_fields[parser->column_count++] = field_index;
+
+        if (last) break;
+    }
+
+    parser->header_parsed = 1;
+    return 0;
+}
+
+static int chess_record_csv_record(ChessRecordParser *parser, ChessRecordField *fields)
+{
+    const char *p = parser->input + parser->position;
+
+    // Blank lines separate nothing.
+    if (*p == '\n' || (*p == '\r' && parser->position + 1 < parser->length && p[1] == '\n'))
+    {
+        parser->position += (*p == '\n') ? 1 : 2;
+        return CHESS_RECORD_NONE;
+    }
+
+    size_t column = 0;
+
+    while (1)
+    {
+        const char *value;
+        size_t length;
+        int escaped;
+
+        int last = chess_record_csv_field(parser, &value, &length, &escaped);
+        if (last == CHESS_RECORD_MALFORMED)
+        {
+            return CHESS_RECORD_MALFORMED;
+        }
+
+        if (column < parser->column_count && parser->column_fields[column] >= 0)
+        {
+            chess_record_set_field(&fields[parser->column_fields[column]], value, length, escaped ? CHESS_RECORD_FIELD_ESCAPED : 0);
+        }
+        column++;
+
+        if (last) break;
+    }
+
+    return CHESS_RECORD_PARSED;
+}
+
+/**
+ * p is after the opening quote. Returns the closing quote, or end.
+ **/
+static const char *chess_record_json_string_end(const char *p, const char *end, int *escaped_out)
+{
+    while (1)
+    {
+        p = chess_record_scan(p, end, '"', '\\', '"');
+        if (p == end || *p == '"')
+        {
+            return p;
+        }
+
+        *escaped_out = 1;
+        p += 2;
+        if (p >= end) return end;
+    }
+}
+
+/**
+ * Skips the object or array at p. Returns the position after it, or NULL.
+ **/
+static const char *chess_record_json_skip_nested(const char *p, const char *end)
+{
+    size_t depth = 0;
+
+    while (p < end)
+    {
+        char ch = *p++;
+
+        if (ch == '"')
+        {
+            int escaped = 0;
+            p = chess_record_json_string_end(p, end, &escaped);
+            if (p == end) return NULL;
+            p++;
+        }
+        else if (ch == '{' || ch == '[')
+        {
+            depth++;
+        }
+        else if (ch == '}' || ch == ']')
+        {
+            if (--depth == 0) return p;
+        }
+    }
+
+    return NULL;
+}
+
+static long chess_record_field_index(ChessRecordParser *parser, const char *name, size_t length)
+{
+    for (size_t i = 0; i < parser->field_count; i++)
+    {
+        if (parser->field_name_lengths[i] == length && memcmp(parser->field_names[i], name, length) == 0)
+        {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+static int chess_record_json_record(ChessRecordParser *parser, ChessRecordField *fields)
+{
+    const char *p = parser->input + parser->position;
+    const char *end = parser->input + parser->length;
+
+    // Between objects: whitespace, the brackets of a top-level array, and commas.
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == ',' || *p == '[' || *p == ']'))
+    {
+        p++;
+    }
+
+    if (p == end)
+    {
+        parser->position = parser->length;
+        return CHESS_RECORD_NONE;
+    }
+
+    if (*p != '{')
+    {
+        parser->position = (size_t)(p - parser->input);
+        return CHESS_RECORD_MALFORMED;
+    }
+
+    p = chess_record_skip_whitespace(p + 1, end);
+
+    if (p < end && *p == '}')
+    {
+        parser->position = (size_t)(p + 1 - parser->input);
+        return CHESS_RECORD_PARSED;
+    }
+
+    while (1)
+    {
+        // Key
+        if (p >= end || *p != '"') break;
+
+        int key_escaped = 0;
+        const char *key = p + 1;
+        p = chess_record_json_string_end(key, end, &key_escaped);
+        if (p == end) break;
+
+        // Keys with escapes never match a field name.
+        long field_index = key_escaped ? -1 : chess_record_field_index(parser, key, (size_t)(p - key));
+
+        p = chess_record_skip_whitespace(p + 1, end);
+        if (p >= end || *p != ':') break;
+        p = chess_record_skip_whitespace(p + 1, end);
+        if (p >= end) break;
+
+        // Value
+        ChessRecordField *field = (field_index >= 0) ? &fields[field_index] : NULL;
+
+        if (*p == '"')
+        {
+            int escaped = 0;
+            const char *value = p + 1;
+            p = chess_record_json_string_end(value, end, &escaped);
+            if (p == end) break;
+
+            if (field) chess_record_set_field(field, value, (size_t)(p - value), CHESS_RECORD_FIELD_JSON | (escaped ? CHESS_RECORD_FIELD_ESCAPED : 0));
+            p++;
+        }
+        else if (*p == '{' || *p == '[')
+        {
+            p = chess_record_json_skip_nested(p, end);
+            if (p == NULL) break;
+        }
+        else if ((size_t)(end - p) >= 4 && memcmp(p, "true", 4) == 0)
+        {
+            if (field)
+            {
+                chess_record_set_field(field, p, 4, CHESS_RECORD_FIELD_JSON | CHESS_RECORD_FIELD_BOOLEAN);
+                field->flags |= CHESS_RECORD_FIELD_INTEGER;
+                field->integer = 1;
+            }
+            p += 4;
+        }
+        else if ((size_t)(end - p) >= 5 && memcmp(p, "false", 5) == 0)
+        {
+            if (field)
+            {
+                chess_record_set_field(field, p, 5, CHESS_RECORD_FIELD_JSON | CHESS_RECORD_FIELD_BOOLEAN);
+                field->flags |= CHESS_RECORD_FIELD_INTEGER;
+            }
+            p += 5;
+        }
+        else if ((size_t)(end - p) >= 4 && memcmp(p, "null", 4) == 0)
+        {
+            if (field) chess_record_set_field(field, NULL, 0, CHESS_RECORD_FIELD_JSON);
+            p += 4;
+        }
+        else
+        {
+            const char *value = p;
+            while (p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E'))
+            {
+                p++;
+            }
+            if (p == value) break;
+
+            if (field) chess_record_set_field(field, value, (size_t)(p - value), CHESS_RECORD_FIELD_JSON | CHESS_RECORD_FIELD_NUMBER);
+        }
+
+        p = chess_record_skip_whitespace(p, end);
+        if (p >= end) break;
+
+        if (*p == ',')
+        {
+            p = chess_record_skip_whitespace(p + 1, end);
+            continue;
+        }
+        if (*p == '}')
+        {
+            parser->position = (size_t)(p + 1 - parser->input);
+            return CHESS_RECORD_PARSED;
+        }
+        break;
+    }
+
+    parser->position = (size_t)((p < end ? p : end) - parser->input);
+    return CHESS_RECORD_MALFORMED;
+}
+
+static int chess_record_parser_init(ChessRecordParser *parser, ChessRecordFormat format,
+                                    const char * const *field_names, size_t field_count)
+{
+    parser->format = format;
+    parser->field_count = field_count;
+    parser->field_names = calloc(field_count ? field_count : 1, sizeof(char *));
+    parser->field_name_lengths = calloc(field_count ? field_count : 1, sizeof(size_t));
+
+    if (parser->field_names == NULL || parser->field_name_lengths == NULL)
+    {
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < field_count; i++)
+    {
+        parser->field_names[i] = strdup(field_names[i]);
+        if (parser->field_names[i] == NULL)
+        {
+            return ENOMEM;
+        }
+        parser->field_name_lengths[i] = strlen(field_names[i]);
+    }
+
+    // UTF-8 byte order mark
+    if (parser->length >= 3 && memcmp(parser->input, "\xEF\xBB\xBF", 3) == 0)
+    {
+        parser->position = 3;
+    }
+
+    return 0;
+}
+
+int chess_record_parser_create(const void *bytes, size_t length, ChessRecordFormat format,
+                               const char * const *field_names, size_t field_count,
+                               ChessRecordParser **parser_out)
+{
+    ChessRecordParser *parser = calloc(1, sizeof(ChessRecordParser));
+    if (parser == NULL)
+    {
+        return ENOMEM;
+    }
+
+    parser->fd = -1;
+    parser->input = bytes;
+    parser->length = length;
+
+    int error = chess_record_parser_init(parser, format, field_names, field_count);
+    if (error)
+    {
+        chess_record_parser_close(parser);
+        return error;
+    }
+
+    *parser_out = parser;
+    return 0;
+}
+
+int chess_record_parser_open(const char *path, ChessRecordFormat format,
+                             const char * const *field_names, size_t field_count,
+                             ChessRecordParser **parser_out)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        int error = errno;
+        close(fd);
+        return error;
+    }
+
+    void *map = NULL;
+    size_t length = (size_t)info.st_size;
+
+    // mmap refuses empty files, an empty input simply has no records.
+    if (length > 0)
+    {
+        map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            int error = errno;
+            close(fd);
+            return error;
+        }
+
+        madvise(map, length, MADV_SEQUENTIAL);
+    }
+
+    int error = chess_record_parser_create(map, length, format, field_names, field_count, parser_out);
+    if (error)
+    {
+        if (map) munmap(map, length);
+        close(fd);
+        return error;
+    }
+
+    (*parser_out)->fd = fd;
+    (*parser_out)->map = map;
+    return 0;
+}
+
+void chess_record_parser_close(ChessRecordParser *parser)
+{
+    if (parser == NULL) return;
+
+    if (parser->map)
+    {
+        munmap(parser->map, parser->length);
+    }
+    if (parser->fd >= 0)
+    {
+        close(parser->fd);
+    }
+
+    if (parser->field_names)
+    {
+        for (size_t i = 0; i < parser->field_count; i++)
+        {
+            free(parser->field_names[i]);
+        }
+    }
+    free(parser->field_names);
+    free(parser->field_name_lengths);
+    free(parser->column_fields);
+    free(parser);
+}
+
+ChessRecordBatch *chess_record_batch_create(size_t capacity, size_t field_count)
+{
+    ChessRecordBatch *batch = calloc(1, sizeof(ChessRecordBatch));
+    if (batch == NULL)
+    {
+        return NULL;
+    }
+
+    batch->capacity = capacity;
+    batch->field_count = field_count;
+    size_t count = capacity * field_count;
+    batch->fields = calloc(count > 0 ? count : 1, sizeof(ChessRecordField));
+    if (batch->fields == NULL)
+    {
+        free(batch);
+        return NULL;
+    }
+
+    return batch;
+}
+
+void chess_record_batch_destroy(ChessRecordBatch *batch)
+{
+    if (batch == NULL) return;
+
+    free(batch->fields);
+    free(batch);
+}
+
+static void chess_record_parser_release_pages(ChessRecordParser *parser)
+{
+    // The previous batches are done with: hand their pages back.
+    // They are clean pages of a read-only mapping, so this is cheap, and touching them again would simply read the file.
+
+    if (parser->map == NULL) return;
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t release_end = (parser->position / page_size) * page_size;
+
+    if (release_end > parser->released)
+    {
+        madvise((char *)parser->map + parser->released, release_end - parser->released, MADV_DONTNEED);
+        parser->released = release_end;
+    }
+}
+
+int chess_record_parser_next_batch(ChessRecordParser *parser, ChessRecordBatch *batch)
+{
+    if (batch->field_count != parser->field_count)
+    {
+        return EINVAL;
+    }
+
+    chess_record_parser_release_pages(parser);
+
+    batch->count = 0;
+    batch->first_record = parser->records;
+
+    if (parser->format == CHESS_RECORD_FORMAT_CSV && !parser->header_parsed)
+    {
+        int error = chess_record_csv_header(parser);
+        if (error)
+        {
+            return error;
+        }
+    }
+
+    while (batch->count < batch->capacity && parser->position < parser->length)
+    {
+        ChessRecordField *fields = batch->fields + (batch->count * batch->field_count);
+        memset(fields, 0, batch->field_count * sizeof(ChessRecordField));
+
+        int result = (parser->format == CHESS_RECORD_FORMAT_CSV) ? chess_record_csv_record(parser, fields)
+                                                                 : chess_record_json_record(parser, fields);
+        if (result == CHESS_RECORD_PARSED)
+        {
+            batch->count++;
+        }
+        else if (result == CHESS_RECORD_MALFORMED)
+        {
+            parser->skipped++;
+
+            // Resynchronize at the next line.
+            const char *p = parser->input + parser->position;
+            const char *newline = memchr(p, '\n', parser->length - parser->position);
+            parser->position = newline ? (size_t)(newline + 1 - parser->input) : parser->length;
+        }
+    }
+
+    parser->records += batch->count;
+    return 0;
+}
+
+static inline int chess_record_hex(char ch)
+{
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+static int chess_record_hex4(const char *p, const char *end, uint32_t *value_out)
+{
+    if (end - p < 4) return 0;
+
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int digit = chess_record_hex(p[i]);
+        if (digit < 0) return 0;
+        value = (value << 4) | (uint32_t)digit;
+    }
+
+    *value_out = value;
+    return 1;
+}
+
+#define CHESS_RECORD_PUT(ch) do { if (length + 1 < size) buffer[length] = (char)(ch); length++; } while (0)
+
+size_t chess_record_field_copy(const ChessRecordField *field, char *buffer, size_t size)
+{
+    // A JSON null, or a field the record does not have, has no value at all.
+    const char *p = field->value;
+    const char *end = p ? p + field->length : NULL;
+    size_t length = 0;
+
+    if (!(field->flags & CHESS_RECORD_FIELD_ESCAPED))
+    {
+        length = p ? field->length : 0;
+        if (size > 0)
+        {
+            size_t copied = (length < size) ? length : size - 1;
+            if (p)
+            {
+                memcpy(buffer, p, copied);
+            }
+            buffer[copied] = '\0';
+        }
+        return length;
+    }
+
+    while (p < end)
+    {
+        char ch = *p++;
+
+        if (!(field->flags & CHESS_RECORD_FIELD_JSON))
+        {
+            // CSV: "" stands for "
+            if (ch == '"' && p < end && *p == '"') p++;
+            CHESS_RECORD_PUT(ch);
+            continue;
+        }
+
+        if (ch != '\\' || p == end)
+        {
+            CHESS_RECORD_PUT(ch);
+            continue;
+        }
+
+        ch = *p++;
+        switch (ch)
+        {
+            case 'b': CHESS_RECORD_PUT('\b'); break;
+            case 'f': CHESS_RECORD_PUT('\f'); break;
+            case 'n': CHESS_RECORD_PUT('\n'); break;
+            case 'r': CHESS_RECORD_PUT('\r'); break;
+            case 't': CHESS_RECORD_PUT('\t'); break;
+            case 'u':
+            {
+                uint32_t code;
+                if (!chess_record_hex4(p, end, &code))
+                {
+                    CHESS_RECORD_PUT('u');
+                    break;
+                }
+                p += 4;
+
+                // A surrogate pair takes two escapes.
+                uint32_t low;
+                if (code >= 0xD800 && code <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                    chess_record_hex4(p + 2, end, &low) && low >= 0xDC00 && low <= 0xDFFF)
+                {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                else if (code >= 0xD800 && code <= 0xDFFF)
+                {
+                    code = 0xFFFD;
+                }
+
+                if (code < 0x80)
+                {
+                    CHESS_RECORD_PUT(code);
+                }
+                else if (code < 0x800)
+                {
+                    CHESS_RECORD_PUT(0xC0 | (code >> 6));
+                    CHESS_RECORD_PUT(0x80 | (code & 0x3F));
+                }
+                else if (code < 0x10000)
+                {
+                    CHESS_RECORD_PUT(0xE0 | (code >> 12));
+                    CHESS_RECORD_PUT(0x80 | ((code >> 6) & 0x3F));
+                    CHESS_RECORD_PUT(0x80 | (code & 0x3F));
+                }
+                else
+                {
+                    CHESS_RECORD_PUT(0xF0 | (code >> 18));
+                    CHESS_RECORD_PUT(0x80 | ((code >> 12) & 0x3F));
+                    CHESS_RECORD_PUT(0x80 | ((code >> 6) & 0x3F));
+                    CHESS_RECORD_PUT(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default:
+                // \" \\ \/ and anything unknown stand for themselves.
+                CHESS_RECORD_PUT(ch);
+                break;
+        }
+    }
+
+    if (size > 0)
+    {
+        buffer[(length < size) ? length : size - 1] = '\0';
+    }
+
+    return length;
+}
+
+uint64_t chess_record_parser_records(ChessRecordParser *parser)
+{
+    return parser->records;
+}
+
+uint64_t chess_record_parser_skipped_records(ChessRecordParser *parser)
+{
+    return parser->skipped;
+}
+
+size_t chess_record_parser_consumed_bytes(ChessRecordParser *parser)
+{
+    return parser->position;
+}
+
+size_t chess_record_parser_input_size(ChessRecordParser *parser)
+{
+    return parser->length;
+}
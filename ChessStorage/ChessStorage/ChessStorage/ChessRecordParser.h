@@ -0,0 +1,120 @@
+//
+//  ChessRecordParser.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/12.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#ifndef ChessRecordParser_h
+#define ChessRecordParser_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A streaming parser of flat records, from CSV or JSON, into fixed-size batches.
+ * Plain C and POSIX, so it builds and runs anywhere: ChessStorageTests/ChessRecordParserTests.c tests it,
+ * and ChessStorageTests/ChessRecordParserBenchmark.c benchmarks it off device (make test, make benchmark).
+ *
+ * CSV: the first line names the columns. Fields are separated by commas, records by LF or CRLF,
+ *      and may be quoted ("a ""quoted"" value", with commas and line breaks).
+ * JSON: flat objects, either as the elements of a top-level array or one per line (JSON Lines).
+ *      Nested objects and arrays are skipped.
+ *
+ * Only the requested fields are extracted, by column or key name, in the requested order.
+ * Field values point into the input, which is memory mapped when parsing a file: nothing is copied
+ * unless the value has escapes (see chess_record_field_copy). Integers are converted while parsing.
+ *
+ * Delimiters are found 16 bytes at a time (SSE2 or NEON, 8 bytes at a time with plain 64-bit arithmetic elsewhere),
+ * and integers of up to 8 digits are converted without a loop.
+ *
+ * Records that cannot be parsed are skipped and counted, the parser resynchronizes at the next line.
+ * A parser is not thread safe. Functions returning int return 0, or an errno value on failure.
+ **/
+
+typedef enum ChessRecordFormat {
+    CHESS_RECORD_FORMAT_CSV = 0,
+    CHESS_RECORD_FORMAT_JSON,
+} ChessRecordFormat;
+
+#define CHESS_RECORD_FIELD_PRESENT      (1u << 0)   // the record has the field (a JSON null is present, with a NULL value)
+#define CHESS_RECORD_FIELD_INTEGER      (1u << 1)   // integer holds the value
+#define CHESS_RECORD_FIELD_NUMBER       (1u << 2)   // a number (JSON) or numeric text (CSV), maybe not an integer
+#define CHESS_RECORD_FIELD_ESCAPED      (1u << 3)   // value holds escapes, see chess_record_field_copy
+#define CHESS_RECORD_FIELD_BOOLEAN      (1u << 4)   // JSON true or false, integer holds 1 or 0
+#define CHESS_RECORD_FIELD_JSON         (1u << 5)   // from a JSON input, escapes are backslash escapes
+
+typedef struct ChessRecordField {
+    const char *value;      // into the input, not NUL terminated, without the quotes
+    uint32_t length;
+    uint32_t flags;
+    int64_t integer;
+} ChessRecordField;
+
+/**
+ * Up to capacity records, field_count fields each.
+ * The fields of record i are fields[i * field_count] to fields[i * field_count + field_count - 1].
+ * They stay valid until the next call to chess_record_parser_next_batch, or until the parser is closed.
+ **/
+typedef struct ChessRecordBatch {
+    size_t capacity;
+    size_t field_count;
+    size_t count;
+    uint64_t first_record;      // index of the first record of the batch in the input
+    ChessRecordField *fields;
+} ChessRecordBatch;
+
+typedef struct ChessRecordParser ChessRecordParser;
+
+/**
+ * Memory maps the file at path.
+ * field_names are copied, and name the columns (CSV) or keys (JSON) to extract.
+ * A CSV file without one of the columns is not an error: the field is never present.
+ **/
+int chess_record_parser_open(const char *path, ChessRecordFormat format,
+                             const char * const *field_names, size_t field_count,
+                             ChessRecordParser **parser_out);
+
+/**
+ * Same as chess_record_parser_open, over bytes owned by the caller, which must outlive the parser.
+ **/
+int chess_record_parser_create(const void *bytes, size_t length, ChessRecordFormat format,
+                               const char * const *field_names, size_t field_count,
+                               ChessRecordParser **parser_out);
+
+void chess_record_parser_close(ChessRecordParser *parser);
+
+ChessRecordBatch *chess_record_batch_create(size_t capacity, size_t field_count);
+void chess_record_batch_destroy(ChessRecordBatch *batch);
+
+/**
+ * Fills batch with the next records. batch->count is 0 once the input is exhausted.
+ * The pages of the mapping holding the previous batches are handed back to the system,
+ * so a file of any size is parsed with a resident size bounded by the batch.
+ **/
+int chess_record_parser_next_batch(ChessRecordParser *parser, ChessRecordBatch *batch);
+
+/**
+ * Copies the value of the field into buffer, unescaped ("" in CSV, backslash escapes in JSON, as UTF-8),
+ * and NUL terminated if there is room. Returns the length of the unescaped value, which is never more than field->length.
+ **/
+size_t chess_record_field_copy(const ChessRecordField *field, char *buffer, size_t size);
+
+/**
+ * The number of records parsed (in batches) and skipped, and the number of input bytes consumed.
+ **/
+uint64_t chess_record_parser_records(ChessRecordParser *parser);
+uint64_t chess_record_parser_skipped_records(ChessRecordParser *parser);
+size_t chess_record_parser_consumed_bytes(ChessRecordParser *parser);
+size_t chess_record_parser_input_size(ChessRecordParser *parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ChessRecordParser_h */
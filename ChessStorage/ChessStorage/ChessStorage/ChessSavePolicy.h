@@ -0,0 +1,110 @@
+//
+//  ChessSavePolicy.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/20.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "ChessSavePolicyCore.h"
+
+typedef NS_ENUM(NSInteger, ChessSaveDecision) {
+    ChessSaveDecisionNone = 0,      // Keep buffering, nothing to do yet.
+    ChessSaveDecisionSaveNow,       // Save the managedObjectContext right away.
+    ChessSaveDecisionDefer,         // Keep buffering, but make sure a save happens within maxSaveDelay.
+};
+
+/**
+ * ChessSavePolicy decides when ChessStorage flushes its managedObjectContext to disk.
+ *
+ * The default policy reproduces the classic behavior:
+ * save as soon as there are no more pending requests,
+ * or when the number of unsaved changes reaches the saveThreshold of the storage.
+ *
+ * On top of that a policy may:
+ * - coalesce saves, so that a steady trickle of requests is flushed at most every maxSaveDelay seconds,
+ * - bound the estimated memory held by unsaved changes,
+ * - adapt the unsaved changes limit to the measured save latency.
+ *
+ * The policy does not know anything about Core Data.
+ * All inputs are handed to it by ChessStorage (on its storageQueue),
+ * so it may be driven with synthetic values as well.
+ * The decisions themselves are made in plain C by ChessSavePolicyCore.h, which ChessStorageTests replays off device.
+ *
+ * Configure the policy before handing it to ChessStorage.
+ * A copy carries the configuration and the save latency measured so far (write shards work with copies).
+ **/
+
+@interface ChessSavePolicy : NSObject <NSCopying>
+
+/**
+ * Returns a new policy instance which behaves exactly as ChessStorage always did.
+ **/
++ (instancetype)defaultPolicy;
+
+/**
+ * The maximum amount of time unsaved changes may be buffered.
+ *
+ * If zero, the context is saved as soon as there are no more pending requests.
+ * Otherwise saves are coalesced, and happen at the latest maxSaveDelay seconds after the first unsaved change.
+ *
+ * Default 0
+ **/
+@property (nonatomic, assign) NSTimeInterval maxSaveDelay;
+
+/**
+ * The maximum estimated number of bytes held by unsaved changes, before a save is triggered.
+ * The estimation is simply the number of unsaved changes multiplied by estimatedBytesPerChange.
+ *
+ * Default 0 (disabled)
+ **/
+@property (nonatomic, assign) NSUInteger maxEstimatedDirtyBytes;
+
+/**
+ * Default 512
+ **/
+@property (nonatomic, assign) NSUInteger estimatedBytesPerChange;
+
+/**
+ * If enabled, the saveThreshold of the storage is replaced by a limit derived from the measured save latency,
+ * such that a single save is expected to take about targetSaveLatency seconds.
+ * The adaptive limit always stays within [minUnsavedChangesLimit, maxUnsavedChangesLimit].
+ *
+ * Default NO, 0.1 seconds, 100, 10000
+ **/
+@property (nonatomic, assign) BOOL adaptsToSaveLatency;
+@property (nonatomic, assign) NSTimeInterval targetSaveLatency;
+@property (nonatomic, assign) NSUInteger minUnsavedChangesLimit;
+@property (nonatomic, assign) NSUInteger maxUnsavedChangesLimit;
+
+/**
+ * The limit of unsaved changes currently in effect, given the saveThreshold of the storage.
+ **/
+- (NSUInteger)unsavedChangesLimitWithSaveThreshold:(NSUInteger)saveThreshold;
+
+/**
+ * Asks the policy what to do after a request has been processed.
+ *
+ * pendingRequests   : the number of requests still waiting on the storageQueue.
+ * unsavedChanges    : the number of unsaved inserted, updated and deleted objects.
+ * saveThreshold     : the saveThreshold of the storage.
+ * unsavedChangesAge : the number of seconds since the first unsaved change was observed.
+ **/
+- (ChessSaveDecision)decisionWithPendingRequests:(int32_t)pendingRequests
+                                  unsavedChanges:(NSUInteger)unsavedChanges
+                                   saveThreshold:(NSUInteger)saveThreshold
+                               unsavedChangesAge:(NSTimeInterval)unsavedChangesAge;
+
+/**
+ * Invoked by ChessStorage after every successful save.
+ **/
+- (void)didSaveChanges:(NSUInteger)numberOfChanges duration:(NSTimeInterval)duration;
+
+/**
+ * The plain C policy behind this instance, which ChessStorage hands to its ChessStorageWriterCore.
+ * It lives as long as this instance. Configure it through the properties above.
+ **/
+- (const ChessSavePolicyCore *)core;
+
+@end
@@ -0,0 +1,95 @@
+//
+//  ChessSavePolicy.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/20.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessSavePolicy.h"
+
+// The decisions are made by ChessSavePolicyCore.c, this class only carries its state.
+
+@interface ChessSavePolicy ()
+{
+    ChessSavePolicyCore core;
+}
+
+@end
+
+@implementation ChessSavePolicy
+
++ (instancetype)defaultPolicy
+{
+    return [[self alloc] init];
+}
+
+- (id)init
+{
+    if (self = [super init]) {
+        chess_save_policy_init(&core);
+    }
+
+    return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    ChessSavePolicy *copy = [[[self class] allocWithZone:zone] init];
+
+    // The configuration, and the save latency measured so far.
+    copy->core = core;
+
+    return copy;
+}
+
+- (NSTimeInterval)maxSaveDelay { return core.max_save_delay; }
+- (void)setMaxSaveDelay:(NSTimeInterval)maxSaveDelay { core.max_save_delay = maxSaveDelay; }
+
+- (NSUInteger)maxEstimatedDirtyBytes { return core.max_estimated_dirty_bytes; }
+- (void)setMaxEstimatedDirtyBytes:(NSUInteger)maxEstimatedDirtyBytes { core.max_estimated_dirty_bytes = maxEstimatedDirtyBytes; }
+
+- (NSUInteger)estimatedBytesPerChange { return core.estimated_bytes_per_change; }
+- (void)setEstimatedBytesPerChange:(NSUInteger)estimatedBytesPerChange { core.estimated_bytes_per_change = estimatedBytesPerChange; }
+
+- (BOOL)adaptsToSaveLatency { return core.adapts_to_save_latency != 0; }
+- (void)setAdaptsToSaveLatency:(BOOL)adaptsToSaveLatency { core.adapts_to_save_latency = adaptsToSaveLatency ? 1 : 0; }
+
+- (NSTimeInterval)targetSaveLatency { return core.target_save_latency; }
+- (void)setTargetSaveLatency:(NSTimeInterval)targetSaveLatency { core.target_save_latency = targetSaveLatency; }
+
+- (NSUInteger)minUnsavedChangesLimit { return core.min_unsaved_changes_limit; }
+- (void)setMinUnsavedChangesLimit:(NSUInteger)minUnsavedChangesLimit { core.min_unsaved_changes_limit = minUnsavedChangesLimit; }
+
+- (NSUInteger)maxUnsavedChangesLimit { return core.max_unsaved_changes_limit; }
+- (void)setMaxUnsavedChangesLimit:(NSUInteger)maxUnsavedChangesLimit { core.max_unsaved_changes_limit = maxUnsavedChangesLimit; }
+
+- (NSUInteger)unsavedChangesLimitWithSaveThreshold:(NSUInteger)saveThreshold
+{
+    return chess_save_policy_unsaved_changes_limit(&core, saveThreshold);
+}
+
+- (ChessSaveDecision)decisionWithPendingRequests:(int32_t)pendingRequests
+                                  unsavedChanges:(NSUInteger)unsavedChanges
+                                   saveThreshold:(NSUInteger)saveThreshold
+                               unsavedChangesAge:(NSTimeInterval)unsavedChangesAge
+{
+    switch (chess_save_policy_decide(&core, pendingRequests, unsavedChanges, saveThreshold, unsavedChangesAge))
+    {
+        case CHESS_SAVE_POLICY_DECISION_SAVE_NOW : return ChessSaveDecisionSaveNow;
+        case CHESS_SAVE_POLICY_DECISION_DEFER    : return ChessSaveDecisionDefer;
+        default                                  : return ChessSaveDecisionNone;
+    }
+}
+
+- (void)didSaveChanges:(NSUInteger)numberOfChanges duration:(NSTimeInterval)duration
+{
+    chess_save_policy_did_save(&core, numberOfChanges, duration);
+}
+
+- (const ChessSavePolicyCore *)core
+{
+    return &core;
+}
+
+@end
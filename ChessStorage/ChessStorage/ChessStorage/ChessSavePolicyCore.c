@@ -0,0 +1,101 @@
+//
+//  ChessSavePolicyCore.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/20.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessSavePolicyCore.h"
+
+#include <string.h>
+
+// Weight of the latest sample in the moving average of the save cost per change.
+#define CHESS_SAVE_POLICY_LATENCY_SMOOTHING 0.2
+
+void chess_save_policy_init(ChessSavePolicyCore *policy)
+{
+    memset(policy, 0, sizeof(*policy));
+
+    policy->max_save_delay = 0;
+    policy->max_estimated_dirty_bytes = 0;
+    policy->estimated_bytes_per_change = 512;
+
+    policy->adapts_to_save_latency = 0;
+    policy->target_save_latency = 0.1;
+    policy->min_unsaved_changes_limit = 100;
+    policy->max_unsaved_changes_limit = 10000;
+}
+
+size_t chess_save_policy_unsaved_changes_limit(const ChessSavePolicyCore *policy, size_t save_threshold)
+{
+    if (!policy->adapts_to_save_latency || policy->seconds_per_change <= 0)
+    {
+        return save_threshold;
+    }
+
+    double limit = policy->target_save_latency / policy->seconds_per_change;
+
+    if (limit < policy->min_unsaved_changes_limit)
+        return policy->min_unsaved_changes_limit;
+    if (limit > policy->max_unsaved_changes_limit)
+        return policy->max_unsaved_changes_limit;
+
+    return (size_t)limit;
+}
+
+ChessSavePolicyDecision chess_save_policy_decide(const ChessSavePolicyCore *policy,
+                                                 int32_t pending_requests,
+                                                 size_t unsaved_changes,
+                                                 size_t save_threshold,
+                                                 double unsaved_changes_age)
+{
+    if (unsaved_changes == 0)
+    {
+        return CHESS_SAVE_POLICY_DECISION_NONE;
+    }
+
+    // Hard limits, regardless of the pending requests.
+
+    if (unsaved_changes >= chess_save_policy_unsaved_changes_limit(policy, save_threshold))
+    {
+        return CHESS_SAVE_POLICY_DECISION_SAVE_NOW;
+    }
+
+    if (policy->max_estimated_dirty_bytes > 0 &&
+        unsaved_changes * policy->estimated_bytes_per_change >= policy->max_estimated_dirty_bytes)
+    {
+        return CHESS_SAVE_POLICY_DECISION_SAVE_NOW;
+    }
+
+    if (policy->max_save_delay <= 0)
+    {
+        // Classic behavior: save once the flurry of requests has ended.
+
+        return (pending_requests == 0) ? CHESS_SAVE_POLICY_DECISION_SAVE_NOW : CHESS_SAVE_POLICY_DECISION_NONE;
+    }
+
+    // Coalescing behavior: the flurry may never end, so bound the delay instead.
+
+    if (unsaved_changes_age >= policy->max_save_delay)
+    {
+        return CHESS_SAVE_POLICY_DECISION_SAVE_NOW;
+    }
+
+    return CHESS_SAVE_POLICY_DECISION_DEFER;
+}
+
+void chess_save_policy_did_save(ChessSavePolicyCore *policy, size_t number_of_changes, double duration)
+{
+    if (number_of_changes == 0 || duration <= 0)
+    {
+        return;
+    }
+
+    double sample = duration / number_of_changes;
+
+    if (policy->seconds_per_change <= 0)
+        policy->seconds_per_change = sample;
+    else
+        policy->seconds_per_change += CHESS_SAVE_POLICY_LATENCY_SMOOTHING * (sample - policy->seconds_per_change);
+}
@@ -0,0 +1,75 @@
+//
+//  ChessSavePolicyCore.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/20.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#ifndef ChessSavePolicyCore_h
+#define ChessSavePolicyCore_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The decisions of ChessSavePolicy, in plain C, so they can be driven by synthetic request streams
+ * anywhere (see ChessStorageTests/ChessSavePolicyHarness.c). ChessSavePolicy wraps one of these.
+ *
+ * Every input is a plain number: the policy knows nothing about Core Data, queues or clocks.
+ * It is not thread safe, each writing queue of ChessStorage has its own.
+ **/
+
+typedef enum ChessSavePolicyDecision {
+    CHESS_SAVE_POLICY_DECISION_NONE = 0,    // keep buffering
+    CHESS_SAVE_POLICY_DECISION_SAVE_NOW,    // save right away
+    CHESS_SAVE_POLICY_DECISION_DEFER,       // keep buffering, but save within max_save_delay
+} ChessSavePolicyDecision;
+
+typedef struct ChessSavePolicyCore {
+    double max_save_delay;                  // seconds, 0 saves as soon as there are no pending requests
+    size_t max_estimated_dirty_bytes;       // 0 disables the byte budget
+    size_t estimated_bytes_per_change;
+
+    int adapts_to_save_latency;
+    double target_save_latency;             // seconds
+    size_t min_unsaved_changes_limit;
+    size_t max_unsaved_changes_limit;
+
+    double seconds_per_change;              // moving average of the measured saves, 0 until the first one
+} ChessSavePolicyCore;
+
+/**
+ * The default policy: save once there are no more pending requests, or at save_threshold unsaved changes.
+ **/
+void chess_save_policy_init(ChessSavePolicyCore *policy);
+
+/**
+ * The limit of unsaved changes in effect: save_threshold, or the adaptive limit once a save has been measured.
+ **/
+size_t chess_save_policy_unsaved_changes_limit(const ChessSavePolicyCore *policy, size_t save_threshold);
+
+/**
+ * What to do after a request has been processed, given the requests still pending, the unsaved changes,
+ * and the age in seconds of the oldest unsaved change.
+ **/
+ChessSavePolicyDecision chess_save_policy_decide(const ChessSavePolicyCore *policy,
+                                                 int32_t pending_requests,
+                                                 size_t unsaved_changes,
+                                                 size_t save_threshold,
+                                                 double unsaved_changes_age);
+
+/**
+ * Feeds a successful save of number_of_changes changes, which took duration seconds, to the adaptive limit.
+ **/
+void chess_save_policy_did_save(ChessSavePolicyCore *policy, size_t number_of_changes, double duration);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ChessSavePolicyCore_h */
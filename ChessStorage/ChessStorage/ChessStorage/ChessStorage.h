@@ -10,6 +10,23 @@
 #import <CoreData/CoreData.h>
 
 #import "ChessConfig.h"
+#import "ChessSavePolicy.h"
+#import "ChessDirtyObjectTracker.h"
+#import "ChessStorageMetrics.h"
+#import "ChessOperationJournal.h"
+#import "ChessChangeFeed.h"
+#import "ChessQueryAdvisor.h"
+#import "ChessColumnarResult.h"
+#import "ChessMemoryGovernor.h"
+#import "ChessRecordParser.h"
+
+/**
+ * The priority lanes of the storageQueue, see scheduleBlock:lane:.
+ **/
+typedef NS_ENUM(NSInteger, ChessStorageLane) {
+    ChessStorageLaneInteractive = 0,    // Default of executeBlock:. Short requests somebody is waiting for.
+    ChessStorageLaneBulk,               // Default of scheduleBlock:. Imports, maintenance, background sync.
+};
 
 /**
  * This class provides an optional base class that may be used to implement
@@ -43,9 +60,6 @@
 
 @interface ChessStorage : NSObject
 {
-@private
-    int32_t pendingRequests;
-    
 @protected
     NSUInteger saveThreshold;
 }
@@ -56,10 +70,83 @@
  * Since NSManagedObjectContext retains any changed objects until they are saved to disk
  * it is an important memory management concern to keep the number of changed objects within a healthy range.
  *
+ * Unsaved changes are lost if the process is killed before the save. A journal (see below) covers the keyed mutations,
+ * but not the changes made directly to managed objects in your own blocks: keep those in mind before raising it.
+ *
  * Default 500
  **/
 @property (readwrite) NSUInteger saveThreshold;
 
+/**
+ * The savePolicy decides, after each request, whether the managedObjectContext should be saved now,
+ * or whether the save should be postponed.
+ *
+ * The default policy saves when there are no more pending requests,
+ * or when the number of unsaved changes reaches the saveThreshold.
+ * See ChessSavePolicy.h for the coalescing, memory bound and adaptive options.
+ *
+ * Setting nil restores the default policy.
+ **/
+@property (readwrite, strong) ChessSavePolicy *savePolicy;
+
+/**
+ * Opt-in instrumentation: queue wait, block execution time, save duration, changes per save,
+ * rollbacks and pending requests depth. See ChessStorageMetrics.h.
+ *
+ * Default nil (disabled, which costs a single branch per request)
+ **/
+@property (readwrite, strong) ChessStorageMetrics *metrics;
+
+/**
+ * Opt-in write-ahead journal, see ChessOperationJournal.h.
+ *
+ * Buffered changes live in the private managedObjectContext until the next save,
+ * so they are lost if the process is killed meanwhile.
+ * With a journal, every keyed mutation handled on the storageQueue (upsertEntityName:uniquingKeyPaths:values:,
+ * deleteEntityName:uniquingKeyPaths:values:, and thus scheduleBatchUpsertEntityName:) is first appended
+ * to the journal as a compact record, and the records are group committed, one fsync per batch.
+ * That makes it safe to raise the saveThreshold (or the maxSaveDelay of the savePolicy) aggressively.
+ *
+ * When a journal is set, its records that never made it into the store are replayed, and saved.
+ * Every successful save on the storageQueue checkpoints the journal, which starts over once everything is saved.
+ * A failed save rolls the context back, but not the journal: the rolled back records stay in it (and are logged),
+ * to be replayed the next time a journal is set on that file. The rollbacks are counted by the metrics.
+ *
+ * Only the keyed mutations above are journaled: changes made directly to managed objects in your own blocks,
+ * and anything done on a write shard, are not. Those are still lost if the process is killed before the next save,
+ * so route the writes that must survive through the keyed mutations (as RosterStorage does).
+ *
+ * Set it before scheduling any request.
+ *
+ * Default nil
+ **/
+@property (readwrite, strong) ChessOperationJournal *journal;
+
+/**
+ * Opt-in memory governor, see ChessMemoryGovernor.h.
+ *
+ * The registered objects of the managedObjectContext are checked after requests (and between the chunks of
+ * upsertEntityName: and deleteEntityName:), those of the mainThreadManagedObjectContext on the main thread.
+ * Over budget, the private context is saved early and refreshed.
+ * On UIApplicationDidReceiveMemoryWarningNotification, the private context is saved and reset,
+ * and the unchanged objects of the mainThreadManagedObjectContext are refreshed.
+ * The contexts of the write shards, and of performReadOnlyBlock: (reset after each block) are not governed.
+ *
+ * Default nil
+ **/
+@property (readwrite, strong) ChessMemoryGovernor *memoryGovernor;
+
+/**
+ * Returns a snapshot of the unsaved changes in the private managedObjectContext,
+ * including a breakdown per entity name.
+ *
+ * The counters are maintained incrementally from NSManagedObjectContextObjectsDidChangeNotification,
+ * and reset on save or rollback, so this is cheap regardless of the number of unsaved changes.
+ *
+ * This method may be invoked on any thread/queue.
+ **/
+- (ChessUnsavedChangesStatistics *)unsavedChangesStatistics;
+
 /**
  * Convenience method to get a managedObjectContext appropriate for use on the main thread.
  * This context should only be used from the main thread.
@@ -87,6 +174,8 @@
  */
 - (id)initWithConfiguration:(ChessConfig *)configuration;
 
+@property (nonatomic, strong, readonly) ChessConfig *config;
+
 @property (nonatomic, weak, readonly) dispatch_queue_t storageQueue;
 @property (nonatomic, assign, readonly) void *storageQueueTag;
 
@@ -95,7 +184,7 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
- * This method synchronously invokes the given block (dispatch_sync) on the storageQueue.
+ * This method synchronously invokes the given block on the storageQueue, in the interactive lane.
  *
  * Prior to dispatching the block it increments (atomically) the number of pending requests.
  * After the block has been executed, it decrements (atomically) the number of pending requests,
@@ -131,30 +220,226 @@
 - (void)executeBlock:(dispatch_block_t)block;
 
 /**
- * This method asynchronously invokes the given block (dispatch_async) on the storageQueue.
+ * This method asynchronously invokes the given block (dispatch_async) on the storageQueue, in the bulk lane.
  *
  * It works very similarly to the executeBlock method.
  * See the executeBlock method above for a full discussion.
  **/
 - (void)scheduleBlock:(dispatch_block_t)block;
 
+/**
+ * The same as executeBlock and scheduleBlock, in the given lane.
+ *
+ * Both lanes run on the storageQueue, with the same managedObjectContext.
+ * Requests of the same lane run in order. Interactive requests jump ahead of the bulk requests of this storage
+ * at block boundaries, so a synchronous read no longer waits behind thousands of queued import blocks.
+ * Long bulk blocks can also let them in from within, see yieldToInteractiveRequests in ChessStorageProtected.h.
+ * While interactive requests are pending, maybeSave defers the save to the last of them.
+ *
+ * Because of that, an interactive request may run before bulk requests scheduled earlier.
+ * To wait for the bulk work scheduled so far, use executeBlock:lane: with ChessStorageLaneBulk.
+ *
+ * The lanes only apply to the storageQueue: requests of the write shards, and the blocks other storages
+ * with the same configuration dispatch onto the storageQueue, are not reordered.
+ **/
+- (void)executeBlock:(dispatch_block_t)block lane:(ChessStorageLane)lane;
+- (void)scheduleBlock:(dispatch_block_t)block lane:(ChessStorageLane)lane;
+
+/**
+ * The same as executeBlock and scheduleBlock, but on the write shard of the given key (see -[ChessConfig numberOfWriteShards]).
+ *
+ * Within the block, managedObjectContext (and so every fetch, upsert or batch method) is the private context of the shard.
+ * Each shard has its own pending requests counter, unsaved changes and save timer,
+ * so the saves of a shard are buffered independently from the storageQueue and from the other shards.
+ * The savePolicy and saveThreshold apply to every shard, but each shard adapts its own copy of the savePolicy
+ * to the latency of its own saves (see adaptsToSaveLatency). The metrics only cover the storageQueue.
+ *
+ * Without write shards, these methods are equivalent to executeBlock and scheduleBlock.
+ *
+ * Requests with the same key run in order. There is no ordering between different shards,
+ * nor between a shard and the storageQueue.
+ **/
+- (void)executeBlock:(dispatch_block_t)block shardKey:(id<NSObject>)shardKey;
+- (void)scheduleBlock:(dispatch_block_t)block shardKey:(id<NSObject>)shardKey;
+
 /**
  * Sometimes you want to call a method after calling save on a Managed Object Context e.g. didSaveObject:
  *
  * addDidSaveManagedObjectContextBlock allows you to add a block of code to be after saving a Managed Object Context,
  * without the overhead of having to call save at that moment.
  *
- ** invokeQueue: didSaveBlock invoke on this queue. If nil, invokeQueue = storageQueue.
+ * This method may be invoked on any thread/queue, and does not dispatch anywhere.
+ * The block runs after the next save boundary of the queue it was added from:
+ * the write shard within a shard block (see scheduleBlock:shardKey:), the storageQueue otherwise.
+ * If that save fails, the block is dropped along with the rolled back changes.
+ * To tie it to the changes of a particular scheduleBlock, add it from within that block.
+ *
+ ** invokeQueue: didSaveBlock invoke on this queue. If nil, invokeQueue = main queue.
  **/
 - (void)addDidSaveManagedObjectContextBlock:(void (^)(void))didSaveBlock invokeQueue:(dispatch_queue_t)invokeQueue;
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Batch Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Asynchronously inserts or updates (upserts) a batch of objects, via scheduleBlock.
+ *
+ * Each dictionary in valuesArray holds the attribute values of one object,
+ * and must contain a value for each of the uniquingKeyPaths, e.g. @[ @"name" ], or @[ @"name", @"age" ] for a compound key.
+ * Objects whose uniquingKeyPaths values all match an existing object update it, the others are inserted.
+ *
+ * Instead of one fetch per object, this method runs a single IN-predicate fetch per chunk of objects.
+ * The chunk size follows the saveThreshold (see savePolicy), and the context is saved on chunk boundaries,
+ * so the memory held by unsaved changes stays bounded even for very large batches.
+ *
+ * completionBlock is invoked on the main queue once the batch has been processed (not necessarily saved),
+ * and, with a journal, once its records are durable.
+ **/
+- (void)scheduleBatchUpsertEntityName:(NSString *)entityName
+                     uniquingKeyPaths:(NSArray *)keyPaths
+                               values:(NSArray *)valuesArray
+                           completion:(void (^)(void))completionBlock;
+
+/**
+ * Asynchronously sets the given properties on every object matching the criteria, via scheduleBlock,
+ * directly in the persistent store (NSBatchUpdateRequest), without loading the objects into memory.
+ *
+ * propertiesToUpdate maps attribute names to values or expressions,
+ * e.g. @{ @"age": [NSExpression expressionWithFormat:@"age + 1"] }.
+ * Store level updates bypass validation, and do not touch relationships.
+ *
+ * Unsaved changes are saved first. The updated objects are then refreshed in the managedObjectContext
+ * and the mainThreadManagedObjectContext (see -[ChessConfig mergeChangesWithUpdatedObjectIDs:deletedObjectIDs:]),
+ * and the didSave blocks are invoked, as after a save.
+ *
+ * Where the store cannot execute the request (before iOS 8, or stores other than SQLite),
+ * the objects are updated through the managedObjectContext instead, and saved in chunks.
+ *
+ * completionBlock is invoked on the main queue, with the IDs of the updated objects.
+ **/
+- (void)scheduleBatchUpdateEntityName:(NSString *)entityName
+                             criteria:(NSString *)criteria
+                            variables:(NSDictionary *)variables
+                   propertiesToUpdate:(NSDictionary *)properties
+                           completion:(void (^)(NSArray *objectIDs, NSError *error))completionBlock;
+
+/**
+ * Asynchronously deletes every object matching the criteria, via scheduleBlock,
+ * directly in the persistent store (NSBatchDeleteRequest), without loading the objects into memory.
+ * Store level deletes do not apply delete rules, so use it for entities without relationships to clean up.
+ *
+ * Like scheduleBatchUpdateEntityName:, the deletions are merged and the didSave blocks are invoked.
+ * Before iOS 9, or for stores other than SQLite, the objects are deleted through the managedObjectContext instead.
+ *
+ * completionBlock is invoked on the main queue, with the IDs of the deleted objects.
+ **/
+- (void)scheduleBatchDeleteEntityName:(NSString *)entityName
+                             criteria:(NSString *)criteria
+                            variables:(NSDictionary *)variables
+                           completion:(void (^)(NSArray *objectIDs, NSError *error))completionBlock;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Import Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Asynchronously imports the records of a CSV or JSON file (see ChessRecordParser.h),
+ * batchSize records at a time, through upsertEntityName:uniquingKeyPaths:values: (see ChessStorageProtected.h).
+ *
+ * The file is memory mapped and parsed on a background queue, while the previous batches are upserted
+ * on the storageQueue, in the bulk lane (see scheduleBlock:lane:).
+ * At most two parsed batches wait for the storageQueue: beyond that the parser waits for the storage,
+ * so the memory used is bounded by the batch size, whatever the size of the file.
+ *
+ * keyPaths name the attributes to import, as well as the CSV columns or JSON keys they are read from.
+ * Values are converted to the type of their attribute: numbers for integer, boolean, floating point and decimal attributes,
+ * dates from seconds since 1970, strings as they are. uniquingKeyPaths is a subset of keyPaths,
+ * the key of the upserts: records missing a value for any of them are skipped.
+ *
+ * completionBlock is invoked on the main queue once every batch has been upserted (not necessarily saved), e.g.
+ *
+ * @{ @"records": @(100000), @"skippedRecords": @(2), @"batches": @(100), @"bytes": @(2288895),
+ *    @"parseTime": @(0.21), @"duration": @(3.4), @"recordsPerSecond": @(29411) }
+ *
+ * parseTime covers parsing and the conversion to values, off the storageQueue.
+ * If the file cannot be opened, statistics is nil, and error is in the NSPOSIXErrorDomain.
+ * If reading or parsing fails part way, the import stops there: the batches parsed so far are upserted,
+ * and completionBlock gets their statistics along with the error, in the NSPOSIXErrorDomain (e.g. EINVAL for a malformed CSV header, ENOMEM).
+ **/
+- (void)importRecordsFromFileAtPath:(NSString *)path
+                             format:(ChessRecordFormat)format
+                         entityName:(NSString *)entityName
+                   uniquingKeyPaths:(NSArray *)uniquingKeyPaths
+                           keyPaths:(NSArray *)keyPaths
+                          batchSize:(NSUInteger)batchSize
+                         completion:(void (^)(NSDictionary *statistics, NSError *error))completionBlock;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Snapshot Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Same as -[ChessConfig exportSnapshotToPath:completion:], at a save boundary of the storageQueue:
+ * the export is scheduled in the bulk lane, behind the requests scheduled so far,
+ * and the pending changes of the private managedObjectContext are saved first, so the snapshot includes them.
+ * Unsaved changes of the write shards are not included.
+ *
+ * Like scheduleBlock:, this method should not be invoked from the storageQueue.
+ **/
+- (void)exportSnapshotToPath:(NSString *)snapshotPath completion:(void (^)(NSDictionary *manifest, NSError *error))completionBlock;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Object ID Cache
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Registers a read-through cache from uniquing key values to NSManagedObjectIDs for the given entity,
+ * e.g. @[ @"name" ], or @[ @"name", @"age" ] for a compound key. A capacity of 0 removes it.
+ * Several caches, with different key paths, may be registered for the same entity.
+ *
+ * The cache serves the managedObjectContext of the storageQueue (not the write shards):
+ * upsertEntityName: looks up the existing objects of a chunk in the cache registered for its uniquingKeyPaths,
+ * and only fetches the misses, and objectWithEntityName:uniquingKeyPaths:values: (see ChessStorageProtected.h)
+ * only fetches on a miss. The cache is kept up to date from the inserted, updated, deleted and saved objects
+ * of the context, and holds at most capacity entries per entity and key paths, least recently used first out.
+ *
+ * Caches are empty until the storageQueue first touches its managedObjectContext.
+ **/
+- (void)setObjectIDCacheCapacity:(NSUInteger)capacity forEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths;
+
+/**
+ * Returns the count, capacity, hits, misses, hit rate and estimated memory use of each object ID cache,
+ * keyed by entity name, then by key paths (see -[ChessObjectIDCache statistics]).
+ **/
+- (NSDictionary *)objectIDCacheStatistics;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark - Fetch Method
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * Parsed criteria, sort descriptors and entity descriptions are kept in a bounded LRU cache,
+ * one per context type, keyed by (entity, criteria, sortKeys, ascending).
+ * Variables are bound to the cached predicate with predicateWithSubstitutionVariables:,
+ * so always pass changing values as $variables rather than formatting them into the criteria.
+ *
+ * Default capacity 64 (per context type)
+ **/
+@property (atomic, assign) NSUInteger fetchRequestCacheCapacity;
+
+/**
+ * Returns the hits, misses and count of each fetch request cache,
+ * e.g. @{ @"private": @{ @"hits": @(42), @"misses": @(3), @"count": @(3) }, @"mainThread": ... }
+ **/
+- (NSDictionary *)fetchRequestCacheStatistics;
+
 /**
  *  According mark, execute the query function in the right context,
  *  and returns a array which contains fetched results(Type of NSManagedObjectResultType).
+ *
+ *  With propertiesToReturn, the results are dictionaries (NSDictionaryResultType) of those properties, one per object.
+ *  They are not grouped, see fetchValuesOfEntityName: for a GROUP BY.
  */
 - (NSArray *)fetchEntityName:(NSString *)entityName
                     criteria:(NSString *)criteria
@@ -173,4 +458,175 @@
                     distinct:(BOOL)isDistinct
                        error:(NSError **)error;
 
+/**
+ * Asynchronously executes the query on one of the pooled read-only contexts of the configuration
+ * (see -[ChessConfig performReadOnlyBlock:]), so that long reads contend neither with
+ * the writes on the storageQueue nor with the main thread.
+ *
+ * Since managed objects cannot leave their context, the results are NSManagedObjectIDs,
+ * or dictionaries if propertiesToReturn is given.
+ * Use objectWithID: or existingObjectWithID:error: to get the objects in your own context.
+ *
+ * completionBlock is invoked on the main queue.
+ **/
+- (void)fetchEntityName:(NSString *)entityName
+               criteria:(NSString *)criteria
+              variables:(NSDictionary *)variables
+                 sortBy:(NSString *)sortKeys
+              ascending:(BOOL)isAscending
+            fetchOffset:(NSInteger)offset
+             fetchLimit:(NSInteger)limit
+     propertiesToReturn:(NSArray *)properties
+               distinct:(BOOL)isDistinct
+             completion:(void (^)(NSArray *results, NSError *error))completionBlock;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Projection Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The projection methods read values straight from the store, without materializing managed objects:
+ * no object graph, no row cache entries, nothing registered in the context.
+ * Use them for list screens that only show a few attributes, and for statistics.
+ *
+ * Like fetchEntityName:, they run in the context of the current queue: the private managedObjectContext
+ * on the storageQueue, the mainThreadManagedObjectContext otherwise (so only on the storageQueue or the main thread).
+ * They read what the store holds: unsaved changes of the context are not taken into account, except by countEntityName:.
+ * For reads off both, use the asynchronous fetchEntityName: with propertiesToReturn, which returns dictionaries.
+ *
+ * properties are attribute names (or NSPropertyDescriptions). Return nil on error.
+ **/
+
+/**
+ * Returns one dictionary per object, holding the given properties (nil values are left out).
+ * groupBy, if any, adds a GROUP BY on those properties, which must then all be in properties.
+ **/
+- (NSArray *)fetchValuesOfEntityName:(NSString *)entityName
+                            criteria:(NSString *)criteria
+                           variables:(NSDictionary *)variables
+                          properties:(NSArray *)properties
+                             groupBy:(NSArray *)groupBy
+                              sortBy:(NSString *)sortKeys
+                           ascending:(BOOL)isAscending
+                          fetchLimit:(NSInteger)limit
+                               error:(NSError **)error;
+
+/**
+ * Same as fetchValuesOfEntityName:, stored column by column, see ChessColumnarResult.
+ * Numeric attributes end up in C buffers, e.g. the ages of every friend in a single int64_t array.
+ **/
+- (ChessColumnarResult *)fetchColumnsOfEntityName:(NSString *)entityName
+                                         criteria:(NSString *)criteria
+                                        variables:(NSDictionary *)variables
+                                       properties:(NSArray *)properties
+                                           sortBy:(NSString *)sortKeys
+                                        ascending:(BOOL)isAscending
+                                       fetchLimit:(NSInteger)limit
+                                            error:(NSError **)error;
+
+/**
+ * Returns the number of matching objects, counted by the store (SELECT COUNT).
+ * Returns NSNotFound on error.
+ **/
+- (NSUInteger)countEntityName:(NSString *)entityName
+                     criteria:(NSString *)criteria
+                    variables:(NSDictionary *)variables
+                        error:(NSError **)error;
+
+/**
+ * Computes aggregates in the store, e.g.
+ *
+ * [storage aggregateEntityName:@"FriendEntity" criteria:nil variables:nil
+ *                   aggregates:@{ @"youngest": @"min:(age)", @"oldest": @"max:(age)", @"averageAge": @"average:(age)" }
+ *                      groupBy:nil error:NULL]
+ *
+ * returns @[ @{ @"youngest": @(1), @"oldest": @(99), @"averageAge": @(49.8) } ].
+ *
+ * aggregates maps result names to NSExpressions, or to strings in the NSExpression format,
+ * of the functions the store supports: min:, max:, sum:, average: and count:.
+ * sum: of an integer attribute is a 64-bit integer, average: always a double.
+ *
+ * Without groupBy, the result holds a single dictionary. With groupBy, one per group,
+ * also holding the values of the groupBy properties.
+ **/
+- (NSArray *)aggregateEntityName:(NSString *)entityName
+                        criteria:(NSString *)criteria
+                       variables:(NSDictionary *)variables
+                      aggregates:(NSDictionary *)aggregates
+                         groupBy:(NSArray *)groupBy
+                           error:(NSError **)error;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Change Feed
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns a started change feed of the object IDs matching the query (see ChessChangeFeed).
+ *
+ * Instead of one NSFetchedResultsController callback per changed object, changeBlock is invoked on the main queue
+ * with one ChessChangeFeedBatch per coalescing interval at most, diffed off the main thread,
+ * so a table view can apply a whole import in a single beginUpdates / endUpdates.
+ * The first batch inserts the initial results.
+ *
+ * The snapshots are fetched on the read-only contexts of the configuration (see -[ChessConfig performReadOnlyBlock:]),
+ * so the storage must be prepared. Keep a strong reference to the feed, and stop it when done.
+ **/
+- (ChessChangeFeed *)changeFeedWithEntityName:(NSString *)entityName
+                                     criteria:(NSString *)criteria
+                                    variables:(NSDictionary *)variables
+                                       sortBy:(NSString *)sortKeys
+                                    ascending:(BOOL)isAscending
+                                   fetchLimit:(NSInteger)limit
+                                  changeBlock:(void (^)(ChessChangeFeedBatch *batch))changeBlock;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Enumeration Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Walks all objects matching the criteria, batchSize objects at a time, in the order of sortKeys,
+ * without ever holding more than one batch in memory. Useful for exports or analytics over a whole table.
+ *
+ * Instead of a growing fetchOffset (which makes every page slower than the previous one),
+ * each batch is fetched with a keyset predicate that starts right after the last object of the previous batch.
+ * keyPath names an attribute whose values are unique (e.g. the single uniquingKeyPaths of the upserts), ideally indexed.
+ * It is appended to sortKeys unless already there, so objects sharing the other sort key values keep a strict order,
+ * and are visited exactly once. sortKeys may be nil, to enumerate in the order of keyPath.
+ *
+ * Each batch runs in its own autorelease pool. Once the block returns, the objects of the batch are turned
+ * back into faults (objects with unsaved changes keep them), so do not keep them beyond the block.
+ * Set *stop to YES to end the enumeration early.
+ *
+ * Like the synchronous fetch, this runs in the managedObjectContext when invoked on the storageQueue,
+ * and in the mainThreadManagedObjectContext otherwise.
+ * Objects inserted, deleted or re-sorted during the enumeration may be missed or visited twice.
+ *
+ * Returns the number of enumerated objects.
+ **/
+- (NSUInteger)enumerateEntityName:(NSString *)entityName
+                         criteria:(NSString *)criteria
+                        variables:(NSDictionary *)variables
+                           sortBy:(NSString *)sortKeys
+                        ascending:(BOOL)isAscending
+                  uniquingKeyPath:(NSString *)keyPath
+                        batchSize:(NSUInteger)batchSize
+                            error:(NSError **)error
+                       usingBlock:(void (^)(NSArray *batch, BOOL *stop))block;
+
+/**
+ * Same as above, but asynchronously on one of the pooled read-only contexts (see -[ChessConfig performReadOnlyBlock:]).
+ * The block is invoked on the queue of that context, which is reset after every batch.
+ *
+ * completionBlock is invoked on the main queue.
+ **/
+- (void)enumerateEntityName:(NSString *)entityName
+                   criteria:(NSString *)criteria
+                  variables:(NSDictionary *)variables
+                     sortBy:(NSString *)sortKeys
+                  ascending:(BOOL)isAscending
+            uniquingKeyPath:(NSString *)keyPath
+                  batchSize:(NSUInteger)batchSize
+                 usingBlock:(void (^)(NSArray *batch, BOOL *stop))block
+                 completion:(void (^)(NSUInteger count, NSError *error))completionBlock;
+
 @end
@@ -9,7 +9,14 @@
 #import "ChessStorage.h"
 #import <UIKit/UIApplication.h>
 #import <libkern/OSAtomic.h>
+#import <pthread.h>
 #import "ChessMulticastBlockBus.h"
+#import "ChessDirtyObjectTracker.h"
+#import "ChessFetchRequestCache.h"
+#import "ChessObjectIDCache.h"
+#import "ChessQueryAdvisor.h"
+#import "ChessStorageWriterCore.h"
+#import "ChessTime.h"
 
 #define SYSTEM_VERSION_EQUAL_TO(v)                  ([[[UIDevice currentDevice] systemVersion] compare:v options:NSNumericSearch] == NSOrderedSame)
 #define SYSTEM_VERSION_GREATER_THAN(v)              ([[[UIDevice currentDevice] systemVersion] compare:v options:NSNumericSearch] == NSOrderedDescending)
@@ -17,9 +24,128 @@
 #define SYSTEM_VERSION_LESS_THAN(v)                 ([[[UIDevice currentDevice] systemVersion] compare:v options:NSNumericSearch] == NSOrderedAscending)
 #define SYSTEM_VERSION_LESS_THAN_OR_EQUAL_TO(v)     ([[[UIDevice currentDevice] systemVersion] compare:v options:NSNumericSearch] != NSOrderedDescending)
 
+/**
+ * The save buffering state of one writing queue: the storageQueue, or a write shard.
+ * The pending requests and the save deferral are kept by core (see ChessStorageWriterCore.h), the timer by saveTimer.
+ * Apart from the pending requests, which are updated atomically, it is only accessed on its queue.
+ *
+ * didSaveBus holds the blocks waiting for the next save boundary of this queue (see addDidSaveManagedObjectContextBlock),
+ * so that neither another queue's save nor its rollback reaches them.
+ *
+ * savePolicy and saveThreshold are the values of the storage, as of the last time they were handed to this queue
+ * (see updateWritersWithSavePolicy). A write shard has its own copy of the policy, measuring its own saves.
+ **/
+@interface ChessStorageWriter : NSObject
+{
+@public
+    dispatch_queue_t queue;
+    ChessStorageWriterCore core;
+    
+    ChessDirtyObjectTracker *dirtyObjectTracker;
+    ChessMulticastBlockBus *didSaveBus;
+    
+    dispatch_source_t saveTimer;
+    
+    ChessSavePolicy *savePolicy;
+    NSUInteger saveThreshold;
+}
+
+- (id)initWithQueue:(dispatch_queue_t)aQueue savePolicy:(ChessSavePolicy *)aSavePolicy saveThreshold:(NSUInteger)aSaveThreshold;
+
+@end
+
+@implementation ChessStorageWriter
+
+- (id)initWithQueue:(dispatch_queue_t)aQueue savePolicy:(ChessSavePolicy *)aSavePolicy saveThreshold:(NSUInteger)aSaveThreshold
+{
+    if ((self = [super init]))
+    {
+        queue = aQueue;
+        chess_storage_writer_init(&core);
+        dirtyObjectTracker = [[ChessDirtyObjectTracker alloc] init];
+        didSaveBus = [[ChessMulticastBlockBus alloc] init];
+        
+        savePolicy = aSavePolicy;
+        saveThreshold = aSaveThreshold;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (saveTimer)
+    {
+        dispatch_source_cancel(saveTimer);
+#if !OS_OBJECT_USE_OBJC
+        dispatch_release(saveTimer);
+#endif
+    }
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * An interactive request, waiting for the storageQueue.
+ * The semaphore of a synchronous request is signaled once the block has run.
+ **/
+@interface ChessStorageRequest : NSObject
+{
+@public
+    dispatch_block_t block;
+    NSTimeInterval enqueueTime;
+    int32_t pendingDepth;
+    dispatch_semaphore_t semaphore;
+}
+
+@end
+
+@implementation ChessStorageRequest
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 @interface ChessStorage ()
 {
-    ChessMulticastBlockBus *didSaveManagedContextBus;
+    ChessStorageWriter *storageQueueWriter;
+    NSArray *writeShardWriters;     // indexed like -[ChessConfig writeShards]
+    
+    // Priority lanes (see scheduleBlock:lane:).
+    // Bulk requests go through the bulkQueue, which targets the storageQueue,
+    // and is suspended while interactive requests are pending.
+    dispatch_queue_t bulkQueue;
+    pthread_mutex_t laneLock;                   // protects the two below
+    NSMutableArray *interactiveRequests;        // ChessStorageRequest, in order
+    BOOL bulkQueueSuspended;
+    BOOL isPerformingInteractiveRequest;        // only accessed on the storageQueue
+    
+    ChessFetchRequestCache *privateFetchRequestCache;
+    ChessFetchRequestCache *mainThreadFetchRequestCache;
+    ChessFetchRequestCache *readOnlyFetchRequestCache;
+    
+    ChessObjectIDCache *objectIDCache;  // only accessed on the storageQueue, tracks its managedObjectContext
+    
+    ChessSavePolicy *savePolicy;    // only accessed on the storageQueue, the writers have their own snapshot
+    
+    ChessStorageMetrics *metrics;   // only accessed on the storageQueue
+    
+    // Only accessed on the storageQueue.
+    ChessOperationJournal *journal;
+    uint64_t lastJournaledLSN;      // every record up to this one has been applied to the context
+    uint64_t keptJournaledLSN;      // the records from this one on were rolled back, and are kept for replay (0 if none)
+    BOOL isReplayingJournal;
+    volatile BOOL metricsEnabled;   // read on any thread
+    
+    // Only accessed on the storageQueue, see memoryGovernor.
+    ChessMemoryGovernor *memoryGovernor;
+    NSTimeInterval lastMemoryCheckTime;
+    int32_t mainThreadMemoryCheckPending;   // updated atomically
+    
+    // Only accessed on the storageQueue, see -[ChessConfig storeProfile].
+    dispatch_source_t storeMaintenanceTimer;
+    NSTimeInterval lastStoreMaintenanceTime;
 }
 
 @property (nonatomic, strong) ChessConfig   *config;
@@ -27,7 +153,8 @@
 @property (nonatomic, assign) void *storageQueueTag;
 
 /**
- * Queries the managedObjectContext to determine the number of unsaved managedObjects.
+ * Returns the number of unsaved managedObjects of the managedObjectContext.
+ * The number is maintained incrementally, so this is cheap regardless of the number of unsaved changes.
  **/
 - (NSUInteger)numberOfUnsavedChanges;
 
@@ -52,8 +179,10 @@
  * }
  *
  * See also the documentation for executeBlock and scheduleBlock below.
+ *
+ * Returns NO if the save failed, in which case the changes have been rolled back.
  **/
-- (void)save; // Read the comments above !
+- (BOOL)save; // Read the comments above !
 
 /**
  * You will rarely need to manually call this method.
@@ -94,8 +223,31 @@
 - (void)commonInit
 {
     saveThreshold = 500;
+    savePolicy = [ChessSavePolicy defaultPolicy];
+    
+    storageQueueWriter = [[ChessStorageWriter alloc] initWithQueue:storageQueue
+                                                        savePolicy:savePolicy
+                                                     saveThreshold:saveThreshold];
+    
+    bulkQueue = dispatch_queue_create("ChessStorage.bulk", NULL);
+    dispatch_set_target_queue(bulkQueue, storageQueue);
+    pthread_mutex_init(&laneLock, NULL);
+    interactiveRequests = [[NSMutableArray alloc] init];
     
-    didSaveManagedContextBus = [[ChessMulticastBlockBus alloc] initWithMulticastBlockQueue:storageQueue multicastBlockQueueTag:storageQueueTag];
+    NSMutableArray *writers = [NSMutableArray array];
+    for (ChessWriteShard *shard in [self.config writeShards])
+    {
+        [writers addObject:[[ChessStorageWriter alloc] initWithQueue:shard.queue
+                                                          savePolicy:[savePolicy copy]
+                                                       saveThreshold:saveThreshold]];
+    }
+    writeShardWriters = [writers copy];
+    
+    privateFetchRequestCache = [[ChessFetchRequestCache alloc] initWithCapacity:64];
+    mainThreadFetchRequestCache = [[ChessFetchRequestCache alloc] initWithCapacity:64];
+    readOnlyFetchRequestCache = [[ChessFetchRequestCache alloc] initWithCapacity:64];
+    
+    objectIDCache = [[ChessObjectIDCache alloc] init];
     
     /**
      *  In iOS 8.0 ~iOS 9.0,saveMainThreadContext while appplication terminate will generate a crash log,
@@ -107,6 +259,11 @@
                                                      name:UIApplicationWillTerminateNotification
                                                    object:nil];
     }
+    
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(didReceiveMemoryWarning:)
+                                                 name:UIApplicationDidReceiveMemoryWarningNotification
+                                               object:nil];
 }
 
 - (void)saveMainThreadContext
@@ -123,10 +280,17 @@
 
 - (NSUInteger)saveThreshold
 {
-    if (dispatch_get_specific(storageQueueTag))
+    void *queueSpecific = dispatch_get_specific(storageQueueTag);
+    
+    if (queueSpecific == storageQueueTag)
     {
         return saveThreshold;
     }
+    else if (queueSpecific)
+    {
+        // Within a write shard: its own snapshot (see updateWritersWithSavePolicy).
+        return [self currentWriter]->saveThreshold;
+    }
     else
     {
         __block NSUInteger result;
@@ -143,9 +307,170 @@
 {
     dispatch_block_t block = ^{
         saveThreshold = newSaveThreshold;
+        [self updateWritersWithSavePolicy];
     };
     
-    if (dispatch_get_specific(storageQueueTag))
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_async(storageQueue, block);
+}
+
+- (ChessSavePolicy *)savePolicy
+{
+    void *queueSpecific = dispatch_get_specific(storageQueueTag);
+    
+    if (queueSpecific == storageQueueTag)
+    {
+        return savePolicy;
+    }
+    else if (queueSpecific)
+    {
+        // Within a write shard: its own snapshot (see updateWritersWithSavePolicy).
+        return [self currentWriter]->savePolicy;
+    }
+    else
+    {
+        __block ChessSavePolicy *result;
+        
+        dispatch_sync(storageQueue, ^{
+            result = savePolicy;
+        });
+        
+        return result;
+    }
+}
+
+- (void)setSavePolicy:(ChessSavePolicy *)newSavePolicy
+{
+    dispatch_block_t block = ^{
+        savePolicy = newSavePolicy ? newSavePolicy : [ChessSavePolicy defaultPolicy];
+        [self updateWritersWithSavePolicy];
+    };
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_async(storageQueue, block);
+}
+
+- (void)updateWritersWithSavePolicy
+{
+    NSAssert(dispatch_get_specific(storageQueueTag) == storageQueueTag, @"Invoked on incorrect queue");
+    
+    // The write shards read the policy and the threshold on their own queue, so they get them there.
+    
+    storageQueueWriter->savePolicy = savePolicy;
+    storageQueueWriter->saveThreshold = saveThreshold;
+    
+    for (ChessStorageWriter *writer in writeShardWriters)
+    {
+        ChessSavePolicy *writerSavePolicy = [savePolicy copy];
+        NSUInteger writerSaveThreshold = saveThreshold;
+        
+        dispatch_async(writer->queue, ^{
+            writer->savePolicy = writerSavePolicy;
+            writer->saveThreshold = writerSaveThreshold;
+        });
+    }
+}
+
+- (ChessStorageMetrics *)metrics
+{
+    // The write shards carry the storageQueueTag as well, these ivars belong to the storageQueue alone.
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+    {
+        return metrics;
+    }
+    else
+    {
+        __block ChessStorageMetrics *result;
+        
+        dispatch_sync(storageQueue, ^{
+            result = metrics;
+        });
+        
+        return result;
+    }
+}
+
+- (void)setMetrics:(ChessStorageMetrics *)newMetrics
+{
+    dispatch_block_t block = ^{
+        metrics = newMetrics;
+        metricsEnabled = (newMetrics != nil);
+    };
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_async(storageQueue, block);
+}
+
+- (ChessMemoryGovernor *)memoryGovernor
+{
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+    {
+        return memoryGovernor;
+    }
+    else
+    {
+        __block ChessMemoryGovernor *result;
+        
+        dispatch_sync(storageQueue, ^{
+            result = memoryGovernor;
+        });
+        
+        return result;
+    }
+}
+
+- (void)setMemoryGovernor:(ChessMemoryGovernor *)newMemoryGovernor
+{
+    dispatch_block_t block = ^{
+        memoryGovernor = newMemoryGovernor;
+        lastMemoryCheckTime = 0;
+    };
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_async(storageQueue, block);
+}
+
+- (ChessOperationJournal *)journal
+{
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+    {
+        return journal;
+    }
+    else
+    {
+        __block ChessOperationJournal *result;
+        
+        dispatch_sync(storageQueue, ^{
+            result = journal;
+        });
+        
+        return result;
+    }
+}
+
+- (void)setJournal:(ChessOperationJournal *)newJournal
+{
+    dispatch_block_t block = ^{ @autoreleasepool {
+        journal = newJournal;
+        lastJournaledLSN = 0;
+        keptJournaledLSN = 0;
+        
+        if (journal)
+        {
+            [self replayJournal];
+        }
+    }};
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
         block();
     else
         dispatch_async(storageQueue, block);
@@ -158,7 +483,63 @@
 
 - (NSManagedObjectContext *)managedObjectContext
 {
-    return [self.config managedObjectContext];
+    NSManagedObjectContext *moc = [self.config managedObjectContext];
+    ChessStorageWriter *writer = [self currentWriter];
+    ChessDirtyObjectTracker *tracker = writer->dirtyObjectTracker;
+    
+    if (moc != tracker.managedObjectContext)
+    {
+        [tracker startTrackingManagedObjectContext:moc];
+    }
+    
+    if (writer == storageQueueWriter && moc != objectIDCache.managedObjectContext)
+    {
+        [objectIDCache startTrackingManagedObjectContext:moc];
+    }
+    
+    return moc;
+}
+
+- (ChessStorageWriter *)currentWriter
+{
+    // The write shards carry the storageQueueTag as well, with the shard as value.
+    void *queueSpecific = dispatch_get_specific(storageQueueTag);
+    
+    if (queueSpecific == NULL || queueSpecific == storageQueueTag)
+    {
+        return storageQueueWriter;
+    }
+    
+    return writeShardWriters[[(__bridge ChessWriteShard *)queueSpecific index]];
+}
+
+- (ChessStorageWriter *)writerForShardKey:(id<NSObject>)shardKey
+{
+    ChessWriteShard *shard = [self.config writeShardForKey:shardKey];
+    if (shard == nil)
+    {
+        return storageQueueWriter;
+    }
+    
+    return writeShardWriters[shard.index];
+}
+
+- (ChessUnsavedChangesStatistics *)unsavedChangesStatistics
+{
+    __block ChessUnsavedChangesStatistics *result = nil;
+    
+    dispatch_block_t block = ^{ @autoreleasepool {
+        [[self managedObjectContext] processPendingChanges];
+        result = [[self currentWriter]->dirtyObjectTracker statistics];
+    }};
+    
+    // Within a write shard, the statistics of its own context.
+    if (dispatch_get_specific(storageQueueTag))
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+    
+    return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -167,17 +548,23 @@
 
 - (NSUInteger)numberOfUnsavedChanges
 {
-    NSManagedObjectContext *moc = [self managedObjectContext];
+    // Flush the pending changes, so that the tracker receives its ObjectsDidChange notification.
+    // This only costs as much as the changes made since the previous call.
+    [[self managedObjectContext] processPendingChanges];
+    
+    return [[self currentWriter]->dirtyObjectTracker numberOfUnsavedChanges];
+}
+
+- (NSUInteger)unsavedChangesLimit
+{
+    // The chunk size of the batch methods, on the storageQueue or a write shard.
     
-    NSUInteger unsavedCount = 0;
-    unsavedCount += [[moc updatedObjects] count];
-    unsavedCount += [[moc insertedObjects] count];
-    unsavedCount += [[moc deletedObjects] count];
+    ChessStorageWriter *writer = [self currentWriter];
     
-    return unsavedCount;
+    return MAX([writer->savePolicy unsavedChangesLimitWithSaveThreshold:writer->saveThreshold], 1);
 }
 
-- (void)save
+- (BOOL)save
 {
     // I'm fairly confident that the implementation of [NSManagedObjectContext save:]
     // internally checks to see if it has anything to save before it actually does anthing.
@@ -186,15 +573,67 @@
     
     NSError *error = nil;
     
+    ChessStorageWriter *writer = [self currentWriter];
+    
+    // The metrics are not thread safe, they only cover the storageQueue.
+    ChessStorageMetrics *saveMetrics = (writer == storageQueueWriter) ? metrics : nil;
+    
+    NSUInteger unsavedCount = [self numberOfUnsavedChanges];
+    NSTimeInterval start = ChessMonotonicTime();
+    uint64_t saveInterval = saveMetrics ? [saveMetrics beginSaveInterval] : 0;
+    
+    chess_storage_writer_will_save(&writer->core);
+    
     if ([[self managedObjectContext] save:&error]){
         
-        [didSaveManagedContextBus multicastBlocks];
+        NSTimeInterval duration = ChessMonotonicTime() - start;
+        [writer->savePolicy didSaveChanges:unsavedCount duration:duration];
+        
+        if (saveMetrics)
+        {
+            [saveMetrics endSaveInterval:saveInterval];
+            [saveMetrics recordSaveDuration:duration numberOfChanges:unsavedCount];
+        }
+        
+        [writer->didSaveBus multicastBlocks];
+        
+        // The journaled changes are in the store now, except those of a previous rollback.
+        // While replaying, the journal is checkpointed once every record has been applied (see replayJournal).
+        if (writer == storageQueueWriter && journal && !isReplayingJournal)
+        {
+            uint64_t lsn = (keptJournaledLSN > 0) ? MIN(lastJournaledLSN, keptJournaledLSN - 1) : lastJournaledLSN;
+            [journal checkpointThroughLSN:lsn];
+        }
+        
+        return YES;
     }
     else
     {
         [[self managedObjectContext] rollback];
+        [writer->dirtyObjectTracker reset];
+        
+        if (saveMetrics)
+        {
+            [saveMetrics endSaveInterval:saveInterval];
+            [saveMetrics recordRollback];
+        }
+        
+        [writer->didSaveBus removeAllInvokeBlocks];
+        
+        // The rolled back changes are lost for the context, not for the journal:
+        // their records are no longer checkpointed, so they are replayed the next time the journal is set.
+        if (writer == storageQueueWriter && journal && lastJournaledLSN > [journal checkpointLSN])
+        {
+            if (keptJournaledLSN == 0)
+            {
+                keptJournaledLSN = [journal checkpointLSN] + 1;
+            }
+            
+            NSLog(@"%@: Save failed, journaled records %llu to %llu are kept for replay: %@",
+                  [self class], keptJournaledLSN, lastJournaledLSN, error);
+        }
         
-        [didSaveManagedContextBus removeAllInvokeBlocks];
+        return NO;
     }
 }
 
@@ -202,34 +641,92 @@
 {
     NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
     
+    // Somebody is waiting on the storageQueue, don't make them wait for the disk as well.
+    // The last interactive request invokes maybeSave again.
+    if ([self hasPendingInteractiveRequests])
+    {
+        [metrics recordDeferredSave];
+        return;
+    }
     
     if ([[self managedObjectContext] hasChanges])
     {
-        if (currentPendingRequests == 0)
+        ChessStorageWriter *writer = [self currentWriter];
+        
+        double timerDelay = 0;
+        ChessStorageWriterAction action = chess_storage_writer_maybe_save(&writer->core,
+                                                                          [writer->savePolicy core],
+                                                                          currentPendingRequests,
+                                                                          [self numberOfUnsavedChanges],
+                                                                          writer->saveThreshold,
+                                                                          ChessMonotonicTime(),
+                                                                          &timerDelay);
+        if (action == CHESS_STORAGE_WRITER_ACTION_SAVE)
         {
             [self save];
         }
-        else
+        else if (action == CHESS_STORAGE_WRITER_ACTION_ARM_TIMER)
         {
-            NSUInteger unsavedCount = [self numberOfUnsavedChanges];
-            if (unsavedCount >= saveThreshold)
-            {
-                [self save];
-            }
+            [self armSaveTimerOfWriter:writer withDelay:timerDelay];
         }
     } else {
-        [didSaveManagedContextBus multicastBlocks];
+        [[self currentWriter]->didSaveBus multicastBlocks];
+    }
+    
+    [self governManagedObjectContext];
+    
+    if (currentPendingRequests == 0 && [self currentWriter] == storageQueueWriter)
+    {
+        [self scheduleStoreMaintenance];
+    }
+}
+
+- (void)armSaveTimerOfWriter:(ChessStorageWriter *)writer withDelay:(NSTimeInterval)delay
+{
+    // A single timer per writing queue coalesces all deferred saves (see chess_storage_writer_maybe_save).
+    // It fires once, and simply asks the savePolicy again.
+    
+    if (writer->saveTimer == NULL)
+    {
+        writer->saveTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, writer->queue);
+        
+        __weak ChessStorage *weakSelf = self;
+        dispatch_source_set_event_handler(writer->saveTimer, ^{ @autoreleasepool {
+            
+            ChessStorage *strongSelf = weakSelf;
+            if (strongSelf == nil) return;
+            
+            // The timer fires on the queue of its writer.
+            chess_storage_writer_save_timer_fired(&[strongSelf currentWriter]->core);
+            [strongSelf maybeSave];
+        }});
+        
+        dispatch_source_set_timer(writer->saveTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(writer->saveTimer);
     }
+    
+    int64_t delayInNanoseconds = (int64_t)(MAX(delay, 0) * NSEC_PER_SEC);
+    dispatch_source_set_timer(writer->saveTimer, dispatch_time(DISPATCH_TIME_NOW, delayInNanoseconds), DISPATCH_TIME_FOREVER, NSEC_PER_MSEC);
 }
 
 - (void)maybeSave
 {
     // Convenience method in the very rare case that a subclass would need to invoke maybeSave manually.
     
-    [self maybeSave:OSAtomicAdd32(0, &pendingRequests)];
+    [self maybeSave:chess_storage_writer_pending_requests(&[self currentWriter]->core)];
 }
 
 - (void)executeBlock:(dispatch_block_t)block
+{
+    [self executeBlock:block lane:ChessStorageLaneInteractive];
+}
+
+- (void)scheduleBlock:(dispatch_block_t)block
+{
+    [self scheduleBlock:block lane:ChessStorageLaneBulk];
+}
+
+- (void)executeBlock:(dispatch_block_t)block lane:(ChessStorageLane)lane
 {
     // By design this method should not be invoked from the storageQueue.
     //
@@ -243,24 +740,37 @@
     // dispatch_Sync
     //          ^
     
-    OSAtomicIncrement32(&pendingRequests);
-    
-    dispatch_sync(storageQueue, ^{ @autoreleasepool {
+    if (lane == ChessStorageLaneInteractive)
+    {
+        // The request may run from the trampoline, or earlier from a yielding bulk block,
+        // so wait for the request itself rather than dispatch_sync.
         
-        block();
+        ChessStorageRequest *request = [self enqueueInteractiveRequestWithBlock:block synchronous:YES];
+        dispatch_semaphore_wait(request->semaphore, DISPATCH_TIME_FOREVER);
+        return;
+    }
+    
+    ChessStorageWriter *writer = storageQueueWriter;
+    
+    int32_t pendingDepth = chess_storage_writer_enqueue(&writer->core);
+    NSTimeInterval enqueueTime = metricsEnabled ? ChessMonotonicTime() : 0;
+    
+    dispatch_sync(bulkQueue, ^{ @autoreleasepool {
+        
+        [self performRequestBlock:block enqueueTime:enqueueTime pendingDepth:pendingDepth interactive:NO];
         
         // Since this is a synchronous request, we want to return as quickly as possible.
         // So we delay the maybeSave operation til later.
         
-        dispatch_async(storageQueue, ^{ @autoreleasepool {
+        dispatch_async(bulkQueue, ^{ @autoreleasepool {
             
-            [self maybeSave:OSAtomicDecrement32(&pendingRequests)];
+            [self maybeSave:chess_storage_writer_dequeue(&writer->core)];
         }});
         
     }});
 }
 
-- (void)scheduleBlock:(dispatch_block_t)block
+- (void)scheduleBlock:(dispatch_block_t)block lane:(ChessStorageLane)lane
 {
     // By design this method should not be invoked from the storageQueue.
     //
@@ -274,43 +784,1461 @@
     // dispatch_Async
     //          ^
     
-    OSAtomicIncrement32(&pendingRequests);
-    dispatch_async(storageQueue, ^{ @autoreleasepool {
+    if (lane == ChessStorageLaneInteractive)
+    {
+        [self enqueueInteractiveRequestWithBlock:block synchronous:NO];
+        return;
+    }
+    
+    ChessStorageWriter *writer = storageQueueWriter;
+    
+    int32_t pendingDepth = chess_storage_writer_enqueue(&writer->core);
+    NSTimeInterval enqueueTime = metricsEnabled ? ChessMonotonicTime() : 0;
+    
+    dispatch_async(bulkQueue, ^{ @autoreleasepool {
+        
+        [self performRequestBlock:block enqueueTime:enqueueTime pendingDepth:pendingDepth interactive:NO];
+        [self maybeSave:chess_storage_writer_dequeue(&writer->core)];
+    }});
+}
+
+- (void)executeBlock:(dispatch_block_t)block shardKey:(id<NSObject>)shardKey
+{
+    // Same rules as executeBlock, from a write shard as well.
+    NSAssert(!dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+    
+    ChessStorageWriter *writer = [self writerForShardKey:shardKey];
+    if (writer == storageQueueWriter)
+    {
+        [self executeBlock:block];
+        return;
+    }
+    
+    chess_storage_writer_enqueue(&writer->core);
+    
+    dispatch_sync(writer->queue, ^{ @autoreleasepool {
+        
+        block();
+        
+        dispatch_async(writer->queue, ^{ @autoreleasepool {
+            
+            [self maybeSave:chess_storage_writer_dequeue(&writer->core)];
+        }});
+    }});
+}
+
+- (void)scheduleBlock:(dispatch_block_t)block shardKey:(id<NSObject>)shardKey
+{
+    // Same rules as scheduleBlock, from a write shard as well.
+    NSAssert(!dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+    
+    ChessStorageWriter *writer = [self writerForShardKey:shardKey];
+    if (writer == storageQueueWriter)
+    {
+        [self scheduleBlock:block];
+        return;
+    }
+    
+    chess_storage_writer_enqueue(&writer->core);
+    
+    dispatch_async(writer->queue, ^{ @autoreleasepool {
         
         block();
-        [self maybeSave:OSAtomicDecrement32(&pendingRequests)];
+        [self maybeSave:chess_storage_writer_dequeue(&writer->core)];
+    }});
+}
+
+- (void)performRequestBlock:(dispatch_block_t)block
+                enqueueTime:(NSTimeInterval)enqueueTime
+               pendingDepth:(int32_t)pendingDepth
+                interactive:(BOOL)interactive
+{
+    if (metrics == nil)
+    {
+        block();
+        return;
+    }
+    
+    NSTimeInterval start = ChessMonotonicTime();
+    if (enqueueTime > 0)
+    {
+        [metrics recordEnqueueWithPendingDepth:pendingDepth];
+        [metrics recordQueueWait:(start - enqueueTime) interactive:interactive];
+    }
+    
+    uint64_t blockInterval = [metrics beginBlockInterval];
+    
+    block();
+    
+    [metrics endBlockInterval:blockInterval];
+    [metrics recordBlockExecution:(ChessMonotonicTime() - start)];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Priority Lanes
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (ChessStorageRequest *)enqueueInteractiveRequestWithBlock:(dispatch_block_t)block synchronous:(BOOL)synchronous
+{
+    // This method may be invoked on any thread/queue, except the storageQueue.
+    
+    ChessStorageWriter *writer = storageQueueWriter;
+    
+    ChessStorageRequest *request = [[ChessStorageRequest alloc] init];
+    request->block = block;
+    request->pendingDepth = chess_storage_writer_enqueue(&writer->core);
+    request->enqueueTime = metricsEnabled ? ChessMonotonicTime() : 0;
+    request->semaphore = synchronous ? dispatch_semaphore_create(0) : NULL;
+    
+    pthread_mutex_lock(&laneLock);
+    
+    [interactiveRequests addObject:request];
+    
+    // Bulk requests stop at the next block boundary, until every interactive request has run.
+    if (!bulkQueueSuspended)
+    {
+        dispatch_suspend(bulkQueue);
+        bulkQueueSuspended = YES;
+    }
+    
+    pthread_mutex_unlock(&laneLock);
+    
+    // One trampoline per request. It finds nothing to do if a yielding bulk block already ran the request.
+    dispatch_async(storageQueue, ^{ @autoreleasepool {
+        
+        if ([self performInteractiveRequests] > 0)
+        {
+            [self maybeSave:chess_storage_writer_pending_requests(&writer->core)];
+        }
+    }});
+    
+    return request;
+}
+
+- (NSUInteger)performInteractiveRequests
+{
+    // Invoked on the storageQueue.
+    // Returns the number of requests performed.
+    
+    NSUInteger count = 0;
+    
+    while (YES)
+    { @autoreleasepool {
+        
+        pthread_mutex_lock(&laneLock);
+        
+        ChessStorageRequest *request = [interactiveRequests firstObject];
+        if (request)
+        {
+            [interactiveRequests removeObjectAtIndex:0];
+        }
+        else if (bulkQueueSuspended)
+        {
+            dispatch_resume(bulkQueue);
+            bulkQueueSuspended = NO;
+        }
+        
+        pthread_mutex_unlock(&laneLock);
+        
+        if (request == nil)
+        {
+            break;
+        }
+        
+        isPerformingInteractiveRequest = YES;
+        [self performRequestBlock:request->block enqueueTime:request->enqueueTime pendingDepth:request->pendingDepth interactive:YES];
+        isPerformingInteractiveRequest = NO;
+        
+        chess_storage_writer_dequeue(&storageQueueWriter->core);
+        count++;
+        
+        if (request->semaphore)
+        {
+            dispatch_semaphore_signal(request->semaphore);
+        }
+    }}
+    
+    return count;
+}
+
+- (BOOL)hasPendingInteractiveRequests
+{
+    if (dispatch_get_specific(storageQueueTag) != storageQueueTag)
+    {
+        // Write shards have no lanes.
+        return NO;
+    }
+    
+    pthread_mutex_lock(&laneLock);
+    BOOL result = ([interactiveRequests count] > 0);
+    pthread_mutex_unlock(&laneLock);
+    
+    return result;
+}
+
+- (void)yieldToInteractiveRequests
+{
+    NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+    
+    if (isPerformingInteractiveRequest || dispatch_get_specific(storageQueueTag) != storageQueueTag)
+    {
+        return;
+    }
+    
+    // The caller has saved its own changes, so these are the requests' alone:
+    // save them now, rather than along with (and at the mercy of) the next chunk of the caller.
+    if ([self performInteractiveRequests] > 0 && [[self managedObjectContext] hasChanges])
+    {
+        [self save];
+    }
+}
+
+- (void)addDidSaveManagedObjectContextBlock:(void (^)(void))didSaveBlock invokeQueue:(dispatch_queue_t)invokeQueue;
+{
+    // The bus is lock-free, no need to hop onto the storageQueue.
+    // Outside of the storageQueue and the write shards, the block waits for the storageQueue.
+    [[self currentWriter]->didSaveBus addInvokeBlock:didSaveBlock invokeQueue:invokeQueue];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Journal
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)journalOperation:(NSString *)operation
+              entityName:(NSString *)entityName
+        uniquingKeyPaths:(NSArray *)keyPaths
+                 objects:(NSArray *)objects
+{
+    if ([self currentWriter] != storageQueueWriter || journal == nil || isReplayingJournal)
+    {
+        return;
+    }
+    
+    NSDictionary *plist = @{ @"op"       : operation,
+                             @"entity"   : entityName,
+                             @"keyPaths" : keyPaths,
+                             @"objects"  : objects };
+    
+    NSError *error = nil;
+    NSData *record = [NSPropertyListSerialization dataWithPropertyList:plist
+                                                                format:NSPropertyListBinaryFormat_v1_0
+                                                               options:0
+                                                                 error:&error];
+    if (record == nil)
+    {
+        NSLog(@"%@: Cannot journal %@ of %@: %@", [self class], operation, entityName, error);
+        return;
+    }
+    
+    uint64_t lsn = [journal appendRecord:record];
+    if (lsn == 0)
+    {
+        // The journal is full. Saving checkpoints it, which frees it up entirely.
+        // A failed save checkpoints nothing (its records are kept for replay), so the journal is still full.
+        if ([self save])
+        {
+            lsn = [journal appendRecord:record];
+        }
+    }
+    
+    if (lsn == 0)
+    {
+        NSLog(@"%@: Cannot journal %@ of %@: journal is full", [self class], operation, entityName);
+        return;
+    }
+    
+    lastJournaledLSN = lsn;
+    [journal commitWithCompletion:nil];
+}
+
+- (void)replayJournal
+{
+    NSAssert(dispatch_get_specific(storageQueueTag) == storageQueueTag, @"Invoked on incorrect queue");
+    
+    // These records were journaled, but never saved, e.g. because the process was killed before the save.
+    // Applying a large record saves in chunks along the way. Those saves do not checkpoint the journal:
+    // the records only count as applied once all of them have been, and saved (below).
+    
+    isReplayingJournal = YES;
+    
+    NSUInteger count = [journal replayRecordsUsingBlock:^BOOL(uint64_t lsn, NSData *record) {
+        
+        [self applyJournalRecord:record];
+        
+        return YES;
+    }];
+    
+    isReplayingJournal = NO;
+    lastJournaledLSN = [journal lastLSN];
+    
+    if (count > 0)
+    {
+        [self save];
+    }
+}
+
+- (void)applyJournalRecord:(NSData *)record
+{
+    NSDictionary *plist = [NSPropertyListSerialization propertyListWithData:record
+                                                                    options:NSPropertyListImmutable
+                                                                     format:NULL
+                                                                      error:NULL];
+    if (![plist isKindOfClass:[NSDictionary class]])
+    {
+        return;
+    }
+    
+    NSString *operation = plist[@"op"];
+    NSString *entityName = plist[@"entity"];
+    NSArray *keyPaths = plist[@"keyPaths"];
+    NSArray *objects = plist[@"objects"];
+    
+    if ([operation isEqualToString:@"upsert"])
+    {
+        [self upsertEntityName:entityName uniquingKeyPaths:keyPaths values:objects];
+    }
+    else if ([operation isEqualToString:@"delete"])
+    {
+        [self deleteEntityName:entityName uniquingKeyPaths:keyPaths values:objects];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Memory Governor
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void ChessRefreshRegisteredObjects(NSManagedObjectContext *moc)
+{
+    // refreshAllObjects is iOS 8.3 and later. Both keep the pending changes.
+    
+    if ([moc respondsToSelector:@selector(refreshAllObjects)])
+    {
+        [moc refreshAllObjects];
+        return;
+    }
+    
+    for (NSManagedObject *object in [[moc registeredObjects] allObjects])
+    {
+        if (![object isFault] && ![object hasChanges])
+        {
+            [moc refreshObject:object mergeChanges:NO];
+        }
+    }
+}
+
+- (ChessMemoryTrim)checkManagedObjectContext:(NSManagedObjectContext *)moc
+                                 contextName:(NSString *)contextName
+                                    governor:(ChessMemoryGovernor *)governor
+{
+    // Invoked on the queue of the context.
+    
+    if (moc == nil)
+    {
+        return ChessMemoryTrimNone;
+    }
+    
+    NSTimeInterval stalenessInterval = governor.stalenessInterval;
+    if (stalenessInterval >= 0 && [moc stalenessInterval] != stalenessInterval)
+    {
+        [moc setStalenessInterval:stalenessInterval];
+    }
+    
+    NSSet *registeredObjects = [moc registeredObjects];
+    
+    NSUInteger faults = 0;
+    for (NSManagedObject *object in registeredObjects)
+    {
+        if ([object isFault]) faults++;
+    }
+    
+    [governor recordCheckOfContextNamed:contextName registeredObjects:[registeredObjects count] faults:faults];
+    
+    return [governor trimWithRegisteredObjects:[registeredObjects count] faults:faults];
+}
+
+- (void)governManagedObjectContext
+{
+    // Invoked on the storageQueue, between requests, or between the chunks of a request.
+    
+    if (dispatch_get_specific(storageQueueTag) != storageQueueTag || memoryGovernor == nil)
+    {
+        // The write shards are not governed.
+        return;
+    }
+    
+    NSTimeInterval now = ChessMonotonicTime();
+    if (lastMemoryCheckTime > 0 && (now - lastMemoryCheckTime) < memoryGovernor.checkInterval)
+    {
+        return;
+    }
+    lastMemoryCheckTime = now;
+    
+    ChessMemoryTrim trim = [self checkManagedObjectContext:[self managedObjectContext] contextName:@"private" governor:memoryGovernor];
+    if (trim != ChessMemoryTrimNone)
+    {
+        [self trimManagedObjectContext:trim];
+    }
+    
+    if (memoryGovernor.governsMainThreadContext)
+    {
+        [self governMainThreadManagedObjectContextForcingTrim:NO];
+    }
+}
+
+- (void)trimManagedObjectContext:(ChessMemoryTrim)trim
+{
+    NSAssert(dispatch_get_specific(storageQueueTag) == storageQueueTag, @"Invoked on incorrect queue");
+    
+    NSManagedObjectContext *moc = [self managedObjectContext];
+    
+    // Changed objects are retained by the context until saved, whatever we do.
+    if ([moc hasChanges])
+    {
+        [memoryGovernor recordEarlySave];
+        [self save];
+    }
+    
+    if (trim == ChessMemoryTrimReset)
+    {
+        // Only between requests: nobody holds on to an object of the context.
+        [moc reset];
+    }
+    else
+    {
+        ChessRefreshRegisteredObjects(moc);
+    }
+    
+    [memoryGovernor recordTrim:trim ofContextNamed:@"private" remainingObjects:[[moc registeredObjects] count]];
+}
+
+- (void)governMainThreadManagedObjectContextForcingTrim:(BOOL)forceTrim
+{
+    // Invoked on the storageQueue. At most one regular check is pending on the main thread at a time.
+    
+    if (!forceTrim && !OSAtomicCompareAndSwap32(0, 1, &mainThreadMemoryCheckPending))
+    {
+        return;
+    }
+    
+    ChessMemoryGovernor *governor = memoryGovernor;
+    
+    dispatch_async(dispatch_get_main_queue(), ^{ @autoreleasepool {
+        
+        if (!forceTrim)
+        {
+            OSAtomicCompareAndSwap32(1, 0, &mainThreadMemoryCheckPending);
+        }
+        
+        NSManagedObjectContext *moc = [self mainThreadManagedObjectContext];
+        
+        ChessMemoryTrim trim = [self checkManagedObjectContext:moc contextName:@"mainThread" governor:governor];
+        if (moc && (trim != ChessMemoryTrimNone || forceTrim))
+        {
+            // The user interface holds on to objects of this context, and owns its changes:
+            // never save or reset it, only refresh.
+            ChessRefreshRegisteredObjects(moc);
+            
+            [governor recordTrim:ChessMemoryTrimRefresh ofContextNamed:@"mainThread" remainingObjects:[[moc registeredObjects] count]];
+        }
+    }});
+}
+
+- (void)didReceiveMemoryWarning:(NSNotification *)notification
+{
+    // Straight onto the storageQueue, rather than behind the pending bulk requests.
+    
+    dispatch_async(storageQueue, ^{ @autoreleasepool {
+        
+        if (memoryGovernor == nil)
+        {
+            return;
+        }
+        
+        [memoryGovernor recordMemoryWarning];
+        [self trimManagedObjectContext:ChessMemoryTrimReset];
+        
+        if (memoryGovernor.governsMainThreadContext)
+        {
+            [self governMainThreadManagedObjectContextForcingTrim:YES];
+        }
     }});
 }
 
-- (void)addDidSaveManagedObjectContextBlock:(void (^)(void))didSaveBlock invokeQueue:(dispatch_queue_t)invokeQueue;
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Store Maintenance
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)scheduleStoreMaintenance
+{
+    // Invoked on the storageQueue, each time it runs out of requests.
+    // Every request pushes the timer back, so it only fires once the storageQueue has been idle for the idle delay.
+    
+    ChessConfig *configuration = self.config;
+    
+    NSTimeInterval idleDelay = configuration.storeMaintenanceIdleDelay;
+    if (idleDelay <= 0 || [configuration databaseFileName] == nil || configuration.storeProfile == ChessStoreProfileDefault)
+    {
+        return;
+    }
+    
+    NSTimeInterval delay = idleDelay;
+    if (lastStoreMaintenanceTime > 0)
+    {
+        delay = MAX(delay, lastStoreMaintenanceTime + configuration.storeMaintenanceInterval - ChessMonotonicTime());
+    }
+    
+    if (storeMaintenanceTimer == NULL)
+    {
+        storeMaintenanceTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, storageQueue);
+        
+        __weak ChessStorage *weakSelf = self;
+        dispatch_source_set_event_handler(storeMaintenanceTimer, ^{ @autoreleasepool {
+            
+            [weakSelf maybePerformStoreMaintenance];
+        }});
+        
+        dispatch_source_set_timer(storeMaintenanceTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(storeMaintenanceTimer);
+    }
+    
+    int64_t delayInNanoseconds = (int64_t)(delay * NSEC_PER_SEC);
+    dispatch_source_set_timer(storeMaintenanceTimer, dispatch_time(DISPATCH_TIME_NOW, delayInNanoseconds), DISPATCH_TIME_FOREVER, 100 * NSEC_PER_MSEC);
+}
+
+- (void)maybePerformStoreMaintenance
+{
+    // Invoked on the storageQueue by the storeMaintenanceTimer.
+    // A request queued since then, in either lane, comes first: its maybeSave schedules the maintenance again.
+    
+    if (chess_storage_writer_pending_requests(&storageQueueWriter->core) > 0 || [self hasPendingInteractiveRequests])
+    {
+        return;
+    }
+    
+    lastStoreMaintenanceTime = ChessMonotonicTime();
+    
+    [self.config performStoreMaintenance];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Batch Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)scheduleBatchUpsertEntityName:(NSString *)entityName
+                     uniquingKeyPaths:(NSArray *)keyPaths
+                               values:(NSArray *)valuesArray
+                           completion:(void (^)(void))completionBlock
+{
+    NSArray *paths = [keyPaths copy];
+    NSArray *values = [valuesArray copy];
+    
+    [self scheduleBlock:^{
+        
+        [self upsertEntityName:entityName uniquingKeyPaths:paths values:values];
+        
+        if (completionBlock == nil)
+        {
+            return;
+        }
+        
+        if (journal)
+        {
+            [journal commitWithCompletion:^(BOOL durable) {
+                dispatch_async(dispatch_get_main_queue(), completionBlock);
+            }];
+        }
+        else
+        {
+            dispatch_async(dispatch_get_main_queue(), completionBlock);
+        }
+    }];
+}
+
+/**
+ * The uniquing key of an object, or of the values of one: the value itself for a single key path,
+ * an array of the values otherwise (like the keys of ChessObjectIDCache). nil if any value is missing.
+ **/
+static id ChessUniquingKey(id values, NSArray *keyPaths)
+{
+    if ([keyPaths count] == 1)
+    {
+        id value = [values valueForKeyPath:keyPaths[0]];
+        return (value == [NSNull null]) ? nil : value;
+    }
+    
+    NSMutableArray *key = [NSMutableArray arrayWithCapacity:[keyPaths count]];
+    for (NSString *keyPath in keyPaths)
+    {
+        id value = [values valueForKeyPath:keyPath];
+        if (value == nil || value == [NSNull null])
+        {
+            return nil;
+        }
+        [key addObject:value];
+    }
+    
+    return key;
+}
+
+/**
+ * An IN-predicate per key path. With several key paths it matches a superset of the keys,
+ * the exact matches are picked by ChessUniquingKey.
+ **/
+static NSPredicate *ChessUniquingKeysPredicate(NSArray *keys, NSArray *keyPaths)
+{
+    if ([keyPaths count] == 1)
+    {
+        return [NSPredicate predicateWithFormat:@"%K IN %@", keyPaths[0], keys];
+    }
+    
+    NSMutableArray *predicates = [NSMutableArray arrayWithCapacity:[keyPaths count]];
+    [keyPaths enumerateObjectsUsingBlock:^(NSString *keyPath, NSUInteger index, BOOL *stop) {
+        
+        NSMutableSet *values = [NSMutableSet setWithCapacity:[keys count]];
+        for (NSArray *key in keys)
+        {
+            [values addObject:key[index]];
+        }
+        [predicates addObject:[NSPredicate predicateWithFormat:@"%K IN %@", keyPath, values]];
+    }];
+    
+    return [NSCompoundPredicate andPredicateWithSubpredicates:predicates];
+}
+
+- (NSUInteger)upsertEntityName:(NSString *)entityName
+              uniquingKeyPaths:(NSArray *)keyPaths
+                        values:(NSArray *)valuesArray
+{
+    NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+    NSParameterAssert([keyPaths count] > 0);
+    
+    NSManagedObjectContext *moc = [self managedObjectContext];
+    NSEntityDescription *entity = [NSEntityDescription entityForName:entityName inManagedObjectContext:moc];
+    if (entity == nil)
+    {
+        return 0;
+    }
+    
+    ChessObjectIDCache *cache = [self objectIDCacheForEntityName:entityName uniquingKeyPaths:keyPaths];
+    
+    NSUInteger total = [valuesArray count];
+    NSUInteger chunkSize = [self unsavedChangesLimit];
+    NSUInteger upsertedCount = 0;
+    
+    for (NSUInteger location = 0; location < total; location += chunkSize)
+    { @autoreleasepool {
+        
+        NSArray *chunk = [valuesArray subarrayWithRange:NSMakeRange(location, MIN(chunkSize, total - location))];
+        
+        [self journalOperation:@"upsert" entityName:entityName uniquingKeyPaths:keyPaths objects:chunk];
+        
+        // The object ID cache answers first (if one is registered for keyPaths),
+        // then one fetch for the rest of the chunk, mapped by uniquing key.
+        
+        NSMutableDictionary *objectsByKey = [NSMutableDictionary dictionaryWithCapacity:[chunk count]];
+        NSMutableArray *keys = [NSMutableArray arrayWithCapacity:[chunk count]];
+        
+        for (NSDictionary *values in chunk)
+        {
+            id key = ChessUniquingKey(values, keyPaths);
+            if (key == nil) continue;
+            
+            NSManagedObject *object = [cache objectWithEntityName:entityName uniquingKeyPaths:keyPaths values:values];
+            if (object)
+                objectsByKey[key] = object;
+            else
+                [keys addObject:key];
+        }
+        
+        if ([keys count] > 0)
+        {
+            NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
+            [fetchRequest setEntity:entity];
+            [fetchRequest setPredicate:ChessUniquingKeysPredicate(keys, keyPaths)];
+            [fetchRequest setReturnsObjectsAsFaults:NO];
+            
+            for (NSManagedObject *object in [self executeFetchRequest:fetchRequest inManagedObjectContext:moc error:nil])
+            {
+                id key = ChessUniquingKey(object, keyPaths);
+                if (key) objectsByKey[key] = object;
+                
+                [cache cacheObject:object];
+            }
+        }
+        
+        // Update or insert.
+        
+        for (NSDictionary *values in chunk)
+        {
+            id key = ChessUniquingKey(values, keyPaths);
+            
+            NSManagedObject *object = key ? objectsByKey[key] : nil;
+            if (object == nil)
+            {
+                object = [[NSManagedObject alloc] initWithEntity:entity insertIntoManagedObjectContext:moc];
+                if (key) objectsByKey[key] = object;
+            }
+            
+            [object setValuesForKeysWithDictionary:values];
+            upsertedCount++;
+        }
+        
+        // Save on chunk boundaries. The last chunk is left to maybeSave.
+        
+        if (location + chunkSize < total)
+        {
+            [self save];
+            [self yieldToInteractiveRequests];
+            [self governManagedObjectContext];
+        }
+    }}
+    
+    return upsertedCount;
+}
+
+- (NSUInteger)deleteEntityName:(NSString *)entityName
+              uniquingKeyPaths:(NSArray *)keyPaths
+                        values:(NSArray *)valuesArray
+{
+    NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+    NSParameterAssert([keyPaths count] > 0);
+    
+    NSManagedObjectContext *moc = [self managedObjectContext];
+    NSEntityDescription *entity = [NSEntityDescription entityForName:entityName inManagedObjectContext:moc];
+    if (entity == nil)
+    {
+        return 0;
+    }
+    
+    NSUInteger total = [valuesArray count];
+    NSUInteger chunkSize = [self unsavedChangesLimit];
+    NSUInteger deletedCount = 0;
+    
+    for (NSUInteger location = 0; location < total; location += chunkSize)
+    { @autoreleasepool {
+        
+        NSArray *chunk = [valuesArray subarrayWithRange:NSMakeRange(location, MIN(chunkSize, total - location))];
+        
+        [self journalOperation:@"delete" entityName:entityName uniquingKeyPaths:keyPaths objects:chunk];
+        
+        NSMutableSet *keys = [NSMutableSet setWithCapacity:[chunk count]];
+        for (id values in chunk)
+        {
+            id key = ChessUniquingKey(values, keyPaths);
+            if (key) [keys addObject:key];
+        }
+        
+        if ([keys count] > 0)
+        {
+            NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
+            [fetchRequest setEntity:entity];
+            [fetchRequest setPredicate:ChessUniquingKeysPredicate([keys allObjects], keyPaths)];
+            
+            // A single key path matches exactly, several need the values to pick the exact matches.
+            [fetchRequest setIncludesPropertyValues:([keyPaths count] > 1)];
+            
+            for (NSManagedObject *object in [self executeFetchRequest:fetchRequest inManagedObjectContext:moc error:nil])
+            {
+                if ([keyPaths count] > 1 && ![keys containsObject:ChessUniquingKey(object, keyPaths)])
+                {
+                    continue;
+                }
+                
+                [moc deleteObject:object];
+                deletedCount++;
+            }
+        }
+        
+        if (location + chunkSize < total)
+        {
+            [self save];
+            [self yieldToInteractiveRequests];
+            [self governManagedObjectContext];
+        }
+    }}
+    
+    return deletedCount;
+}
+
+- (void)scheduleBatchUpdateEntityName:(NSString *)entityName
+                             criteria:(NSString *)criteria
+                            variables:(NSDictionary *)variables
+                   propertiesToUpdate:(NSDictionary *)properties
+                           completion:(void (^)(NSArray *objectIDs, NSError *error))completionBlock
+{
+    NSDictionary *propertiesToUpdate = [properties copy];
+    
+    [self scheduleBlock:^{
+        
+        NSError *error = nil;
+        NSArray *objectIDs = [self batchUpdateEntityName:entityName
+                                                criteria:criteria
+                                               variables:variables
+                                      propertiesToUpdate:propertiesToUpdate
+                                                   error:&error];
+        
+        if (completionBlock)
+        {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock(objectIDs, error);
+            });
+        }
+    }];
+}
+
+- (void)scheduleBatchDeleteEntityName:(NSString *)entityName
+                             criteria:(NSString *)criteria
+                            variables:(NSDictionary *)variables
+                           completion:(void (^)(NSArray *objectIDs, NSError *error))completionBlock
+{
+    [self scheduleBlock:^{
+        
+        NSError *error = nil;
+        NSArray *objectIDs = [self batchDeleteEntityName:entityName
+                                                criteria:criteria
+                                               variables:variables
+                                                   error:&error];
+        
+        if (completionBlock)
+        {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock(objectIDs, error);
+            });
+        }
+    }];
+}
+
+- (NSArray *)batchUpdateEntityName:(NSString *)entityName
+                          criteria:(NSString *)criteria
+                         variables:(NSDictionary *)variables
+                propertiesToUpdate:(NSDictionary *)properties
+                             error:(NSError **)error
+{
+    NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+    
+    NSFetchRequest *fetchRequest = [self batchFetchRequestWithEntityName:entityName criteria:criteria variables:variables];
+    if (fetchRequest == nil || [properties count] == 0)
+    {
+        return nil;
+    }
+    
+    if ([self canExecuteStoreRequestOfClassNamed:@"NSBatchUpdateRequest"])
+    {
+        NSBatchUpdateRequest *request = [[NSBatchUpdateRequest alloc] initWithEntity:[fetchRequest entity]];
+        [request setPredicate:[fetchRequest predicate]];
+        [request setPropertiesToUpdate:properties];
+        [request setResultType:NSUpdatedObjectIDsResultType];
+        
+        NSBatchUpdateResult *result = (NSBatchUpdateResult *)[[self managedObjectContext] executeRequest:request error:error];
+        if (result == nil)
+        {
+            return nil;
+        }
+        
+        NSArray *objectIDs = [result result];
+        [self didChangeStoreWithUpdatedObjectIDs:objectIDs deletedObjectIDs:nil];
+        
+        return objectIDs;
+    }
+    
+    return [self changeObjectsWithFetchRequest:fetchRequest error:error usingBlock:^(NSManagedObject *object) {
+        
+        [properties enumerateKeysAndObjectsUsingBlock:^(NSString *key, id value, BOOL *stop) {
+            if ([value isKindOfClass:[NSExpression class]]) {
+                value = [(NSExpression *)value expressionValueWithObject:object context:nil];
+            }
+            [object setValue:value forKey:key];
+        }];
+    }];
+}
+
+- (NSArray *)batchDeleteEntityName:(NSString *)entityName
+                          criteria:(NSString *)criteria
+                         variables:(NSDictionary *)variables
+                             error:(NSError **)error
+{
+    NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+    
+    NSFetchRequest *fetchRequest = [self batchFetchRequestWithEntityName:entityName criteria:criteria variables:variables];
+    if (fetchRequest == nil)
+    {
+        return nil;
+    }
+    
+    if ([self canExecuteStoreRequestOfClassNamed:@"NSBatchDeleteRequest"])
+    {
+        NSBatchDeleteRequest *request = [[NSBatchDeleteRequest alloc] initWithFetchRequest:fetchRequest];
+        [request setResultType:NSBatchDeleteResultTypeObjectIDs];
+        
+        NSBatchDeleteResult *result = (NSBatchDeleteResult *)[[self managedObjectContext] executeRequest:request error:error];
+        if (result == nil)
+        {
+            return nil;
+        }
+        
+        NSArray *objectIDs = [result result];
+        [self didChangeStoreWithUpdatedObjectIDs:nil deletedObjectIDs:objectIDs];
+        
+        return objectIDs;
+    }
+    
+    NSManagedObjectContext *moc = [self managedObjectContext];
+    return [self changeObjectsWithFetchRequest:fetchRequest error:error usingBlock:^(NSManagedObject *object) {
+        [moc deleteObject:object];
+    }];
+}
+
+- (NSFetchRequest *)batchFetchRequestWithEntityName:(NSString *)entityName
+                                           criteria:(NSString *)criteria
+                                          variables:(NSDictionary *)variables
+{
+    NSManagedObjectContext *moc = [self managedObjectContext];
+    
+    NSFetchRequest *fetchRequest = [self fetchRequestWithEntityName:entityName
+                                                           criteria:criteria
+                                                          variables:variables
+                                                             sortBy:nil
+                                                          ascending:YES
+                                                        fetchOffset:0
+                                                         fetchLimit:0
+                                                 propertiesToReturn:nil
+                                                           distinct:NO
+                                                  fetchRequestCache:privateFetchRequestCache
+                                             inManagedObjectContext:moc];
+    if ([fetchRequest entity] == nil)
+    {
+        return nil;
+    }
+    
+    // Store level requests do not see unsaved changes, so flush them first.
+    if ([moc hasChanges])
+    {
+        [self save];
+    }
+    
+    return fetchRequest;
+}
+
+- (BOOL)canExecuteStoreRequestOfClassNamed:(NSString *)className
+{
+    if (NSClassFromString(className) == nil)
+    {
+        return NO;
+    }
+    
+    NSArray *persistentStores = [[[self managedObjectContext] persistentStoreCoordinator] persistentStores];
+    for (NSPersistentStore *persistentStore in persistentStores)
+    {
+        if (![[persistentStore type] isEqualToString:NSSQLiteStoreType])
+        {
+            return NO;
+        }
+    }
+    
+    return [persistentStores count] > 0;
+}
+
+- (void)didChangeStoreWithUpdatedObjectIDs:(NSArray *)updatedObjectIDs deletedObjectIDs:(NSArray *)deletedObjectIDs
+{
+    // Nothing was saved through a context, so there is no save notification:
+    // merge the changed objects ourselves, and run the didSave blocks as a save would.
+    
+    [self.config mergeChangesWithUpdatedObjectIDs:(updatedObjectIDs ?: @[])
+                                 deletedObjectIDs:(deletedObjectIDs ?: @[])
+                         intoManagedObjectContext:[self managedObjectContext]];
+    
+    [self.config mergeChangesWithUpdatedObjectIDs:updatedObjectIDs deletedObjectIDs:deletedObjectIDs];
+    
+    [[self currentWriter]->didSaveBus multicastBlocks];
+}
+
+- (NSArray *)changeObjectsWithFetchRequest:(NSFetchRequest *)fetchRequest
+                                     error:(NSError **)error
+                                usingBlock:(void (^)(NSManagedObject *object))block
+{
+    // Fallback when the store cannot execute batch requests:
+    // change the objects through the context, saving and faulting them in chunks to bound the memory.
+    
+    NSManagedObjectContext *moc = [self managedObjectContext];
+    
+    NSFetchRequest *objectIDsRequest = [fetchRequest copy];
+    [objectIDsRequest setResultType:NSManagedObjectIDResultType];
+    
+    NSArray *objectIDs = [self executeFetchRequest:objectIDsRequest inManagedObjectContext:moc error:error];
+    if (objectIDs == nil)
+    {
+        return nil;
+    }
+    
+    NSUInteger total = [objectIDs count];
+    NSUInteger chunkSize = [self unsavedChangesLimit];
+    
+    for (NSUInteger location = 0; location < total; location += chunkSize)
+    { @autoreleasepool {
+        
+        NSArray *chunk = [objectIDs subarrayWithRange:NSMakeRange(location, MIN(chunkSize, total - location))];
+        NSMutableArray *objects = [NSMutableArray arrayWithCapacity:[chunk count]];
+        
+        for (NSManagedObjectID *objectID in chunk)
+        {
+            NSManagedObject *object = [moc objectWithID:objectID];
+            block(object);
+            [objects addObject:object];
+        }
+        
+        [self save];
+        
+        for (NSManagedObject *object in objects)
+        {
+            if (![object isDeleted]) [moc refreshObject:object mergeChanges:NO];
+        }
+    }}
+    
+    return objectIDs;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Import Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Parsed batches waiting for the storageQueue, beyond which the parser waits.
+#define kChessImportMaxPendingBatches 2
+
+static NSString *ChessImportString(const ChessRecordField *field)
+{
+    if (!(field->flags & CHESS_RECORD_FIELD_ESCAPED))
+    {
+        return [[NSString alloc] initWithBytes:field->value length:field->length encoding:NSUTF8StringEncoding];
+    }
+    
+    // Unescaping never makes the value longer.
+    NSMutableData *buffer = [NSMutableData dataWithLength:field->length + 1];
+    size_t length = chess_record_field_copy(field, [buffer mutableBytes], [buffer length]);
+    
+    return [[NSString alloc] initWithBytes:[buffer bytes] length:length encoding:NSUTF8StringEncoding];
+}
+
+static id ChessImportValue(const ChessRecordField *field, NSAttributeDescription *attribute)
+{
+    if (!(field->flags & CHESS_RECORD_FIELD_PRESENT) || field->value == NULL)
+    {
+        return nil;
+    }
+    
+    BOOL isInteger = (field->flags & CHESS_RECORD_FIELD_INTEGER) != 0;
+    
+    switch ([attribute attributeType])
+    {
+        case NSInteger16AttributeType:
+        case NSInteger32AttributeType:
+        case NSInteger64AttributeType:
+            return isInteger ? @(field->integer) : @([ChessImportString(field) longLongValue]);
+            
+        case NSBooleanAttributeType:
+            return isInteger ? @(field->integer != 0) : @([ChessImportString(field) boolValue]);
+            
+        case NSDoubleAttributeType:
+        case NSFloatAttributeType:
+            return isInteger ? @((double)field->integer) : @([ChessImportString(field) doubleValue]);
+            
+        case NSDecimalAttributeType:
+        {
+            NSString *string = ChessImportString(field);
+            return string ? [NSDecimalNumber decimalNumberWithString:string] : nil;
+        }
+            
+        case NSDateAttributeType:
+            return [NSDate dateWithTimeIntervalSince1970:(isInteger ? (double)field->integer : [ChessImportString(field) doubleValue])];
+            
+        default:
+            // Strings, and key paths that are not attributes.
+            return ChessImportString(field);
+    }
+}
+
+- (void)importRecordsFromFileAtPath:(NSString *)path
+                             format:(ChessRecordFormat)format
+                         entityName:(NSString *)entityName
+                   uniquingKeyPaths:(NSArray *)uniquingKeyPaths
+                           keyPaths:(NSArray *)keyPaths
+                          batchSize:(NSUInteger)batchSize
+                         completion:(void (^)(NSDictionary *statistics, NSError *error))completionBlock
+{
+    // This is a public method.
+    // It may be invoked on any thread/queue.
+    
+    NSParameterAssert(path != nil);
+    NSParameterAssert([uniquingKeyPaths count] > 0);
+    NSParameterAssert([[NSSet setWithArray:uniquingKeyPaths] isSubsetOfSet:[NSSet setWithArray:keyPaths]]);
+    
+    NSArray *fieldNames = [keyPaths copy];
+    NSArray *uniquingFieldNames = [uniquingKeyPaths copy];
+    NSUInteger capacity = MAX(batchSize, 1);
+    
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{ @autoreleasepool {
+        
+        NSTimeInterval start = ChessMonotonicTime();
+        
+        NSUInteger fieldCount = [fieldNames count];
+        const char **names = calloc(MAX(fieldCount, 1), sizeof(char *));
+        for (NSUInteger i = 0; i < fieldCount; i++)
+        {
+            names[i] = [fieldNames[i] UTF8String];
+        }
+        
+        ChessRecordParser *parser = NULL;
+        int error = chess_record_parser_open([path fileSystemRepresentation], format, names, fieldCount, &parser);
+        free(names);
+        
+        if (error != 0)
+        {
+            if (completionBlock)
+            {
+                NSError *openError = [NSError errorWithDomain:NSPOSIXErrorDomain code:error userInfo:@{ NSFilePathErrorKey: path }];
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    completionBlock(nil, openError);
+                });
+            }
+            return;
+        }
+        
+        // The model is loaded by now, or on its way: managedObjectModel waits for it.
+        NSDictionary *attributesByName = [[[[self.config managedObjectModel] entitiesByName] objectForKey:entityName] attributesByName];
+        
+        NSMutableIndexSet *keyIndexes = [NSMutableIndexSet indexSet];
+        for (NSString *keyPath in uniquingFieldNames)
+        {
+            [keyIndexes addIndex:[fieldNames indexOfObject:keyPath]];
+        }
+        
+        ChessRecordBatch *batch = chess_record_batch_create(capacity, fieldCount);
+        dispatch_semaphore_t pendingBatches = dispatch_semaphore_create(kChessImportMaxPendingBatches);
+        
+        NSTimeInterval parseTime = 0;
+        NSUInteger numberOfBatches = 0;
+        NSUInteger keylessRecords = 0;
+        
+        int parseError = (batch == NULL) ? ENOMEM : 0;
+        
+        while (batch)
+        { @autoreleasepool {
+            
+            // Backpressure: no more than kChessImportMaxPendingBatches ahead of the storageQueue.
+            dispatch_semaphore_wait(pendingBatches, DISPATCH_TIME_FOREVER);
+            
+            NSTimeInterval parseStart = ChessMonotonicTime();
+            
+            parseError = chess_record_parser_next_batch(parser, batch);
+            
+            if (parseError != 0 || batch->count == 0)
+            {
+                dispatch_semaphore_signal(pendingBatches);
+                break;
+            }
+            
+            NSMutableArray *values = [NSMutableArray arrayWithCapacity:batch->count];
+            
+            for (size_t record = 0; record < batch->count; record++)
+            {
+                const ChessRecordField *fields = batch->fields + (record * fieldCount);
+                
+                NSMutableDictionary *value = [NSMutableDictionary dictionaryWithCapacity:fieldCount];
+                BOOL isKeyless = NO;
+                
+                for (NSUInteger i = 0; i < fieldCount; i++)
+                {
+                    NSString *name = fieldNames[i];
+                    id fieldValue = ChessImportValue(&fields[i], attributesByName[name]);
+                    if (fieldValue)
+                    {
+                        value[name] = fieldValue;
+                    }
+                    else if ([keyIndexes containsIndex:i])
+                    {
+                        isKeyless = YES;
+                        break;
+                    }
+                }
+                
+                if (isKeyless)
+                {
+                    keylessRecords++;
+                    continue;
+                }
+                [values addObject:value];
+            }
+            
+            parseTime += ChessMonotonicTime() - parseStart;
+            numberOfBatches++;
+            
+            [self scheduleBlock:^{
+                
+                [self upsertEntityName:entityName uniquingKeyPaths:uniquingFieldNames values:values];
+                dispatch_semaphore_signal(pendingBatches);
+                
+            } lane:ChessStorageLaneBulk];
+        }}
+        
+        uint64_t numberOfRecords = chess_record_parser_records(parser);
+        uint64_t skippedRecords = chess_record_parser_skipped_records(parser) + keylessRecords;
+        size_t bytes = chess_record_parser_consumed_bytes(parser);
+        
+        chess_record_batch_destroy(batch);
+        chess_record_parser_close(parser);
+        
+        // The batches parsed before a read or parse error are imported all the same.
+        NSError *importError = nil;
+        if (parseError != 0)
+        {
+            importError = [NSError errorWithDomain:NSPOSIXErrorDomain code:parseError userInfo:@{ NSFilePathErrorKey: path }];
+        }
+        
+        // Queued behind the last batch.
+        [self scheduleBlock:^{
+            
+            NSTimeInterval duration = ChessMonotonicTime() - start;
+            uint64_t importedRecords = numberOfRecords - keylessRecords;
+            
+            NSDictionary *statistics = @{ @"records": @(importedRecords),
+                                          @"skippedRecords": @(skippedRecords),
+                                          @"batches": @(numberOfBatches),
+                                          @"bytes": @(bytes),
+                                          @"parseTime": @(parseTime),
+                                          @"duration": @(duration),
+                                          @"recordsPerSecond": @(duration > 0 ? importedRecords / duration : 0) };
+            
+            if (completionBlock)
+            {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    completionBlock(statistics, importError);
+                });
+            }
+            
+        } lane:ChessStorageLaneBulk];
+    }});
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Snapshot Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)exportSnapshotToPath:(NSString *)snapshotPath completion:(void (^)(NSDictionary *manifest, NSError *error))completionBlock
+{
+    [self scheduleBlock:^{
+        
+        if ([[self managedObjectContext] hasChanges])
+        {
+            [self save];
+        }
+        
+        // On the storageQueue, the configuration copies the files right away.
+        [self.config exportSnapshotToPath:snapshotPath completion:completionBlock];
+        
+    } lane:ChessStorageLaneBulk];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Object ID Cache
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)setObjectIDCacheCapacity:(NSUInteger)capacity forEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths
+{
+    NSArray *paths = [keyPaths copy];
+    
+    dispatch_block_t block = ^{
+        [objectIDCache setCapacity:capacity forEntityName:entityName uniquingKeyPaths:paths];
+    };
+    
+    // The cache belongs to the storageQueue, not to the write shards.
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_async(storageQueue, block);
+}
+
+- (NSDictionary *)objectIDCacheStatistics
+{
+    __block NSDictionary *result = nil;
+    
+    dispatch_block_t block = ^{
+        result = [objectIDCache statistics];
+    };
+    
+    if (dispatch_get_specific(storageQueueTag) == storageQueueTag)
+        block();
+    else
+        dispatch_sync(storageQueue, block);
+    
+    return result;
+}
+
+/**
+ * Returns the object ID cache if one is registered for the entity and key paths,
+ * and the current queue is the storageQueue. Write shards have their own contexts, and no cache.
+ **/
+- (ChessObjectIDCache *)objectIDCacheForEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths
+{
+    if ([self currentWriter] != storageQueueWriter)
+    {
+        return nil;
+    }
+    
+    // Makes sure the cache tracks the current managedObjectContext.
+    [self managedObjectContext];
+    
+    return [objectIDCache hasCacheForEntityName:entityName uniquingKeyPaths:keyPaths] ? objectIDCache : nil;
+}
+
+- (NSManagedObject *)objectWithEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths values:(id)values
+{
+    NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+    
+    ChessObjectIDCache *cache = [self objectIDCacheForEntityName:entityName uniquingKeyPaths:keyPaths];
+    
+    NSManagedObject *object = [cache objectWithEntityName:entityName uniquingKeyPaths:keyPaths values:values];
+    if (object)
+    {
+        return object;
+    }
+    
+    NSManagedObjectContext *moc = [self managedObjectContext];
+    NSEntityDescription *entity = [NSEntityDescription entityForName:entityName inManagedObjectContext:moc];
+    if (entity == nil)
+    {
+        return nil;
+    }
+    
+    NSMutableArray *subpredicates = [NSMutableArray arrayWithCapacity:[keyPaths count]];
+    for (NSString *keyPath in keyPaths)
+    {
+        [subpredicates addObject:[NSPredicate predicateWithFormat:@"%K == %@", keyPath, [values valueForKeyPath:keyPath]]];
+    }
+    
+    NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
+    [fetchRequest setEntity:entity];
+    [fetchRequest setPredicate:[NSCompoundPredicate andPredicateWithSubpredicates:subpredicates]];
+    [fetchRequest setFetchLimit:1];
+    [fetchRequest setReturnsObjectsAsFaults:NO];
+    
+    object = [[self executeFetchRequest:fetchRequest inManagedObjectContext:moc error:nil] firstObject];
+    if (object)
+    {
+        [cache cacheObject:object];
+    }
+    
+    return object;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Memory Management
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    
+    // A suspended queue must not be released.
+    if (bulkQueueSuspended)
+    {
+        dispatch_resume(bulkQueue);
+    }
+    pthread_mutex_destroy(&laneLock);
+    
+    if (storeMaintenanceTimer)
+    {
+        dispatch_source_cancel(storeMaintenanceTimer);
+#if !OS_OBJECT_USE_OBJC
+        dispatch_release(storeMaintenanceTimer);
+#endif
+    }
+    
+#if !OS_OBJECT_USE_OBJC
+    if (storageQueue)
+        dispatch_release(storageQueue);
+    if (bulkQueue)
+        dispatch_release(bulkQueue);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Fetch Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)fetchRequestCacheCapacity
+{
+    return privateFetchRequestCache.capacity;
+}
+
+- (void)setFetchRequestCacheCapacity:(NSUInteger)capacity
+{
+    privateFetchRequestCache.capacity = capacity;
+    mainThreadFetchRequestCache.capacity = capacity;
+    readOnlyFetchRequestCache.capacity = capacity;
+}
+
+- (NSDictionary *)fetchRequestCacheStatistics
 {
-    dispatch_block_t block = ^{
-        [didSaveManagedContextBus addInvokeBlock:didSaveBlock invokeQueue:invokeQueue];
+    NSDictionary *(^statistics)(ChessFetchRequestCache *) = ^(ChessFetchRequestCache *cache){
+        return @{ @"count"  : @(cache.count),
+                  @"hits"   : @(cache.hits),
+                  @"misses" : @(cache.misses) };
     };
     
-    if (dispatch_get_specific(storageQueueTag))
-        block();
-    else
-        dispatch_async(storageQueue, block);
+    return @{ @"private"    : statistics(privateFetchRequestCache),
+              @"mainThread" : statistics(mainThreadFetchRequestCache),
+              @"readOnly"   : statistics(readOnlyFetchRequestCache) };
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark Memory Management
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+- (NSArray *)executeFetchRequest:(NSFetchRequest *)fetchRequest inManagedObjectContext:(NSManagedObjectContext *)moc error:(NSError **)error
+{
+    // Every fetch of the storage goes through here, so the query advisor sees them all.
+    // This method is invoked on the queue of the context.
+    
+    ChessQueryAdvisor *queryAdvisor = self.config.queryAdvisor;
+    if (queryAdvisor == nil)
+    {
+        return [moc executeFetchRequest:fetchRequest error:error];
+    }
+    
+    NSTimeInterval start = ChessMonotonicTime();
+    NSArray *results = [moc executeFetchRequest:fetchRequest error:error];
+    
+    [queryAdvisor recordFetchRequest:fetchRequest duration:(ChessMonotonicTime() - start) numberOfResults:[results count]];
+    
+    return results;
+}
 
-- (void)dealloc
+- (NSUInteger)countForFetchRequest:(NSFetchRequest *)fetchRequest inManagedObjectContext:(NSManagedObjectContext *)moc error:(NSError **)error
 {
-    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    // Same as above, for counts.
     
-#if !OS_OBJECT_USE_OBJC
-    if (storageQueue)
-        dispatch_release(storageQueue);
-#endif
+    ChessQueryAdvisor *queryAdvisor = self.config.queryAdvisor;
+    if (queryAdvisor == nil)
+    {
+        return [moc countForFetchRequest:fetchRequest error:error];
+    }
+    
+    NSTimeInterval start = ChessMonotonicTime();
+    NSUInteger count = [moc countForFetchRequest:fetchRequest error:error];
+    
+    [queryAdvisor recordFetchRequest:fetchRequest duration:(ChessMonotonicTime() - start) numberOfResults:1];
+    
+    return count;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#pragma mark - Fetch Method
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+- (NSManagedObjectContext *)fetchContextWithFetchRequestCache:(ChessFetchRequestCache **)fetchRequestCachePtr
+{
+    // Each context type has its own template cache,
+    // so that cached entity descriptions always match the context.
+    
+    if (dispatch_get_specific(storageQueueTag)) {
+        *fetchRequestCachePtr = privateFetchRequestCache;
+        return [self managedObjectContext];
+    } else {
+        *fetchRequestCachePtr = mainThreadFetchRequestCache;
+        return [self mainThreadManagedObjectContext];
+    }
+}
 
 - (NSArray *)fetchEntityName:(NSString *)entityName
                     criteria:(NSString *)criteria
@@ -341,39 +2269,106 @@
                     distinct:(BOOL)isDistinct
                        error:(NSError **)error
 {
-    NSManagedObjectContext *fetchContext = nil;
-    if (dispatch_get_specific(storageQueueTag)) {
-        fetchContext = [self managedObjectContext];
-    } else {
-        fetchContext = [self mainThreadManagedObjectContext];
-    }
+    ChessFetchRequestCache *fetchRequestCache = nil;
+    NSManagedObjectContext *fetchContext = [self fetchContextWithFetchRequestCache:&fetchRequestCache];
     
     if (fetchContext == nil) {
         return nil;
     }
     
+    NSFetchRequest *fetchRequest = [self fetchRequestWithEntityName:entityName
+                                                           criteria:criteria
+                                                          variables:variables
+                                                             sortBy:sortKeys
+                                                          ascending:isAscending
+                                                        fetchOffset:offset
+                                                         fetchLimit:limit
+                                                 propertiesToReturn:properties
+                                                           distinct:isDistinct
+                                                  fetchRequestCache:fetchRequestCache
+                                             inManagedObjectContext:fetchContext];
+    
+    return [self executeFetchRequest:fetchRequest inManagedObjectContext:fetchContext error:error];
+}
+
+- (void)fetchEntityName:(NSString *)entityName
+               criteria:(NSString *)criteria
+              variables:(NSDictionary *)variables
+                 sortBy:(NSString *)sortKeys
+              ascending:(BOOL)isAscending
+            fetchOffset:(NSInteger)offset
+             fetchLimit:(NSInteger)limit
+     propertiesToReturn:(NSArray *)properties
+               distinct:(BOOL)isDistinct
+             completion:(void (^)(NSArray *results, NSError *error))completionBlock
+{
+    [self.config performReadOnlyBlock:^(NSManagedObjectContext *moc) {
+        
+        NSArray *results = nil;
+        NSError *error = nil;
+        
+        if (moc)
+        {
+            NSFetchRequest *fetchRequest = [self fetchRequestWithEntityName:entityName
+                                                                   criteria:criteria
+                                                                  variables:variables
+                                                                     sortBy:sortKeys
+                                                                  ascending:isAscending
+                                                                fetchOffset:offset
+                                                                 fetchLimit:limit
+                                                         propertiesToReturn:properties
+                                                                   distinct:isDistinct
+                                                          fetchRequestCache:readOnlyFetchRequestCache
+                                                     inManagedObjectContext:moc];
+            
+            // Managed objects may not leave the pooled context.
+            if ([fetchRequest resultType] == NSManagedObjectResultType) {
+                [fetchRequest setResultType:NSManagedObjectIDResultType];
+            }
+            
+            results = [self executeFetchRequest:fetchRequest inManagedObjectContext:moc error:&error];
+        }
+        
+        if (completionBlock)
+        {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock(results, error);
+            });
+        }
+    }];
+}
+
+- (NSFetchRequest *)fetchRequestWithEntityName:(NSString *)entityName
+                                      criteria:(NSString *)criteria
+                                     variables:(NSDictionary *)variables
+                                        sortBy:(NSString *)sortKeys
+                                     ascending:(BOOL)isAscending
+                                   fetchOffset:(NSInteger)offset
+                                    fetchLimit:(NSInteger)limit
+                            propertiesToReturn:(NSArray*)properties
+                                      distinct:(BOOL)isDistinct
+                             fetchRequestCache:(ChessFetchRequestCache *)fetchRequestCache
+                        inManagedObjectContext:(NSManagedObjectContext *)fetchContext
+{
+    ChessFetchTemplate *fetchTemplate = [fetchRequestCache templateForEntityName:entityName
+                                                                        criteria:criteria
+                                                                          sortBy:sortKeys
+                                                                       ascending:isAscending
+                                                          inManagedObjectContext:fetchContext];
+    
     NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
-    [fetchRequest setEntity:[NSEntityDescription entityForName:entityName inManagedObjectContext:fetchContext]];
+    [fetchRequest setEntity:fetchTemplate.entity];
     
-    if (criteria && [criteria length]>0) {
-        NSPredicate *predicate = [NSPredicate predicateWithFormat:criteria];
+    NSPredicate *predicate = fetchTemplate.predicateTemplate;
+    if (predicate) {
         if (variables && [variables count]>0) {
             predicate = [predicate predicateWithSubstitutionVariables:variables];
         }
         [fetchRequest setPredicate:predicate];
     }
     
-    // sort results by keys which separeted by character ' , '
-    if (sortKeys && [sortKeys length]>0) {
-        NSArray *keys = [sortKeys componentsSeparatedByString:@","];
-        if (keys && [keys count]>0) {
-            NSMutableArray *sortDescriptorArray = [NSMutableArray arrayWithCapacity:2];
-            for (int i = 0; i<[keys count]; i++) {
-                NSSortDescriptor *sortDescriptor = [NSSortDescriptor sortDescriptorWithKey:[keys objectAtIndex:i] ascending:isAscending];
-                [sortDescriptorArray addObject:sortDescriptor];
-            }
-            [fetchRequest setSortDescriptors:sortDescriptorArray];
-        }
+    if (fetchTemplate.sortDescriptors) {
+        [fetchRequest setSortDescriptors:fetchTemplate.sortDescriptors];
     }
     
     // 0 means no limit
@@ -386,13 +2381,546 @@
     
     if (properties && [properties count]>0) {
         [fetchRequest setPropertiesToFetch:properties];
-        [fetchRequest setPropertiesToGroupBy:properties];
         [fetchRequest setResultType:NSDictionaryResultType];
     }
     
     [fetchRequest setReturnsDistinctResults:isDistinct];
     
-    return [fetchContext executeFetchRequest:fetchRequest error:error];
+    return fetchRequest;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Projection Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The result type of an aggregate: wide enough for a sum, the attribute type for min and max.
+ **/
+static NSAttributeType ChessAggregateResultType(NSExpression *expression, NSEntityDescription *entity)
+{
+    if ([expression expressionType] != NSFunctionExpressionType)
+    {
+        return NSDoubleAttributeType;
+    }
+    
+    NSString *function = [expression function];
+    if ([function isEqualToString:@"count:"])
+    {
+        return NSInteger64AttributeType;
+    }
+    if ([function isEqualToString:@"average:"])
+    {
+        return NSDoubleAttributeType;
+    }
+    
+    NSExpression *argument = [[expression arguments] firstObject];
+    NSAttributeDescription *attribute = nil;
+    if ([argument expressionType] == NSKeyPathExpressionType)
+    {
+        attribute = [entity attributesByName][[argument keyPath]];
+    }
+    
+    if (attribute == nil)
+    {
+        return NSDoubleAttributeType;
+    }
+    
+    NSAttributeType type = [attribute attributeType];
+    if ([function isEqualToString:@"sum:"] && (type == NSInteger16AttributeType || type == NSInteger32AttributeType))
+    {
+        return NSInteger64AttributeType;
+    }
+    
+    return type;
+}
+
+- (NSFetchRequest *)projectionFetchRequestWithEntityName:(NSString *)entityName
+                                                criteria:(NSString *)criteria
+                                               variables:(NSDictionary *)variables
+                                              properties:(NSArray *)properties
+                                                 groupBy:(NSArray *)groupBy
+                                                  sortBy:(NSString *)sortKeys
+                                               ascending:(BOOL)isAscending
+                                              fetchLimit:(NSInteger)limit
+                                       fetchRequestCache:(ChessFetchRequestCache *)fetchRequestCache
+                                  inManagedObjectContext:(NSManagedObjectContext *)fetchContext
+{
+    NSParameterAssert([properties count] > 0);
+    
+    NSFetchRequest *fetchRequest = [self fetchRequestWithEntityName:entityName
+                                                           criteria:criteria
+                                                          variables:variables
+                                                             sortBy:sortKeys
+                                                          ascending:isAscending
+                                                        fetchOffset:0
+                                                         fetchLimit:limit
+                                                 propertiesToReturn:properties
+                                                           distinct:NO
+                                                  fetchRequestCache:fetchRequestCache
+                                             inManagedObjectContext:fetchContext];
+    if ([fetchRequest entity] == nil)
+    {
+        return nil;
+    }
+    
+    // Dictionary results always come from the store, make it explicit.
+    [fetchRequest setIncludesPendingChanges:NO];
+    
+    if ([groupBy count] > 0)
+    {
+        [fetchRequest setPropertiesToGroupBy:groupBy];
+    }
+    
+    return fetchRequest;
+}
+
+- (NSArray *)fetchValuesOfEntityName:(NSString *)entityName
+                            criteria:(NSString *)criteria
+                           variables:(NSDictionary *)variables
+                          properties:(NSArray *)properties
+                             groupBy:(NSArray *)groupBy
+                              sortBy:(NSString *)sortKeys
+                           ascending:(BOOL)isAscending
+                          fetchLimit:(NSInteger)limit
+                               error:(NSError **)error
+{
+    ChessFetchRequestCache *fetchRequestCache = nil;
+    NSManagedObjectContext *fetchContext = [self fetchContextWithFetchRequestCache:&fetchRequestCache];
+    if (fetchContext == nil)
+    {
+        return nil;
+    }
+    
+    NSFetchRequest *fetchRequest = [self projectionFetchRequestWithEntityName:entityName
+                                                                     criteria:criteria
+                                                                    variables:variables
+                                                                   properties:properties
+                                                                      groupBy:groupBy
+                                                                       sortBy:sortKeys
+                                                                    ascending:isAscending
+                                                                   fetchLimit:limit
+                                                            fetchRequestCache:fetchRequestCache
+                                                       inManagedObjectContext:fetchContext];
+    if (fetchRequest == nil)
+    {
+        return nil;
+    }
+    
+    return [self executeFetchRequest:fetchRequest inManagedObjectContext:fetchContext error:error];
+}
+
+- (ChessColumnarResult *)fetchColumnsOfEntityName:(NSString *)entityName
+                                         criteria:(NSString *)criteria
+                                        variables:(NSDictionary *)variables
+                                       properties:(NSArray *)properties
+                                           sortBy:(NSString *)sortKeys
+                                        ascending:(BOOL)isAscending
+                                       fetchLimit:(NSInteger)limit
+                                            error:(NSError **)error
+{
+    NSArray *rows = [self fetchValuesOfEntityName:entityName
+                                         criteria:criteria
+                                        variables:variables
+                                       properties:properties
+                                          groupBy:nil
+                                           sortBy:sortKeys
+                                        ascending:isAscending
+                                       fetchLimit:limit
+                                            error:error];
+    if (rows == nil)
+    {
+        return nil;
+    }
+    
+    NSMutableArray *propertyNames = [NSMutableArray arrayWithCapacity:[properties count]];
+    for (id property in properties)
+    {
+        [propertyNames addObject:[property isKindOfClass:[NSPropertyDescription class]] ? [property name] : property];
+    }
+    
+    ChessFetchRequestCache *fetchRequestCache = nil;
+    NSManagedObjectContext *fetchContext = [self fetchContextWithFetchRequestCache:&fetchRequestCache];
+    NSEntityDescription *entity = [NSEntityDescription entityForName:entityName inManagedObjectContext:fetchContext];
+    
+    return [[ChessColumnarResult alloc] initWithRows:rows propertyNames:propertyNames entity:entity];
+}
+
+- (NSUInteger)countEntityName:(NSString *)entityName
+                     criteria:(NSString *)criteria
+                    variables:(NSDictionary *)variables
+                        error:(NSError **)error
+{
+    ChessFetchRequestCache *fetchRequestCache = nil;
+    NSManagedObjectContext *fetchContext = [self fetchContextWithFetchRequestCache:&fetchRequestCache];
+    if (fetchContext == nil)
+    {
+        return NSNotFound;
+    }
+    
+    NSFetchRequest *fetchRequest = [self fetchRequestWithEntityName:entityName
+                                                           criteria:criteria
+                                                          variables:variables
+                                                             sortBy:nil
+                                                          ascending:YES
+                                                        fetchOffset:0
+                                                         fetchLimit:0
+                                                 propertiesToReturn:nil
+                                                           distinct:NO
+                                                  fetchRequestCache:fetchRequestCache
+                                             inManagedObjectContext:fetchContext];
+    if ([fetchRequest entity] == nil)
+    {
+        return NSNotFound;
+    }
+    
+    return [self countForFetchRequest:fetchRequest inManagedObjectContext:fetchContext error:error];
+}
+
+- (NSArray *)aggregateEntityName:(NSString *)entityName
+                        criteria:(NSString *)criteria
+                       variables:(NSDictionary *)variables
+                      aggregates:(NSDictionary *)aggregates
+                         groupBy:(NSArray *)groupBy
+                           error:(NSError **)error
+{
+    ChessFetchRequestCache *fetchRequestCache = nil;
+    NSManagedObjectContext *fetchContext = [self fetchContextWithFetchRequestCache:&fetchRequestCache];
+    
+    NSEntityDescription *entity = fetchContext ? [NSEntityDescription entityForName:entityName inManagedObjectContext:fetchContext] : nil;
+    if (entity == nil)
+    {
+        return nil;
+    }
+    
+    NSMutableArray *properties = [NSMutableArray arrayWithArray:(groupBy ?: @[])];
+    
+    [aggregates enumerateKeysAndObjectsUsingBlock:^(NSString *name, id aggregate, BOOL *stop) {
+        
+        NSExpression *expression = [aggregate isKindOfClass:[NSExpression class]] ? aggregate
+                                                                                   : [NSExpression expressionWithFormat:aggregate];
+        
+        NSExpressionDescription *description = [[NSExpressionDescription alloc] init];
+        [description setName:name];
+        [description setExpression:expression];
+        [description setExpressionResultType:ChessAggregateResultType(expression, entity)];
+        
+        [properties addObject:description];
+    }];
+    
+    NSFetchRequest *fetchRequest = [self projectionFetchRequestWithEntityName:entityName
+                                                                     criteria:criteria
+                                                                    variables:variables
+                                                                   properties:properties
+                                                                      groupBy:groupBy
+                                                                       sortBy:nil
+                                                                    ascending:YES
+                                                                   fetchLimit:0
+                                                            fetchRequestCache:fetchRequestCache
+                                                       inManagedObjectContext:fetchContext];
+    if (fetchRequest == nil)
+    {
+        return nil;
+    }
+    
+    return [self executeFetchRequest:fetchRequest inManagedObjectContext:fetchContext error:error];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Change Feed
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (ChessChangeFeed *)changeFeedWithEntityName:(NSString *)entityName
+                                     criteria:(NSString *)criteria
+                                    variables:(NSDictionary *)variables
+                                       sortBy:(NSString *)sortKeys
+                                    ascending:(BOOL)isAscending
+                                   fetchLimit:(NSInteger)limit
+                                  changeBlock:(void (^)(ChessChangeFeedBatch *batch))changeBlock
+{
+    NSDictionary *boundVariables = [variables copy];
+    
+    NSArray *(^snapshotBlock)(NSManagedObjectContext *) = ^NSArray *(NSManagedObjectContext *moc) {
+        
+        NSFetchRequest *fetchRequest = [self fetchRequestWithEntityName:entityName
+                                                               criteria:criteria
+                                                              variables:boundVariables
+                                                                 sortBy:sortKeys
+                                                              ascending:isAscending
+                                                            fetchOffset:0
+                                                             fetchLimit:limit
+                                                     propertiesToReturn:nil
+                                                               distinct:NO
+                                                      fetchRequestCache:readOnlyFetchRequestCache
+                                                 inManagedObjectContext:moc];
+        if ([fetchRequest entity] == nil)
+        {
+            return nil;
+        }
+        
+        [fetchRequest setResultType:NSManagedObjectIDResultType];
+        
+        return [self executeFetchRequest:fetchRequest inManagedObjectContext:moc error:nil];
+    };
+    
+    ChessChangeFeed *feed = [[ChessChangeFeed alloc] initWithConfig:self.config
+                                                         entityName:entityName
+                                                      snapshotBlock:snapshotBlock];
+    feed.changeBlock = changeBlock;
+    [feed start];
+    
+    return feed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Enumeration Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)enumerateEntityName:(NSString *)entityName
+                         criteria:(NSString *)criteria
+                        variables:(NSDictionary *)variables
+                           sortBy:(NSString *)sortKeys
+                        ascending:(BOOL)isAscending
+                  uniquingKeyPath:(NSString *)keyPath
+                        batchSize:(NSUInteger)batchSize
+                            error:(NSError **)error
+                       usingBlock:(void (^)(NSArray *batch, BOOL *stop))block
+{
+    NSManagedObjectContext *fetchContext = nil;
+    ChessFetchRequestCache *fetchRequestCache = nil;
+    if (dispatch_get_specific(storageQueueTag)) {
+        fetchContext = [self managedObjectContext];
+        fetchRequestCache = privateFetchRequestCache;
+    } else {
+        fetchContext = [self mainThreadManagedObjectContext];
+        fetchRequestCache = mainThreadFetchRequestCache;
+    }
+    
+    if (fetchContext == nil) {
+        return 0;
+    }
+    
+    return [self enumerateEntityName:entityName
+                            criteria:criteria
+                           variables:variables
+                              sortBy:sortKeys
+                           ascending:isAscending
+                     uniquingKeyPath:keyPath
+                           batchSize:batchSize
+                   fetchRequestCache:fetchRequestCache
+              inManagedObjectContext:fetchContext
+                       resetsContext:NO
+                               error:error
+                          usingBlock:block];
+}
+
+- (void)enumerateEntityName:(NSString *)entityName
+                   criteria:(NSString *)criteria
+                  variables:(NSDictionary *)variables
+                     sortBy:(NSString *)sortKeys
+                  ascending:(BOOL)isAscending
+            uniquingKeyPath:(NSString *)keyPath
+                  batchSize:(NSUInteger)batchSize
+                 usingBlock:(void (^)(NSArray *batch, BOOL *stop))block
+                 completion:(void (^)(NSUInteger count, NSError *error))completionBlock
+{
+    [self.config performReadOnlyBlock:^(NSManagedObjectContext *moc) {
+        
+        NSUInteger count = 0;
+        NSError *error = nil;
+        
+        if (moc)
+        {
+            // Nothing else lives in the pooled context, so it is simply reset after every batch.
+            count = [self enumerateEntityName:entityName
+                                     criteria:criteria
+                                    variables:variables
+                                       sortBy:sortKeys
+                                    ascending:isAscending
+                              uniquingKeyPath:keyPath
+                                    batchSize:batchSize
+                            fetchRequestCache:readOnlyFetchRequestCache
+                       inManagedObjectContext:moc
+                                resetsContext:YES
+                                        error:&error
+                                   usingBlock:block];
+        }
+        
+        if (completionBlock)
+        {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock(count, error);
+            });
+        }
+    }];
+}
+
+- (NSUInteger)enumerateEntityName:(NSString *)entityName
+                         criteria:(NSString *)criteria
+                        variables:(NSDictionary *)variables
+                           sortBy:(NSString *)sortKeys
+                        ascending:(BOOL)isAscending
+                  uniquingKeyPath:(NSString *)keyPath
+                        batchSize:(NSUInteger)batchSize
+                fetchRequestCache:(ChessFetchRequestCache *)fetchRequestCache
+           inManagedObjectContext:(NSManagedObjectContext *)fetchContext
+                    resetsContext:(BOOL)resetsContext
+                            error:(NSError **)errorPtr
+                       usingBlock:(void (^)(NSArray *batch, BOOL *stop))block
+{
+    NSAssert([keyPath length] > 0, @"Keyset pagination needs a uniquing key path");
+    
+    if (block == nil || [keyPath length] == 0) {
+        return 0;
+    }
+    
+    batchSize = MAX(batchSize, 1);
+    
+    // The uniquing key path breaks the ties between objects sharing the other sort key values,
+    // so the position of the last visited object is always a single, exact keyset.
+    if ([sortKeys length] == 0) {
+        sortKeys = keyPath;
+    } else if (![[sortKeys componentsSeparatedByString:@","] containsObject:keyPath]) {
+        sortKeys = [sortKeys stringByAppendingFormat:@",%@", keyPath];
+    }
+    
+    NSFetchRequest *fetchRequest = [self fetchRequestWithEntityName:entityName
+                                                           criteria:criteria
+                                                          variables:variables
+                                                             sortBy:sortKeys
+                                                          ascending:isAscending
+                                                        fetchOffset:0
+                                                         fetchLimit:batchSize
+                                                 propertiesToReturn:nil
+                                                           distinct:NO
+                                                  fetchRequestCache:fetchRequestCache
+                                             inManagedObjectContext:fetchContext];
+    if (fetchRequest.entity == nil) {
+        return 0;
+    }
+    
+    NSPredicate *predicate = [fetchRequest predicate];
+    NSArray *keyPaths = [[fetchRequest sortDescriptors] valueForKey:@"key"];
+    
+    // The sort key values of the last visited object.
+    NSArray *lastValues = nil;
+    
+    NSUInteger count = 0;
+    NSError *fetchError = nil;
+    BOOL stop = NO;
+    
+    while (!stop)
+    { @autoreleasepool {
+        
+        if (lastValues)
+        {
+            NSPredicate *keysetPredicate = [self keysetPredicateWithKeyPaths:keyPaths
+                                                                  lastValues:lastValues
+                                                                   ascending:isAscending];
+            if (predicate) {
+                keysetPredicate = [NSCompoundPredicate andPredicateWithSubpredicates:@[predicate, keysetPredicate]];
+            }
+            [fetchRequest setPredicate:keysetPredicate];
+        }
+        
+        NSError *error = nil;
+        NSArray *batch = [self executeFetchRequest:fetchRequest inManagedObjectContext:fetchContext error:&error];
+        if (batch == nil)
+        {
+            fetchError = error;
+            break;
+        }
+        
+        if ([batch count] == 0)
+        {
+            break;
+        }
+        
+        block(batch, &stop);
+        count += [batch count];
+        
+        // Remember where the next batch starts.
+        
+        lastValues = [self sortValuesOfObject:[batch lastObject] keyPaths:keyPaths];
+        
+        // Turn the batch back into faults, so the context does not grow with the enumeration.
+        // Objects with unsaved changes keep them.
+        
+        if (resetsContext)
+        {
+            [fetchContext reset];
+        }
+        else
+        {
+            for (NSManagedObject *object in batch)
+            {
+                [fetchContext refreshObject:object mergeChanges:[object hasChanges]];
+            }
+        }
+        
+        if ([batch count] < batchSize)
+        {
+            break;
+        }
+    }}
+    
+    if (errorPtr) {
+        *errorPtr = fetchError;
+    }
+    
+    return count;
+}
+
+- (NSArray *)sortValuesOfObject:(NSManagedObject *)object keyPaths:(NSArray *)keyPaths
+{
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:[keyPaths count]];
+    for (NSString *keyPath in keyPaths)
+    {
+        [values addObject:([object valueForKeyPath:keyPath] ?: [NSNull null])];
+    }
+    
+    return values;
+}
+
+- (NSPredicate *)keysetPredicateWithKeyPaths:(NSArray *)keyPaths
+                                  lastValues:(NSArray *)lastValues
+                                   ascending:(BOOL)isAscending
+{
+    // Objects sorted after the last visited one, i.e. for keys (a, b):
+    //
+    // (a > $a) OR (a == $a AND b > $b)
+    //
+    // One of the keys is unique, so no other object shares all the values of the last one.
+    // nil sorts before any other value.
+    
+    NSMutableArray *orPredicates = [NSMutableArray arrayWithCapacity:[keyPaths count]];
+    NSMutableArray *equalPredicates = [NSMutableArray arrayWithCapacity:[keyPaths count]];
+    
+    for (NSUInteger i = 0; i < [keyPaths count]; i++)
+    {
+        NSString *keyPath = keyPaths[i];
+        id value = lastValues[i];
+        
+        NSPredicate *afterPredicate = nil;
+        NSPredicate *equalPredicate = nil;
+        
+        if (value == [NSNull null])
+        {
+            afterPredicate = isAscending ? [NSPredicate predicateWithFormat:@"%K != nil", keyPath]
+                                         : [NSPredicate predicateWithValue:NO];
+            equalPredicate = [NSPredicate predicateWithFormat:@"%K == nil", keyPath];
+        }
+        else
+        {
+            afterPredicate = isAscending ? [NSPredicate predicateWithFormat:@"%K > %@", keyPath, value]
+                                         : [NSPredicate predicateWithFormat:@"%K < %@ OR %K == nil", keyPath, value, keyPath];
+            equalPredicate = [NSPredicate predicateWithFormat:@"%K == %@", keyPath, value];
+        }
+        
+        [orPredicates addObject:[NSCompoundPredicate andPredicateWithSubpredicates:[equalPredicates arrayByAddingObject:afterPredicate]]];
+        [equalPredicates addObject:equalPredicate];
+    }
+    
+    return [NSCompoundPredicate orPredicateWithSubpredicates:orPredicates];
 }
 
 @end
@@ -0,0 +1,105 @@
+//
+//  ChessStorageMetrics.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/8/2.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Summary of one metric, e.g. the time blocks waited on the storageQueue.
+ * Durations are in seconds.
+ **/
+
+@interface ChessMetricSummary : NSObject
+
+@property (nonatomic, assign, readonly) uint64_t count;
+@property (nonatomic, assign, readonly) double min;
+@property (nonatomic, assign, readonly) double max;
+@property (nonatomic, assign, readonly) double mean;
+@property (nonatomic, assign, readonly) double p50;
+@property (nonatomic, assign, readonly) double p90;
+@property (nonatomic, assign, readonly) double p99;
+@property (nonatomic, assign, readonly) double p999;
+
+- (NSDictionary *)dictionaryRepresentation;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Immutable snapshot of ChessStorageMetrics.
+ **/
+
+@interface ChessStorageMetricsSnapshot : NSObject
+
+@property (nonatomic, strong, readonly) ChessMetricSummary *queueWait;          // enqueue to start, seconds
+@property (nonatomic, strong, readonly) ChessMetricSummary *interactiveQueueWait;   // queueWait of the interactive lane
+@property (nonatomic, strong, readonly) ChessMetricSummary *bulkQueueWait;          // queueWait of the bulk lane
+@property (nonatomic, strong, readonly) ChessMetricSummary *blockExecution;     // seconds
+@property (nonatomic, strong, readonly) ChessMetricSummary *saveDuration;       // seconds
+@property (nonatomic, strong, readonly) ChessMetricSummary *changesPerSave;     // objects
+@property (nonatomic, strong, readonly) ChessMetricSummary *pendingDepth;       // requests, sampled at enqueue
+
+@property (nonatomic, assign, readonly) uint64_t numberOfRollbacks;
+@property (nonatomic, assign, readonly) uint64_t numberOfDeferredSaves;    // by maybeSave, for pending interactive requests
+@property (nonatomic, assign, readonly) int32_t maxPendingDepth;
+
+/**
+ * Suitable for NSJSONSerialization.
+ **/
+- (NSDictionary *)dictionaryRepresentation;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * ChessStorageMetrics records the latency and queue depth of a ChessStorage
+ * into fixed-size log-linear histograms, without any allocation per sample.
+ *
+ * Assign an instance to -[ChessStorage metrics] to enable it.
+ * While no metrics are assigned, ChessStorage pays a single branch per request.
+ *
+ * Apart from snapshotHandler and snapshotInterval, which should be configured before the metrics are assigned,
+ * instances are driven by ChessStorage on its storageQueue, and are not thread safe.
+ *
+ * When available (iOS 12 and later), block executions and saves are also emitted as os_signpost intervals,
+ * in the "ChessStorage" subsystem, so they show up in Instruments.
+ **/
+
+@interface ChessStorageMetrics : NSObject
+
+/**
+ * If set, invoked on the main queue with a new snapshot at most every snapshotInterval seconds.
+ * Snapshots are taken after saves.
+ *
+ * Default nil, 10 seconds
+ **/
+@property (nonatomic, copy) void (^snapshotHandler)(ChessStorageMetricsSnapshot *snapshot);
+@property (nonatomic, assign) NSTimeInterval snapshotInterval;
+
+- (void)recordEnqueueWithPendingDepth:(int32_t)pendingDepth;
+- (void)recordQueueWait:(NSTimeInterval)wait;
+- (void)recordQueueWait:(NSTimeInterval)wait interactive:(BOOL)interactive;
+- (void)recordBlockExecution:(NSTimeInterval)duration;
+- (void)recordSaveDuration:(NSTimeInterval)duration numberOfChanges:(NSUInteger)numberOfChanges;
+- (void)recordRollback;
+- (void)recordDeferredSave;
+
+/**
+ * os_signpost intervals. The returned identifier must be handed to the matching end method.
+ **/
+- (uint64_t)beginBlockInterval;
+- (void)endBlockInterval:(uint64_t)intervalID;
+- (uint64_t)beginSaveInterval;
+- (void)endSaveInterval:(uint64_t)intervalID;
+
+- (ChessStorageMetricsSnapshot *)snapshot;
+
+- (void)reset;
+
+@end
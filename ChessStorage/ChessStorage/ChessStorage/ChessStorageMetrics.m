@@ -0,0 +1,312 @@
+//
+//  ChessStorageMetrics.m
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/8/2.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessStorageMetrics.h"
+#import "ChessHistogram.h"
+#import "ChessTime.h"
+
+#if __has_include(<os/signpost.h>)
+#import <os/signpost.h>
+#define CHESS_SIGNPOST_AVAILABLE 1
+#endif
+
+// Durations are recorded in microseconds.
+#define kChessMetricsMicroseconds 1000000.0
+
+#if CHESS_SIGNPOST_AVAILABLE
+static os_log_t ChessStorageSignpostLog(void) API_AVAILABLE(ios(12.0))
+{
+    static os_log_t log;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        log = os_log_create("ChessStorage", "Storage");
+    });
+
+    return log;
+}
+#endif
+
+@interface ChessMetricSummary ()
+
+@property (nonatomic, assign, readwrite) uint64_t count;
+@property (nonatomic, assign, readwrite) double min;
+@property (nonatomic, assign, readwrite) double max;
+@property (nonatomic, assign, readwrite) double mean;
+@property (nonatomic, assign, readwrite) double p50;
+@property (nonatomic, assign, readwrite) double p90;
+@property (nonatomic, assign, readwrite) double p99;
+@property (nonatomic, assign, readwrite) double p999;
+
+@end
+
+@implementation ChessMetricSummary
+
++ (instancetype)summaryWithHistogram:(const ChessHistogram *)histogram scale:(double)scale
+{
+    ChessMetricSummary *summary = [[self alloc] init];
+    summary.count = histogram->count;
+    summary.min = histogram->min / scale;
+    summary.max = histogram->max / scale;
+    summary.mean = chess_histogram_mean(histogram) / scale;
+    summary.p50 = chess_histogram_percentile(histogram, 50) / scale;
+    summary.p90 = chess_histogram_percentile(histogram, 90) / scale;
+    summary.p99 = chess_histogram_percentile(histogram, 99) / scale;
+    summary.p999 = chess_histogram_percentile(histogram, 99.9) / scale;
+
+    return summary;
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+    return @{ @"count" : @(self.count),
+              @"min"   : @(self.min),
+              @"max"   : @(self.max),
+              @"mean"  : @(self.mean),
+              @"p50"   : @(self.p50),
+              @"p90"   : @(self.p90),
+              @"p99"   : @(self.p99),
+              @"p999"  : @(self.p999) };
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessStorageMetricsSnapshot ()
+
+@property (nonatomic, strong, readwrite) ChessMetricSummary *queueWait;
+@property (nonatomic, strong, readwrite) ChessMetricSummary *interactiveQueueWait;
+@property (nonatomic, strong, readwrite) ChessMetricSummary *bulkQueueWait;
+@property (nonatomic, strong, readwrite) ChessMetricSummary *blockExecution;
+@property (nonatomic, strong, readwrite) ChessMetricSummary *saveDuration;
+@property (nonatomic, strong, readwrite) ChessMetricSummary *changesPerSave;
+@property (nonatomic, strong, readwrite) ChessMetricSummary *pendingDepth;
+@property (nonatomic, assign, readwrite) uint64_t numberOfRollbacks;
+@property (nonatomic, assign, readwrite) uint64_t numberOfDeferredSaves;
+@property (nonatomic, assign, readwrite) int32_t maxPendingDepth;
+
+@end
+
+@implementation ChessStorageMetricsSnapshot
+
+- (NSDictionary *)dictionaryRepresentation
+{
+    return @{ @"queueWait"             : [self.queueWait dictionaryRepresentation],
+              @"interactiveQueueWait"  : [self.interactiveQueueWait dictionaryRepresentation],
+              @"bulkQueueWait"         : [self.bulkQueueWait dictionaryRepresentation],
+              @"blockExecution"        : [self.blockExecution dictionaryRepresentation],
+              @"saveDuration"          : [self.saveDuration dictionaryRepresentation],
+              @"changesPerSave"        : [self.changesPerSave dictionaryRepresentation],
+              @"pendingDepth"          : [self.pendingDepth dictionaryRepresentation],
+              @"numberOfRollbacks"     : @(self.numberOfRollbacks),
+              @"numberOfDeferredSaves" : @(self.numberOfDeferredSaves),
+              @"maxPendingDepth"       : @(self.maxPendingDepth) };
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %p %@>", NSStringFromClass([self class]), self, [self dictionaryRepresentation]];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessStorageMetrics ()
+{
+    ChessHistogram queueWait;
+    ChessHistogram interactiveQueueWait;
+    ChessHistogram bulkQueueWait;
+    ChessHistogram blockExecution;
+    ChessHistogram saveDuration;
+    ChessHistogram changesPerSave;
+    ChessHistogram pendingDepth;
+
+    uint64_t numberOfRollbacks;
+    uint64_t numberOfDeferredSaves;
+    int32_t maxPendingDepth;
+
+    NSTimeInterval lastSnapshotTime;
+}
+
+@end
+
+@implementation ChessStorageMetrics
+
+@synthesize snapshotHandler, snapshotInterval;
+
+- (id)init
+{
+    if (self = [super init]) {
+        snapshotInterval = 10;
+        [self reset];
+    }
+
+    return self;
+}
+
+- (void)reset
+{
+    chess_histogram_reset(&queueWait);
+    chess_histogram_reset(&interactiveQueueWait);
+    chess_histogram_reset(&bulkQueueWait);
+    chess_histogram_reset(&blockExecution);
+    chess_histogram_reset(&saveDuration);
+    chess_histogram_reset(&changesPerSave);
+    chess_histogram_reset(&pendingDepth);
+
+    numberOfRollbacks = 0;
+    numberOfDeferredSaves = 0;
+    maxPendingDepth = 0;
+    lastSnapshotTime = ChessMonotonicTime();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Recording
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)recordEnqueueWithPendingDepth:(int32_t)depth
+{
+    chess_histogram_record(&pendingDepth, (uint64_t)MAX(depth, 0));
+    maxPendingDepth = MAX(maxPendingDepth, depth);
+}
+
+- (void)recordQueueWait:(NSTimeInterval)wait
+{
+    chess_histogram_record(&queueWait, (uint64_t)(MAX(wait, 0) * kChessMetricsMicroseconds));
+}
+
+- (void)recordQueueWait:(NSTimeInterval)wait interactive:(BOOL)interactive
+{
+    [self recordQueueWait:wait];
+
+    ChessHistogram *laneQueueWait = interactive ? &interactiveQueueWait : &bulkQueueWait;
+    chess_histogram_record(laneQueueWait, (uint64_t)(MAX(wait, 0) * kChessMetricsMicroseconds));
+}
+
+- (void)recordBlockExecution:(NSTimeInterval)duration
+{
+    chess_histogram_record(&blockExecution, (uint64_t)(MAX(duration, 0) * kChessMetricsMicroseconds));
+}
+
+- (void)recordSaveDuration:(NSTimeInterval)duration numberOfChanges:(NSUInteger)numberOfChanges
+{
+    chess_histogram_record(&saveDuration, (uint64_t)(MAX(duration, 0) * kChessMetricsMicroseconds));
+    chess_histogram_record(&changesPerSave, numberOfChanges);
+
+    [self maybeDeliverSnapshot];
+}
+
+- (void)recordRollback
+{
+    numberOfRollbacks++;
+
+    [self maybeDeliverSnapshot];
+}
+
+- (void)recordDeferredSave
+{
+    numberOfDeferredSaves++;
+}
+
+- (void)maybeDeliverSnapshot
+{
+    void (^handler)(ChessStorageMetricsSnapshot *) = snapshotHandler;
+    if (handler == nil)
+    {
+        return;
+    }
+
+    NSTimeInterval now = ChessMonotonicTime();
+    if (now - lastSnapshotTime < snapshotInterval)
+    {
+        return;
+    }
+
+    lastSnapshotTime = now;
+
+    ChessStorageMetricsSnapshot *snapshot = [self snapshot];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        handler(snapshot);
+    });
+}
+
+- (ChessStorageMetricsSnapshot *)snapshot
+{
+    ChessStorageMetricsSnapshot *snapshot = [[ChessStorageMetricsSnapshot alloc] init];
+    snapshot.queueWait = [ChessMetricSummary summaryWithHistogram:&queueWait scale:kChessMetricsMicroseconds];
+    snapshot.interactiveQueueWait = [ChessMetricSummary summaryWithHistogram:&interactiveQueueWait scale:kChessMetricsMicroseconds];
+    snapshot.bulkQueueWait = [ChessMetricSummary summaryWithHistogram:&bulkQueueWait scale:kChessMetricsMicroseconds];
+    snapshot.blockExecution = [ChessMetricSummary summaryWithHistogram:&blockExecution scale:kChessMetricsMicroseconds];
+    snapshot.saveDuration = [ChessMetricSummary summaryWithHistogram:&saveDuration scale:kChessMetricsMicroseconds];
+    snapshot.changesPerSave = [ChessMetricSummary summaryWithHistogram:&changesPerSave scale:1];
+    snapshot.pendingDepth = [ChessMetricSummary summaryWithHistogram:&pendingDepth scale:1];
+    snapshot.numberOfRollbacks = numberOfRollbacks;
+    snapshot.numberOfDeferredSaves = numberOfDeferredSaves;
+    snapshot.maxPendingDepth = maxPendingDepth;
+
+    return snapshot;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Signposts
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (uint64_t)beginBlockInterval
+{
+#if CHESS_SIGNPOST_AVAILABLE
+    if (@available(iOS 12.0, *)) {
+        os_log_t log = ChessStorageSignpostLog();
+        if (os_signpost_enabled(log)) {
+            os_signpost_id_t intervalID = os_signpost_id_generate(log);
+            os_signpost_interval_begin(log, intervalID, "Block");
+            return intervalID;
+        }
+    }
+#endif
+    return 0;
+}
+
+- (void)endBlockInterval:(uint64_t)intervalID
+{
+#if CHESS_SIGNPOST_AVAILABLE
+    if (intervalID == 0) return;
+
+    if (@available(iOS 12.0, *)) {
+        os_signpost_interval_end(ChessStorageSignpostLog(), intervalID, "Block");
+    }
+#endif
+}
+
+- (uint64_t)beginSaveInterval
+{
+#if CHESS_SIGNPOST_AVAILABLE
+    if (@available(iOS 12.0, *)) {
+        os_log_t log = ChessStorageSignpostLog();
+        if (os_signpost_enabled(log)) {
+            os_signpost_id_t intervalID = os_signpost_id_generate(log);
+            os_signpost_interval_begin(log, intervalID, "Save");
+            return intervalID;
+        }
+    }
+#endif
+    return 0;
+}
+
+- (void)endSaveInterval:(uint64_t)intervalID
+{
+#if CHESS_SIGNPOST_AVAILABLE
+    if (intervalID == 0) return;
+
+    if (@available(iOS 12.0, *)) {
+        os_signpost_interval_end(ChessStorageSignpostLog(), intervalID, "Save");
+    }
+#endif
+}
+
+@end
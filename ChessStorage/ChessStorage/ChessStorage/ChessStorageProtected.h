@@ -22,5 +22,72 @@
  **/
 - (void)commonInit;
 
+/**
+ * Runs the pending interactive requests right away, from within a long bulk block (see scheduleBlock:lane:),
+ * e.g. between two chunks of an import. Save the changes of the block first: otherwise the requests run against
+ * half applied changes, and a failed save of the block rolls the requests back along with them.
+ * The changes made by the requests are saved before this method returns, for the same reason.
+ * upsertEntityName: and deleteEntityName: save, then yield, between their chunks.
+ *
+ * Does nothing outside of the storageQueue (e.g. on a write shard), or within an interactive request.
+ **/
+- (void)yieldToInteractiveRequests;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark - Batch Method
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The synchronous counterpart of scheduleBatchUpsertEntityName:uniquingKeyPaths:values:completion:,
+ * for use from within your own executeBlock or scheduleBlock.
+ *
+ * Must be invoked on the storageQueue.
+ * Returns the number of upserted objects.
+ **/
+- (NSUInteger)upsertEntityName:(NSString *)entityName
+              uniquingKeyPaths:(NSArray *)keyPaths
+                        values:(NSArray *)valuesArray;
+
+/**
+ * Deletes the objects whose key paths have the values of one of the given dictionaries,
+ * i.e. the objects upsertEntityName:uniquingKeyPaths:values: would have updated.
+ * Values missing a key path are skipped.
+ * Like upsertEntityName:, it works in chunks, and is journaled (see -[ChessStorage journal]).
+ *
+ * Must be invoked on the storageQueue.
+ * Returns the number of deleted objects.
+ **/
+- (NSUInteger)deleteEntityName:(NSString *)entityName
+              uniquingKeyPaths:(NSArray *)keyPaths
+                        values:(NSArray *)valuesArray;
+
+/**
+ * Returns the object of the entity whose key paths have the given values (a dictionary, or any key-value coding container),
+ * or nil if there is none.
+ *
+ * With an object ID cache registered for the entity and key paths (see setObjectIDCacheCapacity:forEntityName:uniquingKeyPaths:),
+ * a hit costs a hash lookup, and the fetch only happens on a miss. Without one, it is a plain fetch with a fetchLimit of 1.
+ *
+ * Must be invoked on the storageQueue.
+ **/
+- (NSManagedObject *)objectWithEntityName:(NSString *)entityName uniquingKeyPaths:(NSArray *)keyPaths values:(id)values;
+
+/**
+ * The synchronous counterparts of scheduleBatchUpdateEntityName: and scheduleBatchDeleteEntityName:.
+ *
+ * Must be invoked on the storageQueue.
+ * Return the IDs of the updated or deleted objects, or nil on error.
+ **/
+- (NSArray *)batchUpdateEntityName:(NSString *)entityName
+                          criteria:(NSString *)criteria
+                         variables:(NSDictionary *)variables
+                propertiesToUpdate:(NSDictionary *)properties
+                             error:(NSError **)error;
+
+- (NSArray *)batchDeleteEntityName:(NSString *)entityName
+                          criteria:(NSString *)criteria
+                         variables:(NSDictionary *)variables
+                             error:(NSError **)error;
+
 @end
 
@@ -0,0 +1,80 @@
+//
+//  ChessStorageWriterCore.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/24.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessStorageWriterCore.h"
+
+#include <string.h>
+
+void chess_storage_writer_init(ChessStorageWriterCore *writer)
+{
+    memset(writer, 0, sizeof(*writer));
+}
+
+int32_t chess_storage_writer_enqueue(ChessStorageWriterCore *writer)
+{
+    return __atomic_add_fetch(&writer->pending_requests, 1, __ATOMIC_SEQ_CST);
+}
+
+int32_t chess_storage_writer_dequeue(ChessStorageWriterCore *writer)
+{
+    return __atomic_sub_fetch(&writer->pending_requests, 1, __ATOMIC_SEQ_CST);
+}
+
+int32_t chess_storage_writer_pending_requests(ChessStorageWriterCore *writer)
+{
+    return __atomic_load_n(&writer->pending_requests, __ATOMIC_SEQ_CST);
+}
+
+ChessStorageWriterAction chess_storage_writer_maybe_save(ChessStorageWriterCore *writer,
+                                                         const ChessSavePolicyCore *policy,
+                                                         int32_t pending_requests,
+                                                         size_t unsaved_changes,
+                                                         size_t save_threshold,
+                                                         double now,
+                                                         double *timer_delay)
+{
+    if (writer->first_unsaved_change_time == 0)
+    {
+        writer->first_unsaved_change_time = now;
+    }
+
+    double age = now - writer->first_unsaved_change_time;
+
+    switch (chess_save_policy_decide(policy, pending_requests, unsaved_changes, save_threshold, age))
+    {
+        case CHESS_SAVE_POLICY_DECISION_SAVE_NOW:
+            return CHESS_STORAGE_WRITER_ACTION_SAVE;
+
+        case CHESS_SAVE_POLICY_DECISION_DEFER:
+            // A single timer coalesces all deferred saves. It fires once, and the policy is simply asked again.
+            if (writer->save_timer_armed)
+            {
+                return CHESS_STORAGE_WRITER_ACTION_NONE;
+            }
+
+            writer->save_timer_armed = 1;
+            if (timer_delay)
+            {
+                *timer_delay = (policy->max_save_delay > age) ? (policy->max_save_delay - age) : 0;
+            }
+            return CHESS_STORAGE_WRITER_ACTION_ARM_TIMER;
+
+        default:
+            return CHESS_STORAGE_WRITER_ACTION_NONE;
+    }
+}
+
+void chess_storage_writer_will_save(ChessStorageWriterCore *writer)
+{
+    writer->first_unsaved_change_time = 0;
+}
+
+void chess_storage_writer_save_timer_fired(ChessStorageWriterCore *writer)
+{
+    writer->save_timer_armed = 0;
+}
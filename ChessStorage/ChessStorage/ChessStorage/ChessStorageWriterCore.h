@@ -0,0 +1,85 @@
+//
+//  ChessStorageWriterCore.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/24.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#ifndef ChessStorageWriterCore_h
+#define ChessStorageWriterCore_h
+
+#include "ChessSavePolicyCore.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The save buffering of one writing queue of ChessStorage, in plain C: the pending requests counter,
+ * the age of the unsaved changes, and the single coalescing save timer, around the decisions of ChessSavePolicyCore.
+ * ChessStorage runs one per writing queue, and ChessStorageTests/ChessStandInBenchmark.c drives the same code off device.
+ *
+ * The writer owns no queue, context or timer: it tells its caller what to do with them.
+ * pending_requests is updated atomically, from any thread. The rest is only accessed on the writing queue.
+ **/
+
+typedef enum ChessStorageWriterAction {
+    CHESS_STORAGE_WRITER_ACTION_NONE = 0,   // keep buffering
+    CHESS_STORAGE_WRITER_ACTION_SAVE,       // save right away
+    CHESS_STORAGE_WRITER_ACTION_ARM_TIMER,  // keep buffering, and arm the save timer to fire after timer_delay
+} ChessStorageWriterAction;
+
+typedef struct ChessStorageWriterCore {
+    int32_t pending_requests;               // enqueued, and not yet processed
+    double first_unsaved_change_time;       // seconds, 0 if there are no unsaved changes
+    int save_timer_armed;
+} ChessStorageWriterCore;
+
+void chess_storage_writer_init(ChessStorageWriterCore *writer);
+
+/**
+ * A request was enqueued. Returns the number of pending requests, this one included.
+ **/
+int32_t chess_storage_writer_enqueue(ChessStorageWriterCore *writer);
+
+/**
+ * A request was processed. Returns the number of requests still pending.
+ **/
+int32_t chess_storage_writer_dequeue(ChessStorageWriterCore *writer);
+
+int32_t chess_storage_writer_pending_requests(ChessStorageWriterCore *writer);
+
+/**
+ * What to do after a request has been processed, or the save timer has fired, while there are unsaved changes.
+ * now is in seconds, on a monotonic clock.
+ *
+ * Unsaved changes are saved at the latest max_save_delay after the first one was observed:
+ * a deferred save arms the timer once (with the remaining delay in timer_delay), later deferrals leave it armed.
+ **/
+ChessStorageWriterAction chess_storage_writer_maybe_save(ChessStorageWriterCore *writer,
+                                                         const ChessSavePolicyCore *policy,
+                                                         int32_t pending_requests,
+                                                         size_t unsaved_changes,
+                                                         size_t save_threshold,
+                                                         double now,
+                                                         double *timer_delay);
+
+/**
+ * The unsaved changes are about to be saved (or rolled back): the next change starts a new delay.
+ **/
+void chess_storage_writer_will_save(ChessStorageWriterCore *writer);
+
+/**
+ * The save timer fired. The caller then asks chess_storage_writer_maybe_save again.
+ **/
+void chess_storage_writer_save_timer_fired(ChessStorageWriterCore *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ChessStorageWriterCore_h */
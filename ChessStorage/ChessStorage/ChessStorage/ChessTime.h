@@ -0,0 +1,23 @@
+//
+//  ChessTime.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/7/28.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <mach/mach_time.h>
+
+/**
+ * Returns a monotonic timestamp in seconds, suitable for measuring durations.
+ * It has nothing to do with the wall clock.
+ **/
+static inline NSTimeInterval ChessMonotonicTime(void)
+{
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0)
+        mach_timebase_info(&timebase);
+    
+    return (double)mach_absolute_time() * timebase.numer / timebase.denom / NSEC_PER_SEC;
+}
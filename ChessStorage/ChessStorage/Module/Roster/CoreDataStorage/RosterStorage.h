@@ -14,8 +14,51 @@
 
 @interface RosterStorage : ChessStorage
 
+/**
+ * Adds the friend, or updates the friend with the same name and age, in the interactive lane.
+ * It is upserted like addNewFriendEntities:, so it is journaled (see -[ChessStorage journal]).
+ **/
 - (void)addNewFriendEntityWithName:(NSString *)name age:(NSInteger)age;
 
+/**
+ * Adds or updates many friends at once.
+ *
+ * friends is an array of dictionaries with a "name" (NSString) and an "age" (NSNumber) value.
+ * Like addNewFriendEntityWithName:age:, a friend is identified by name and age:
+ * a friend already stored with the same name and age is updated, the others are added.
+ **/
+- (void)addNewFriendEntities:(NSArray *)friends;
+
+/**
+ * Imports friends from a CSV file with "name" and "age" columns,
+ * or a JSON file (.json, .jsonl) of objects with "name" and "age" keys,
+ * identified by name and age like addNewFriendEntities:. See -[ChessStorage importRecordsFromFileAtPath:...].
+ **/
+- (void)importFriendsFromFileAtPath:(NSString *)path completion:(void (^)(NSDictionary *statistics, NSError *error))completionBlock;
+
+/**
+ * Deletes the friend in the private context, so the deletion is saved (and seen by change feeds).
+ * Like the additions, it goes through the keyed mutations of ChessStorage, so it is journaled (see -[ChessStorage journal]):
+ * it deletes every friend with the same name and age.
+ **/
 - (void)deleteFriendEntity:(FriendEntity *)entity;
+- (void)deleteFriendWithObjectID:(NSManagedObjectID *)objectID;
+
+/**
+ * Deletes every friend older than the given age, in the persistent store.
+ **/
+- (void)deleteFriendsOlderThan:(NSInteger)age;
+
+/**
+ * Adds years to the age of every friend, in the persistent store.
+ **/
+- (void)increaseAgeOfAllFriendsBy:(NSInteger)years;
+
+/**
+ * The number of friends and their youngest, oldest and average age, computed by the store without loading any friend, e.g.
+ * @{ @"count": @(120), @"youngest": @(18), @"oldest": @(64), @"averageAge": @(35.2) }
+ * Ages are absent without friends. Must be invoked on the main thread.
+ **/
+- (NSDictionary *)friendAgeStatistics;
 
 @end
@@ -7,46 +7,121 @@
 //
 
 #import "RosterStorage.h"
+#import "ChessStorageProtected.h"
 
 @implementation RosterStorage
 
+- (void)commonInit
+{
+    [super commonInit];
+    
+    // A friend is identified by name and age, by the batch upserts and addNewFriendEntityWithName:age: alike.
+    [self setObjectIDCacheCapacity:1024 forEntityName:kRosterFriendEntityName uniquingKeyPaths:@[@"name", @"age"]];
+}
+
 - (void)addNewFriendEntityWithName:(NSString *)name age:(NSInteger)age
+{
+    // Added by hand, so it should not wait behind an import, and may run between two of its chunks.
+    // The imports identify a friend by name and age as well: a later chunk only finds this friend if it has the same values.
+    // Upserted like the imports, so it is journaled, and survives a kill before the save.
+    [self scheduleBlock:^{
+        [self upsertEntityName:kRosterFriendEntityName
+              uniquingKeyPaths:@[@"name", @"age"]
+                        values:@[@{@"name": name, @"age": @(age)}]];
+        // context will auto perform saving action, and then post contextDidMergeNotification
+    } lane:ChessStorageLaneInteractive];
+}
+
+- (void)addNewFriendEntities:(NSArray *)friends
+{
+    [self scheduleBatchUpsertEntityName:kRosterFriendEntityName
+                       uniquingKeyPaths:@[@"name", @"age"]
+                                 values:friends
+                             completion:nil];
+}
+
+- (void)importFriendsFromFileAtPath:(NSString *)path completion:(void (^)(NSDictionary *statistics, NSError *error))completionBlock
+{
+    NSString *extension = [[path pathExtension] lowercaseString];
+    ChessRecordFormat format = ([extension isEqualToString:@"json"] || [extension isEqualToString:@"jsonl"]) ? CHESS_RECORD_FORMAT_JSON
+                                                                                                             : CHESS_RECORD_FORMAT_CSV;
+    
+    // One upsert chunk per batch, see saveThreshold.
+    [self importRecordsFromFileAtPath:path
+                               format:format
+                           entityName:kRosterFriendEntityName
+                     uniquingKeyPaths:@[@"name", @"age"]
+                             keyPaths:@[@"name", @"age"]
+                            batchSize:500
+                           completion:completionBlock];
+}
+
+- (void)deleteFriendEntity:(FriendEntity *)entity
+{
+    // Whatever its context, the friend is deleted in the private context, like the other writes.
+    [self deleteFriendWithObjectID:[entity objectID]];
+}
+
+- (void)deleteFriendWithObjectID:(NSManagedObjectID *)objectID
 {
     [self scheduleBlock:^{
-        NSString *criteria = [NSString stringWithFormat:@"name = $name && age = $age"];
-        NSArray *result = [self fetchEntityName:kRosterFriendEntityName
-                                       criteria:criteria
-                                      variables:@{@"name": name,
-                                                  @"age": @(age)}
-                                         sortBy:nil
-                                      ascending:YES];
-        
-        FriendEntity *entity = nil;
         NSManagedObjectContext *context = [self managedObjectContext];
-        if ([result count]) {
-            // Need to update
-            entity = result[0];
-        } else {
-            // Need to add a new record
-            entity = (FriendEntity *)[[NSManagedObject alloc] initWithEntity:[NSEntityDescription entityForName:kRosterFriendEntityName inManagedObjectContext:context] insertIntoManagedObjectContext:context];
+        FriendEntity *entity = (FriendEntity *)[context existingObjectWithID:objectID error:nil];
+        if (entity == nil) {
+            return;
         }
         
-        entity.name = name;
-        entity.age = @(age);
-        // context will auto perform saving action, and then post contextDidMergeNotification
+        // Deleted by name and age, so the deletion is journaled like the upserts.
+        // Only a friend missing either is deleted directly.
+        if (entity.name && entity.age) {
+            [self deleteEntityName:kRosterFriendEntityName
+                  uniquingKeyPaths:@[@"name", @"age"]
+                            values:@[@{@"name": entity.name, @"age": entity.age}]];
+        } else {
+            [context deleteObject:entity];
+        }
     }];
 }
 
-- (void)deleteFriendEntity:(FriendEntity *)entity
+- (void)deleteFriendsOlderThan:(NSInteger)age
 {
-    //MainThreadManangedObjectContext
-    NSManagedObjectContext *context = entity.managedObjectContext;
-    if ([context isEqual:[self mainThreadManagedObjectContext]]) {
-        [context deleteObject:entity];
-    } else {
-        [self scheduleBlock:^{
-            [context deleteObject:entity];
-        }];
+    [self scheduleBatchDeleteEntityName:kRosterFriendEntityName
+                               criteria:@"age > $age"
+                              variables:@{@"age": @(age)}
+                             completion:nil];
+}
+
+- (void)increaseAgeOfAllFriendsBy:(NSInteger)years
+{
+    NSExpression *age = [NSExpression expressionWithFormat:@"age + %@", @(years)];
+    
+    [self scheduleBatchUpdateEntityName:kRosterFriendEntityName
+                               criteria:nil
+                              variables:nil
+                     propertiesToUpdate:@{@"age": age}
+                             completion:nil];
+}
+
+- (NSDictionary *)friendAgeStatistics
+{
+    NSDictionary *ages = [[self aggregateEntityName:kRosterFriendEntityName
+                                           criteria:nil
+                                          variables:nil
+                                         aggregates:@{@"count": @"count:(age)",
+                                                      @"youngest": @"min:(age)",
+                                                      @"oldest": @"max:(age)",
+                                                      @"averageAge": @"average:(age)"}
+                                            groupBy:nil
+                                              error:nil] firstObject];
+    
+    // count:(age) leaves out friends without an age.
+    NSMutableDictionary *statistics = [NSMutableDictionary dictionaryWithDictionary:ages];
+    statistics[@"count"] = @([self countEntityName:kRosterFriendEntityName criteria:nil variables:nil error:nil]);
+    
+    if ([ages[@"count"] integerValue] == 0) {
+        [statistics removeObjectsForKeys:@[@"youngest", @"oldest", @"averageAge"]];
     }
+    
+    return statistics;
 }
 @end
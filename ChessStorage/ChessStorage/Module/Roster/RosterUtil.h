@@ -11,10 +11,40 @@
 
 @interface RosterUtil : NSObject
 
+/**
+ * Sets up the roster database in the background.
+ * completionBlock is invoked on the main thread, after which fetchedResultsController no longer blocks.
+ **/
+- (void)prepareWithCompletion:(void (^)(NSError *error))completionBlock;
+
 - (NSFetchedResultsController *)fetchedResultsController;
 
+/**
+ * A change feed of all friends sorted by age, with one coalesced batch per change (see ChessChangeFeed).
+ * changeBlock is invoked on the main thread. Must be invoked once prepared.
+ **/
+- (ChessChangeFeed *)friendChangeFeedWithBlock:(void (^)(ChessChangeFeedBatch *batch))changeBlock;
+
+/**
+ * The friend of the given ID in the main thread context, or nil if it no longer exists.
+ * Must be invoked on the main thread.
+ **/
+- (FriendEntity *)friendWithObjectID:(NSManagedObjectID *)objectID;
+
+/**
+ * See -[RosterStorage friendAgeStatistics]. Must be invoked on the main thread.
+ **/
+- (NSDictionary *)friendAgeStatistics;
+
 - (void)addNewFriendWithName:(NSString *)name age:(NSInteger)age;
 
+/**
+ * See -[RosterStorage importFriendsFromFileAtPath:completion:]. completionBlock is invoked on the main thread.
+ **/
+- (void)importFriendsFromFileAtPath:(NSString *)path completion:(void (^)(NSDictionary *statistics, NSError *error))completionBlock;
+
 - (void)deleteFriendWithFriendEntity:(FriendEntity *)entity;
 
+- (void)deleteFriendWithObjectID:(NSManagedObjectID *)objectID;
+
 @end
@@ -11,6 +11,7 @@
 @interface RosterUtil ()
 
 @property (nonatomic, strong) RosterStorage *rosterStorage;
+@property (nonatomic, strong) ChessConfig *config;
 
 @end
 
@@ -21,12 +22,40 @@
     if (self = [super init]) {
         ChessConfig *config = [[ChessConfig alloc] initWithDatabaseFilename:@"Roster"
                                                      managedObjectModelName:@"Roster"];
+        config.mainThreadMergeMode = ChessMainThreadMergeModeTargeted;
+        
+#ifdef DEBUG
+        config.queryAdvisor = [[ChessQueryAdvisor alloc] init];
+#endif
+        
+        self.config = config;
         self.rosterStorage = [[RosterStorage alloc] initWithConfiguration:config];
+        
+        // The friend list is long-lived: keep both contexts at a steady footprint.
+        self.rosterStorage.memoryGovernor = [[ChessMemoryGovernor alloc] init];
     }
     
     return self;
 }
 
+- (void)prepareWithCompletion:(void (^)(NSError *error))completionBlock
+{
+    [self.config prepareWithCompletion:^(NSDictionary *timings, NSError *error) {
+        
+        if (error) {
+            NSLog(@"Roster storage not available: %@", error);
+        }
+        
+        if ([timings[@"migrationRequired"] boolValue]) {
+            NSLog(@"Roster storage migrated in %.3fs", [timings[@"addPersistentStoreTime"] doubleValue]);
+        }
+        
+        if (completionBlock) {
+            completionBlock(error);
+        }
+    }];
+}
+
 - (NSFetchedResultsController *)fetchedResultsController
 {
     NSManagedObjectContext *moc = [self.rosterStorage mainThreadManagedObjectContext];
@@ -44,10 +73,37 @@
     [request setEntity:entity];
     [request setPredicate:pridicate];
     
-    return [[NSFetchedResultsController alloc] initWithFetchRequest:request
-                                               managedObjectContext:moc
-                                                 sectionNameKeyPath:nil
-                                                          cacheName:nil];
+    NSFetchedResultsController *controller = [[NSFetchedResultsController alloc] initWithFetchRequest:request
+                                                                                 managedObjectContext:moc
+                                                                                   sectionNameKeyPath:nil
+                                                                                            cacheName:nil];
+    
+    // Targeted merges only fault in updated friends the controller may care about.
+    [self.config registerFetchedResultsController:controller];
+    
+    return controller;
+}
+
+- (ChessChangeFeed *)friendChangeFeedWithBlock:(void (^)(ChessChangeFeedBatch *batch))changeBlock
+{
+    return [self.rosterStorage changeFeedWithEntityName:kRosterFriendEntityName
+                                               criteria:@"name != nil"
+                                              variables:nil
+                                                 sortBy:@"age"
+                                              ascending:YES
+                                             fetchLimit:0
+                                            changeBlock:changeBlock];
+}
+
+- (FriendEntity *)friendWithObjectID:(NSManagedObjectID *)objectID
+{
+    NSManagedObjectContext *moc = [self.rosterStorage mainThreadManagedObjectContext];
+    return (FriendEntity *)[moc existingObjectWithID:objectID error:nil];
+}
+
+- (NSDictionary *)friendAgeStatistics
+{
+    return [self.rosterStorage friendAgeStatistics];
 }
 
 - (void)addNewFriendWithName:(NSString *)name age:(NSInteger)age
@@ -59,6 +115,11 @@
     [self.rosterStorage addNewFriendEntityWithName:name age:age];
 }
 
+- (void)importFriendsFromFileAtPath:(NSString *)path completion:(void (^)(NSDictionary *statistics, NSError *error))completionBlock
+{
+    [self.rosterStorage importFriendsFromFileAtPath:path completion:completionBlock];
+}
+
 - (void)deleteFriendWithFriendEntity:(FriendEntity *)entity;
 {
     // Run some other code
@@ -68,4 +129,9 @@
     [self.rosterStorage deleteFriendEntity:entity];
 }
 
+- (void)deleteFriendWithObjectID:(NSManagedObjectID *)objectID
+{
+    [self.rosterStorage deleteFriendWithObjectID:objectID];
+}
+
 @end
@@ -9,9 +9,10 @@
 #import "FriendListViewController.h"
 #import "RosterUtil.h"
 
-@interface FriendListViewController () <NSFetchedResultsControllerDelegate>
+@interface FriendListViewController ()
 
-@property (nonatomic, strong) NSFetchedResultsController    *fetchedResultsController;
+@property (nonatomic, strong) ChessChangeFeed       *friendChangeFeed;
+@property (nonatomic, strong) NSArray               *friendObjectIDs;
 @property (nonatomic, strong) RosterUtil            *rosterUtil;
 
 @end
@@ -22,26 +23,31 @@
 {
     if (self = [super initWithStyle:style]) {
         self.rosterUtil = [[RosterUtil alloc] init];
-        self.fetchedResultsController = [self.rosterUtil fetchedResultsController];
-        self.fetchedResultsController.delegate = self;
     }
     
     return self;
 }
 
+- (void)dealloc
+{
+    [self.friendChangeFeed stop];
+}
+
 - (void)viewDidLoad {
     [super viewDidLoad];
     
     [self initNavigationItems];
-    [self performFetch];
-}
-
-- (void)performFetch
-{
-    NSError *error = nil;
-    if ([self.fetchedResultsController performFetch:&error]) {
-        [self.tableView reloadData];
-    }
+    
+    // Opening the database may take a while (e.g. a migration), so do not block the launch.
+    __weak FriendListViewController *weakSelf = self;
+    [self.rosterUtil prepareWithCompletion:^(NSError *error) {
+        FriendListViewController *strongSelf = weakSelf;
+        if (strongSelf == nil) return;
+        
+        strongSelf.friendChangeFeed = [strongSelf.rosterUtil friendChangeFeedWithBlock:^(ChessChangeFeedBatch *batch) {
+            [weakSelf applyChangeFeedBatch:batch];
+        }];
+    }];
 }
 
 - (void)initNavigationItems
@@ -65,7 +71,7 @@
 }
 
 - (NSInteger)tableView:(UITableView *)tableView numberOfRowsInSection:(NSInteger)section {
-    return [self.fetchedResultsController.fetchedObjects count];
+    return [self.friendObjectIDs count];
 }
 
 
@@ -77,7 +83,7 @@
         cell = [[UITableViewCell alloc] initWithStyle:UITableViewCellStyleDefault reuseIdentifier:cellIdentifier];
     }
     
-    FriendEntity *entity = (FriendEntity *)[self.fetchedResultsController.fetchedObjects objectAtIndex:indexPath.row];
+    FriendEntity *entity = [self.rosterUtil friendWithObjectID:self.friendObjectIDs[indexPath.row]];
     [cell.textLabel setText:entity.name];
     [cell.detailTextLabel setText:[entity.age stringValue]];
     
@@ -94,8 +100,7 @@
 - (void)tableView:(UITableView *)tableView commitEditingStyle:(UITableViewCellEditingStyle)editingStyle forRowAtIndexPath:(NSIndexPath *)indexPath {
     if (editingStyle == UITableViewCellEditingStyleDelete) {
         // Delete the row from the data source
-        FriendEntity *entity = (FriendEntity *)[self.fetchedResultsController.fetchedObjects objectAtIndex:indexPath.row];
-        [self.rosterUtil deleteFriendWithFriendEntity:entity];
+        [self.rosterUtil deleteFriendWithObjectID:self.friendObjectIDs[indexPath.row]];
     }
 }
 
@@ -104,42 +109,66 @@
     [tableView deselectRowAtIndexPath:indexPath animated:YES];
 }
 
-#pragma mark - FetchedResultsController Delegate
-- (void)controller:(NSFetchedResultsController *)controller didChangeObject:(id)anObject atIndexPath:(NSIndexPath *)indexPath forChangeType:(NSFetchedResultsChangeType)type newIndexPath:(NSIndexPath *)newIndexPath
+#pragma mark - Change Feed
+
+static NSArray *FriendListIndexPaths(NSIndexSet *indexes)
+{
+    NSMutableArray *indexPaths = [NSMutableArray arrayWithCapacity:[indexes count]];
+    [indexes enumerateIndexesUsingBlock:^(NSUInteger index, BOOL *stop) {
+        [indexPaths addObject:[NSIndexPath indexPathForRow:index inSection:0]];
+    }];
+    return indexPaths;
+}
+
+- (void)applyChangeFeedBatch:(ChessChangeFeedBatch *)batch
 {
-    NSLog(@"At: %ld   newIndex: %ld",indexPath.row,newIndexPath.row );
-    switch (type) {
-        case NSFetchedResultsChangeInsert:
-        {
-            [self.tableView insertRowsAtIndexPaths:@[newIndexPath] withRowAnimation:UITableViewRowAnimationRight];
-            [self.tableView scrollToRowAtIndexPath:newIndexPath
-                                  atScrollPosition:UITableViewScrollPositionBottom
-                                          animated:YES];
-            break;
-        }
-            case NSFetchedResultsChangeDelete:
-        {
-            [self.tableView deleteRowsAtIndexPaths:@[indexPath] withRowAnimation:UITableViewRowAnimationLeft];
-            break;
-        }
-        case NSFetchedResultsChangeUpdate:
-        {
-            [self.tableView reloadRowsAtIndexPaths:@[indexPath] withRowAnimation:UITableViewRowAnimationFade];
-            break;
-        }
-            case NSFetchedResultsChangeMove:
-        {
-            [self.tableView moveRowAtIndexPath:indexPath toIndexPath:newIndexPath];
-            break;
-        }
-        default:
-            break;
+    if (self.friendObjectIDs == nil) {
+        // Initial results
+        self.friendObjectIDs = batch.objectIDs;
+        [self.tableView reloadData];
+        [self updateTitle];
+        return;
+    }
+    
+    // A whole batch of saves (e.g. a 1000 friends import) is a single animation.
+    [self.tableView beginUpdates];
+    
+    self.friendObjectIDs = batch.objectIDs;
+    
+    [self.tableView deleteRowsAtIndexPaths:FriendListIndexPaths(batch.deletedIndexes) withRowAnimation:UITableViewRowAnimationLeft];
+    [self.tableView insertRowsAtIndexPaths:FriendListIndexPaths(batch.insertedIndexes) withRowAnimation:UITableViewRowAnimationRight];
+    [self.tableView reloadRowsAtIndexPaths:FriendListIndexPaths(batch.updatedIndexes) withRowAnimation:UITableViewRowAnimationFade];
+    [batch enumerateMovesUsingBlock:^(NSUInteger fromIndex, NSUInteger toIndex) {
+        [self.tableView moveRowAtIndexPath:[NSIndexPath indexPathForRow:fromIndex inSection:0]
+                               toIndexPath:[NSIndexPath indexPathForRow:toIndex inSection:0]];
+    }];
+    
+    [self.tableView endUpdates];
+    
+    // A row cannot be moved and reloaded in the same batch.
+    if ([batch.movedUpdatedIndexes count]) {
+        [self.tableView reloadRowsAtIndexPaths:FriendListIndexPaths(batch.movedUpdatedIndexes) withRowAnimation:UITableViewRowAnimationNone];
+    }
+    
+    if ([batch.insertedIndexes count]) {
+        [self.tableView scrollToRowAtIndexPath:[NSIndexPath indexPathForRow:[batch.insertedIndexes lastIndex] inSection:0]
+                              atScrollPosition:UITableViewScrollPositionBottom
+                                      animated:YES];
     }
+    
+    [self updateTitle];
 }
 
-- (void)controllerDidChangeContent:(NSFetchedResultsController *)controller
+- (void)updateTitle
 {
+    // Aggregated by the store, no friend gets loaded for it.
+    NSDictionary *statistics = [self.rosterUtil friendAgeStatistics];
     
+    if (statistics[@"averageAge"]) {
+        self.title = [NSString stringWithFormat:@"%@ friends, %.1f years avg", statistics[@"count"], [statistics[@"averageAge"] doubleValue]];
+    } else {
+        self.title = [NSString stringWithFormat:@"%@ friends", statistics[@"count"]];
+    }
 }
 
 @end
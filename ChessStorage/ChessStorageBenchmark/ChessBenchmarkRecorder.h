@@ -0,0 +1,64 @@
+//
+//  ChessBenchmarkRecorder.h
+//  ChessStorageBenchmark
+//
+//  Created by Xiangqi on 16/8/9.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Collects the outcome of one workload run: elapsed time, number of operations,
+ * and a latency histogram.
+ *
+ * recordLatency: and addOperations: are thread safe, so latencies may be recorded
+ * from the storageQueue, the main thread, or a completion block.
+ **/
+
+@interface ChessBenchmarkRecorder : NSObject
+
+- (id)initWithName:(NSString *)name storeType:(NSString *)storeType;
+
+@property (nonatomic, copy, readonly) NSString *name;
+@property (nonatomic, copy, readonly) NSString *storeType;
+
+/**
+ * Workload specific values, added to the result as is. Must be suitable for NSJSONSerialization.
+ **/
+@property (nonatomic, strong, readonly) NSMutableDictionary *extras;
+
+- (void)start;
+- (void)stop;
+
+- (void)recordLatency:(NSTimeInterval)latency;
+- (void)addOperations:(NSUInteger)count;
+
+/**
+ * e.g.
+ * @{ @"name": @"bulk-insert", @"store": @"sqlite", @"operations": @(10000), @"elapsed": @(1.2),
+ *    @"throughput": @(8333), @"latency": @{ @"count": ..., @"p50": ..., @"p99": ..., @"max": ..., @"mean": ... },
+ *    @"peakResidentSize": @(52428800), @"residentSize": @(41943040) }
+ * Times are in seconds, throughput in operations per second, sizes in bytes.
+ **/
+- (NSDictionary *)result;
+
+@end
+
+/**
+ * The process wide high-water mark of the resident set size, in bytes (getrusage).
+ **/
+uint64_t ChessBenchmarkPeakResidentSize(void);
+
+/**
+ * The current resident set size, in bytes.
+ **/
+uint64_t ChessBenchmarkResidentSize(void);
+
+/**
+ * Runs the current run loop until condition returns YES, or timeout seconds have elapsed.
+ * Blocks dispatched to the main queue are serviced meanwhile, when invoked on the main thread.
+ *
+ * Returns NO on timeout.
+ **/
+BOOL ChessBenchmarkRunUntil(BOOL (^condition)(void), NSTimeInterval timeout);
@@ -0,0 +1,161 @@
+//
+//  ChessBenchmarkRecorder.m
+//  ChessStorageBenchmark
+//
+//  Created by Xiangqi on 16/8/9.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessBenchmarkRecorder.h"
+#import "ChessHistogram.h"
+#import "ChessTime.h"
+
+#import <mach/mach.h>
+#import <pthread.h>
+#import <sys/resource.h>
+
+// Latencies are recorded in microseconds.
+#define kChessBenchmarkMicroseconds 1000000.0
+
+@interface ChessBenchmarkRecorder ()
+{
+    pthread_mutex_t mutex;
+    ChessHistogram latencies;
+    NSUInteger operations;
+
+    NSTimeInterval startTime;
+    NSTimeInterval elapsed;
+}
+
+@end
+
+@implementation ChessBenchmarkRecorder
+
+@synthesize name, storeType, extras;
+
+- (id)initWithName:(NSString *)aName storeType:(NSString *)aStoreType
+{
+    if (self = [super init]) {
+        name = [aName copy];
+        storeType = [aStoreType copy];
+        extras = [[NSMutableDictionary alloc] init];
+
+        pthread_mutex_init(&mutex, NULL);
+        chess_histogram_reset(&latencies);
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    pthread_mutex_destroy(&mutex);
+}
+
+- (void)start
+{
+    startTime = ChessMonotonicTime();
+}
+
+- (void)stop
+{
+    elapsed = ChessMonotonicTime() - startTime;
+}
+
+- (void)recordLatency:(NSTimeInterval)latency
+{
+    uint64_t value = (uint64_t)(MAX(latency, 0) * kChessBenchmarkMicroseconds);
+
+    pthread_mutex_lock(&mutex);
+    chess_histogram_record(&latencies, value);
+    pthread_mutex_unlock(&mutex);
+}
+
+- (void)addOperations:(NSUInteger)count
+{
+    pthread_mutex_lock(&mutex);
+    operations += count;
+    pthread_mutex_unlock(&mutex);
+}
+
+- (NSDictionary *)result
+{
+    pthread_mutex_lock(&mutex);
+
+    NSDictionary *latency = @{ @"count" : @(latencies.count),
+                               @"p50"   : @(chess_histogram_percentile(&latencies, 50) / kChessBenchmarkMicroseconds),
+                               @"p99"   : @(chess_histogram_percentile(&latencies, 99) / kChessBenchmarkMicroseconds),
+                               @"max"   : @(latencies.max / kChessBenchmarkMicroseconds),
+                               @"mean"  : @(chess_histogram_mean(&latencies) / kChessBenchmarkMicroseconds) };
+    NSUInteger count = operations;
+
+    pthread_mutex_unlock(&mutex);
+
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithCapacity:10];
+    result[@"name"] = name;
+    result[@"store"] = storeType;
+    result[@"operations"] = @(count);
+    result[@"elapsed"] = @(elapsed);
+    result[@"throughput"] = @(elapsed > 0 ? count / elapsed : 0);
+    result[@"latency"] = latency;
+    result[@"peakResidentSize"] = @(ChessBenchmarkPeakResidentSize());
+    result[@"residentSize"] = @(ChessBenchmarkResidentSize());
+
+    if ([extras count] > 0)
+    {
+        result[@"extras"] = [extras copy];
+    }
+
+    return result;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Process
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t ChessBenchmarkPeakResidentSize(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+
+    // ru_maxrss is in bytes on Darwin.
+    return (uint64_t)usage.ru_maxrss;
+}
+
+uint64_t ChessBenchmarkResidentSize(void)
+{
+    struct mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+    kern_return_t kr = task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count);
+    if (kr != KERN_SUCCESS)
+    {
+        return 0;
+    }
+
+    return info.resident_size;
+}
+
+BOOL ChessBenchmarkRunUntil(BOOL (^condition)(void), NSTimeInterval timeout)
+{
+    NSTimeInterval deadline = ChessMonotonicTime() + timeout;
+
+    while (!condition())
+    {
+        if (ChessMonotonicTime() > deadline)
+        {
+            return NO;
+        }
+
+        @autoreleasepool {
+            [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.001]];
+        }
+    }
+
+    return YES;
+}
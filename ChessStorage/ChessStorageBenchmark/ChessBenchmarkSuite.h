@@ -0,0 +1,62 @@
+//
+//  ChessBenchmarkSuite.h
+//  ChessStorageBenchmark
+//
+//  Created by Xiangqi on 16/8/9.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSInteger, ChessBenchmarkStoreType) {
+    ChessBenchmarkStoreTypeInMemory = 0,
+    ChessBenchmarkStoreTypeSQLite,
+};
+
+/**
+ * Drives RosterStorage / FriendEntity workloads against a fresh store each,
+ * and reports one result dictionary per measured variant (see ChessBenchmarkRecorder).
+ *
+ * Every workload runs on the main thread, and spins the main run loop while waiting
+ * for completion blocks and main thread merges.
+ **/
+
+@interface ChessBenchmarkSuite : NSObject
+
+- (id)initWithStoreType:(ChessBenchmarkStoreType)storeType;
+
+@property (nonatomic, assign, readonly) ChessBenchmarkStoreType storeType;
+
+/**
+ * The number of friends each workload inserts, reads, upserts or deletes.
+ *
+ * Default 10000
+ **/
+@property (nonatomic, assign) NSUInteger numberOfRows;
+
+/**
+ * The number of rows handled by a single request, where a workload batches its requests.
+ *
+ * Default 100
+ **/
+@property (nonatomic, assign) NSUInteger batchSize;
+
+/**
+ * All workload names, in the order they are run by default.
+ **/
++ (NSArray *)workloadNames;
+
+/**
+ * Runs the named workload, and returns its results (one dictionary per variant).
+ * Returns nil for an unknown name.
+ *
+ * Must be invoked on the main thread.
+ **/
+- (NSArray *)runWorkloadNamed:(NSString *)name;
+
+/**
+ * Removes the SQLite files written by the workloads.
+ **/
+- (void)removeStoreFiles;
+
+@end
@@ -0,0 +1,1880 @@
+//
+//  ChessBenchmarkSuite.m
+//  ChessStorageBenchmark
+//
+//  Created by Xiangqi on 16/8/9.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#import "ChessBenchmarkSuite.h"
+#import "ChessBenchmarkRecorder.h"
+#import "ChessTime.h"
+#import "RosterStorage.h"
+#import "ChessStorageProtected.h"
+#import "ChessConfigProtected.h"
+
+#import <UIKit/UIApplication.h>
+#import <libkern/OSAtomic.h>
+
+// Generous upper bound for anything the workloads wait for on the main run loop.
+#define kChessBenchmarkTimeout 60.0
+
+/**
+ * Loads the first version of the Roster model, from before its fetch indexes,
+ * as the baseline of the indexed queries.
+ **/
+@interface ChessBenchmarkUnindexedConfig : ChessConfig
+@end
+
+@implementation ChessBenchmarkUnindexedConfig
+
+- (NSBundle *)managedObjectModelBundle
+{
+    // The versions of a model are compiled to separate .mom files, named after the versions, within the .momd
+    NSString *momdPath = [[super managedObjectModelBundle] pathForResource:[self managedObjectModelName] ofType:@"momd"];
+
+    return momdPath ? [NSBundle bundleWithPath:momdPath] : [super managedObjectModelBundle];
+}
+
+@end
+
+static NSString *ChessBenchmarkFriendName(NSUInteger index)
+{
+    return [NSString stringWithFormat:@"friend-%06lu", (unsigned long)index];
+}
+
+static NSNumber *ChessBenchmarkFriendAge(NSUInteger index)
+{
+    return @(index % 100);
+}
+
+static void ChessBenchmarkInsertFriend(NSManagedObjectContext *moc, NSUInteger index)
+{
+    FriendEntity *friend = [NSEntityDescription insertNewObjectForEntityForName:kRosterFriendEntityName
+                                                         inManagedObjectContext:moc];
+    friend.name = ChessBenchmarkFriendName(index);
+    friend.age = ChessBenchmarkFriendAge(index);
+}
+
+static double ChessBenchmarkMedian(NSMutableArray *values)
+{
+    if ([values count] == 0) return 0;
+
+    [values sortUsingSelector:@selector(compare:)];
+    return [values[[values count] / 2] doubleValue];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessBenchmarkFetchedResultsObserver : NSObject <NSFetchedResultsControllerDelegate>
+
+@property (atomic, assign) NSUInteger numberOfChanges;
+
+@end
+
+@implementation ChessBenchmarkFetchedResultsObserver
+
+- (void)controllerDidChangeContent:(NSFetchedResultsController *)controller
+{
+    self.numberOfChanges++;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface ChessBenchmarkSuite ()
+{
+    NSString *storeDirectory;
+}
+
+@end
+
+@implementation ChessBenchmarkSuite
+
+@synthesize storeType, numberOfRows, batchSize;
+
++ (NSArray *)workloadNames
+{
+    return @[ @"bulk-insert",
+              @"write-shards",
+              @"upsert-storm",
+              @"bulk-import",
+              @"snapshot-restore",
+              @"journaled-upsert",
+              @"mixed-read-write",
+              @"priority-lanes",
+              @"object-id-cache",
+              @"paged-fetch",
+              @"paged-enumeration",
+              @"delete-heavy",
+              @"batch-maintenance",
+              @"main-context-merge",
+              @"change-feed",
+              @"fetch-cache",
+              @"projection",
+              @"query-advisor",
+              @"memory-governor",
+              @"did-save-bus",
+              @"maybe-save",
+              @"store-profiles" ];
+}
+
+- (id)initWithStoreType:(ChessBenchmarkStoreType)aStoreType
+{
+    if (self = [super init]) {
+        storeType = aStoreType;
+        numberOfRows = 10000;
+        batchSize = 100;
+
+        storeDirectory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"ChessStorageBenchmark"];
+    }
+
+    return self;
+}
+
+- (NSArray *)runWorkloadNamed:(NSString *)name
+{
+    NSAssert([NSThread isMainThread], @"Invoked on incorrect thread");
+
+    NSDictionary *workloads = @{ @"bulk-insert"        : NSStringFromSelector(@selector(runBulkInsert)),
+                                 @"write-shards"       : NSStringFromSelector(@selector(runWriteShards)),
+                                 @"upsert-storm"       : NSStringFromSelector(@selector(runUpsertStorm)),
+                                 @"bulk-import"        : NSStringFromSelector(@selector(runBulkImport)),
+                                 @"snapshot-restore"   : NSStringFromSelector(@selector(runSnapshotRestore)),
+                                 @"journaled-upsert"   : NSStringFromSelector(@selector(runJournaledUpsert)),
+                                 @"mixed-read-write"   : NSStringFromSelector(@selector(runMixedReadWrite)),
+                                 @"priority-lanes"     : NSStringFromSelector(@selector(runPriorityLanes)),
+                                 @"object-id-cache"    : NSStringFromSelector(@selector(runObjectIDCache)),
+                                 @"paged-fetch"        : NSStringFromSelector(@selector(runPagedFetch)),
+                                 @"paged-enumeration"  : NSStringFromSelector(@selector(runPagedEnumeration)),
+                                 @"delete-heavy"       : NSStringFromSelector(@selector(runDeleteHeavy)),
+                                 @"batch-maintenance"  : NSStringFromSelector(@selector(runBatchMaintenance)),
+                                 @"main-context-merge" : NSStringFromSelector(@selector(runMainContextMerge)),
+                                 @"change-feed"        : NSStringFromSelector(@selector(runChangeFeed)),
+                                 @"fetch-cache"        : NSStringFromSelector(@selector(runFetchCache)),
+                                 @"projection"         : NSStringFromSelector(@selector(runProjection)),
+                                 @"query-advisor"      : NSStringFromSelector(@selector(runQueryAdvisor)),
+                                 @"memory-governor"    : NSStringFromSelector(@selector(runMemoryGovernor)),
+                                 @"did-save-bus"       : NSStringFromSelector(@selector(runDidSaveBus)),
+                                 @"maybe-save"         : NSStringFromSelector(@selector(runMaybeSave)),
+                                 @"store-profiles"     : NSStringFromSelector(@selector(runStoreProfiles)) };
+
+    NSString *selectorName = workloads[name];
+    if (selectorName == nil)
+    {
+        return nil;
+    }
+
+    NSArray *(*run)(id, SEL) = (NSArray *(*)(id, SEL))[self methodForSelector:NSSelectorFromString(selectorName)];
+
+    @autoreleasepool {
+        return run(self, NSSelectorFromString(selectorName));
+    }
+}
+
+- (void)removeStoreFiles
+{
+    [[NSFileManager defaultManager] removeItemAtPath:storeDirectory error:NULL];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Helpers
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)storeTypeName
+{
+    return (storeType == ChessBenchmarkStoreTypeSQLite) ? @"sqlite" : @"memory";
+}
+
+- (ChessBenchmarkRecorder *)recorderWithName:(NSString *)name
+{
+    return [[ChessBenchmarkRecorder alloc] initWithName:name storeType:[self storeTypeName]];
+}
+
+- (RosterStorage *)newStorage
+{
+    return [self newStorageWithWriteShards:0];
+}
+
+- (RosterStorage *)newStorageWithWriteShards:(NSUInteger)numberOfWriteShards
+{
+    return [self newStorageWithWriteShards:numberOfWriteShards fetchIndexes:YES];
+}
+
+- (RosterStorage *)newStorageWithWriteShards:(NSUInteger)numberOfWriteShards fetchIndexes:(BOOL)fetchIndexes
+{
+    ChessConfig *config = nil;
+    Class configClass = fetchIndexes ? [ChessConfig class] : [ChessBenchmarkUnindexedConfig class];
+
+    if (storeType == ChessBenchmarkStoreTypeSQLite)
+    {
+        [[NSFileManager defaultManager] createDirectoryAtPath:storeDirectory
+                                  withIntermediateDirectories:YES
+                                                   attributes:nil
+                                                        error:NULL];
+
+        // A new file for every storage, so no workload starts with the leftovers of another.
+        config = [[configClass alloc] initWithDatabaseFilename:[[NSUUID UUID] UUIDString] managedObjectModelName:@"Roster"];
+        config.persistentStoreDirectory = storeDirectory;
+    }
+    else
+    {
+        config = [[configClass alloc] initWithInMemoryStoreAndManagedObjectModelName:@"Roster"];
+    }
+
+    config.numberOfWriteShards = numberOfWriteShards;
+
+    RosterStorage *storage = [[RosterStorage alloc] initWithConfiguration:config];
+    storage.metrics = [[ChessStorageMetrics alloc] init];
+
+    return storage;
+}
+
+/**
+ * Waits until every request scheduled so far has been processed, and the resulting save (if any) is done.
+ **/
+- (void)drainStorage:(RosterStorage *)storage
+{
+    // executeBlock runs maybeSave asynchronously after the block,
+    // so the second request is queued behind the save of the first one.
+    // The bulk lane, because interactive requests jump ahead of scheduled ones.
+    [storage executeBlock:^{} lane:ChessStorageLaneBulk];
+    [storage executeBlock:^{} lane:ChessStorageLaneBulk];
+}
+
+/**
+ * Same as drainStorage:, for the storageQueue and every write shard.
+ * Creates the contexts of the shards, if needed.
+ **/
+- (void)drainWriteShardsOfStorage:(RosterStorage *)storage
+{
+    [self drainStorage:storage];
+
+    NSUInteger numberOfShards = [[storage.config writeShards] count];
+    NSMutableIndexSet *drainedShards = [NSMutableIndexSet indexSet];
+
+    for (NSUInteger key = 0; [drainedShards count] < numberOfShards && key < numberOfShards * 64; key++)
+    {
+        NSUInteger index = [[storage.config writeShardForKey:@(key)] index];
+        if ([drainedShards containsIndex:index]) continue;
+
+        [drainedShards addIndex:index];
+        [storage executeBlock:^{ [storage managedObjectContext]; } shardKey:@(key)];
+        [storage executeBlock:^{} shardKey:@(key)];
+    }
+}
+
+- (void)seedStorage:(RosterStorage *)storage count:(NSUInteger)count
+{
+    for (NSUInteger location = 0; location < count; location += 1000)
+    {
+        NSUInteger end = MIN(location + 1000, count);
+
+        [storage executeBlock:^{
+            NSManagedObjectContext *moc = [storage managedObjectContext];
+            for (NSUInteger i = location; i < end; i++)
+            {
+                ChessBenchmarkInsertFriend(moc, i);
+            }
+        }];
+    }
+
+    [self drainStorage:storage];
+}
+
+- (NSDictionary *)metricsOfStorage:(RosterStorage *)storage
+{
+    __block NSDictionary *result = nil;
+
+    [storage executeBlock:^{
+        result = [[storage.metrics snapshot] dictionaryRepresentation];
+    }];
+
+    return result;
+}
+
+- (NSDictionary *)finishRecorder:(ChessBenchmarkRecorder *)recorder storage:(RosterStorage *)storage
+{
+    recorder.extras[@"storageMetrics"] = [self metricsOfStorage:storage];
+
+    return [recorder result];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Workloads
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Inserts numberOfRows friends, batchSize per executeBlock.
+ * Latency: one executeBlock round trip.
+ **/
+- (NSArray *)runBulkInsert
+{
+    ChessBenchmarkRecorder *recorder = [self recorderWithName:@"bulk-insert"];
+    RosterStorage *storage = [self newStorage];
+
+    [recorder start];
+
+    for (NSUInteger location = 0; location < numberOfRows; location += batchSize)
+    {
+        NSUInteger end = MIN(location + batchSize, numberOfRows);
+        NSTimeInterval start = ChessMonotonicTime();
+
+        [storage executeBlock:^{
+            NSManagedObjectContext *moc = [storage managedObjectContext];
+            for (NSUInteger i = location; i < end; i++)
+            {
+                ChessBenchmarkInsertFriend(moc, i);
+            }
+        }];
+
+        [recorder recordLatency:(ChessMonotonicTime() - start)];
+        [recorder addOperations:(end - location)];
+    }
+
+    [self drainStorage:storage];
+    [recorder stop];
+
+    return @[ [self finishRecorder:recorder storage:storage] ];
+}
+
+/**
+ * Inserts numberOfRows friends, batchSize per scheduleBlock:shardKey:, keyed by batch,
+ * without write shards (everything on the storageQueue), then with 1, 2 and 4 write shards.
+ * Latency: from scheduling a batch to the end of its block.
+ **/
+- (NSArray *)runWriteShards
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:4];
+
+    for (NSNumber *shards in @[ @0, @1, @2, @4 ])
+    {
+        NSUInteger numberOfShards = [shards unsignedIntegerValue];
+
+        NSString *name = [NSString stringWithFormat:@"write-shards-%lu", (unsigned long)numberOfShards];
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:name];
+        RosterStorage *storage = [self newStorageWithWriteShards:numberOfShards];
+
+        // Set up the CoreData stack, and the contexts of the shards, beforehand.
+        [self drainWriteShardsOfStorage:storage];
+
+        [recorder start];
+
+        for (NSUInteger location = 0; location < numberOfRows; location += batchSize)
+        {
+            NSUInteger end = MIN(location + batchSize, numberOfRows);
+            NSTimeInterval enqueueTime = ChessMonotonicTime();
+
+            [storage scheduleBlock:^{
+                NSManagedObjectContext *moc = [storage managedObjectContext];
+                for (NSUInteger i = location; i < end; i++)
+                {
+                    ChessBenchmarkInsertFriend(moc, i);
+                }
+
+                [recorder recordLatency:(ChessMonotonicTime() - enqueueTime)];
+                [recorder addOperations:(end - location)];
+
+            } shardKey:@(location / batchSize)];
+        }
+
+        [self drainWriteShardsOfStorage:storage];
+        [recorder stop];
+
+        recorder.extras[@"numberOfWriteShards"] = shards;
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+/**
+ * Half of the rows exist beforehand, then every row is upserted by name:
+ * once with one scheduleBlock (fetch, then update or insert) per row,
+ * once with scheduleBatchUpsertEntityName:, 1000 rows per batch.
+ * Latency: from scheduling to the end of the block, or to the completion block.
+ **/
+- (NSArray *)runUpsertStorm
+{
+    NSUInteger rows = numberOfRows;
+
+    // Visit the rows in a scattered order, so updates and inserts interleave.
+    NSUInteger stride = 7919;
+    while (rows > 1 && rows % stride == 0) stride++;
+
+    // Per row
+
+    ChessBenchmarkRecorder *perRowRecorder = [self recorderWithName:@"upsert-storm-per-row"];
+    RosterStorage *perRowStorage = [self newStorage];
+    [self seedStorage:perRowStorage count:rows / 2];
+
+    [perRowRecorder start];
+
+    for (NSUInteger i = 0; i < rows; i++)
+    {
+        NSUInteger index = (i * stride) % rows;
+        NSTimeInterval enqueueTime = ChessMonotonicTime();
+
+        [perRowStorage scheduleBlock:^{
+            NSArray *result = [perRowStorage fetchEntityName:kRosterFriendEntityName
+                                                    criteria:@"name == $name"
+                                                   variables:@{ @"name": ChessBenchmarkFriendName(index) }
+                                                      sortBy:nil
+                                                   ascending:YES];
+
+            FriendEntity *friend = [result firstObject];
+            if (friend)
+            {
+                friend.age = @(([friend.age integerValue] + 1) % 100);
+            }
+            else
+            {
+                ChessBenchmarkInsertFriend([perRowStorage managedObjectContext], index);
+            }
+
+            [perRowRecorder recordLatency:(ChessMonotonicTime() - enqueueTime)];
+        }];
+
+        [perRowRecorder addOperations:1];
+    }
+
+    [self drainStorage:perRowStorage];
+    [perRowRecorder stop];
+
+    // Batch
+
+    ChessBenchmarkRecorder *batchRecorder = [self recorderWithName:@"upsert-storm-batch"];
+    RosterStorage *batchStorage = [self newStorage];
+    [self seedStorage:batchStorage count:rows / 2];
+
+    NSUInteger upsertBatchSize = 1000;
+    NSMutableArray *batches = [NSMutableArray array];
+    for (NSUInteger location = 0; location < rows; location += upsertBatchSize)
+    {
+        NSMutableArray *values = [NSMutableArray arrayWithCapacity:upsertBatchSize];
+        for (NSUInteger i = location; i < MIN(location + upsertBatchSize, rows); i++)
+        {
+            NSUInteger index = (i * stride) % rows;
+            [values addObject:@{ @"name": ChessBenchmarkFriendName(index), @"age": ChessBenchmarkFriendAge(index + 1) }];
+        }
+        [batches addObject:values];
+    }
+
+    __block NSUInteger completedBatches = 0;
+
+    [batchRecorder start];
+
+    for (NSArray *values in batches)
+    {
+        NSTimeInterval enqueueTime = ChessMonotonicTime();
+
+        [batchStorage scheduleBatchUpsertEntityName:kRosterFriendEntityName
+                                   uniquingKeyPaths:@[ @"name" ]
+                                             values:values
+                                         completion:^{
+            [batchRecorder recordLatency:(ChessMonotonicTime() - enqueueTime)];
+            completedBatches++;
+        }];
+
+        [batchRecorder addOperations:[values count]];
+    }
+
+    NSUInteger numberOfBatches = [batches count];
+    ChessBenchmarkRunUntil(^BOOL{ return completedBatches == numberOfBatches; }, kChessBenchmarkTimeout);
+
+    [self drainStorage:batchStorage];
+    [batchRecorder stop];
+
+    return @[ [self finishRecorder:perRowRecorder storage:perRowStorage],
+              [self finishRecorder:batchRecorder storage:batchStorage] ];
+}
+
+/**
+ * Imports numberOfRows friends from a file:
+ * the parser alone (ChessRecordParser over the CSV file), one addNewFriendEntityWithName:age: per record,
+ * then importFriendsFromFileAtPath: from the CSV file and from the JSON Lines file.
+ * Latency: one parsed batch (parser alone), or the whole import.
+ * The extras show the statistics of the import, and the peak resident size while it runs.
+ **/
+- (NSArray *)runBulkImport
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:4];
+    NSUInteger rows = numberOfRows;
+
+    [[NSFileManager defaultManager] createDirectoryAtPath:storeDirectory
+                              withIntermediateDirectories:YES
+                                               attributes:nil
+                                                    error:NULL];
+
+    NSString *csvPath = [storeDirectory stringByAppendingPathComponent:@"friends.csv"];
+    NSString *jsonPath = [storeDirectory stringByAppendingPathComponent:@"friends.jsonl"];
+
+    NSMutableString *csv = [NSMutableString stringWithString:@"name,age\n"];
+    NSMutableString *json = [NSMutableString string];
+    for (NSUInteger i = 0; i < rows; i++)
+    {
+        [csv appendFormat:@"%@,%@\n", ChessBenchmarkFriendName(i), ChessBenchmarkFriendAge(i)];
+        [json appendFormat:@"{\"name\": \"%@\", \"age\": %@}\n", ChessBenchmarkFriendName(i), ChessBenchmarkFriendAge(i)];
+    }
+    [csv writeToFile:csvPath atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    [json writeToFile:jsonPath atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    csv = nil;
+    json = nil;
+
+    // Parser alone
+
+    ChessBenchmarkRecorder *parseRecorder = [self recorderWithName:@"bulk-import-parse"];
+    const char *fieldNames[] = { "name", "age" };
+    ChessRecordParser *parser = NULL;
+
+    if (chess_record_parser_open([csvPath fileSystemRepresentation], CHESS_RECORD_FORMAT_CSV, fieldNames, 2, &parser) == 0)
+    {
+        ChessRecordBatch *batch = chess_record_batch_create(500, 2);
+        int64_t totalAge = 0;
+
+        [parseRecorder start];
+
+        while (YES)
+        {
+            NSTimeInterval start = ChessMonotonicTime();
+
+            chess_record_parser_next_batch(parser, batch);
+            for (size_t i = 0; i < batch->count; i++)
+            {
+                totalAge += batch->fields[(i * 2) + 1].integer;
+            }
+
+            if (batch->count == 0) break;
+
+            [parseRecorder recordLatency:(ChessMonotonicTime() - start)];
+            [parseRecorder addOperations:batch->count];
+        }
+
+        [parseRecorder stop];
+
+        parseRecorder.extras[@"totalAge"] = @(totalAge);
+        parseRecorder.extras[@"bytes"] = @(chess_record_parser_input_size(parser));
+
+        chess_record_batch_destroy(batch);
+        chess_record_parser_close(parser);
+    }
+
+    [results addObject:[parseRecorder result]];
+
+    // One block per record
+
+    ChessBenchmarkRecorder *perRecordRecorder = [self recorderWithName:@"bulk-import-per-record"];
+    RosterStorage *perRecordStorage = [self newStorage];
+
+    [perRecordRecorder start];
+
+    for (NSUInteger i = 0; i < rows; i++)
+    {
+        [perRecordStorage addNewFriendEntityWithName:ChessBenchmarkFriendName(i) age:[ChessBenchmarkFriendAge(i) integerValue]];
+    }
+
+    [self drainStorage:perRecordStorage];
+    [perRecordRecorder stop];
+
+    [perRecordRecorder addOperations:rows];
+    [results addObject:[self finishRecorder:perRecordRecorder storage:perRecordStorage]];
+
+    // Import pipeline
+
+    for (NSString *path in @[ csvPath, jsonPath ])
+    {
+        BOOL isCSV = [[path pathExtension] isEqualToString:@"csv"];
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:(isCSV ? @"bulk-import-csv" : @"bulk-import-json")];
+        RosterStorage *storage = [self newStorage];
+
+        __block NSDictionary *statistics = nil;
+        __block uint64_t maxResidentSize = 0;
+        NSTimeInterval start = ChessMonotonicTime();
+
+        [recorder start];
+
+        [storage importFriendsFromFileAtPath:path completion:^(NSDictionary *importStatistics, NSError *error) {
+            statistics = importStatistics ?: @{ @"error": [error description] };
+        }];
+
+        ChessBenchmarkRunUntil(^BOOL{
+            maxResidentSize = MAX(maxResidentSize, ChessBenchmarkResidentSize());
+            return statistics != nil;
+        }, kChessBenchmarkTimeout);
+
+        [self drainStorage:storage];
+        [recorder stop];
+
+        [recorder recordLatency:(ChessMonotonicTime() - start)];
+        [recorder addOperations:[statistics[@"records"] unsignedIntegerValue]];
+
+        recorder.extras[@"import"] = statistics;
+        recorder.extras[@"maxResidentSize"] = @(maxResidentSize);
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    [[NSFileManager defaultManager] removeItemAtPath:csvPath error:NULL];
+    [[NSFileManager defaultManager] removeItemAtPath:jsonPath error:NULL];
+
+    return results;
+}
+
+/**
+ * Seeds a store with numberOfRows friends by inserting them, exports a snapshot of it,
+ * then seeds a new store by restoring the snapshot instead, and opens it to count the friends.
+ * Latency: the whole seeding, export or restore. SQLite only, an in-memory store has no files to snapshot.
+ **/
+- (NSArray *)runSnapshotRestore
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:3];
+
+    if (storeType != ChessBenchmarkStoreTypeSQLite)
+    {
+        return results;
+    }
+
+    NSString *snapshotPath = [storeDirectory stringByAppendingPathComponent:@"friends.snapshot"];
+
+    // Seeding by inserts
+
+    ChessBenchmarkRecorder *insertRecorder = [self recorderWithName:@"snapshot-seed-inserts"];
+    RosterStorage *storage = [self newStorage];
+
+    NSTimeInterval start = ChessMonotonicTime();
+    [insertRecorder start];
+
+    [self seedStorage:storage count:numberOfRows];
+
+    [insertRecorder stop];
+    [insertRecorder recordLatency:(ChessMonotonicTime() - start)];
+    [insertRecorder addOperations:numberOfRows];
+    [results addObject:[self finishRecorder:insertRecorder storage:storage]];
+
+    // Export
+
+    ChessBenchmarkRecorder *exportRecorder = [self recorderWithName:@"snapshot-export"];
+
+    __block NSDictionary *manifest = nil;
+    __block NSError *exportError = nil;
+    __block BOOL exported = NO;
+
+    start = ChessMonotonicTime();
+    [exportRecorder start];
+
+    [storage exportSnapshotToPath:snapshotPath completion:^(NSDictionary *snapshotManifest, NSError *error) {
+        manifest = snapshotManifest;
+        exportError = error;
+        exported = YES;
+    }];
+
+    ChessBenchmarkRunUntil(^BOOL{ return exported; }, kChessBenchmarkTimeout);
+
+    [exportRecorder stop];
+    [exportRecorder recordLatency:(ChessMonotonicTime() - start)];
+    [exportRecorder addOperations:numberOfRows];
+
+    uint64_t bytes = 0;
+    for (NSDictionary *file in manifest[@"files"])
+    {
+        bytes += [file[@"size"] unsignedLongLongValue];
+    }
+
+    exportRecorder.extras[@"bytes"] = @(bytes);
+    exportRecorder.extras[@"files"] = @([manifest[@"files"] count]);
+    exportRecorder.extras[@"copyTime"] = manifest[@"copyTime"] ?: @(0);
+    if (exportError) exportRecorder.extras[@"error"] = [exportError description];
+    [results addObject:[self finishRecorder:exportRecorder storage:storage]];
+
+    // Seeding by restore, opening the store included
+
+    ChessBenchmarkRecorder *restoreRecorder = [self recorderWithName:@"snapshot-restore"];
+    RosterStorage *restoredStorage = [self newStorage];
+    NSError *restoreError = nil;
+
+    start = ChessMonotonicTime();
+    [restoreRecorder start];
+
+    [restoredStorage.config restoreSnapshotAtPath:snapshotPath replaceExistingStore:YES error:&restoreError];
+    NSTimeInterval restoreTime = ChessMonotonicTime() - start;
+
+    NSUInteger count = [restoredStorage countEntityName:kRosterFriendEntityName criteria:nil variables:nil error:NULL];
+
+    [restoreRecorder stop];
+    [restoreRecorder recordLatency:(ChessMonotonicTime() - start)];
+    [restoreRecorder addOperations:numberOfRows];
+
+    restoreRecorder.extras[@"restoreTime"] = @(restoreTime);
+    restoreRecorder.extras[@"count"] = @(count);
+    if (restoreError) restoreRecorder.extras[@"error"] = [restoreError description];
+    [results addObject:[self finishRecorder:restoreRecorder storage:restoredStorage]];
+
+    [[NSFileManager defaultManager] removeItemAtPath:snapshotPath error:NULL];
+
+    return results;
+}
+
+/**
+ * Upserts numberOfRows friends with scheduleBatchUpsertEntityName:, batchSize per batch:
+ * without a journal (saveThreshold 500), then with a journal and a saveThreshold of 500 and of 10000.
+ * Latency: from scheduling a batch to its completion block, which waits for the group commit when journaled.
+ **/
+- (NSArray *)runJournaledUpsert
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:3];
+
+    NSArray *variants = @[ @[ @"journaled-upsert-off", @NO, @500 ],
+                           @[ @"journaled-upsert-500", @YES, @500 ],
+                           @[ @"journaled-upsert-10000", @YES, @10000 ] ];
+
+    for (NSArray *variant in variants)
+    {
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:variant[0]];
+        RosterStorage *storage = [self newStorage];
+        storage.saveThreshold = [variant[2] unsignedIntegerValue];
+
+        NSString *journalPath = nil;
+        if ([variant[1] boolValue])
+        {
+            [[NSFileManager defaultManager] createDirectoryAtPath:storeDirectory
+                                      withIntermediateDirectories:YES
+                                                       attributes:nil
+                                                            error:NULL];
+
+            journalPath = [storeDirectory stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+            storage.journal = [[ChessOperationJournal alloc] initWithPath:journalPath error:NULL];
+        }
+
+        __block NSUInteger completedBatches = 0;
+        NSUInteger numberOfBatches = 0;
+
+        [recorder start];
+
+        for (NSUInteger location = 0; location < numberOfRows; location += batchSize)
+        {
+            NSMutableArray *values = [NSMutableArray arrayWithCapacity:batchSize];
+            for (NSUInteger i = location; i < MIN(location + batchSize, numberOfRows); i++)
+            {
+                [values addObject:@{ @"name": ChessBenchmarkFriendName(i), @"age": ChessBenchmarkFriendAge(i) }];
+            }
+
+            NSTimeInterval enqueueTime = ChessMonotonicTime();
+
+            [storage scheduleBatchUpsertEntityName:kRosterFriendEntityName
+                                  uniquingKeyPaths:@[ @"name" ]
+                                            values:values
+                                        completion:^{
+                [recorder recordLatency:(ChessMonotonicTime() - enqueueTime)];
+                completedBatches++;
+            }];
+
+            [recorder addOperations:[values count]];
+            numberOfBatches++;
+        }
+
+        ChessBenchmarkRunUntil(^BOOL{ return completedBatches == numberOfBatches; }, kChessBenchmarkTimeout);
+
+        [self drainStorage:storage];
+        [recorder stop];
+
+        if (journalPath)
+        {
+            recorder.extras[@"journal"] = [storage.journal statistics];
+            storage.journal = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:journalPath error:NULL];
+        }
+
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+/**
+ * numberOfRows requests on a seeded store, 4 reads (fetch by name) for every write (update by name).
+ * Latency: one executeBlock round trip.
+ **/
+- (NSArray *)runMixedReadWrite
+{
+    ChessBenchmarkRecorder *recorder = [self recorderWithName:@"mixed-read-write"];
+    RosterStorage *storage = [self newStorage];
+    [self seedStorage:storage count:numberOfRows];
+
+    NSUInteger rows = numberOfRows;
+
+    [recorder start];
+
+    for (NSUInteger i = 0; i < rows; i++)
+    {
+        NSUInteger index = (i * 31) % rows;
+        BOOL isWrite = (i % 5 == 0);
+        NSTimeInterval start = ChessMonotonicTime();
+
+        [storage executeBlock:^{
+            NSArray *result = [storage fetchEntityName:kRosterFriendEntityName
+                                              criteria:@"name == $name"
+                                             variables:@{ @"name": ChessBenchmarkFriendName(index) }
+                                                sortBy:nil
+                                             ascending:YES];
+            if (isWrite)
+            {
+                FriendEntity *friend = [result firstObject];
+                friend.age = @(([friend.age integerValue] + 1) % 100);
+            }
+        }];
+
+        [recorder recordLatency:(ChessMonotonicTime() - start)];
+        [recorder addOperations:1];
+    }
+
+    [self drainStorage:storage];
+    [recorder stop];
+
+    recorder.extras[@"readRatio"] = @(0.8);
+    recorder.extras[@"fetchRequestCache"] = [storage fetchRequestCacheStatistics];
+
+    return @[ [self finishRecorder:recorder storage:storage] ];
+}
+
+/**
+ * Schedules an import of numberOfRows friends, batchSize per scheduleBlock, then looks up 200 friends by name
+ * with executeBlock while the import is queued: in the interactive lane, then in the bulk lane (plain FIFO).
+ * Latency: one lookup round trip.
+ * The storage metrics hold the queue wait of each lane, and the saves deferred for interactive requests.
+ **/
+- (NSArray *)runPriorityLanes
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:2];
+
+    for (NSNumber *lane in @[ @(ChessStorageLaneInteractive), @(ChessStorageLaneBulk) ])
+    {
+        BOOL interactive = ([lane integerValue] == ChessStorageLaneInteractive);
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:(interactive ? @"priority-lanes" : @"priority-lanes-fifo")];
+
+        RosterStorage *storage = [self newStorage];
+        NSUInteger seededRows = MIN((NSUInteger)1000, numberOfRows);
+        [self seedStorage:storage count:seededRows];
+
+        NSUInteger rows = numberOfRows;
+        NSUInteger size = batchSize;
+        NSUInteger numberOfLookups = 200;
+
+        [recorder start];
+
+        for (NSUInteger location = 0; location < rows; location += size)
+        {
+            [storage scheduleBlock:^{
+                NSManagedObjectContext *moc = [storage managedObjectContext];
+                for (NSUInteger i = location; i < MIN(location + size, rows); i++)
+                {
+                    ChessBenchmarkInsertFriend(moc, seededRows + i);
+                }
+            }];
+        }
+
+        for (NSUInteger i = 0; i < numberOfLookups; i++)
+        {
+            NSUInteger index = (i * 31) % seededRows;
+            NSTimeInterval start = ChessMonotonicTime();
+
+            [storage executeBlock:^{
+                [storage fetchEntityName:kRosterFriendEntityName
+                                criteria:@"name == $name"
+                               variables:@{ @"name": ChessBenchmarkFriendName(index) }
+                                  sortBy:nil
+                               ascending:YES];
+            } lane:[lane integerValue]];
+
+            [recorder recordLatency:(ChessMonotonicTime() - start)];
+            [recorder addOperations:1];
+        }
+
+        [self drainStorage:storage];
+        [recorder stop];
+
+        recorder.extras[@"importedRows"] = @(rows);
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+/**
+ * numberOfRows lookups by name on a seeded store, with objectWithEntityName:uniquingKeyPaths:values:,
+ * 9 out of 10 of them in a hot set of 1000 friends, every 5th one followed by an update.
+ * Without an object ID cache for the name, then with one of 2000 entries.
+ * Latency: one executeBlock round trip.
+ **/
+- (NSArray *)runObjectIDCache
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:2];
+    NSUInteger rows = numberOfRows;
+    NSUInteger hotRows = MIN((NSUInteger)1000, rows);
+
+    for (NSNumber *capacity in @[ @0, @2000 ])
+    {
+        NSString *name = [capacity unsignedIntegerValue] ? @"object-id-cache-on" : @"object-id-cache-off";
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:name];
+
+        RosterStorage *storage = [self newStorage];
+        [storage setObjectIDCacheCapacity:[capacity unsignedIntegerValue]
+                            forEntityName:kRosterFriendEntityName
+                         uniquingKeyPaths:@[ @"name" ]];
+        [self seedStorage:storage count:rows];
+
+        [recorder start];
+
+        for (NSUInteger i = 0; i < rows; i++)
+        {
+            NSUInteger index = (i % 10 == 0) ? (i * 31) % rows : (i * 31) % hotRows;
+            BOOL isWrite = (i % 5 == 0);
+            NSTimeInterval start = ChessMonotonicTime();
+
+            [storage executeBlock:^{
+                FriendEntity *friend = (FriendEntity *)[storage objectWithEntityName:kRosterFriendEntityName
+                                                                    uniquingKeyPaths:@[ @"name" ]
+                                                                              values:@{ @"name": ChessBenchmarkFriendName(index) }];
+                if (isWrite)
+                {
+                    friend.age = @(([friend.age integerValue] + 1) % 100);
+                }
+            }];
+
+            [recorder recordLatency:(ChessMonotonicTime() - start)];
+            [recorder addOperations:1];
+        }
+
+        [self drainStorage:storage];
+        [recorder stop];
+
+        recorder.extras[@"objectIDCache"] = [storage objectIDCacheStatistics];
+
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+/**
+ * Pages through a seeded store sorted by age and name, batchSize friends per page:
+ * once sequentially on the storageQueue with fetchOffset / fetchLimit,
+ * once with every page requested at once through the read-only context pool.
+ * Latency: one page, from request to results.
+ **/
+- (NSArray *)runPagedFetch
+{
+    RosterStorage *storage = [self newStorage];
+    [self seedStorage:storage count:numberOfRows];
+
+    NSUInteger pageSize = batchSize;
+    NSUInteger numberOfPages = (numberOfRows + pageSize - 1) / pageSize;
+
+    // Offset paging on the storageQueue
+
+    ChessBenchmarkRecorder *recorder = [self recorderWithName:@"paged-fetch"];
+    [recorder start];
+
+    for (NSUInteger page = 0; page < numberOfPages; page++)
+    {
+        __block NSUInteger count = 0;
+        NSTimeInterval start = ChessMonotonicTime();
+
+        [storage executeBlock:^{
+            NSArray *result = [storage fetchEntityName:kRosterFriendEntityName
+                                              criteria:nil
+                                             variables:nil
+                                                sortBy:@"age,name"
+                                             ascending:YES
+                                           fetchOffset:(page * pageSize)
+                                            fetchLimit:pageSize
+                                    propertiesToReturn:nil
+                                              distinct:NO
+                                                 error:nil];
+            count = [result count];
+        }];
+
+        [recorder recordLatency:(ChessMonotonicTime() - start)];
+        [recorder addOperations:count];
+    }
+
+    [recorder stop];
+
+    // Read-only context pool
+
+    ChessBenchmarkRecorder *poolRecorder = [self recorderWithName:@"paged-fetch-read-pool"];
+    __block NSUInteger completedPages = 0;
+
+    [poolRecorder start];
+
+    for (NSUInteger page = 0; page < numberOfPages; page++)
+    {
+        NSTimeInterval start = ChessMonotonicTime();
+
+        [storage fetchEntityName:kRosterFriendEntityName
+                        criteria:nil
+                       variables:nil
+                          sortBy:@"age,name"
+                       ascending:YES
+                     fetchOffset:(page * pageSize)
+                      fetchLimit:pageSize
+              propertiesToReturn:nil
+                        distinct:NO
+                      completion:^(NSArray *results, NSError *error) {
+            [poolRecorder recordLatency:(ChessMonotonicTime() - start)];
+            [poolRecorder addOperations:[results count]];
+            completedPages++;
+        }];
+    }
+
+    ChessBenchmarkRunUntil(^BOOL{ return completedPages == numberOfPages; }, kChessBenchmarkTimeout);
+    [poolRecorder stop];
+
+    return @[ [self finishRecorder:recorder storage:storage],
+              [poolRecorder result] ];
+}
+
+/**
+ * Walks every friend of a seeded store sorted by age and name, batchSize friends per batch, reading each name:
+ * once with growing fetchOffset values, once with the keyset enumeration.
+ * Latency: one batch. The extras report the highest resident size sampled after each batch,
+ * and the number of objects still registered in the context at the end.
+ **/
+- (NSArray *)runPagedEnumeration
+{
+    RosterStorage *storage = [self newStorage];
+    [self seedStorage:storage count:numberOfRows];
+
+    NSUInteger pageSize = batchSize;
+    NSUInteger rows = numberOfRows;
+
+    // fetchOffset
+
+    ChessBenchmarkRecorder *offsetRecorder = [self recorderWithName:@"enumeration-offset"];
+    __block uint64_t offsetMaxResidentSize = 0;
+    __block NSUInteger offsetRegisteredObjects = 0;
+
+    [offsetRecorder start];
+
+    [storage executeBlock:^{
+        for (NSUInteger offset = 0; offset < rows; offset += pageSize)
+        { @autoreleasepool {
+
+            NSTimeInterval start = ChessMonotonicTime();
+
+            NSArray *page = [storage fetchEntityName:kRosterFriendEntityName
+                                            criteria:nil
+                                           variables:nil
+                                              sortBy:@"age,name"
+                                           ascending:YES
+                                         fetchOffset:offset
+                                          fetchLimit:pageSize
+                                  propertiesToReturn:nil
+                                            distinct:NO
+                                               error:nil];
+            for (FriendEntity *friend in page)
+            {
+                [friend.name length];
+            }
+
+            [offsetRecorder recordLatency:(ChessMonotonicTime() - start)];
+            [offsetRecorder addOperations:[page count]];
+            offsetMaxResidentSize = MAX(offsetMaxResidentSize, ChessBenchmarkResidentSize());
+        }}
+
+        offsetRegisteredObjects = [[[storage managedObjectContext] registeredObjects] count];
+        [[storage managedObjectContext] reset];
+    }];
+
+    [offsetRecorder stop];
+
+    offsetRecorder.extras[@"maxResidentSize"] = @(offsetMaxResidentSize);
+    offsetRecorder.extras[@"registeredObjects"] = @(offsetRegisteredObjects);
+
+    // Keyset
+
+    ChessBenchmarkRecorder *keysetRecorder = [self recorderWithName:@"enumeration-keyset"];
+    __block uint64_t keysetMaxResidentSize = 0;
+    __block NSUInteger keysetRegisteredObjects = 0;
+
+    [keysetRecorder start];
+
+    [storage executeBlock:^{
+        __block NSTimeInterval start = ChessMonotonicTime();
+
+        [storage enumerateEntityName:kRosterFriendEntityName
+                            criteria:nil
+                           variables:nil
+                              sortBy:@"age,name"
+                           ascending:YES
+                     uniquingKeyPath:@"name"
+                           batchSize:pageSize
+                               error:nil
+                          usingBlock:^(NSArray *batch, BOOL *stop) {
+            for (FriendEntity *friend in batch)
+            {
+                [friend.name length];
+            }
+
+            [keysetRecorder recordLatency:(ChessMonotonicTime() - start)];
+            [keysetRecorder addOperations:[batch count]];
+            keysetMaxResidentSize = MAX(keysetMaxResidentSize, ChessBenchmarkResidentSize());
+
+            start = ChessMonotonicTime();
+        }];
+
+        keysetRegisteredObjects = [[[storage managedObjectContext] registeredObjects] count];
+    }];
+
+    [keysetRecorder stop];
+
+    keysetRecorder.extras[@"maxResidentSize"] = @(keysetMaxResidentSize);
+    keysetRecorder.extras[@"registeredObjects"] = @(keysetRegisteredObjects);
+
+    return @[ [offsetRecorder result],
+              [self finishRecorder:keysetRecorder storage:storage] ];
+}
+
+/**
+ * Deletes every friend of a seeded store, batchSize per executeBlock.
+ * Latency: one executeBlock round trip.
+ **/
+- (NSArray *)runDeleteHeavy
+{
+    ChessBenchmarkRecorder *recorder = [self recorderWithName:@"delete-heavy"];
+    RosterStorage *storage = [self newStorage];
+    [self seedStorage:storage count:numberOfRows];
+
+    NSUInteger limit = batchSize;
+    __block NSUInteger deleted = 0;
+
+    [recorder start];
+
+    do {
+        NSTimeInterval start = ChessMonotonicTime();
+
+        [storage executeBlock:^{
+            NSManagedObjectContext *moc = [storage managedObjectContext];
+
+            NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] initWithEntityName:kRosterFriendEntityName];
+            [fetchRequest setFetchLimit:limit];
+            [fetchRequest setIncludesPropertyValues:NO];
+
+            NSArray *friends = [moc executeFetchRequest:fetchRequest error:nil];
+            for (FriendEntity *friend in friends)
+            {
+                [moc deleteObject:friend];
+            }
+
+            deleted = [friends count];
+        }];
+
+        // Save, so the next fetch does not return the deleted friends again.
+        [self drainStorage:storage];
+
+        [recorder recordLatency:(ChessMonotonicTime() - start)];
+        [recorder addOperations:deleted];
+
+    } while (deleted > 0);
+
+    [recorder stop];
+
+    return @[ [self finishRecorder:recorder storage:storage] ];
+}
+
+/**
+ * Increases the age of all numberOfRows friends, then deletes the older half,
+ * with scheduleBatchUpdateEntityName: and scheduleBatchDeleteEntityName:.
+ * Latency: from scheduling a request to its completion block.
+ **/
+- (NSArray *)runBatchMaintenance
+{
+    ChessBenchmarkRecorder *recorder = [self recorderWithName:@"batch-maintenance"];
+    RosterStorage *storage = [self newStorage];
+    [self seedStorage:storage count:numberOfRows];
+
+    uint64_t residentSize = ChessBenchmarkResidentSize();
+    __block BOOL done = NO;
+    __block NSUInteger changed = 0;
+
+    [recorder start];
+
+    NSTimeInterval start = ChessMonotonicTime();
+    [storage scheduleBatchUpdateEntityName:kRosterFriendEntityName
+                                  criteria:nil
+                                 variables:nil
+                        propertiesToUpdate:@{ @"age": [NSExpression expressionWithFormat:@"age + 1"] }
+                                completion:^(NSArray *objectIDs, NSError *error) {
+                                    changed = [objectIDs count];
+                                    done = YES;
+                                }];
+    ChessBenchmarkRunUntil(^BOOL{ return done; }, kChessBenchmarkTimeout);
+    [recorder recordLatency:(ChessMonotonicTime() - start)];
+    [recorder addOperations:changed];
+
+    done = NO;
+    start = ChessMonotonicTime();
+    [storage scheduleBatchDeleteEntityName:kRosterFriendEntityName
+                                  criteria:@"age > 50"
+                                 variables:nil
+                                completion:^(NSArray *objectIDs, NSError *error) {
+                                    changed = [objectIDs count];
+                                    done = YES;
+                                }];
+    ChessBenchmarkRunUntil(^BOOL{ return done; }, kChessBenchmarkTimeout);
+    [recorder recordLatency:(ChessMonotonicTime() - start)];
+    [recorder addOperations:changed];
+
+    [recorder stop];
+
+    recorder.extras[@"residentSizeGrowth"] = @((int64_t)ChessBenchmarkResidentSize() - (int64_t)residentSize);
+
+    return @[ [self finishRecorder:recorder storage:storage] ];
+}
+
+/**
+ * Saves batches of 5 * batchSize changes (half inserts, half updates) while a fetched results controller
+ * watches all friends on the mainThreadManagedObjectContext, in both main thread merge modes.
+ * Latency: from scheduling a batch to the controller reporting the change.
+ **/
+- (NSArray *)runMainContextMerge
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:2];
+
+    NSArray *modes = @[ @(ChessMainThreadMergeModeFaultAllUpdatedObjects), @(ChessMainThreadMergeModeTargeted) ];
+    for (NSNumber *mode in modes)
+    {
+        BOOL targeted = ([mode integerValue] == ChessMainThreadMergeModeTargeted);
+        NSString *name = targeted ? @"main-context-merge-targeted" : @"main-context-merge-fault-all";
+
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:name];
+        RosterStorage *storage = [self newStorage];
+        ChessConfig *config = storage.config;
+        config.mainThreadMergeMode = [mode integerValue];
+
+        NSManagedObjectContext *moc = [storage mainThreadManagedObjectContext];
+
+        NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] initWithEntityName:kRosterFriendEntityName];
+        [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"name != nil"]];
+        [fetchRequest setSortDescriptors:@[ [NSSortDescriptor sortDescriptorWithKey:@"age" ascending:YES] ]];
+        [fetchRequest setFetchBatchSize:20];
+
+        NSFetchedResultsController *controller = [[NSFetchedResultsController alloc] initWithFetchRequest:fetchRequest
+                                                                                     managedObjectContext:moc
+                                                                                       sectionNameKeyPath:nil
+                                                                                                cacheName:nil];
+        ChessBenchmarkFetchedResultsObserver *observer = [[ChessBenchmarkFetchedResultsObserver alloc] init];
+        controller.delegate = observer;
+        [controller performFetch:nil];
+        [config registerFetchedResultsController:controller];
+
+        NSUInteger changesPerBatch = batchSize * 5;
+        NSUInteger numberOfBatches = MAX(numberOfRows / changesPerBatch, 1);
+
+        [recorder start];
+
+        for (NSUInteger batch = 0; batch < numberOfBatches; batch++)
+        {
+            NSUInteger firstIndex = batch * changesPerBatch;
+            NSUInteger expectedChanges = observer.numberOfChanges + 1;
+            NSTimeInterval start = ChessMonotonicTime();
+
+            [storage scheduleBlock:^{
+                NSManagedObjectContext *storageMoc = [storage managedObjectContext];
+
+                // Insert the second half of the batch.
+                for (NSUInteger i = firstIndex + changesPerBatch / 2; i < firstIndex + changesPerBatch; i++)
+                {
+                    ChessBenchmarkInsertFriend(storageMoc, i);
+                }
+
+                // Update the friends inserted by the previous batch.
+                if (batch > 0)
+                {
+                    NSUInteger previousIndex = firstIndex - changesPerBatch / 2;
+
+                    NSFetchRequest *updateRequest = [[NSFetchRequest alloc] initWithEntityName:kRosterFriendEntityName];
+                    [updateRequest setPredicate:[NSPredicate predicateWithFormat:@"name >= %@ AND name < %@",
+                                                 ChessBenchmarkFriendName(previousIndex),
+                                                 ChessBenchmarkFriendName(firstIndex)]];
+
+                    for (FriendEntity *friend in [storageMoc executeFetchRequest:updateRequest error:nil])
+                    {
+                        friend.age = @(([friend.age integerValue] + 1) % 100);
+                    }
+                }
+            }];
+
+            ChessBenchmarkRunUntil(^BOOL{ return observer.numberOfChanges >= expectedChanges; }, kChessBenchmarkTimeout);
+
+            [recorder recordLatency:(ChessMonotonicTime() - start)];
+            [recorder addOperations:changesPerBatch];
+        }
+
+        [recorder stop];
+
+        recorder.extras[@"mainThreadMerge"] = [config mainThreadMergeStatistics];
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+
+        [config unregisterFetchedResultsController:controller];
+        controller.delegate = nil;
+    }
+
+    return results;
+}
+
+/**
+ * Inserts numberOfRows friends, batchSize per scheduleBlock, while a change feed of all friends sorted by age
+ * is running, until the feed has delivered every friend to the main thread.
+ * Latency: the main thread time between two batches of the feed.
+ * The number of batches (vs. the number of saves in the storage metrics) shows how much the feed coalesced.
+ **/
+- (NSArray *)runChangeFeed
+{
+    ChessBenchmarkRecorder *recorder = [self recorderWithName:@"change-feed"];
+    RosterStorage *storage = [self newStorage];
+
+    __block NSUInteger numberOfFriends = 0;
+    __block NSUInteger numberOfBatches = 0;
+    __block NSTimeInterval lastBatchTime = 0;
+
+    ChessChangeFeed *feed = [storage changeFeedWithEntityName:kRosterFriendEntityName
+                                                     criteria:@"name != nil"
+                                                    variables:nil
+                                                       sortBy:@"age"
+                                                    ascending:YES
+                                                   fetchLimit:0
+                                                  changeBlock:^(ChessChangeFeedBatch *batch) {
+        NSTimeInterval now = ChessMonotonicTime();
+        if (lastBatchTime > 0)
+        {
+            [recorder recordLatency:(now - lastBatchTime)];
+        }
+        lastBatchTime = now;
+
+        numberOfFriends = [batch.objectIDs count];
+        numberOfBatches++;
+    }];
+
+    // Wait for the initial (empty) snapshot.
+    ChessBenchmarkRunUntil(^BOOL{ return feed.objectIDs != nil; }, kChessBenchmarkTimeout);
+
+    NSUInteger rows = numberOfRows;
+
+    [recorder start];
+
+    for (NSUInteger location = 0; location < rows; location += batchSize)
+    {
+        NSUInteger end = MIN(location + batchSize, rows);
+
+        [storage scheduleBlock:^{
+            NSManagedObjectContext *moc = [storage managedObjectContext];
+            for (NSUInteger i = location; i < end; i++)
+            {
+                ChessBenchmarkInsertFriend(moc, i);
+            }
+        }];
+
+        [recorder addOperations:(end - location)];
+    }
+
+    ChessBenchmarkRunUntil(^BOOL{ return numberOfFriends == rows; }, kChessBenchmarkTimeout);
+    [recorder stop];
+
+    [feed stop];
+
+    recorder.extras[@"batches"] = @(numberOfBatches);
+    recorder.extras[@"changeFeed"] = [feed statistics];
+
+    return @[ [self finishRecorder:recorder storage:storage] ];
+}
+
+/**
+ * Repeats numberOfRows fetches by name on the storageQueue, with and without the fetch request cache.
+ * Latency: one fetch.
+ **/
+- (NSArray *)runFetchCache
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:2];
+
+    for (NSNumber *capacity in @[ @(64), @(0) ])
+    {
+        NSString *name = [capacity unsignedIntegerValue] > 0 ? @"fetch-cache" : @"fetch-cache-disabled";
+
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:name];
+        RosterStorage *storage = [self newStorage];
+        storage.fetchRequestCacheCapacity = [capacity unsignedIntegerValue];
+        [self seedStorage:storage count:1000];
+
+        NSUInteger rows = numberOfRows;
+
+        [recorder start];
+
+        [storage executeBlock:^{
+            for (NSUInteger i = 0; i < rows; i++)
+            { @autoreleasepool {
+
+                NSTimeInterval start = ChessMonotonicTime();
+
+                [storage fetchEntityName:kRosterFriendEntityName
+                                criteria:@"name == $name"
+                               variables:@{ @"name": ChessBenchmarkFriendName(i % 1000) }
+                                  sortBy:@"age"
+                               ascending:YES];
+
+                [recorder recordLatency:(ChessMonotonicTime() - start)];
+            }}
+        }];
+
+        [recorder addOperations:rows];
+        [recorder stop];
+
+        recorder.extras[@"fetchRequestCache"] = [storage fetchRequestCacheStatistics];
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+/**
+ * Sums the ages of numberOfRows friends, 20 times, by fetching the friends (managed objects),
+ * their values (dictionaries), their columns (ChessColumnarResult), and with a sum:(age) aggregate in the store.
+ * Latency: one sum.
+ **/
+- (NSArray *)runProjection
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:4];
+
+    RosterStorage *storage = [self newStorage];
+    [self seedStorage:storage count:numberOfRows];
+
+    NSUInteger iterations = 20;
+    NSArray *modes = @[ @"projection-objects", @"projection-values", @"projection-columns", @"projection-aggregate" ];
+
+    for (NSString *mode in modes)
+    {
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:mode];
+        uint64_t residentSize = ChessBenchmarkResidentSize();
+        __block int64_t totalAge = 0;
+
+        [recorder start];
+
+        [storage executeBlock:^{
+            for (NSUInteger i = 0; i < iterations; i++)
+            { @autoreleasepool {
+
+                NSTimeInterval start = ChessMonotonicTime();
+                int64_t sum = 0;
+
+                if ([mode isEqualToString:@"projection-objects"])
+                {
+                    NSArray *friends = [storage fetchEntityName:kRosterFriendEntityName criteria:nil variables:nil sortBy:@"age" ascending:YES];
+                    for (FriendEntity *friend in friends)
+                    {
+                        sum += [friend.age longLongValue];
+                    }
+
+                    // Don't let the row cache of the previous iteration help the next one.
+                    [[storage managedObjectContext] reset];
+                }
+                else if ([mode isEqualToString:@"projection-values"])
+                {
+                    NSArray *rows = [storage fetchValuesOfEntityName:kRosterFriendEntityName
+                                                            criteria:nil
+                                                           variables:nil
+                                                          properties:@[ @"name", @"age" ]
+                                                             groupBy:nil
+                                                              sortBy:@"age"
+                                                           ascending:YES
+                                                          fetchLimit:0
+                                                               error:NULL];
+                    for (NSDictionary *row in rows)
+                    {
+                        sum += [row[@"age"] longLongValue];
+                    }
+                }
+                else if ([mode isEqualToString:@"projection-columns"])
+                {
+                    ChessColumnarResult *columns = [storage fetchColumnsOfEntityName:kRosterFriendEntityName
+                                                                            criteria:nil
+                                                                           variables:nil
+                                                                          properties:@[ @"name", @"age" ]
+                                                                              sortBy:@"age"
+                                                                           ascending:YES
+                                                                          fetchLimit:0
+                                                                               error:NULL];
+                    const int64_t *ages = [columns integerColumn:@"age"];
+                    for (NSUInteger row = 0; row < columns.count; row++)
+                    {
+                        sum += ages[row];
+                    }
+                }
+                else
+                {
+                    NSDictionary *aggregate = [[storage aggregateEntityName:kRosterFriendEntityName
+                                                                   criteria:nil
+                                                                  variables:nil
+                                                                 aggregates:@{ @"totalAge": @"sum:(age)" }
+                                                                    groupBy:nil
+                                                                      error:NULL] firstObject];
+                    sum = [aggregate[@"totalAge"] longLongValue];
+                }
+
+                [recorder recordLatency:(ChessMonotonicTime() - start)];
+                totalAge = sum;
+            }}
+        }];
+
+        [recorder addOperations:iterations];
+        [recorder stop];
+
+        recorder.extras[@"totalAge"] = @(totalAge);
+        recorder.extras[@"residentSizeGrowth"] = @((int64_t)ChessBenchmarkResidentSize() - (int64_t)residentSize);
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+/**
+ * A long session on a seeded store: every friend is read and updated, batchSize per executeBlock,
+ * with saves coalesced over 10 seconds, so the changed objects pile up in the private context.
+ * Without a memory governor, then with one bounding each context to 2000 registered objects,
+ * followed by a simulated memory warning.
+ * Latency: one executeBlock round trip.
+ * The extras show the peak number of registered objects and resident size.
+ **/
+- (NSArray *)runMemoryGovernor
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:2];
+
+    for (NSNumber *governed in @[ @NO, @YES ])
+    {
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:([governed boolValue] ? @"memory-governor-on" : @"memory-governor-off")];
+
+        RosterStorage *storage = [self newStorage];
+        [self seedStorage:storage count:numberOfRows];
+
+        ChessSavePolicy *savePolicy = [ChessSavePolicy defaultPolicy];
+        savePolicy.maxSaveDelay = 10.0;
+        storage.savePolicy = savePolicy;
+        storage.saveThreshold = numberOfRows * 2;
+
+        ChessMemoryGovernor *governor = nil;
+        if ([governed boolValue])
+        {
+            governor = [[ChessMemoryGovernor alloc] init];
+            governor.maxRegisteredObjects = 2000;
+            governor.checkInterval = 0.05;
+            storage.memoryGovernor = governor;
+        }
+
+        NSUInteger rows = numberOfRows;
+        NSUInteger size = batchSize;
+        __block NSUInteger maxRegisteredObjects = 0;
+        uint64_t maxResidentSize = 0;
+
+        [recorder start];
+
+        for (NSUInteger location = 0; location < rows; location += size)
+        {
+            NSTimeInterval start = ChessMonotonicTime();
+
+            [storage executeBlock:^{
+                NSManagedObjectContext *moc = [storage managedObjectContext];
+
+                NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] initWithEntityName:kRosterFriendEntityName];
+                [fetchRequest setSortDescriptors:@[ [NSSortDescriptor sortDescriptorWithKey:@"name" ascending:YES] ]];
+                [fetchRequest setFetchOffset:location];
+                [fetchRequest setFetchLimit:size];
+
+                for (FriendEntity *friend in [moc executeFetchRequest:fetchRequest error:NULL])
+                {
+                    friend.age = @(([friend.age integerValue] + 1) % 100);
+                }
+
+                maxRegisteredObjects = MAX(maxRegisteredObjects, [[moc registeredObjects] count]);
+            }];
+
+            [recorder recordLatency:(ChessMonotonicTime() - start)];
+            [recorder addOperations:size];
+
+            maxResidentSize = MAX(maxResidentSize, ChessBenchmarkResidentSize());
+        }
+
+        [self drainStorage:storage];
+        [recorder stop];
+
+        if (governor)
+        {
+            [[NSNotificationCenter defaultCenter] postNotificationName:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+            [self drainStorage:storage];
+        }
+
+        __block NSUInteger registeredObjects = 0;
+        [storage executeBlock:^{
+            registeredObjects = [[[storage managedObjectContext] registeredObjects] count];
+        } lane:ChessStorageLaneBulk];
+
+        recorder.extras[@"maxRegisteredObjects"] = @(maxRegisteredObjects);
+        recorder.extras[@"registeredObjectsAtEnd"] = @(registeredObjects);
+        recorder.extras[@"maxResidentSize"] = @(maxResidentSize);
+        if (governor)
+        {
+            recorder.extras[@"memoryGovernor"] = [governor statistics];
+        }
+
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+/**
+ * Looks up numberOfRows friends by name and age, and pages through friends older than a given age sorted by age,
+ * with a query advisor recording every fetch, without and with the fetch indexes of the Roster model.
+ * Latency: one lookup or one page.
+ * The advisor report shows which query shapes ran as full scans, and the indexes it recommends.
+ **/
+- (NSArray *)runQueryAdvisor
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:2];
+
+    for (NSNumber *fetchIndexes in @[ @NO, @YES ])
+    {
+        NSString *name = [fetchIndexes boolValue] ? @"query-advisor-indexed" : @"query-advisor-unindexed";
+
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:name];
+        RosterStorage *storage = [self newStorageWithWriteShards:0 fetchIndexes:[fetchIndexes boolValue]];
+        [self seedStorage:storage count:numberOfRows];
+
+        ChessQueryAdvisor *queryAdvisor = [[ChessQueryAdvisor alloc] init];
+        storage.config.queryAdvisor = queryAdvisor;
+
+        NSUInteger rows = numberOfRows;
+
+        [recorder start];
+
+        [storage executeBlock:^{
+            for (NSUInteger i = 0; i < rows; i++)
+            { @autoreleasepool {
+
+                NSUInteger index = (i * 7919) % rows;
+                NSTimeInterval start = ChessMonotonicTime();
+
+                if (i % 10 == 0)
+                {
+                    [storage fetchEntityName:kRosterFriendEntityName
+                                    criteria:@"age > $age"
+                                   variables:@{ @"age": ChessBenchmarkFriendAge(index) }
+                                      sortBy:@"age"
+                                   ascending:YES
+                                 fetchOffset:0
+                                  fetchLimit:20
+                          propertiesToReturn:nil
+                                    distinct:NO
+                                       error:NULL];
+                }
+                else
+                {
+                    [storage fetchEntityName:kRosterFriendEntityName
+                                    criteria:@"name == $name AND age == $age"
+                                   variables:@{ @"name": ChessBenchmarkFriendName(index), @"age": ChessBenchmarkFriendAge(index) }
+                                      sortBy:nil
+                                   ascending:YES];
+                }
+
+                [recorder recordLatency:(ChessMonotonicTime() - start)];
+            }}
+        }];
+
+        [recorder addOperations:rows];
+        [recorder stop];
+
+        storage.config.queryAdvisor = nil;
+
+        recorder.extras[@"queryAdvisor"] = [queryAdvisor reportWithManagedObjectModel:storage.config.managedObjectModel];
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+/**
+ * Adds numberOfRows did-save blocks from 4 concurrent producers, spread over 4 invoke queues,
+ * then triggers a single save.
+ * Latency: 100 consecutive addDidSaveManagedObjectContextBlock:invokeQueue: calls.
+ **/
+- (NSArray *)runDidSaveBus
+{
+    ChessBenchmarkRecorder *recorder = [self recorderWithName:@"did-save-bus"];
+    RosterStorage *storage = [self newStorage];
+
+    NSUInteger numberOfProducers = 4;
+    NSUInteger blocksPerProducer = numberOfRows / numberOfProducers;
+    NSUInteger totalBlocks = blocksPerProducer * numberOfProducers;
+
+    NSArray *invokeQueues = @[ dispatch_get_main_queue(),
+                               dispatch_queue_create("ChessStorageBenchmark.bus.1", NULL),
+                               dispatch_queue_create("ChessStorageBenchmark.bus.2", NULL),
+                               dispatch_queue_create("ChessStorageBenchmark.bus.3", NULL) ];
+
+    __block volatile int32_t invokedBlocks = 0;
+
+    [recorder start];
+
+    dispatch_apply(numberOfProducers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t producer) {
+
+        dispatch_queue_t invokeQueue = invokeQueues[producer % [invokeQueues count]];
+
+        for (NSUInteger location = 0; location < blocksPerProducer; location += 100)
+        {
+            NSUInteger count = MIN(100, blocksPerProducer - location);
+            NSTimeInterval start = ChessMonotonicTime();
+
+            for (NSUInteger i = 0; i < count; i++)
+            {
+                [storage addDidSaveManagedObjectContextBlock:^{
+                    OSAtomicIncrement32(&invokedBlocks);
+                } invokeQueue:invokeQueue];
+            }
+
+            [recorder recordLatency:(ChessMonotonicTime() - start)];
+            [recorder addOperations:count];
+        }
+    });
+
+    NSTimeInterval saveStart = ChessMonotonicTime();
+
+    [storage scheduleBlock:^{
+        ChessBenchmarkInsertFriend([storage managedObjectContext], 0);
+    }];
+
+    ChessBenchmarkRunUntil(^BOOL{ return OSAtomicAdd32(0, &invokedBlocks) == (int32_t)totalBlocks; }, kChessBenchmarkTimeout);
+
+    [recorder stop];
+
+    recorder.extras[@"deliveryTime"] = @(ChessMonotonicTime() - saveStart);
+    recorder.extras[@"invokedBlocks"] = @(OSAtomicAdd32(0, &invokedBlocks));
+
+    return @[ [self finishRecorder:recorder storage:storage] ];
+}
+
+/**
+ * Inserts numberOfRows friends, one per executeBlock, while saves are deferred,
+ * so the number of unsaved changes keeps growing.
+ * The cost of a request should not depend on the number of unsaved changes:
+ * the extras compare the median latency of the first and last tenth of the requests.
+ * Latency: one executeBlock round trip.
+ **/
+- (NSArray *)runMaybeSave
+{
+    ChessBenchmarkRecorder *recorder = [self recorderWithName:@"maybe-save"];
+    RosterStorage *storage = [self newStorage];
+
+    ChessSavePolicy *savePolicy = [ChessSavePolicy defaultPolicy];
+    savePolicy.maxSaveDelay = 3600;
+    storage.savePolicy = savePolicy;
+    storage.saveThreshold = numberOfRows * 2;
+
+    NSUInteger rows = numberOfRows;
+    NSUInteger decile = MAX(rows / 10, 1);
+    NSMutableArray *firstLatencies = [NSMutableArray arrayWithCapacity:decile];
+    NSMutableArray *lastLatencies = [NSMutableArray arrayWithCapacity:decile];
+
+    [recorder start];
+
+    for (NSUInteger i = 0; i < rows; i++)
+    {
+        NSTimeInterval start = ChessMonotonicTime();
+
+        [storage executeBlock:^{
+            ChessBenchmarkInsertFriend([storage managedObjectContext], i);
+        }];
+
+        NSTimeInterval latency = ChessMonotonicTime() - start;
+        [recorder recordLatency:latency];
+        [recorder addOperations:1];
+
+        if (i < decile) [firstLatencies addObject:@(latency)];
+        else if (i >= rows - decile) [lastLatencies addObject:@(latency)];
+    }
+
+    [recorder stop];
+
+    double firstMedian = ChessBenchmarkMedian(firstLatencies);
+    double lastMedian = ChessBenchmarkMedian(lastLatencies);
+
+    recorder.extras[@"firstTenthMedian"] = @(firstMedian);
+    recorder.extras[@"lastTenthMedian"] = @(lastMedian);
+    recorder.extras[@"lastToFirstRatio"] = @(firstMedian > 0 ? lastMedian / firstMedian : 0);
+    recorder.extras[@"unsavedChanges"] = @([[storage unsavedChangesStatistics] numberOfUnsavedChanges]);
+
+    return @[ [self finishRecorder:recorder storage:storage] ];
+}
+
+/**
+ * Inserts numberOfRows friends, batchSize per executeBlock, each batch waiting for its save,
+ * with every store profile, then runs the store maintenance once.
+ * Latency: one batch, from executeBlock until its save is done. The storage metrics hold the save durations.
+ * SQLite only, an in-memory store has no pragmas.
+ **/
+- (NSArray *)runStoreProfiles
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:4];
+
+    if (storeType != ChessBenchmarkStoreTypeSQLite)
+    {
+        return results;
+    }
+
+    NSDictionary *profiles = @{ @"default"    : @(ChessStoreProfileDefault),
+                                @"durable"    : @(ChessStoreProfileDurable),
+                                @"balanced"   : @(ChessStoreProfileBalanced),
+                                @"throughput" : @(ChessStoreProfileThroughput) };
+
+    for (NSString *profileName in @[ @"default", @"durable", @"balanced", @"throughput" ])
+    {
+        ChessBenchmarkRecorder *recorder = [self recorderWithName:[@"store-profile-" stringByAppendingString:profileName]];
+        RosterStorage *storage = [self newStorage];
+
+        storage.config.storeProfile = [profiles[profileName] integerValue];
+        storage.saveThreshold = batchSize;
+
+        [recorder start];
+
+        for (NSUInteger location = 0; location < numberOfRows; location += batchSize)
+        {
+            NSUInteger end = MIN(location + batchSize, numberOfRows);
+            NSTimeInterval start = ChessMonotonicTime();
+
+            [storage executeBlock:^{
+                NSManagedObjectContext *moc = [storage managedObjectContext];
+                for (NSUInteger i = location; i < end; i++)
+                {
+                    ChessBenchmarkInsertFriend(moc, i);
+                }
+            }];
+            [self drainStorage:storage];
+
+            [recorder recordLatency:(ChessMonotonicTime() - start)];
+            [recorder addOperations:(end - location)];
+        }
+
+        [recorder stop];
+
+        NSString *storePath = [storeDirectory stringByAppendingPathComponent:storage.config.databaseFileName];
+        NSString *logPath = [storePath stringByAppendingString:@"-wal"];
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+
+        recorder.extras[@"pragmas"] = storage.config.storeOptions[NSSQLitePragmasOption] ?: @{};
+        recorder.extras[@"logSizeBeforeMaintenance"] = @([[fileManager attributesOfItemAtPath:logPath error:NULL] fileSize]);
+        recorder.extras[@"maintenance"] = [storage.config performStoreMaintenance] ?: @{};
+        recorder.extras[@"logSizeAfterMaintenance"] = @([[fileManager attributesOfItemAtPath:logPath error:NULL] fileSize]);
+
+        [results addObject:[self finishRecorder:recorder storage:storage]];
+    }
+
+    return results;
+}
+
+@end
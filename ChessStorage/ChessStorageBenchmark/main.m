@@ -0,0 +1,115 @@
+//
+//  main.m
+//  ChessStorageBenchmark
+//
+//  Created by Xiangqi on 16/8/9.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+//  Runs the storage workloads and prints the results as JSON, then exits.
+//  There is no user interface, e.g. on the simulator:
+//
+//  xcrun simctl launch --console booted com.XiangqiTu.ChessStorageBenchmark \
+//      -stores memory,sqlite -workloads bulk-insert,upsert-storm -rows 10000 -batchSize 100
+//
+//  Every argument is optional. By default every workload runs against both store types.
+//  The JSON is also written to Documents/ChessStorageBenchmark.json, or to the -output path.
+//
+//  Without a device, ChessStorageTests/ChessStandInBenchmark.c runs the same workloads (with the same arguments
+//  and the same JSON) against a stand-in backend, which keeps the queueing, save policy and journal layers.
+//
+
+#import <Foundation/Foundation.h>
+#import "ChessBenchmarkSuite.h"
+#import "ChessBenchmarkRecorder.h"
+
+static NSArray *ChessBenchmarkArgumentList(NSUserDefaults *defaults, NSString *key, NSArray *defaultValue)
+{
+    NSString *value = [defaults stringForKey:key];
+    if ([value length] == 0)
+    {
+        return defaultValue;
+    }
+
+    return [value componentsSeparatedByString:@","];
+}
+
+int main(int argc, char * argv[]) {
+    @autoreleasepool {
+
+        // Launch arguments such as "-rows 10000" end up in the argument domain of the user defaults.
+        NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+
+        NSArray *stores = ChessBenchmarkArgumentList(defaults, @"stores", @[ @"memory", @"sqlite" ]);
+        NSArray *workloads = ChessBenchmarkArgumentList(defaults, @"workloads", [ChessBenchmarkSuite workloadNames]);
+        NSInteger rows = [defaults integerForKey:@"rows"];
+        NSInteger batchSize = [defaults integerForKey:@"batchSize"];
+
+        NSMutableArray *results = [NSMutableArray array];
+
+        for (NSString *store in stores)
+        {
+            ChessBenchmarkStoreType storeType;
+            if ([store isEqualToString:@"memory"])
+            {
+                storeType = ChessBenchmarkStoreTypeInMemory;
+            }
+            else if ([store isEqualToString:@"sqlite"])
+            {
+                storeType = ChessBenchmarkStoreTypeSQLite;
+            }
+            else
+            {
+                NSLog(@"ChessStorageBenchmark: unknown store type %@", store);
+                continue;
+            }
+
+            ChessBenchmarkSuite *suite = [[ChessBenchmarkSuite alloc] initWithStoreType:storeType];
+            if (rows > 0) suite.numberOfRows = rows;
+            if (batchSize > 0) suite.batchSize = batchSize;
+
+            for (NSString *workload in workloads)
+            {
+                NSArray *workloadResults = [suite runWorkloadNamed:workload];
+                if (workloadResults == nil)
+                {
+                    NSLog(@"ChessStorageBenchmark: unknown workload %@", workload);
+                    continue;
+                }
+
+                [results addObjectsFromArray:workloadResults];
+            }
+
+            [suite removeStoreFiles];
+        }
+
+        NSProcessInfo *processInfo = [NSProcessInfo processInfo];
+        NSDictionary *report = @{ @"date"             : @([[NSDate date] timeIntervalSince1970]),
+                                  @"system"           : [processInfo operatingSystemVersionString],
+                                  @"processorCount"   : @([processInfo activeProcessorCount]),
+                                  @"peakResidentSize" : @(ChessBenchmarkPeakResidentSize()),
+                                  @"results"          : results };
+
+        NSError *error = nil;
+        NSData *json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:&error];
+        if (json == nil)
+        {
+            NSLog(@"ChessStorageBenchmark: %@", error);
+            return 1;
+        }
+
+        NSString *outputPath = [defaults stringForKey:@"output"];
+        if ([outputPath length] == 0)
+        {
+            NSString *documents = [NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES) firstObject];
+            outputPath = [documents stringByAppendingPathComponent:@"ChessStorageBenchmark.json"];
+        }
+
+        [json writeToFile:outputPath atomically:YES];
+
+        fwrite([json bytes], 1, [json length], stdout);
+        fputc('\n', stdout);
+        fflush(stdout);
+
+        return 0;
+    }
+}
@@ -0,0 +1,267 @@
+//
+//  ChessJournalFileTests.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/20.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessTest.h"
+#include "ChessJournalFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+// Layout of ChessJournalFile.c: a 64 bytes header, then records of a 16 bytes header and a payload padded to 8 bytes.
+#define kHeaderSize         64
+#define kRecordHeaderSize   16
+#define kRecordSize         24      // with the 8 bytes payloads below
+
+typedef struct Replay {
+    uint64_t lsns[16];
+    char payloads[16][16];
+    size_t count;
+    ChessJournalFile *journal;      // checkpointed from the replay function, if set
+} Replay;
+
+static int replay_function(void *context, uint64_t lsn, const void *payload, uint32_t length)
+{
+    Replay *replay = context;
+
+    if (replay->count < 16)
+    {
+        replay->lsns[replay->count] = lsn;
+        memcpy(replay->payloads[replay->count], payload, length < 15 ? length : 15);
+        replay->payloads[replay->count][length < 15 ? length : 15] = 0;
+    }
+    replay->count++;
+
+    if (replay->journal)
+    {
+        chess_journal_file_checkpoint(replay->journal, lsn);
+    }
+
+    return 0;
+}
+
+static Replay replay_journal(ChessJournalFile *journal)
+{
+    Replay replay;
+    memset(&replay, 0, sizeof(replay));
+
+    uint64_t count = 0;
+    CHESS_CHECK(chess_journal_file_replay(journal, replay_function, &replay, &count) == 0);
+    CHESS_CHECK(count == replay.count);
+
+    return replay;
+}
+
+static void append_records(ChessJournalFile *journal, uint64_t first, uint64_t last)
+{
+    char payload[9];
+
+    for (uint64_t i = first; i <= last; i++)
+    {
+        snprintf(payload, sizeof(payload), "record%02u", (unsigned)i);
+
+        uint64_t lsn = 0;
+        CHESS_CHECK(chess_journal_file_append(journal, payload, 8, &lsn) == 0);
+        CHESS_CHECK(lsn == i);
+    }
+}
+
+static void write_at(const char *path, off_t offset, const void *bytes, size_t length)
+{
+    int fd = open(path, O_RDWR);
+    CHESS_CHECK(fd >= 0);
+    CHESS_CHECK(pwrite(fd, bytes, length, offset) == (ssize_t)length);
+    close(fd);
+}
+
+static void test_append_and_replay_order(void)
+{
+    char path[256];
+    chess_test_temporary_path(path, sizeof(path), "journal");
+    unlink(path);
+
+    ChessJournalFile *journal = NULL;
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    CHESS_CHECK(chess_journal_file_last_lsn(journal) == 0);
+
+    append_records(journal, 1, 5);
+
+    uint64_t durable = 0;
+    CHESS_CHECK(chess_journal_file_sync(journal, &durable) == 0);
+    CHESS_CHECK(durable == 5);
+    CHESS_CHECK(chess_journal_file_used_size(journal) == kHeaderSize + 5 * kRecordSize);
+
+    Replay replay = replay_journal(journal);
+    CHESS_CHECK(replay.count == 5);
+    for (size_t i = 0; i < 5 && i < replay.count; i++)
+    {
+        char expected[9];
+        snprintf(expected, sizeof(expected), "record%02u", (unsigned)(i + 1));
+
+        CHESS_CHECK(replay.lsns[i] == i + 1);
+        CHESS_CHECK(strcmp(replay.payloads[i], expected) == 0);
+    }
+
+    chess_journal_file_close(journal);
+
+    // Reopened, appends continue after the last record.
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    CHESS_CHECK(chess_journal_file_last_lsn(journal) == 5);
+    CHESS_CHECK(replay_journal(journal).count == 5);
+
+    append_records(journal, 6, 6);
+    chess_journal_file_close(journal);
+
+    unlink(path);
+}
+
+static void test_torn_tail_recovery(void)
+{
+    char path[256];
+    chess_test_temporary_path(path, sizeof(path), "journal");
+    unlink(path);
+
+    ChessJournalFile *journal = NULL;
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    append_records(journal, 1, 3);
+    CHESS_CHECK(chess_journal_file_sync(journal, NULL) == 0);
+    chess_journal_file_close(journal);
+
+    // The length of the last record runs past the end of the file, as if its header was only partly written.
+    uint32_t length = 0x7fffffff;
+    write_at(path, kHeaderSize + 2 * kRecordSize, &length, sizeof(length));
+
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    CHESS_CHECK(chess_journal_file_last_lsn(journal) == 2);
+    CHESS_CHECK(replay_journal(journal).count == 2);
+
+    // The torn record is overwritten by the next append.
+    append_records(journal, 3, 3);
+    CHESS_CHECK(chess_journal_file_sync(journal, NULL) == 0);
+    chess_journal_file_close(journal);
+
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    Replay replay = replay_journal(journal);
+    CHESS_CHECK(replay.count == 3);
+    CHESS_CHECK(strcmp(replay.payloads[2], "record03") == 0);
+    chess_journal_file_close(journal);
+
+    unlink(path);
+}
+
+static void test_crc_rejection(void)
+{
+    char path[256];
+    chess_test_temporary_path(path, sizeof(path), "journal");
+    unlink(path);
+
+    ChessJournalFile *journal = NULL;
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    append_records(journal, 1, 3);
+    CHESS_CHECK(chess_journal_file_sync(journal, NULL) == 0);
+    chess_journal_file_close(journal);
+
+    // A flipped byte in the payload of the second record: it, and everything after it, is rejected.
+    char corrupt = 'X';
+    write_at(path, kHeaderSize + kRecordSize + kRecordHeaderSize + 2, &corrupt, 1);
+
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    CHESS_CHECK(chess_journal_file_last_lsn(journal) == 1);
+
+    Replay replay = replay_journal(journal);
+    CHESS_CHECK(replay.count == 1);
+    CHESS_CHECK(strcmp(replay.payloads[0], "record01") == 0);
+    chess_journal_file_close(journal);
+
+    // A corrupt file header is not a journal.
+    write_at(path, 0, "XXXX", 4);
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == EINVAL);
+
+    unlink(path);
+}
+
+static void test_checkpoint_truncation(void)
+{
+    char path[256];
+    chess_test_temporary_path(path, sizeof(path), "journal");
+    unlink(path);
+
+    ChessJournalFile *journal = NULL;
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    append_records(journal, 1, 4);
+
+    // A partial checkpoint only skips the records it covers, and survives a reopen.
+    CHESS_CHECK(chess_journal_file_checkpoint(journal, 2) == 0);
+    CHESS_CHECK(chess_journal_file_checkpoint_lsn(journal) == 2);
+    CHESS_CHECK(chess_journal_file_used_size(journal) == kHeaderSize + 4 * kRecordSize);
+
+    Replay replay = replay_journal(journal);
+    CHESS_CHECK(replay.count == 2);
+    CHESS_CHECK(replay.lsns[0] == 3 && replay.lsns[1] == 4);
+
+    CHESS_CHECK(chess_journal_file_sync(journal, NULL) == 0);
+    chess_journal_file_close(journal);
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    CHESS_CHECK(chess_journal_file_checkpoint_lsn(journal) == 2);
+    CHESS_CHECK(replay_journal(journal).count == 2);
+
+    // Checkpointing every record starts the journal over at the beginning of the file, LSNs go on.
+    CHESS_CHECK(chess_journal_file_checkpoint(journal, 4) == 0);
+    CHESS_CHECK(chess_journal_file_used_size(journal) == kHeaderSize);
+    CHESS_CHECK(replay_journal(journal).count == 0);
+
+    append_records(journal, 5, 5);
+    CHESS_CHECK(chess_journal_file_used_size(journal) == kHeaderSize + kRecordSize);
+    CHESS_CHECK(chess_journal_file_sync(journal, NULL) == 0);
+    chess_journal_file_close(journal);
+
+    // The records of the previous generation, still in the file, are not replayed.
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    CHESS_CHECK(chess_journal_file_last_lsn(journal) == 5);
+
+    replay = replay_journal(journal);
+    CHESS_CHECK(replay.count == 1);
+    CHESS_CHECK(replay.lsns[0] == 5 && strcmp(replay.payloads[0], "record05") == 0);
+    chess_journal_file_close(journal);
+
+    unlink(path);
+}
+
+static void test_checkpoint_while_replaying(void)
+{
+    char path[256];
+    chess_test_temporary_path(path, sizeof(path), "journal");
+    unlink(path);
+
+    ChessJournalFile *journal = NULL;
+    CHESS_CHECK(chess_journal_file_open(path, &journal) == 0);
+    append_records(journal, 1, 3);
+
+    // The replay function checkpoints each record, as a save in the middle of a replay does.
+    // Once the last one is checkpointed the journal starts over, which ends the replay.
+    Replay replay;
+    memset(&replay, 0, sizeof(replay));
+    replay.journal = journal;
+
+    CHESS_CHECK(chess_journal_file_replay(journal, replay_function, &replay, NULL) == 0);
+    CHESS_CHECK(replay.count == 3);
+    CHESS_CHECK(chess_journal_file_used_size(journal) == kHeaderSize);
+
+    chess_journal_file_close(journal);
+    unlink(path);
+}
+
+int main(void)
+{
+    CHESS_TEST_RUN(test_append_and_replay_order);
+    CHESS_TEST_RUN(test_torn_tail_recovery);
+    CHESS_TEST_RUN(test_crc_rejection);
+    CHESS_TEST_RUN(test_checkpoint_truncation);
+    CHESS_TEST_RUN(test_checkpoint_while_replaying);
+
+    return CHESS_TEST_RESULT;
+}
@@ -0,0 +1,224 @@
+//
+//  ChessRecordParserBenchmark.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/21.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+//  The parser stage of the bulk-import workload of ChessStorageBenchmark, off device:
+//
+//  ./ChessRecordParserBenchmark -inputs csv,json -rows 1000000 -batchSize 500
+//
+//  Each input is a file of rows friends, written like the benchmark app writes them
+//  (csv-quoted quotes every name, with an escaped quote in it), then memory mapped and parsed batchSize records at a time.
+//  The results are printed as JSON, in the format of ChessBenchmarkRecorder: the latency is the parsing of one batch.
+//
+
+#include "ChessHistogram.h"
+#include "ChessRecordParser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+static double monotonic_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static uint64_t peak_resident_size(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;           // bytes
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;    // kilobytes
+#endif
+}
+
+typedef struct Input {
+    const char *name;               // of the -inputs argument
+    const char *result_name;
+    ChessRecordFormat format;
+} Input;
+
+static const Input kInputs[] = {
+    { "csv",        "bulk-import-parse",        CHESS_RECORD_FORMAT_CSV  },
+    { "csv-quoted", "bulk-import-parse-quoted", CHESS_RECORD_FORMAT_CSV  },
+    { "json",       "bulk-import-parse-json",   CHESS_RECORD_FORMAT_JSON },
+};
+
+static int write_input(const char *path, const Input *input, size_t rows)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    if (input->format == CHESS_RECORD_FORMAT_CSV)
+    {
+        fprintf(file, "name,age\n");
+    }
+
+    // The names and ages of ChessBenchmarkFriendName and ChessBenchmarkFriendAge.
+    for (size_t i = 0; i < rows; i++)
+    {
+        if (input->format == CHESS_RECORD_FORMAT_JSON)
+            fprintf(file, "{\"name\": \"friend-%06zu\", \"age\": %zu}\n", i, i % 100);
+        else if (strcmp(input->name, "csv-quoted") == 0)
+            fprintf(file, "\"friend \"\"%06zu\"\"\",%zu\n", i, i % 100);
+        else
+            fprintf(file, "friend-%06zu,%zu\n", i, i % 100);
+    }
+
+    return fclose(file) == 0;
+}
+
+static int list_contains(const char *list, const char *name)
+{
+    if (list == NULL)
+    {
+        return 1;
+    }
+
+    size_t length = strlen(name);
+    for (const char *item = list; item && *item; item = strchr(item, ','), item = item ? item + 1 : NULL)
+    {
+        if (strncmp(item, name, length) == 0 && (item[length] == ',' || item[length] == 0))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *inputs = NULL;
+    size_t rows = 1000000;
+    size_t batch_size = 500;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-inputs") == 0)            inputs = argv[i + 1];
+        else if (strcmp(argv[i], "-rows") == 0)         rows = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-batchSize") == 0)    batch_size = strtoul(argv[i + 1], NULL, 10);
+        else
+        {
+            fprintf(stderr, "usage: %s [-inputs csv,csv-quoted,json] [-rows n] [-batchSize n]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (rows == 0) rows = 1000000;
+    if (batch_size == 0) batch_size = 500;
+
+    const char *directory = getenv("TMPDIR");
+    if (directory == NULL || *directory == 0) directory = "/tmp";
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/ChessRecordParserBenchmark.%d", directory, (int)getpid());
+
+    static const char * const field_names[] = { "name", "age" };
+    int status = EXIT_SUCCESS;
+
+    printf("[\n");
+    int first = 1;
+
+    for (size_t n = 0; n < sizeof(kInputs) / sizeof(kInputs[0]); n++)
+    {
+        const Input *input = &kInputs[n];
+        if (!list_contains(inputs, input->name))
+            continue;
+
+        ChessRecordParser *parser = NULL;
+        ChessRecordBatch *batch = chess_record_batch_create(batch_size, 2);
+
+        if (!write_input(path, input, rows) || batch == NULL ||
+            chess_record_parser_open(path, input->format, field_names, 2, &parser) != 0)
+        {
+            fprintf(stderr, "ChessRecordParserBenchmark: cannot prepare the %s input at %s\n", input->name, path);
+            chess_record_batch_destroy(batch);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        ChessHistogram latencies;
+        chess_histogram_reset(&latencies);
+
+        // Reads every field, like the import does, so nothing is left to laziness.
+        int64_t total_age = 0;
+        size_t name_bytes = 0;
+        char name[64];
+
+        double start = monotonic_time();
+
+        while (1)
+        {
+            double batch_start = monotonic_time();
+
+            if (chess_record_parser_next_batch(parser, batch) != 0 || batch->count == 0)
+            {
+                break;
+            }
+
+            for (size_t i = 0; i < batch->count; i++)
+            {
+                const ChessRecordField *fields = batch->fields + (i * 2);
+
+                name_bytes += chess_record_field_copy(&fields[0], name, sizeof(name));
+                total_age += fields[1].integer;
+            }
+
+            chess_histogram_record(&latencies, (uint64_t)((monotonic_time() - batch_start) * 1e6));
+        }
+
+        double elapsed = monotonic_time() - start;
+
+        uint64_t records = chess_record_parser_records(parser);
+        size_t bytes = chess_record_parser_input_size(parser);
+
+        printf("%s  {\"name\": \"%s\", \"store\": \"none\", \"operations\": %llu, \"elapsed\": %.6f, \"throughput\": %.1f,\n",
+               first ? "" : ",\n", input->result_name, (unsigned long long)records, elapsed,
+               elapsed > 0 ? (double)records / elapsed : 0.0);
+        printf("   \"latency\": {\"count\": %llu, \"p50\": %.6f, \"p99\": %.6f, \"max\": %.6f, \"mean\": %.6f},\n",
+               (unsigned long long)latencies.count,
+               chess_histogram_percentile(&latencies, 50) / 1e6, chess_histogram_percentile(&latencies, 99) / 1e6,
+               latencies.max / 1e6, chess_histogram_mean(&latencies) / 1e6);
+        printf("   \"peakResidentSize\": %llu,\n", (unsigned long long)peak_resident_size());
+        printf("   \"extras\": {\"backend\": \"parser\", \"bytes\": %zu, \"bytesPerSecond\": %.0f, \"skippedRecords\": %llu, "
+               "\"totalAge\": %lld, \"nameBytes\": %zu}}",
+               bytes, elapsed > 0 ? (double)bytes / elapsed : 0.0,
+               (unsigned long long)chess_record_parser_skipped_records(parser), (long long)total_age, name_bytes);
+        first = 0;
+
+        if (records != rows || chess_record_parser_skipped_records(parser) != 0)
+        {
+            fprintf(stderr, "ChessRecordParserBenchmark: %s: parsed %llu of %zu records\n",
+                    input->name, (unsigned long long)records, rows);
+            status = EXIT_FAILURE;
+        }
+
+        chess_record_batch_destroy(batch);
+        chess_record_parser_close(parser);
+    }
+
+    printf("\n]\n");
+
+    unlink(path);
+
+    return status;
+}
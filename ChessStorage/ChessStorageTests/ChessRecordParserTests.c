@@ -0,0 +1,287 @@
+//
+//  ChessRecordParserTests.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/21.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessTest.h"
+#include "ChessRecordParser.h"
+
+#include <errno.h>
+
+static const char * const kFieldNames[] = { "name", "age", "note" };
+
+typedef struct Parsed {
+    size_t count;
+    char names[8][64];
+    char notes[8][64];
+    uint32_t name_flags[8];
+    uint32_t age_flags[8];
+    int64_t ages[8];
+    uint64_t skipped;
+} Parsed;
+
+/**
+ * Parses the whole input, at most 8 records, with the three fields above.
+ **/
+static Parsed parse_all(const char *input, ChessRecordFormat format)
+{
+    Parsed parsed;
+    memset(&parsed, 0, sizeof(parsed));
+
+    ChessRecordParser *parser = NULL;
+    CHESS_CHECK(chess_record_parser_create(input, strlen(input), format, kFieldNames, 3, &parser) == 0);
+    if (parser == NULL)
+    {
+        return parsed;
+    }
+
+    ChessRecordBatch *batch = chess_record_batch_create(8, 3);
+    CHESS_CHECK(chess_record_parser_next_batch(parser, batch) == 0);
+
+    for (size_t i = 0; i < batch->count; i++)
+    {
+        const ChessRecordField *fields = batch->fields + (i * 3);
+
+        chess_record_field_copy(&fields[0], parsed.names[i], sizeof(parsed.names[i]));
+        chess_record_field_copy(&fields[2], parsed.notes[i], sizeof(parsed.notes[i]));
+        parsed.name_flags[i] = fields[0].flags;
+        parsed.age_flags[i] = fields[1].flags;
+        parsed.ages[i] = fields[1].integer;
+    }
+    parsed.count = batch->count;
+
+    // The input is exhausted.
+    CHESS_CHECK(chess_record_parser_next_batch(parser, batch) == 0);
+    CHESS_CHECK(batch->count == 0);
+    CHESS_CHECK(chess_record_parser_consumed_bytes(parser) == strlen(input));
+
+    parsed.skipped = chess_record_parser_skipped_records(parser);
+
+    chess_record_batch_destroy(batch);
+    chess_record_parser_close(parser);
+
+    return parsed;
+}
+
+static void test_csv_quoted_fields(void)
+{
+    Parsed parsed = parse_all("note,age,name,unused\n"
+                              "\"first line\nsecond line\",30,\"Smith, \"\"Jo\"\"\",x\n"
+                              "plain,31,Ann,y\n",
+                              CHESS_RECORD_FORMAT_CSV);
+
+    // Columns are picked by name, in any order, and the embedded line break does not end the record.
+    CHESS_CHECK(parsed.count == 2);
+    CHESS_CHECK(strcmp(parsed.names[0], "Smith, \"Jo\"") == 0);
+    CHESS_CHECK(parsed.name_flags[0] & CHESS_RECORD_FIELD_ESCAPED);
+    CHESS_CHECK(strcmp(parsed.notes[0], "first line\nsecond line") == 0);
+    CHESS_CHECK(parsed.ages[0] == 30);
+
+    CHESS_CHECK(strcmp(parsed.names[1], "Ann") == 0);
+    CHESS_CHECK(!(parsed.name_flags[1] & CHESS_RECORD_FIELD_ESCAPED));
+    CHESS_CHECK(parsed.ages[1] == 31);
+    CHESS_CHECK(parsed.skipped == 0);
+
+    // A copy is truncated to the buffer, and still returns the whole length.
+    ChessRecordField field = { "\"\"quoted\"\"", 10, CHESS_RECORD_FIELD_PRESENT | CHESS_RECORD_FIELD_ESCAPED, 0 };
+    char small[4];
+    CHESS_CHECK(chess_record_field_copy(&field, small, sizeof(small)) == 8);
+    CHESS_CHECK(strcmp(small, "\"qu") == 0);
+}
+
+static void test_csv_crlf(void)
+{
+    Parsed parsed = parse_all("name,age\r\n"
+                              "Ann,31\r\n"
+                              "\r\n"
+                              "\"Bob\",-32\r\n"
+                              "Cy,33",
+                              CHESS_RECORD_FORMAT_CSV);
+
+    // No \r at the end of the values, blank lines separate nothing, and the last record has no line break.
+    CHESS_CHECK(parsed.count == 3);
+    CHESS_CHECK(strcmp(parsed.names[0], "Ann") == 0);
+    CHESS_CHECK(strcmp(parsed.names[1], "Bob") == 0);
+    CHESS_CHECK(strcmp(parsed.names[2], "Cy") == 0);
+
+    CHESS_CHECK(parsed.ages[0] == 31 && (parsed.age_flags[0] & CHESS_RECORD_FIELD_INTEGER));
+    CHESS_CHECK(parsed.ages[1] == -32 && (parsed.age_flags[1] & CHESS_RECORD_FIELD_INTEGER));
+    CHESS_CHECK(parsed.ages[2] == 33 && (parsed.age_flags[2] & CHESS_RECORD_FIELD_INTEGER));
+    CHESS_CHECK(parsed.skipped == 0);
+
+    // The missing note column is never present.
+    CHESS_CHECK(parsed.notes[0][0] == 0);
+}
+
+static void test_json_escapes(void)
+{
+    Parsed parsed = parse_all("[{\"name\": \"a\\\"b\\\\c\\/d\\ne\\u00e9\\u20ac\\ud83d\\ude00\", \"age\": 1234567890123},\n"
+                              " {\"name\": \"lone \\ud83d surrogate\", \"age\": 2.5}]",
+                              CHESS_RECORD_FORMAT_JSON);
+
+    CHESS_CHECK(parsed.count == 2);
+
+    // é, € and a surrogate pair (U+1F600) as UTF-8.
+    CHESS_CHECK(strcmp(parsed.names[0], "a\"b\\c/d\ne\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80") == 0);
+    CHESS_CHECK(parsed.name_flags[0] & CHESS_RECORD_FIELD_ESCAPED);
+    CHESS_CHECK(parsed.ages[0] == 1234567890123LL && (parsed.age_flags[0] & CHESS_RECORD_FIELD_INTEGER));
+
+    // A lone surrogate becomes U+FFFD.
+    CHESS_CHECK(strcmp(parsed.names[1], "lone \xEF\xBF\xBD surrogate") == 0);
+    CHESS_CHECK((parsed.age_flags[1] & CHESS_RECORD_FIELD_NUMBER) && !(parsed.age_flags[1] & CHESS_RECORD_FIELD_INTEGER));
+}
+
+static void test_json_null_and_nested_values(void)
+{
+    Parsed parsed = parse_all("{\"name\": null, \"friends\": [{\"age\": 1}, \"]\"], \"meta\": {\"note\": {}}, \"age\": 7, \"note\": true}\n"
+                              "{\"age\": false}\n",
+                              CHESS_RECORD_FORMAT_JSON);
+
+    CHESS_CHECK(parsed.count == 2);
+
+    // A null is present, without a value, and copies as an empty string.
+    CHESS_CHECK(parsed.name_flags[0] & CHESS_RECORD_FIELD_PRESENT);
+    CHESS_CHECK(parsed.names[0][0] == 0);
+
+    // The nested objects and arrays are skipped, keys inside them included.
+    CHESS_CHECK(parsed.ages[0] == 7);
+    CHESS_CHECK(strcmp(parsed.notes[0], "true") == 0);
+
+    CHESS_CHECK(!(parsed.name_flags[1] & CHESS_RECORD_FIELD_PRESENT));
+    CHESS_CHECK((parsed.age_flags[1] & CHESS_RECORD_FIELD_BOOLEAN) && parsed.ages[1] == 0);
+    CHESS_CHECK(parsed.skipped == 0);
+
+    ChessRecordField null_field = { NULL, 0, CHESS_RECORD_FIELD_PRESENT | CHESS_RECORD_FIELD_JSON, 0 };
+    char buffer[8] = "garbage";
+    CHESS_CHECK(chess_record_field_copy(&null_field, buffer, sizeof(buffer)) == 0);
+    CHESS_CHECK(buffer[0] == 0);
+}
+
+static void test_resync_after_bad_record(void)
+{
+    Parsed csv = parse_all("name,age\n"
+                           "Ann,1\n"
+                           "B\"ob,2\n"                 // quote within an unquoted field
+                           "\"Cy\"x,3\n"               // text after the closing quote
+                           "Dan,4\n",
+                           CHESS_RECORD_FORMAT_CSV);
+
+    CHESS_CHECK(csv.count == 2);
+    CHESS_CHECK(strcmp(csv.names[0], "Ann") == 0);
+    CHESS_CHECK(strcmp(csv.names[1], "Dan") == 0 && csv.ages[1] == 4);
+    CHESS_CHECK(csv.skipped == 2);
+
+    Parsed json = parse_all("{\"name\": \"a\", \"age\": 1}\n"
+                            "{\"name\": oops, \"age\": 2}\n"
+                            "not an object\n"
+                            "{\"name\": \"c\", \"age\": 3}\n",
+                            CHESS_RECORD_FORMAT_JSON);
+
+    CHESS_CHECK(json.count == 2);
+    CHESS_CHECK(strcmp(json.names[0], "a") == 0);
+    CHESS_CHECK(strcmp(json.names[1], "c") == 0 && json.ages[1] == 3);
+    CHESS_CHECK(json.skipped == 2);
+
+    // An unterminated quote runs to the end of the input: the rest of its line is skipped, not the rest of the file.
+    Parsed unterminated = parse_all("name,age\n\"Eve,5\nFay,6\n", CHESS_RECORD_FORMAT_CSV);
+    CHESS_CHECK(unterminated.count == 1);
+    CHESS_CHECK(strcmp(unterminated.names[0], "Fay") == 0);
+    CHESS_CHECK(unterminated.skipped == 1);
+}
+
+static void test_batch_boundaries(void)
+{
+    // A file, so the mapping and the release of its pages are covered as well.
+    char path[256];
+    chess_test_temporary_path(path, sizeof(path), "records");
+
+    const size_t rows = 10000;
+    FILE *file = fopen(path, "w");
+    CHESS_CHECK(file != NULL);
+    if (file == NULL) return;
+
+    fprintf(file, "name,age\n");
+    for (size_t i = 0; i < rows; i++)
+    {
+        fprintf(file, "friend%zu,%zu\n", i, i % 100);
+    }
+    fclose(file);
+
+    ChessRecordParser *parser = NULL;
+    CHESS_CHECK(chess_record_parser_open(path, CHESS_RECORD_FORMAT_CSV, kFieldNames, 2, &parser) == 0);
+    if (parser == NULL) return;
+
+    // The batch must have the fields of the parser.
+    ChessRecordBatch *wrong = chess_record_batch_create(8, 3);
+    CHESS_CHECK(chess_record_parser_next_batch(parser, wrong) == EINVAL);
+    chess_record_batch_destroy(wrong);
+
+    ChessRecordBatch *batch = chess_record_batch_create(333, 2);
+    uint64_t records = 0, batches = 0;
+    int64_t total_age = 0;
+    int in_order = 1;
+
+    while (1)
+    {
+        CHESS_CHECK(chess_record_parser_next_batch(parser, batch) == 0);
+        if (batch->count == 0) break;
+
+        CHESS_CHECK(batch->first_record == records);
+        CHESS_CHECK(batch->count == 333 || records + batch->count == rows);
+
+        for (size_t i = 0; i < batch->count; i++)
+        {
+            const ChessRecordField *fields = batch->fields + (i * 2);
+            char name[32], expected[32];
+
+            chess_record_field_copy(&fields[0], name, sizeof(name));
+            snprintf(expected, sizeof(expected), "friend%llu", (unsigned long long)(records + i));
+            in_order &= (strcmp(name, expected) == 0);
+
+            total_age += fields[1].integer;
+        }
+
+        records += batch->count;
+        batches++;
+    }
+
+    CHESS_CHECK(in_order);
+    CHESS_CHECK(records == rows);
+    CHESS_CHECK(batches == (rows + 332) / 333);
+    CHESS_CHECK(total_age == (int64_t)(rows / 100) * 4950);
+    CHESS_CHECK(chess_record_parser_records(parser) == rows);
+    CHESS_CHECK(chess_record_parser_consumed_bytes(parser) == chess_record_parser_input_size(parser));
+
+    chess_record_batch_destroy(batch);
+    chess_record_parser_close(parser);
+
+    // An empty file has no records, and no header either.
+    file = fopen(path, "w");
+    if (file) fclose(file);
+
+    CHESS_CHECK(chess_record_parser_open(path, CHESS_RECORD_FORMAT_CSV, kFieldNames, 2, &parser) == 0);
+    batch = chess_record_batch_create(4, 2);
+    CHESS_CHECK(chess_record_parser_next_batch(parser, batch) == 0);
+    CHESS_CHECK(batch->count == 0);
+    chess_record_batch_destroy(batch);
+    chess_record_parser_close(parser);
+
+    unlink(path);
+
+    CHESS_CHECK(chess_record_parser_open(path, CHESS_RECORD_FORMAT_CSV, kFieldNames, 2, &parser) == ENOENT);
+}
+
+int main(void)
+{
+    CHESS_TEST_RUN(test_csv_quoted_fields);
+    CHESS_TEST_RUN(test_csv_crlf);
+    CHESS_TEST_RUN(test_json_escapes);
+    CHESS_TEST_RUN(test_json_null_and_nested_values);
+    CHESS_TEST_RUN(test_resync_after_bad_record);
+    CHESS_TEST_RUN(test_batch_boundaries);
+
+    return CHESS_TEST_RESULT;
+}
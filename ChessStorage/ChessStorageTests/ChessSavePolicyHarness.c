@@ -0,0 +1,309 @@
+//
+//  ChessSavePolicyHarness.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/20.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessTest.h"
+#include "ChessSavePolicyCore.h"
+
+/**
+ * Replays synthetic request streams through ChessSavePolicyCore, the way ChessStorage drives it:
+ * the storageQueue processes the requests in order, asks the policy after each one (see maybeSave:),
+ * arms a single timer on a deferred save, and pays a simulated cost for every save.
+ *
+ * Time is simulated, so the results are deterministic: the table it prints is a baseline to compare against,
+ * and the checks fail the build if a policy stops bounding what it claims to bound.
+ **/
+
+// Simulated cost of a save of n changes: a fixed part (the fsync) and a part per change.
+#define kSaveBaseCost       0.002
+#define kSaveCostPerChange  0.00002
+
+#define kSaveThreshold      500
+
+#define kTimerLeeway        0.000001
+
+typedef struct Request {
+    double arrival;         // seconds
+    double service;         // seconds spent in the block
+    size_t changes;
+} Request;
+
+typedef struct Stream {
+    const char *name;
+    Request *requests;
+    size_t count;
+} Stream;
+
+typedef struct Result {
+    size_t saves;
+    size_t saved_changes;
+    size_t max_unsaved_changes;
+    double max_unsaved_changes_age;     // at the time of the save: how much work a crash could lose
+    double save_time;
+    double last_save_duration;
+    double elapsed;
+    size_t final_limit;
+} Result;
+
+static void simulate_save(ChessSavePolicyCore *policy, Result *result, double *clock,
+                          size_t *unsaved_changes, double *first_unsaved_change_time)
+{
+    double age = *clock - *first_unsaved_change_time;
+    if (age > result->max_unsaved_changes_age)
+        result->max_unsaved_changes_age = age;
+
+    double duration = kSaveBaseCost + kSaveCostPerChange * (double)*unsaved_changes;
+    *clock += duration;
+
+    chess_save_policy_did_save(policy, *unsaved_changes, duration);
+
+    result->saves++;
+    result->saved_changes += *unsaved_changes;
+    result->save_time += duration;
+    result->last_save_duration = duration;
+
+    *unsaved_changes = 0;
+    *first_unsaved_change_time = 0;
+}
+
+static void simulate_decision(ChessSavePolicyCore *policy, Result *result, int32_t pending_requests, double *clock,
+                              size_t *unsaved_changes, double *first_unsaved_change_time, double *timer_fire_time)
+{
+    if (*unsaved_changes == 0)
+        return;
+
+    if (*first_unsaved_change_time == 0)
+        *first_unsaved_change_time = *clock;
+
+    ChessSavePolicyDecision decision = chess_save_policy_decide(policy, pending_requests, *unsaved_changes, kSaveThreshold,
+                                                                *clock - *first_unsaved_change_time);
+    if (decision == CHESS_SAVE_POLICY_DECISION_SAVE_NOW)
+    {
+        simulate_save(policy, result, clock, unsaved_changes, first_unsaved_change_time);
+    }
+    else if (decision == CHESS_SAVE_POLICY_DECISION_DEFER && *timer_fire_time < 0)
+    {
+        *timer_fire_time = *first_unsaved_change_time + policy->max_save_delay;
+    }
+}
+
+static Result simulate(const Stream *stream, ChessSavePolicyCore policy)
+{
+    Result result;
+    memset(&result, 0, sizeof(result));
+
+    double clock = 0;
+    size_t unsaved_changes = 0;
+    double first_unsaved_change_time = 0;
+    double timer_fire_time = -1;
+
+    size_t next = 0;
+    while (next < stream->count || timer_fire_time >= 0)
+    {
+        // The timer event is queued at its fire time, behind the requests which arrived before it.
+        if (timer_fire_time >= 0 && (next == stream->count || timer_fire_time < stream->requests[next].arrival))
+        {
+            // Timers fire late, never early.
+            if (clock < timer_fire_time + kTimerLeeway)
+                clock = timer_fire_time + kTimerLeeway;
+
+            timer_fire_time = -1;
+
+            int32_t pending = 0;
+            for (size_t i = next; i < stream->count && stream->requests[i].arrival <= clock; i++)
+                pending++;
+
+            simulate_decision(&policy, &result, pending, &clock, &unsaved_changes, &first_unsaved_change_time, &timer_fire_time);
+            continue;
+        }
+
+        const Request *request = &stream->requests[next++];
+
+        if (clock < request->arrival)
+            clock = request->arrival;
+
+        clock += request->service;
+        unsaved_changes += request->changes;
+
+        if (unsaved_changes > result.max_unsaved_changes)
+            result.max_unsaved_changes = unsaved_changes;
+
+        int32_t pending = 0;
+        for (size_t i = next; i < stream->count && stream->requests[i].arrival <= clock; i++)
+            pending++;
+
+        simulate_decision(&policy, &result, pending, &clock, &unsaved_changes, &first_unsaved_change_time, &timer_fire_time);
+    }
+
+    result.elapsed = clock;
+    result.final_limit = chess_save_policy_unsaved_changes_limit(&policy, kSaveThreshold);
+
+    return result;
+}
+
+static Stream make_stream(const char *name, size_t count)
+{
+    Stream stream = { name, calloc(count, sizeof(Request)), count };
+    return stream;
+}
+
+// A request every 5 ms, one change each: the classic policy saves after every single one.
+static Stream trickle_stream(void)
+{
+    Stream stream = make_stream("trickle", 2000);
+
+    for (size_t i = 0; i < stream.count; i++)
+        stream.requests[i] = (Request){ i * 0.005, 0.0002, 1 };
+
+    return stream;
+}
+
+// Ten bursts of 500 requests arriving at once, a second apart, two changes each.
+static Stream burst_stream(void)
+{
+    Stream stream = make_stream("burst", 5000);
+
+    for (size_t i = 0; i < stream.count; i++)
+        stream.requests[i] = (Request){ (double)(i / 500), 0.0001, 2 };
+
+    return stream;
+}
+
+// Twenty back to back requests of 1000 changes each, as a bulk import.
+static Stream bulk_stream(void)
+{
+    Stream stream = make_stream("bulk", 20);
+
+    for (size_t i = 0; i < stream.count; i++)
+        stream.requests[i] = (Request){ 0, 0.05, 1000 };
+
+    return stream;
+}
+
+typedef struct Policy {
+    const char *name;
+    ChessSavePolicyCore core;
+} Policy;
+
+static Policy default_policy(void)
+{
+    Policy policy;
+    policy.name = "default";
+    chess_save_policy_init(&policy.core);
+    return policy;
+}
+
+static Policy coalescing_policy(void)
+{
+    Policy policy = default_policy();
+    policy.name = "coalescing-100ms";
+    policy.core.max_save_delay = 0.1;
+    return policy;
+}
+
+static Policy byte_budget_policy(void)
+{
+    Policy policy = coalescing_policy();
+    policy.name = "byte-budget-64k";
+    policy.core.max_estimated_dirty_bytes = 64 * 1024;
+    return policy;
+}
+
+static Policy adaptive_policy(void)
+{
+    Policy policy = default_policy();
+    policy.name = "adaptive-10ms";
+    policy.core.adapts_to_save_latency = 1;
+    policy.core.target_save_latency = 0.01;
+    return policy;
+}
+
+static void print_result(const Stream *stream, const Policy *policy, const Result *result)
+{
+    printf("%-8s %-18s %7zu %9.1f %7zu %9.1f %9.1f %7zu\n", stream->name, policy->name,
+           result->saves, result->saves ? (double)result->saved_changes / result->saves : 0.0,
+           result->max_unsaved_changes, result->max_unsaved_changes_age * 1000, result->save_time * 1000,
+           result->final_limit);
+}
+
+static size_t total_changes(const Stream *stream)
+{
+    size_t changes = 0;
+    for (size_t i = 0; i < stream->count; i++)
+        changes += stream->requests[i].changes;
+    return changes;
+}
+
+int main(void)
+{
+    Stream streams[] = { trickle_stream(), burst_stream(), bulk_stream() };
+    Policy policies[] = { default_policy(), coalescing_policy(), byte_budget_policy(), adaptive_policy() };
+
+    size_t stream_count = sizeof(streams) / sizeof(streams[0]);
+    size_t policy_count = sizeof(policies) / sizeof(policies[0]);
+
+    printf("%-8s %-18s %7s %9s %7s %9s %9s %7s\n",
+           "stream", "policy", "saves", "changes", "max", "max age", "save", "limit");
+    printf("%-8s %-18s %7s %9s %7s %9s %9s %7s\n",
+           "", "", "", "per save", "unsaved", "(ms)", "(ms)", "");
+
+    for (size_t s = 0; s < stream_count; s++)
+    {
+        const Stream *stream = &streams[s];
+
+        for (size_t p = 0; p < policy_count; p++)
+        {
+            const Policy *policy = &policies[p];
+            Result result = simulate(stream, policy->core);
+
+            print_result(stream, policy, &result);
+
+            // Every change is saved in the end, whatever the policy.
+            CHESS_CHECK(result.saved_changes == total_changes(stream));
+
+            // Nothing exceeds the save threshold by more than the request that crossed it.
+            CHESS_CHECK(result.max_unsaved_changes < kSaveThreshold + 1000);
+
+            if (policy->core.max_save_delay > 0)
+            {
+                // A change waits at most max_save_delay, plus the request or save in progress when the timer fires.
+                CHESS_CHECK(result.max_unsaved_changes_age <= policy->core.max_save_delay + 0.05 + 0.03);
+            }
+
+            if (policy->core.max_estimated_dirty_bytes > 0)
+            {
+                size_t budget = policy->core.max_estimated_dirty_bytes / policy->core.estimated_bytes_per_change;
+                CHESS_CHECK(result.max_unsaved_changes < budget + 1000);
+                if (stream != &streams[2])
+                    CHESS_CHECK(result.max_unsaved_changes <= budget);
+            }
+
+            if (policy->core.adapts_to_save_latency && stream == &streams[1])
+            {
+                // Within the bursts, saves are only triggered by the limit, which converges
+                // on the one at which a save takes targetSaveLatency: 2 ms + 20 us * 400 = 10 ms.
+                CHESS_CHECK(result.final_limit >= 350 && result.final_limit <= 450);
+                CHESS_CHECK(result.last_save_duration <= policy->core.target_save_latency * 1.2);
+            }
+
+            // The simulation is deterministic.
+            Result again = simulate(stream, policy->core);
+            CHESS_CHECK(memcmp(&again, &result, sizeof(result)) == 0);
+        }
+    }
+
+    // Under a trickle the classic policy saves once per request, coalescing once per max_save_delay.
+    Result classic = simulate(&streams[0], policies[0].core);
+    Result coalesced = simulate(&streams[0], policies[1].core);
+    CHESS_CHECK(classic.saves == streams[0].count);
+    CHESS_CHECK(coalesced.saves <= (size_t)(coalesced.elapsed / policies[1].core.max_save_delay) + 1);
+
+    for (size_t s = 0; s < stream_count; s++)
+        free(streams[s].requests);
+
+    return CHESS_TEST_RESULT;
+}
@@ -0,0 +1,860 @@
+//
+//  ChessStandInBenchmark.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/20.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+//  The storage workloads of ChessStorageBenchmark, against a stand-in backend which runs anywhere:
+//
+//  ./ChessStandInBenchmark -stores memory,sqlite -workloads bulk-insert,upsert-storm -rows 10000 -batchSize 100
+//
+//  The stand-in keeps the layers of ChessStorage that do not depend on Core Data:
+//  - a serial storage thread, fed by scheduleBlock (async) and executeBlock (sync),
+//  - the save buffering of ChessStorageWriterCore, as run by ChessStorage: its pending requests counter,
+//    and the decisions of ChessSavePolicyCore after every request, with a single coalescing timer,
+//  - optionally the ChessJournalFile write ahead journal, checkpointed after every save.
+//  The managedObjectContext is replaced by an open SQLite transaction, and a save by its commit.
+//
+//  The results are printed as JSON, in the format of ChessBenchmarkRecorder,
+//  so they can be compared from one run (or one commit) to the next.
+//
+
+#include "ChessHistogram.h"
+#include "ChessJournalFile.h"
+#include "ChessSavePolicyCore.h"
+#include "ChessStorageWriterCore.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define kSaveThreshold          500
+#define kUpsertStormProducers   4
+#define kUpsertStormKeys        2000
+#define kPageSize               100
+
+static double monotonic_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static uint64_t peak_resident_size(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;           // bytes
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;    // kilobytes
+#endif
+}
+
+static uint64_t resident_size(void)
+{
+    unsigned long size = 0, resident = 0;
+
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(file);
+
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+// Stand-in Storage
+
+typedef struct StandInStorage StandInStorage;
+typedef void (*StandInFunction)(StandInStorage *storage, void *context);
+
+typedef struct StandInRequest {
+    StandInFunction function;
+    void *context;
+    double enqueue_time;
+    int synchronous;
+    int done;
+    struct StandInRequest *next;
+} StandInRequest;
+
+struct StandInStorage {
+    pthread_t thread;
+    pthread_mutex_t lock;               // protects the fields up to stopping
+    pthread_cond_t condition;           // new requests, stop, and completed synchronous requests
+    StandInRequest *head;
+    StandInRequest *tail;
+    int stopping;
+
+    ChessStorageWriterCore writer;      // its pending requests are updated atomically, the rest on the storage thread
+
+    // Only accessed on the storage thread.
+    sqlite3 *db;
+    sqlite3_stmt *upsert_statement;
+    sqlite3_stmt *select_statement;
+    sqlite3_stmt *delete_statement;
+    sqlite3_stmt *page_statement;
+    int in_transaction;
+
+    ChessSavePolicyCore policy;
+    size_t unsaved_changes;
+    double timer_fire_time;             // < 0 if the timer is not armed
+
+    ChessJournalFile *journal;
+    uint64_t last_journaled_lsn;
+
+    ChessHistogram latencies;           // microseconds, from schedule to completion
+    uint64_t saves;
+    double save_time;
+};
+
+static void standin_check(StandInStorage *storage, int result, const char *what)
+{
+    if (result != SQLITE_OK && result != SQLITE_DONE && result != SQLITE_ROW)
+    {
+        fprintf(stderr, "ChessStandInBenchmark: %s: %s\n", what, sqlite3_errmsg(storage->db));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void standin_save(StandInStorage *storage)
+{
+    if (!storage->in_transaction)
+    {
+        return;
+    }
+
+    double start = monotonic_time();
+    standin_check(storage, sqlite3_exec(storage->db, "COMMIT", NULL, NULL, NULL), "commit");
+    double duration = monotonic_time() - start;
+
+    chess_save_policy_did_save(&storage->policy, storage->unsaved_changes, duration);
+
+    storage->in_transaction = 0;
+    storage->unsaved_changes = 0;
+    chess_storage_writer_will_save(&storage->writer);
+    storage->saves++;
+    storage->save_time += duration;
+
+    // The journaled changes are in the store now.
+    if (storage->journal)
+    {
+        chess_journal_file_checkpoint(storage->journal, storage->last_journaled_lsn);
+    }
+}
+
+static void standin_maybe_save(StandInStorage *storage, int32_t pending_requests)
+{
+    if (storage->unsaved_changes == 0)
+    {
+        return;
+    }
+
+    double now = monotonic_time();
+    double timer_delay = 0;
+
+    ChessStorageWriterAction action = chess_storage_writer_maybe_save(&storage->writer, &storage->policy, pending_requests,
+                                                                      storage->unsaved_changes, kSaveThreshold,
+                                                                      now, &timer_delay);
+    if (action == CHESS_STORAGE_WRITER_ACTION_SAVE)
+    {
+        standin_save(storage);
+    }
+    else if (action == CHESS_STORAGE_WRITER_ACTION_ARM_TIMER)
+    {
+        storage->timer_fire_time = now + timer_delay;
+    }
+}
+
+static void *standin_run(void *argument)
+{
+    StandInStorage *storage = argument;
+
+    pthread_mutex_lock(&storage->lock);
+
+    for (;;)
+    {
+        while (storage->head == NULL && !storage->stopping)
+        {
+            if (storage->timer_fire_time < 0)
+            {
+                pthread_cond_wait(&storage->condition, &storage->lock);
+                continue;
+            }
+
+            // The coalescing timer: it fires once, and simply asks the policy again.
+            double fire_time = storage->timer_fire_time;
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            double delay = fire_time - monotonic_time();
+            if (delay > 0)
+            {
+                deadline.tv_sec += (time_t)delay;
+                deadline.tv_nsec += (long)((delay - (double)(time_t)delay) * 1e9);
+                if (deadline.tv_nsec >= 1000000000L)
+                {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                if (pthread_cond_timedwait(&storage->condition, &storage->lock, &deadline) != ETIMEDOUT)
+                {
+                    continue;
+                }
+            }
+
+            storage->timer_fire_time = -1;
+            chess_storage_writer_save_timer_fired(&storage->writer);
+            int32_t pending_requests = chess_storage_writer_pending_requests(&storage->writer);
+
+            pthread_mutex_unlock(&storage->lock);
+            standin_maybe_save(storage, pending_requests);
+            pthread_mutex_lock(&storage->lock);
+        }
+
+        if (storage->head == NULL)
+        {
+            break;
+        }
+
+        StandInRequest *request = storage->head;
+        storage->head = request->next;
+        if (storage->head == NULL)
+        {
+            storage->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&storage->lock);
+
+        request->function(storage, request->context);
+        chess_histogram_record(&storage->latencies, (uint64_t)((monotonic_time() - request->enqueue_time) * 1e6));
+
+        int synchronous = request->synchronous;
+
+        pthread_mutex_lock(&storage->lock);
+        int32_t pending_requests = chess_storage_writer_dequeue(&storage->writer);
+        if (synchronous)
+        {
+            request->done = 1;
+            pthread_cond_broadcast(&storage->condition);
+        }
+        else
+        {
+            free(request);
+        }
+        pthread_mutex_unlock(&storage->lock);
+
+        standin_maybe_save(storage, pending_requests);
+
+        pthread_mutex_lock(&storage->lock);
+    }
+
+    pthread_mutex_unlock(&storage->lock);
+
+    // As saveMainThreadContext on termination: nothing is left unsaved.
+    standin_save(storage);
+
+    return NULL;
+}
+
+static void standin_enqueue(StandInStorage *storage, StandInRequest *request)
+{
+    request->enqueue_time = monotonic_time();
+    request->next = NULL;
+
+    pthread_mutex_lock(&storage->lock);
+
+    chess_storage_writer_enqueue(&storage->writer);
+    if (storage->tail)
+        storage->tail->next = request;
+    else
+        storage->head = request;
+    storage->tail = request;
+
+    pthread_cond_broadcast(&storage->condition);
+
+    if (request->synchronous)
+    {
+        while (!request->done)
+        {
+            pthread_cond_wait(&storage->condition, &storage->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&storage->lock);
+}
+
+static void standin_schedule(StandInStorage *storage, StandInFunction function, void *context)
+{
+    StandInRequest *request = calloc(1, sizeof(StandInRequest));
+    request->function = function;
+    request->context = context;
+
+    standin_enqueue(storage, request);
+}
+
+static void standin_execute(StandInStorage *storage, StandInFunction function, void *context)
+{
+    StandInRequest request;
+    memset(&request, 0, sizeof(request));
+    request.function = function;
+    request.context = context;
+    request.synchronous = 1;
+
+    standin_enqueue(storage, &request);
+}
+
+static StandInStorage *standin_create(const char *path, const ChessSavePolicyCore *policy, const char *journal_path)
+{
+    StandInStorage *storage = calloc(1, sizeof(StandInStorage));
+
+    pthread_mutex_init(&storage->lock, NULL);
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+#ifndef __APPLE__
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&storage->condition, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    chess_storage_writer_init(&storage->writer);
+    storage->policy = *policy;
+    storage->timer_fire_time = -1;
+    chess_histogram_reset(&storage->latencies);
+
+    if (sqlite3_open(path, &storage->db) != SQLITE_OK)
+    {
+        fprintf(stderr, "ChessStandInBenchmark: cannot open %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    // The pragmas of ChessStoreProfileBalanced (see -[ChessConfig storePragmasForProfile:]).
+    standin_check(storage, sqlite3_exec(storage->db,
+                                        "PRAGMA journal_mode = WAL;"
+                                        "PRAGMA synchronous = NORMAL;"
+                                        "CREATE TABLE IF NOT EXISTS friend (jid TEXT PRIMARY KEY, name TEXT, presence INTEGER);"
+                                        "CREATE INDEX IF NOT EXISTS friend_name ON friend (name, jid);",
+                                        NULL, NULL, NULL), "schema");
+
+    standin_check(storage, sqlite3_prepare_v2(storage->db,
+                                              "INSERT INTO friend (jid, name, presence) VALUES (?1, ?2, ?3) "
+                                              "ON CONFLICT (jid) DO UPDATE SET name = excluded.name, presence = excluded.presence",
+                                              -1, &storage->upsert_statement, NULL), "upsert");
+    standin_check(storage, sqlite3_prepare_v2(storage->db, "SELECT name, presence FROM friend WHERE jid = ?1",
+                                              -1, &storage->select_statement, NULL), "select");
+    standin_check(storage, sqlite3_prepare_v2(storage->db, "DELETE FROM friend WHERE jid = ?1",
+                                              -1, &storage->delete_statement, NULL), "delete");
+    standin_check(storage, sqlite3_prepare_v2(storage->db,
+                                              "SELECT jid, name FROM friend WHERE (name, jid) > (?1, ?2) ORDER BY name, jid LIMIT ?3",
+                                              -1, &storage->page_statement, NULL), "page");
+
+    if (journal_path)
+    {
+        unlink(journal_path);
+        int error = chess_journal_file_open(journal_path, &storage->journal);
+        if (error)
+        {
+            fprintf(stderr, "ChessStandInBenchmark: cannot open the journal %s: %s\n", journal_path, strerror(error));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_create(&storage->thread, NULL, standin_run, storage);
+
+    return storage;
+}
+
+/**
+ * Processes the requests left, saves, and ends the storage thread.
+ **/
+static void standin_stop(StandInStorage *storage)
+{
+    pthread_mutex_lock(&storage->lock);
+    storage->stopping = 1;
+    pthread_cond_broadcast(&storage->condition);
+    pthread_mutex_unlock(&storage->lock);
+
+    pthread_join(storage->thread, NULL);
+}
+
+static void standin_destroy(StandInStorage *storage)
+{
+
+    sqlite3_finalize(storage->upsert_statement);
+    sqlite3_finalize(storage->select_statement);
+    sqlite3_finalize(storage->delete_statement);
+    sqlite3_finalize(storage->page_statement);
+    sqlite3_close(storage->db);
+
+    if (storage->journal)
+    {
+        chess_journal_file_close(storage->journal);
+    }
+
+    pthread_cond_destroy(&storage->condition);
+    pthread_mutex_destroy(&storage->lock);
+    free(storage);
+}
+
+// Operations (on the storage thread)
+
+static void standin_begin(StandInStorage *storage)
+{
+    if (!storage->in_transaction)
+    {
+        standin_check(storage, sqlite3_exec(storage->db, "BEGIN", NULL, NULL, NULL), "begin");
+        storage->in_transaction = 1;
+    }
+}
+
+static void standin_journal(StandInStorage *storage, const char *operation, size_t key)
+{
+    if (storage->journal)
+    {
+        char payload[64];
+        int length = snprintf(payload, sizeof(payload), "%s friend%zu", operation, key);
+
+        chess_journal_file_append(storage->journal, payload, (uint32_t)length, &storage->last_journaled_lsn);
+    }
+}
+
+static void standin_upsert(StandInStorage *storage, size_t key, int presence)
+{
+    char jid[48], name[32];
+    snprintf(jid, sizeof(jid), "friend%zu@chess", key);
+    snprintf(name, sizeof(name), "Friend %zu", (key * 7919) % 100003);
+
+    standin_journal(storage, "upsert", key);
+    standin_begin(storage);
+
+    sqlite3_stmt *statement = storage->upsert_statement;
+    sqlite3_bind_text(statement, 1, jid, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(statement, 2, name, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(statement, 3, presence);
+    standin_check(storage, sqlite3_step(statement), "upsert");
+    sqlite3_reset(statement);
+
+    storage->unsaved_changes += (size_t)sqlite3_changes(storage->db);
+}
+
+static void standin_delete(StandInStorage *storage, size_t key)
+{
+    char jid[48];
+    snprintf(jid, sizeof(jid), "friend%zu@chess", key);
+
+    standin_journal(storage, "delete", key);
+    standin_begin(storage);
+
+    sqlite3_stmt *statement = storage->delete_statement;
+    sqlite3_bind_text(statement, 1, jid, -1, SQLITE_TRANSIENT);
+    standin_check(storage, sqlite3_step(statement), "delete");
+    sqlite3_reset(statement);
+
+    storage->unsaved_changes += (size_t)sqlite3_changes(storage->db);
+}
+
+static int standin_fetch(StandInStorage *storage, size_t key)
+{
+    char jid[48];
+    snprintf(jid, sizeof(jid), "friend%zu@chess", key);
+
+    sqlite3_stmt *statement = storage->select_statement;
+    sqlite3_bind_text(statement, 1, jid, -1, SQLITE_TRANSIENT);
+    int result = sqlite3_step(statement);
+    standin_check(storage, result, "select");
+    sqlite3_reset(statement);
+
+    return result == SQLITE_ROW;
+}
+
+// Workloads
+
+typedef struct Workload {
+    size_t rows;
+    size_t batch_size;
+    uint64_t operations;
+} Workload;
+
+typedef struct Batch {
+    size_t first;
+    size_t count;
+} Batch;
+
+// Like the batch methods of ChessStorage: saved in chunks of the unsaved changes limit.
+static void upsert_batch(StandInStorage *storage, void *context)
+{
+    Batch *batch = context;
+    size_t limit = chess_save_policy_unsaved_changes_limit(&storage->policy, kSaveThreshold);
+
+    for (size_t key = batch->first; key < batch->first + batch->count; key++)
+    {
+        standin_upsert(storage, key, 0);
+
+        if (storage->unsaved_changes >= limit)
+        {
+            standin_save(storage);
+        }
+    }
+
+    free(batch);
+}
+
+static void delete_batch(StandInStorage *storage, void *context)
+{
+    Batch *batch = context;
+
+    for (size_t key = batch->first; key < batch->first + batch->count; key++)
+    {
+        standin_delete(storage, key);
+    }
+
+    free(batch);
+}
+
+static void schedule_batches(StandInStorage *storage, StandInFunction function, size_t rows, size_t batch_size)
+{
+    for (size_t first = 0; first < rows; first += batch_size)
+    {
+        Batch *batch = malloc(sizeof(Batch));
+        batch->first = first;
+        batch->count = (rows - first < batch_size) ? rows - first : batch_size;
+
+        standin_schedule(storage, function, batch);
+    }
+}
+
+static void nothing(StandInStorage *storage, void *context)
+{
+    (void)storage;
+    (void)context;
+}
+
+static void wait_for_storage(StandInStorage *storage)
+{
+    standin_execute(storage, nothing, NULL);
+}
+
+// The setup of the read and delete workloads, not measured.
+static void seed(StandInStorage *storage, Workload *workload)
+{
+    schedule_batches(storage, upsert_batch, workload->rows, workload->batch_size);
+    wait_for_storage(storage);
+}
+
+static void reset_measurements(StandInStorage *storage, void *context)
+{
+    (void)context;
+
+    chess_histogram_reset(&storage->latencies);
+    storage->saves = 0;
+    storage->save_time = 0;
+}
+
+static void bulk_insert(StandInStorage *storage, Workload *workload)
+{
+    schedule_batches(storage, upsert_batch, workload->rows, workload->batch_size);
+    wait_for_storage(storage);
+
+    workload->operations = workload->rows;
+}
+
+typedef struct Producer {
+    StandInStorage *storage;
+    size_t index;
+    size_t count;
+} Producer;
+
+static void upsert_one(StandInStorage *storage, void *context)
+{
+    size_t key = (size_t)(uintptr_t)context;
+    standin_upsert(storage, key, (int)(key % 5));
+}
+
+static void *upsert_storm_producer(void *argument)
+{
+    Producer *producer = argument;
+
+    for (size_t i = 0; i < producer->count; i++)
+    {
+        size_t key = (i * kUpsertStormProducers + producer->index) % kUpsertStormKeys;
+        standin_schedule(producer->storage, upsert_one, (void *)(uintptr_t)key);
+    }
+
+    return NULL;
+}
+
+// Several threads scheduling single row upserts over a small key space, as presence updates do.
+static void upsert_storm(StandInStorage *storage, Workload *workload)
+{
+    pthread_t threads[kUpsertStormProducers];
+    Producer producers[kUpsertStormProducers];
+
+    for (size_t i = 0; i < kUpsertStormProducers; i++)
+    {
+        producers[i] = (Producer){ storage, i, workload->rows / kUpsertStormProducers };
+        pthread_create(&threads[i], NULL, upsert_storm_producer, &producers[i]);
+    }
+    for (size_t i = 0; i < kUpsertStormProducers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    wait_for_storage(storage);
+
+    workload->operations = (workload->rows / kUpsertStormProducers) * kUpsertStormProducers;
+}
+
+static void fetch_one(StandInStorage *storage, void *context)
+{
+    size_t key = (size_t)(uintptr_t)context;
+    standin_fetch(storage, key);
+}
+
+// Four synchronous reads for every scheduled write.
+static void mixed_read_write(StandInStorage *storage, Workload *workload)
+{
+    for (size_t i = 0; i < workload->rows; i++)
+    {
+        size_t key = (i * 7919) % workload->rows;
+
+        if (i % 5 == 4)
+            standin_schedule(storage, upsert_one, (void *)(uintptr_t)key);
+        else
+            standin_execute(storage, fetch_one, (void *)(uintptr_t)key);
+    }
+    wait_for_storage(storage);
+
+    workload->operations = workload->rows;
+}
+
+typedef struct Page {
+    char name[64];
+    char jid[64];
+    size_t count;
+} Page;
+
+// Keyset pagination on (name, jid), as fetchEntityName:...afterValues: does.
+static void fetch_page(StandInStorage *storage, void *context)
+{
+    Page *page = context;
+    sqlite3_stmt *statement = storage->page_statement;
+
+    sqlite3_bind_text(statement, 1, page->name, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(statement, 2, page->jid, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(statement, 3, kPageSize);
+
+    page->count = 0;
+    int result;
+    while ((result = sqlite3_step(statement)) == SQLITE_ROW)
+    {
+        snprintf(page->jid, sizeof(page->jid), "%s", (const char *)sqlite3_column_text(statement, 0));
+        snprintf(page->name, sizeof(page->name), "%s", (const char *)sqlite3_column_text(statement, 1));
+        page->count++;
+    }
+    standin_check(storage, result, "page");
+    sqlite3_reset(statement);
+}
+
+static void paged_fetch(StandInStorage *storage, Workload *workload)
+{
+    Page page;
+    memset(&page, 0, sizeof(page));
+
+    uint64_t pages = 0;
+    do
+    {
+        standin_execute(storage, fetch_page, &page);
+        pages++;
+    }
+    while (page.count == kPageSize);
+
+    workload->operations = pages;
+}
+
+static void delete_heavy(StandInStorage *storage, Workload *workload)
+{
+    size_t batch_size = workload->batch_size / 10 ? workload->batch_size / 10 : 1;
+    schedule_batches(storage, delete_batch, workload->rows, batch_size);
+    wait_for_storage(storage);
+
+    workload->operations = workload->rows;
+}
+
+// Main
+
+typedef struct WorkloadEntry {
+    const char *name;
+    void (*setup)(StandInStorage *storage, Workload *workload);
+    void (*run)(StandInStorage *storage, Workload *workload);
+} WorkloadEntry;
+
+static const WorkloadEntry kWorkloads[] = {
+    { "bulk-insert", NULL, bulk_insert },
+    { "upsert-storm", NULL, upsert_storm },
+    { "mixed-read-write", seed, mixed_read_write },
+    { "paged-fetch", seed, paged_fetch },
+    { "delete-heavy", seed, delete_heavy },
+};
+
+typedef struct PolicyEntry {
+    const char *name;
+    double max_save_delay;
+    int journal;
+} PolicyEntry;
+
+static const PolicyEntry kPolicies[] = {
+    { "default", 0, 0 },
+    { "coalescing-100ms", 0.1, 0 },
+    { "coalescing-100ms-journal", 0.1, 1 },
+};
+
+static int list_contains(const char *list, const char *name)
+{
+    if (list == NULL)
+    {
+        return 1;
+    }
+
+    size_t length = strlen(name);
+    for (const char *item = list; item && *item; item = strchr(item, ','), item = item ? item + 1 : NULL)
+    {
+        if (strncmp(item, name, length) == 0 && (item[length] == ',' || item[length] == 0))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void print_result(const char *workload_name, const char *store, const PolicyEntry *policy_entry,
+                         const Workload *workload, const StandInStorage *storage, double elapsed, int first)
+{
+    const ChessHistogram *latencies = &storage->latencies;
+
+    printf("%s  {\"name\": \"%s\", \"store\": \"%s\", \"operations\": %llu, \"elapsed\": %.6f, \"throughput\": %.1f,\n",
+           first ? "" : ",\n", workload_name, store, (unsigned long long)workload->operations, elapsed,
+           elapsed > 0 ? (double)workload->operations / elapsed : 0.0);
+    printf("   \"latency\": {\"count\": %llu, \"p50\": %.6f, \"p99\": %.6f, \"max\": %.6f, \"mean\": %.6f},\n",
+           (unsigned long long)latencies->count,
+           chess_histogram_percentile(latencies, 50) / 1e6, chess_histogram_percentile(latencies, 99) / 1e6,
+           latencies->max / 1e6, chess_histogram_mean(latencies) / 1e6);
+    printf("   \"peakResidentSize\": %llu, \"residentSize\": %llu,\n",
+           (unsigned long long)peak_resident_size(), (unsigned long long)resident_size());
+    printf("   \"extras\": {\"backend\": \"stand-in\", \"policy\": \"%s\", \"journal\": %s, \"saves\": %llu, \"saveTime\": %.6f}}",
+           policy_entry->name, policy_entry->journal ? "true" : "false",
+           (unsigned long long)storage->saves, storage->save_time);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *stores = "memory,sqlite";
+    const char *workloads = NULL;
+    const char *policies = NULL;
+    size_t rows = 10000;
+    size_t batch_size = 100;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-stores") == 0)            stores = argv[i + 1];
+        else if (strcmp(argv[i], "-workloads") == 0)    workloads = argv[i + 1];
+        else if (strcmp(argv[i], "-policies") == 0)     policies = argv[i + 1];
+        else if (strcmp(argv[i], "-rows") == 0)         rows = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-batchSize") == 0)    batch_size = strtoul(argv[i + 1], NULL, 10);
+        else
+        {
+            fprintf(stderr, "usage: %s [-stores memory,sqlite] [-workloads name,...] [-policies name,...] "
+                            "[-rows n] [-batchSize n]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (rows == 0) rows = 10000;
+    if (batch_size == 0) batch_size = 100;
+
+    const char *directory = getenv("TMPDIR");
+    if (directory == NULL || *directory == 0) directory = "/tmp";
+
+    char database_path[512], journal_path[512];
+    snprintf(database_path, sizeof(database_path), "%s/ChessStandInBenchmark.%d.sqlite", directory, (int)getpid());
+    snprintf(journal_path, sizeof(journal_path), "%s/ChessStandInBenchmark.%d.journal", directory, (int)getpid());
+
+    printf("[\n");
+    int first = 1;
+
+    for (int sqlite = 0; sqlite <= 1; sqlite++)
+    {
+        const char *store = sqlite ? "sqlite" : "memory";
+        if (!list_contains(stores, store))
+            continue;
+
+        for (size_t w = 0; w < sizeof(kWorkloads) / sizeof(kWorkloads[0]); w++)
+        {
+            if (!list_contains(workloads, kWorkloads[w].name))
+                continue;
+
+            for (size_t p = 0; p < sizeof(kPolicies) / sizeof(kPolicies[0]); p++)
+            {
+                const PolicyEntry *policy_entry = &kPolicies[p];
+                if (!list_contains(policies, policy_entry->name))
+                    continue;
+
+                ChessSavePolicyCore policy;
+                chess_save_policy_init(&policy);
+                policy.max_save_delay = policy_entry->max_save_delay;
+
+                char wal_path[600], shm_path[600];
+                snprintf(wal_path, sizeof(wal_path), "%s-wal", database_path);
+                snprintf(shm_path, sizeof(shm_path), "%s-shm", database_path);
+                unlink(database_path);
+                unlink(wal_path);
+                unlink(shm_path);
+
+                StandInStorage *storage = standin_create(sqlite ? database_path : ":memory:", &policy,
+                                                         policy_entry->journal ? journal_path : NULL);
+
+                Workload workload = { rows, batch_size, 0 };
+
+                if (kWorkloads[w].setup)
+                {
+                    kWorkloads[w].setup(storage, &workload);
+                    standin_execute(storage, reset_measurements, NULL);
+                }
+
+                double start = monotonic_time();
+                kWorkloads[w].run(storage, &workload);
+                double elapsed = monotonic_time() - start;
+
+                // The latencies and saves are read once the storage thread is gone.
+                standin_stop(storage);
+
+                print_result(kWorkloads[w].name, store, policy_entry, &workload, storage, elapsed, first);
+                first = 0;
+
+                standin_destroy(storage);
+            }
+        }
+    }
+
+    printf("\n]\n");
+
+    unlink(database_path);
+    unlink(journal_path);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+//
+//  ChessStorageWriterCoreTests.c
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/24.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#include "ChessTest.h"
+#include "ChessStorageWriterCore.h"
+
+#include <math.h>
+
+static void test_pending_requests(void)
+{
+    ChessStorageWriterCore writer;
+    chess_storage_writer_init(&writer);
+
+    CHESS_CHECK(chess_storage_writer_enqueue(&writer) == 1);
+    CHESS_CHECK(chess_storage_writer_enqueue(&writer) == 2);
+    CHESS_CHECK(chess_storage_writer_dequeue(&writer) == 1);
+    CHESS_CHECK(chess_storage_writer_pending_requests(&writer) == 1);
+    CHESS_CHECK(chess_storage_writer_dequeue(&writer) == 0);
+}
+
+static void test_default_policy_saves_when_idle(void)
+{
+    ChessSavePolicyCore policy;
+    chess_save_policy_init(&policy);
+
+    ChessStorageWriterCore writer;
+    chess_storage_writer_init(&writer);
+
+    // Requests still pending: keep buffering, up to the save threshold.
+    CHESS_CHECK(chess_storage_writer_maybe_save(&writer, &policy, 3, 10, 500, 1.0, NULL) == CHESS_STORAGE_WRITER_ACTION_NONE);
+    CHESS_CHECK(chess_storage_writer_maybe_save(&writer, &policy, 3, 500, 500, 1.0, NULL) == CHESS_STORAGE_WRITER_ACTION_SAVE);
+    CHESS_CHECK(chess_storage_writer_maybe_save(&writer, &policy, 0, 10, 500, 1.0, NULL) == CHESS_STORAGE_WRITER_ACTION_SAVE);
+    CHESS_CHECK(writer.save_timer_armed == 0);
+}
+
+static void test_deferred_save_arms_the_timer_once(void)
+{
+    ChessSavePolicyCore policy;
+    chess_save_policy_init(&policy);
+    policy.max_save_delay = 0.5;
+
+    ChessStorageWriterCore writer;
+    chess_storage_writer_init(&writer);
+
+    // The delay runs from the first unsaved change.
+    double delay = -1;
+    CHESS_CHECK(chess_storage_writer_maybe_save(&writer, &policy, 0, 1, 500, 10.0, &delay) == CHESS_STORAGE_WRITER_ACTION_ARM_TIMER);
+    CHESS_CHECK(fabs(delay - 0.5) < 1e-9);
+
+    delay = -1;
+    CHESS_CHECK(chess_storage_writer_maybe_save(&writer, &policy, 0, 2, 500, 10.2, &delay) == CHESS_STORAGE_WRITER_ACTION_NONE);
+    CHESS_CHECK(delay == -1);
+
+    // The timer fires late: the policy asked again saves right away.
+    chess_storage_writer_save_timer_fired(&writer);
+    CHESS_CHECK(chess_storage_writer_maybe_save(&writer, &policy, 0, 2, 500, 10.6, &delay) == CHESS_STORAGE_WRITER_ACTION_SAVE);
+
+    // After the save, the next change starts a new delay.
+    chess_storage_writer_will_save(&writer);
+    CHESS_CHECK(chess_storage_writer_maybe_save(&writer, &policy, 0, 1, 500, 20.0, &delay) == CHESS_STORAGE_WRITER_ACTION_ARM_TIMER);
+    CHESS_CHECK(fabs(delay - 0.5) < 1e-9);
+
+    // Re-armed after firing early, only for the remaining delay.
+    chess_storage_writer_save_timer_fired(&writer);
+    CHESS_CHECK(chess_storage_writer_maybe_save(&writer, &policy, 0, 1, 500, 20.3, &delay) == CHESS_STORAGE_WRITER_ACTION_ARM_TIMER);
+    CHESS_CHECK(fabs(delay - 0.2) < 1e-9);
+}
+
+int main(void)
+{
+    CHESS_TEST_RUN(test_pending_requests);
+    CHESS_TEST_RUN(test_default_policy_saves_when_idle);
+    CHESS_TEST_RUN(test_deferred_save_arms_the_timer_once);
+
+    return CHESS_TEST_RESULT;
+}
@@ -0,0 +1,55 @@
+//
+//  ChessTest.h
+//  ChessStorage
+//
+//  Created by Xiangqi on 16/10/20.
+//  Copyright © 2016年 Xiangqi. All rights reserved.
+//
+
+#ifndef ChessTest_h
+#define ChessTest_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * A minimal harness for the plain C tests: no dependency, so they build with any C compiler (see the Makefile).
+ * Each test file has its own main, which runs its tests with CHESS_TEST_RUN and returns CHESS_TEST_RESULT.
+ **/
+
+static int chess_test_failures = 0;
+
+#define CHESS_CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            chess_test_failures++; \
+        } \
+    } while (0)
+
+#define CHESS_TEST_RUN(test) \
+    do { \
+        int failures_before = chess_test_failures; \
+        test(); \
+        printf("%s %s\n", (chess_test_failures == failures_before) ? "ok  " : "FAIL", #test); \
+    } while (0)
+
+#define CHESS_TEST_RESULT (chess_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
+
+/**
+ * Fills path with the name of a new, empty temporary file, and returns path.
+ **/
+static inline char *chess_test_temporary_path(char *path, size_t size, const char *name)
+{
+    const char *directory = getenv("TMPDIR");
+    snprintf(path, size, "%s/%s.XXXXXX", (directory && *directory) ? directory : "/tmp", name);
+
+    int fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+
+    return path;
+}
+
+#endif /* ChessTest_h */